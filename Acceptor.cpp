@@ -0,0 +1,73 @@
+#include "Acceptor.hpp"
+
+#include "Concurrency.hpp"
+#include "Metrics.hpp"
+#include "Thread.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+
+namespace abel {
+
+Acceptor::Acceptor(Socket listener, size_t threads, size_t pending_per_thread, Callback on_accept, Placement placement) :
+    listener{listener},
+    pending_per_thread{std::clamp<size_t>(pending_per_thread, 1, MAXIMUM_WAIT_OBJECTS - 1)},
+    on_accept{std::move(on_accept)} {
+
+    // wait_stopped waits on all of them at once
+    size_t count = std::clamp<size_t>(threads, 1, MAXIMUM_WAIT_OBJECTS);
+    auto placements = Thread::placements(placement, count);
+
+    for (size_t i = 0; i < count; ++i) {
+        auto options = ThreadOptions{.affinity = placements[i], .name = "accept " + std::to_string(i)};
+        this->threads.push_back(Thread::create<Acceptor, &Acceptor::loop>(this, options).handle);
+    }
+}
+
+Acceptor::~Acceptor() {
+    stopping = true;
+
+    // The cancelled accepts complete with an error, which the loops take as the signal to stop. A loop may issue
+    // another accept after a cancel but before it sees `stopping`, so the cancel is repeated until they're all gone.
+    std::vector<Handle> handles(threads.begin(), threads.end());
+    do {
+        CancelIoEx((HANDLE)listener.raw(), nullptr);
+    } while (Handle::wait_multiple(handles, true, cancel_retry_ms) == (size_t)-1);
+}
+
+bool Acceptor::wait_stopped(DWORD miliseconds) {
+    std::vector<Handle> handles(threads.begin(), threads.end());
+    return Handle::wait_multiple(handles, false, miliseconds) != (size_t)-1;
+}
+
+void Acceptor::loop() {
+    std::vector<AIO<void>> tasks{};
+    for (size_t i = 0; i < pending_per_thread; ++i) {
+        tasks.push_back(accept_forever());
+    }
+
+    ParallelAIOs loops{std::move(tasks)};
+    loops.run();
+}
+
+AIO<void> Acceptor::accept_forever() {
+    while (!stopping) {
+        try {
+            OwningSocket client = co_await listener.accept_async();
+            ++accepted_;
+            metrics::add(metrics::Counter::connections_accepted);
+
+            metrics::ScopedTimer handoff{metrics::Latency::accept_handoff};
+            on_accept(std::move(client));
+        } catch (std::exception &) {
+            if (stopping) {
+                break;
+            }
+
+            // A connection going away before it was accepted shouldn't take the listener down with it
+            ++errors_;
+        }
+    }
+}
+
+}  // namespace abel
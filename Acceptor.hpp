@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Socket.hpp"
+#include "Handle.hpp"
+#include "Thread.hpp"
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace abel {
+
+template <typename T>
+class AIO;
+
+// Accepts connections on a listening socket from several threads at once, each keeping
+// several AcceptEx calls pending, so that a burst of connections doesn't queue up behind
+// a single blocking accept. Windows has no SO_REUSEPORT; instead, the kernel completes
+// whichever pending AcceptEx comes first, which spreads the connections across the threads.
+class Acceptor {
+public:
+    using Callback = std::function<void(OwningSocket)>;
+
+protected:
+    // How often the destructor repeats its cancel while the threads are still running
+    static constexpr DWORD cancel_retry_ms = 10;
+
+    Socket listener;
+    size_t pending_per_thread;
+    Callback on_accept;
+
+    std::vector<OwningHandle> threads{};
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> accepted_{0};
+    std::atomic<uint64_t> errors_{0};
+
+    void loop();
+
+    AIO<void> accept_forever();
+
+public:
+    // `on_accept` is called on the accepting threads, and should hand the connection off quickly
+    Acceptor(Socket listener, size_t threads, size_t pending_per_thread, Callback on_accept, Placement placement = Placement::none);
+
+    Acceptor(const Acceptor &) = delete;
+    Acceptor &operator=(const Acceptor &) = delete;
+    Acceptor(Acceptor &&) = delete;
+    Acceptor &operator=(Acceptor &&) = delete;
+
+    // Cancels the pending accepts and waits for the threads. The listening socket stays open.
+    ~Acceptor();
+
+    // Returns true if an accepting thread has stopped, which only happens on failure, or false on timeout
+    bool wait_stopped(DWORD miliseconds = INFINITE);
+
+    uint64_t accepted() const noexcept {
+        return accepted_;
+    }
+
+    // Connections that failed between being queued by the kernel and being accepted, e.g. reset by the client
+    uint64_t errors() const noexcept {
+        return errors_;
+    }
+};
+
+}  // namespace abel
@@ -0,0 +1,143 @@
+#include "Admission.hpp"
+
+#include <algorithm>
+
+namespace abel {
+
+AdmissionVerdict AdmissionControl::enter(const std::function<void(uint32_t position)> &on_queued) {
+    std::unique_lock lock{mutex};
+
+    if (closed) {
+        return AdmissionVerdict::rejected_shutdown;
+    }
+
+    if (queue.empty() && active < limits.max_sessions) {
+        ++active;
+        ++stats_.admitted;
+        return AdmissionVerdict::admitted;
+    }
+
+    if (queue.size() >= limits.max_queue) {
+        ++stats_.rejected_queue_full;
+        return AdmissionVerdict::rejected_queue_full;
+    }
+
+    uint64_t ticket = next_ticket++;
+    queue.push_back(ticket);
+    uint32_t position = (uint32_t)queue.size();
+
+    // Takes the ticket out of the line, and lets the next one in line check whether it's admissible now.
+    // Expects the lock to be held.
+    auto leave_queue = [&] {
+        std::erase(queue, ticket);
+        changed.notify_all();
+    };
+
+    // Not under the lock, since it talks to the client
+    lock.unlock();
+    try {
+        on_queued(position);
+    } catch (...) {
+        // Otherwise the ticket would stay at the head of the queue for good, and nobody after it would get in
+        lock.lock();
+        leave_queue();
+        throw;
+    }
+    lock.lock();
+
+    auto admissible = [&] {
+        return closed || (queue.front() == ticket && active < limits.max_sessions);
+    };
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(limits.queue_timeout_ms);
+    bool admitted = false;
+    bool abandoned = false;
+    while (true) {
+        auto wake = gone ? std::min(deadline, std::chrono::steady_clock::now() + std::chrono::milliseconds(abandon_poll_ms)) : deadline;
+        admitted = changed.wait_until(lock, wake, admissible);
+        if (admitted || std::chrono::steady_clock::now() >= deadline) {
+            break;
+        }
+
+        // Not under the lock either, since it may look at the socket
+        lock.unlock();
+        try {
+            abandoned = gone();
+        } catch (...) {
+            lock.lock();
+            leave_queue();
+            throw;
+        }
+        lock.lock();
+        if (abandoned) {
+            break;
+        }
+    }
+
+    if (closed) {
+        leave_queue();
+        return AdmissionVerdict::rejected_shutdown;
+    }
+
+    if (abandoned) {
+        leave_queue();
+        return AdmissionVerdict::abandoned;
+    }
+
+    if (!admitted) {
+        ++stats_.rejected_timeout;
+        leave_queue();
+        return AdmissionVerdict::rejected_timeout;
+    }
+
+    std::erase(queue, ticket);
+    ++active;
+    ++stats_.admitted;
+    ++stats_.admitted_after_queueing;
+    changed.notify_all();
+    return AdmissionVerdict::admitted;
+}
+
+void AdmissionControl::leave() {
+    {
+        std::lock_guard lock{mutex};
+        --active;
+    }
+    changed.notify_all();
+}
+
+void AdmissionControl::set_limits(AdmissionLimits new_limits) {
+    {
+        std::lock_guard lock{mutex};
+
+        auto update = [](uint32_t &limit, uint32_t value) {
+            if (value != AdminRequest::keep) {
+                limit = value;
+            }
+        };
+        update(limits.max_sessions, new_limits.max_sessions);
+        update(limits.max_queue, new_limits.max_queue);
+        update(limits.queue_timeout_ms, new_limits.queue_timeout_ms);
+    }
+    changed.notify_all();
+}
+
+void AdmissionControl::close() {
+    {
+        std::lock_guard lock{mutex};
+        closed = true;
+    }
+    changed.notify_all();
+}
+
+AdmissionStats AdmissionControl::stats() {
+    std::lock_guard lock{mutex};
+
+    AdmissionStats result = stats_;
+    result.limits = limits;
+    result.active = active;
+    result.queued = (uint32_t)queue.size();
+    return result;
+}
+
+}  // namespace abel
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <Windows.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace abel {
+
+// Bounds how many sessions run at once. Sessions over the limit wait in a FIFO queue,
+// and are turned away if the queue is full or they've waited for too long.
+// Everything here is a plain wire struct too, since the limits can be changed through an admin session.
+
+struct AdmissionLimits {
+    uint32_t max_sessions{64};
+    uint32_t max_queue{64};
+    uint32_t queue_timeout_ms{30'000};
+};
+
+struct AdmissionStats {
+    AdmissionLimits limits{};
+    uint32_t active{0};
+    uint32_t queued{0};
+    uint32_t reserved{0};
+    uint64_t admitted{0};
+    // Of the admitted ones, how many had to wait in the queue
+    uint64_t admitted_after_queueing{0};
+    uint64_t rejected_queue_full{0};
+    uint64_t rejected_timeout{0};
+};
+
+static_assert(sizeof(AdmissionStats) == 56);
+
+enum class AdminOp : uint8_t {
+    get_stats = 0,
+    set_limits = 1,
+};
+
+// Client -> server in an admin session. The server answers with AdmissionStats, after applying the request.
+struct AdminRequest {
+    // For set_limits, leaves that limit as it is
+    static constexpr uint32_t keep = UINT32_MAX;
+
+    AdminOp op{AdminOp::get_stats};
+    uint8_t reserved[3]{};
+    AdmissionLimits limits{};
+};
+
+static_assert(sizeof(AdminRequest) == 16);
+
+enum class AdmissionVerdict {
+    admitted,
+    rejected_queue_full,
+    rejected_timeout,
+    rejected_shutdown,
+    // The session went away while it was queued
+    abandoned,
+};
+
+class AdmissionControl {
+protected:
+    static constexpr DWORD abandon_poll_ms = 1000;
+
+    std::mutex mutex{};
+    std::condition_variable changed{};
+
+    AdmissionLimits limits{};
+    uint32_t active{0};
+    // Tickets of the waiting sessions, oldest first
+    std::deque<uint64_t> queue{};
+    uint64_t next_ticket{0};
+    bool closed{false};
+    AdmissionStats stats_{};
+
+public:
+    explicit AdmissionControl(AdmissionLimits limits = {}) :
+        limits{limits} {
+    }
+
+    AdmissionControl(const AdmissionControl &) = delete;
+    AdmissionControl &operator=(const AdmissionControl &) = delete;
+
+    // Blocks until the session may run, or it's rejected. `on_queued` is called with the session's
+    // position in the queue (1 = next), if it has to wait; if it throws, the session leaves the queue.
+    // `gone` is polled every abandon_poll_ms while waiting, and returning true gives up the place in the queue.
+    // A successful enter must be paired with leave.
+    AdmissionVerdict enter(const std::function<void(uint32_t position)> &on_queued, const std::function<bool()> &gone = {});
+
+    void leave();
+
+    // Takes effect right away: raising max_sessions lets queued sessions in, lowering it doesn't stop running ones.
+    // Fields equal to AdminRequest::keep are left as they are.
+    void set_limits(AdmissionLimits new_limits);
+
+    // Turns away every waiting session, and every session from now on
+    void close();
+
+    AdmissionStats stats();
+};
+
+// Leaves on destruction, if entered
+class AdmissionSlot {
+protected:
+    AdmissionControl *control{};
+
+public:
+    AdmissionSlot() = default;
+
+    explicit AdmissionSlot(AdmissionControl &control) :
+        control{&control} {
+    }
+
+    AdmissionSlot(const AdmissionSlot &) = delete;
+    AdmissionSlot &operator=(const AdmissionSlot &) = delete;
+
+    AdmissionSlot(AdmissionSlot &&other) noexcept :
+        control{other.control} {
+        other.control = nullptr;
+    }
+
+    AdmissionSlot &operator=(AdmissionSlot &&other) noexcept {
+        std::swap(control, other.control);
+        return *this;
+    }
+
+    ~AdmissionSlot() {
+        if (control) {
+            control->leave();
+        }
+    }
+};
+
+}  // namespace abel
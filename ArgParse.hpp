@@ -95,6 +95,17 @@ public:
         };
     }
 
+    template <std::floating_point T>
+    static handler_t handler_store_float(T &destination) {
+        return [&destination](ArgParser &parser) {
+            std::string_view arg = parser.next_arg();
+            auto status = std::from_chars(arg.data(), arg.data() + arg.size(), destination);
+            if (status.ec != std::errc{} || status.ptr != arg.data() + arg.size()) {
+                fail("Invalid argument");
+            }
+        };
+    }
+
     static handler_t handler_store_flag(bool &destination) {
         return [&destination](ArgParser &parser) {
             destination = true;
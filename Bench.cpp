@@ -0,0 +1,1627 @@
+#include "Bench.hpp"
+
+#include "Handle.hpp"
+#include "Compression.hpp"
+#include "Crypto.hpp"
+#include "Datagram.hpp"
+#include "Acceptor.hpp"
+#include "ShellPool.hpp"
+#include "Pty.hpp"
+#include "Process.hpp"
+#include "Pipe.hpp"
+#include "Recording.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "Log.hpp"
+#include "Socket.hpp"
+#include "Thread.hpp"
+#include "Concurrency.hpp"
+#include "Sync.hpp"
+#include "ConsoleWriter.hpp"
+#include "Error.hpp"
+
+#include <Psapi.h>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <exception>
+#include <atomic>
+#include <string>
+#include <charconv>
+#include <memory>
+#include <mutex>
+#include <functional>
+
+namespace abel::bench {
+
+namespace {
+
+class Stopwatch {
+protected:
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+public:
+    double seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+std::vector<unsigned char> read_whole_file(std::string_view path) {
+    auto file = Handle::open_file(std::string{path});
+    std::vector<unsigned char> result(file.file_size());
+    file.read_full_into(result);
+    return result;
+}
+
+double megabytes_per_second(uint64_t bytes, double seconds) {
+    return seconds > 0 ? bytes / seconds / (1024 * 1024) : 0;
+}
+
+// accept_peer blocks, so it gets its own thread while the client connects
+struct UdpAcceptor {
+    udp::Transport *transport;
+    std::exception_ptr error{};
+
+    void run() {
+        try {
+            transport->accept_peer();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+};
+
+// One of the connecting threads of the accept benchmark
+struct StormClient {
+    uint16_t port;
+    unsigned connections;
+    std::vector<double> latencies_ms{};
+    unsigned failures{0};
+
+    void run() {
+        for (unsigned i = 0; i < connections; ++i) {
+            Stopwatch time{};
+            try {
+                auto socket = Socket::connect("127.0.0.1", port);
+                latencies_ms.push_back(time.seconds() * 1000);
+            } catch (std::exception &) {
+                ++failures;
+            }
+        }
+    }
+};
+
+// Serves a single shell session on a pseudo console, the way the server does, minus the session stages
+struct PtyHost {
+    Socket listener;
+    ShellOptions options;
+    std::vector<term::TerminalSize> resizes{};
+    std::exception_ptr error{};
+
+    void run() {
+        try {
+            auto socket = listener.accept();
+            auto shell = Shell::spawn(options);
+            Handle process = shell.cmd.process;
+
+            auto on_resize = [&](term::TerminalSize size) {
+                resizes.push_back(size);
+                shell.pty.resize(size);
+            };
+
+            ParallelAIOs tasks{
+                async_transfer(pty::ResizeFilter{socket.borrow(), on_resize}, shell.pipe_in.write.borrow()),
+                async_transfer(shell.pipe_out.read.borrow(), socket.borrow()),
+            };
+            tasks.until(process).run();
+
+            // Closing the console lets its output run into the end, once it's been read
+            shell.pipe_out.write.close();
+            auto closer = Thread::create<pty::PseudoConsole, &pty::PseudoConsole::close>(&shell.pty).handle;
+
+            auto flushed = Handle::create_timer();
+            flushed.set_timer(1000);
+            tasks.until(flushed).run();
+
+            shell.pipe_out.read.close();
+            closer.wait();
+            socket.shutdown();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+};
+
+// Streams a pattern to whoever connects, in chunks the size of a shell's pipe reads
+struct PatternSender {
+    Socket listener;
+    size_t total;
+    size_t chunk;
+    std::exception_ptr error{};
+
+    void run() {
+        try {
+            auto socket = listener.accept();
+
+            std::vector<unsigned char> data(chunk);
+            for (size_t i = 0; i < chunk; ++i) {
+                data[i] = (unsigned char)(i * 31 + (i >> 8));
+            }
+
+            for (size_t sent = 0; sent < total; sent += chunk) {
+                socket.write_full_from({data.data(), std::min(chunk, total - sent)});
+            }
+            socket.shutdown();
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+};
+
+template <async_readable R>
+AIO<void> receive_counting(R reader, size_t chunk, uint64_t &received) {
+    std::vector<unsigned char> buffer(chunk);
+    while (true) {
+        auto read = co_await reader.read_async_into(buffer);
+        received += read.value;
+        if (read.is_eof) {
+            co_return;
+        }
+    }
+}
+
+// Hammers one way of counting from a thread of its own
+struct CountingWorker {
+    enum class Mode {
+        // metrics::add, into the thread's own slot
+        slot,
+        // A single atomic shared by all the workers, the obvious alternative
+        shared,
+        // metrics::ScopedTimer, clock reads included
+        timer,
+    };
+
+    Mode mode;
+    unsigned rounds;
+    std::atomic<uint64_t> *shared;
+    double seconds{0};
+
+    void run() {
+        Stopwatch time{};
+        for (unsigned i = 0; i < rounds; ++i) {
+            switch (mode) {
+            case Mode::slot:
+                metrics::add(metrics::Counter::bytes_to_clients);
+                break;
+
+            case Mode::shared:
+                shared->fetch_add(1, std::memory_order_relaxed);
+                break;
+
+            case Mode::timer: {
+                metrics::ScopedTimer timer{metrics::Latency::client_write};
+                break;
+            }
+            }
+        }
+        seconds = time.seconds();
+    }
+};
+
+// Logs a message with a couple of fields, the way the server does, as fast as it can
+struct LoggingWorker {
+    unsigned rounds;
+    double seconds{0};
+
+    void run() {
+        Stopwatch time{};
+        for (unsigned i = 0; i < rounds; ++i) {
+            log::info(log::Category::session, "Bench message", {{"round", i}, {"error", "Failed to read from socket"}});
+        }
+        seconds = time.seconds();
+    }
+};
+
+AIO<void> await_signaled(Handle event) {
+    co_await event_signaled{event};
+}
+
+// Every round creates a child coroutine, which suspends and gets resumed by the loop, then gets destroyed,
+// the way every IO operation goes. That's what the tracing hooks see the most of.
+AIO<void> await_children(unsigned rounds, Handle event) {
+    for (unsigned i = 0; i < rounds; ++i) {
+        co_await await_signaled(event);
+    }
+}
+
+// Runs each body on a thread of its own, all at once, and returns how long it took until the last one was done
+struct ContendingWorker {
+    std::function<void()> body;
+    Event *start;
+
+    void run() {
+        start->wait();
+        body();
+    }
+};
+
+double contend(std::vector<std::function<void()>> bodies) {
+    Event start{true, false};
+    std::vector<ContendingWorker> workers{};
+    for (auto &body : bodies) {
+        workers.push_back(ContendingWorker{std::move(body), &start});
+    }
+
+    std::vector<OwningHandle> handles{};
+    for (auto &worker : workers) {
+        handles.push_back(Thread::create<ContendingWorker, &ContendingWorker::run>(&worker).handle);
+    }
+
+    Stopwatch time{};
+    start.signal();
+    for (auto &handle : handles) {
+        handle.wait();
+    }
+    return time.seconds();
+}
+
+double contend(unsigned threads, const std::function<void()> &body) {
+    return contend(std::vector<std::function<void()>>(threads, body));
+}
+
+AIO<void> count_locked(AsyncMutex &mutex, unsigned rounds, uint64_t &counter) {
+    for (unsigned i = 0; i < rounds; ++i) {
+        co_await mutex.lock_async();
+        ++counter;
+        mutex.unlock();
+    }
+}
+
+// One side of a ping-pong between two loops: waits for its own event, then signals the other side's
+AIO<void> async_ping(AsyncEvent &mine, AsyncEvent &other, unsigned rounds) {
+    for (unsigned i = 0; i < rounds; ++i) {
+        co_await mine.wait_async();
+        mine.reset();
+        other.signal();
+    }
+}
+
+AIO<void> kernel_ping(Handle mine, Handle other, unsigned rounds) {
+    for (unsigned i = 0; i < rounds; ++i) {
+        co_await event_signaled{mine};
+        mine.reset();
+        other.signal();
+    }
+}
+
+// The same with a Wakeup on each loop, woken by posting to the other loop. The queue is only looked up once
+// the loops run, since the other loop is created after this one.
+AIO<void> posted_ping(Wakeup &mine, Wakeup &other, TaskQueue *const &other_queue, unsigned rounds) {
+    for (unsigned i = 0; i < rounds; ++i) {
+        co_await mine;
+        other_queue->post([&other]() { other.wake(); });
+    }
+}
+
+AIO<void> await_wakeup(Wakeup &wakeup) {
+    co_await wakeup;
+}
+
+AIO<void> write_lines(ConsoleAsyncIO writer, const std::vector<std::string> &lines) {
+    for (const auto &line : lines) {
+        co_await writer.write_async_full_from({(const unsigned char *)line.data(), line.size()});
+    }
+}
+
+AIO<void> read_console(ConsoleAsyncIO reader, size_t total, std::string &received) {
+    std::vector<unsigned char> buffer(4096);
+    while (received.size() < total) {
+        auto result = co_await reader.read_async_into(buffer);
+        received.append((const char *)buffer.data(), result.value);
+    }
+}
+
+// The stand-in shell of the loopback benchmark: echoes everything back, from a thread per session,
+// through async_transfer, the same way the server runs its sessions
+struct EchoSession {
+    OwningSocket socket;
+
+    void run() {
+        try {
+            ParallelAIOs tasks{async_transfer(socket.borrow(), socket.borrow())};
+            tasks.run();
+            // Passes the end of the stream on, since the host keeps the socket open until it joins the sessions
+            socket.shutdown(SD_SEND);
+        } catch (std::exception &) {
+            // The client went away abruptly, which is its business
+        }
+    }
+};
+
+struct EchoHost {
+    Socket listener;
+    std::atomic<bool> stopping{false};
+    std::atomic<size_t> started{0};
+    std::exception_ptr error{};
+
+    std::mutex mutex{};
+    std::vector<std::unique_ptr<EchoSession>> sessions{};
+    std::vector<OwningHandle> threads{};
+
+    void run() {
+        while (true) {
+            try {
+                auto session = std::make_unique<EchoSession>(listener.accept());
+
+                std::lock_guard lock{mutex};
+                threads.push_back(Thread::create<EchoSession, &EchoSession::run>(session.get()).handle);
+                sessions.push_back(std::move(session));
+                ++started;
+            } catch (...) {
+                // Closing the listener is how the host is stopped
+                if (!stopping) {
+                    error = std::current_exception();
+                }
+                return;
+            }
+        }
+    }
+
+    // Once the clients have hung up
+    void join_sessions() {
+        std::lock_guard lock{mutex};
+        for (auto &thread : threads) {
+            thread.wait();
+        }
+        threads.clear();
+        sessions.clear();
+    }
+};
+
+// One side of the loopback benchmark's bulk transfer, while the other reads the echo back
+struct BulkWriter {
+    Socket socket;
+    size_t total;
+    std::exception_ptr error{};
+
+    void run() {
+        try {
+            std::vector<unsigned char> chunk(64 * 1024);
+            for (size_t i = 0; i < chunk.size(); ++i) {
+                chunk[i] = (unsigned char)(i * 7);
+            }
+
+            for (size_t sent = 0; sent < total; sent += chunk.size()) {
+                socket.write_full_from({chunk.data(), std::min(chunk.size(), total - sent)});
+            }
+            socket.shutdown(SD_SEND);
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+};
+
+uint64_t private_bytes() {
+    PROCESS_MEMORY_COUNTERS_EX counters{.cb = sizeof(counters)};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), (PROCESS_MEMORY_COUNTERS *)&counters, sizeof(counters))) {
+        fail_ec("Failed to get the process memory usage");
+    }
+    return counters.PrivateUsage;
+}
+
+// A benchmark result, and how it compares against an earlier one
+struct Measurement {
+    std::string key;
+    double value;
+    bool higher_is_better;
+    // How much worse than the baseline it may get before it counts as a regression, in percent
+    double tolerance;
+};
+
+// Reads the flat {"key": number, ...} objects that the loopback benchmark writes, and nothing more
+std::vector<std::pair<std::string, double>> parse_flat_json(std::string_view text) {
+    std::vector<std::pair<std::string, double>> result{};
+
+    size_t pos = 0;
+    while ((pos = text.find('"', pos)) != std::string_view::npos) {
+        size_t end = text.find('"', pos + 1);
+        if (end == std::string_view::npos) {
+            fail("Malformed baseline");
+        }
+        std::string key{text.substr(pos + 1, end - pos - 1)};
+
+        pos = text.find_first_not_of(" \t\r\n:", end + 1);
+        if (pos == std::string_view::npos) {
+            fail("Malformed baseline");
+        }
+
+        double value = 0;
+        auto status = std::from_chars(text.data() + pos, text.data() + text.size(), value);
+        if (status.ec != std::errc{}) {
+            fail("Malformed baseline");
+        }
+        pos = status.ptr - text.data();
+
+        result.emplace_back(std::move(key), value);
+    }
+
+    return result;
+}
+
+size_t count_occurrences(std::string_view text, std::string_view what) {
+    size_t count = 0;
+    for (size_t pos = text.find(what); pos != std::string_view::npos; pos = text.find(what, pos + what.size())) {
+        ++count;
+    }
+    return count;
+}
+
+double percentile(std::vector<double> &values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+
+    std::ranges::sort(values);
+    size_t index = (size_t)(p / 100 * (values.size() - 1));
+    return values[index];
+}
+
+AIO<void> send_all(udp::Stream stream, std::span<const unsigned char> data) {
+    co_await stream.write_async_full_from(data);
+}
+
+AIO<void> receive_all(udp::Stream stream, std::span<unsigned char> data) {
+    if ((co_await stream.read_async_full_into(data)).is_eof) {
+        fail("The udp stream ended early");
+    }
+}
+
+}  // namespace
+
+void run(const BenchArgs &args) {
+    if (args.name == "compression") {
+        compression(args);
+    } else if (args.name == "crypto") {
+        crypto(args);
+    } else if (args.name == "udp") {
+        udp(args);
+    } else if (args.name == "accept") {
+        accept(args);
+    } else if (args.name == "pty") {
+        pty(args);
+    } else if (args.name == "spawn") {
+        spawn(args);
+    } else if (args.name == "record") {
+        record(args);
+    } else if (args.name == "metrics") {
+        metrics(args);
+    } else if (args.name == "trace") {
+        trace(args);
+    } else if (args.name == "log") {
+        logging(args);
+    } else if (args.name == "sync") {
+        sync(args);
+    } else if (args.name == "post") {
+        post(args);
+    } else if (args.name == "console") {
+        console(args);
+    } else if (args.name == "loopback") {
+        loopback(args);
+    } else {
+        fail("Unknown benchmark");
+    }
+}
+
+void compression(const BenchArgs &args) {
+    if (args.input.empty()) {
+        fail("The compression benchmark needs --input <recorded session output>");
+    }
+
+    auto recording = read_whole_file(args.input);
+
+    // async_transfer reads the shell's output in chunks of up to 4096 bytes
+    constexpr size_t transfer_chunk = 4096;
+    constexpr unsigned rounds = 20;
+
+    std::vector<std::vector<unsigned char>> frames{};
+    CompressionStats stats{};
+
+    Stopwatch encode_time{};
+    for (unsigned round = 0; round < rounds; ++round) {
+        FrameCompressor compressor{};
+        frames.clear();
+
+        for (size_t pos = 0; pos < recording.size(); pos += transfer_chunk) {
+            auto chunk = std::span{recording}.subspan(pos, std::min(transfer_chunk, recording.size() - pos));
+            auto frame = compressor.encode(chunk);
+            frames.emplace_back(frame.begin(), frame.end());
+        }
+
+        stats = compressor.stats();
+    }
+    double encode_seconds = encode_time.seconds();
+
+    Stopwatch decode_time{};
+    for (unsigned round = 0; round < rounds; ++round) {
+        FrameDecompressor decompressor{};
+
+        for (const auto &frame : frames) {
+            CompressedFrameHeader header{};
+            memcpy(&header, frame.data(), sizeof(header));
+            auto payload = decompressor.payload_buffer(header);
+            std::copy(frame.begin() + sizeof(header), frame.end(), payload.begin());
+            decompressor.decode(header);
+        }
+    }
+    double decode_seconds = decode_time.seconds();
+
+    uint64_t total = (uint64_t)recording.size() * rounds;
+
+    printf("compression: %zu bytes of recorded output, %u rounds\n", recording.size(), rounds);
+    printf("  wire size:   %llu bytes (%.1f%% of raw)\n", stats.wire_bytes, 100.0 * stats.wire_bytes / std::max<uint64_t>(stats.raw_bytes, 1));
+    printf("  frames:      %llu compressed, %llu stored, %llu bypassed\n", stats.frames_compressed, stats.frames_stored, stats.frames_bypassed);
+    printf("  disabled:    %llu times\n", stats.times_disabled);
+    printf("  compress:    %.1f MiB/s\n", megabytes_per_second(total, encode_seconds));
+    printf("  decompress:  %.1f MiB/s\n", megabytes_per_second(total, decode_seconds));
+}
+
+void crypto(const BenchArgs &args) {
+    (void)args;
+
+    crypto::ensure_self_test();
+
+    // Same frame size as async_transfer produces
+    constexpr size_t frame_size = 4096;
+    constexpr unsigned rounds = 64 * 1024;
+
+    crypto::Key key{};
+    crypto::random_bytes(key);
+    crypto::Nonce nonce{};
+
+    std::vector<unsigned char> source(frame_size), frame(frame_size);
+    crypto::random_bytes(source);
+
+    auto measure = [&](const char *label, auto &&body) {
+        Stopwatch time{};
+        for (unsigned round = 0; round < rounds; ++round) {
+            body();
+        }
+        double seconds = time.seconds();
+        printf("  %-16s %.1f MiB/s\n", label, megabytes_per_second((uint64_t)frame_size * rounds, seconds));
+    };
+
+    printf("crypto: %u frames of %zu bytes\n", rounds, frame_size);
+
+    measure("memcpy:", [&] {
+        memcpy(frame.data(), source.data(), frame_size);
+    });
+    measure("chacha20 scalar:", [&] {
+        crypto::chacha20_xor_scalar(key, 1, nonce, source, frame);
+    });
+    measure("chacha20:", [&] {
+        crypto::chacha20_xor(key, 1, nonce, source, frame);
+    });
+
+    crypto::FrameNonces nonces{crypto::Direction::client_to_server};
+    crypto::Tag tag{};
+    measure("seal:", [&] {
+        tag = crypto::seal(key, nonces.next(), {}, source, frame);
+    });
+
+    crypto::Tag reference = crypto::seal(key, nonce, {}, source, frame);
+    std::vector<unsigned char> sealed = frame;
+    measure("open:", [&] {
+        memcpy(frame.data(), sealed.data(), frame_size);
+        if (!crypto::open(key, nonce, {}, frame, reference)) {
+            fail("Sealed frame failed authentication");
+        }
+    });
+}
+
+void udp(const BenchArgs &args) {
+    constexpr size_t total = 4 * 1024 * 1024;
+
+    SocketLibGuard socket_lib_guard{};
+
+    udp::TransportOptions options{.loss_percent = args.udp_loss};
+    auto server = udp::Transport::listen(options);
+
+    UdpAcceptor acceptor{server.get()};
+    auto accept_thread = Thread::create<UdpAcceptor, &UdpAcceptor::run>(&acceptor).handle;
+
+    sockaddr_in loopback{.sin_family = AF_INET};
+    loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    auto client = udp::Transport::connect(loopback, server->offer(), options);
+
+    accept_thread.wait();
+    if (acceptor.error) {
+        std::rethrow_exception(acceptor.error);
+    }
+
+    std::vector<unsigned char> source(total), received(total);
+    for (size_t i = 0; i < total; ++i) {
+        source[i] = (unsigned char)(i * 31 + (i >> 12));
+    }
+
+    Stopwatch time{};
+    ParallelAIOs tasks{
+        send_all(client->stream(), source),
+        receive_all(server->stream(), received),
+    };
+    tasks.run();
+    tasks.rethrow();
+    double seconds = time.seconds();
+
+    client->close();
+    server->close();
+
+    auto stats = client->stats();
+    bool intact = source == received;
+
+    printf("udp: %zu bytes over loopback, %.1f%% injected loss\n", total, args.udp_loss);
+    printf("  throughput:  %.1f MiB/s\n", megabytes_per_second(total, seconds));
+    printf("  packets:     %llu sent, %llu dropped by the injector\n", stats.packets_sent, stats.dropped_by_injector);
+    printf("  retransmits: %llu (%llu fast, %llu timeouts)\n", stats.retransmits, stats.fast_retransmits, stats.timeouts);
+    printf("  rtt:         %.2f ms, final cwnd %.1f\n", stats.srtt_ms, stats.cwnd);
+    printf("  verified:    %s\n", intact ? "yes" : "NO");
+
+    if (!intact) {
+        fail("The udp stream corrupted the data");
+    }
+}
+
+void accept(const BenchArgs &args) {
+    constexpr unsigned client_threads = 32;
+    constexpr unsigned connections_per_thread = 200;
+    constexpr unsigned total = client_threads * connections_per_thread;
+
+    SocketLibGuard socket_lib_guard{};
+
+    auto listener = Socket::listen(0);
+    uint16_t port = ntohs(listener.local_address().sin_port);
+
+    auto storm = [&](const char *label, unsigned threads, unsigned pending) {
+        Acceptor acceptor{listener.borrow(), threads, pending, [](OwningSocket) {}};
+
+        std::vector<StormClient> clients(client_threads, StormClient{port, connections_per_thread});
+        std::vector<OwningHandle> handles{};
+
+        Stopwatch time{};
+        for (auto &client : clients) {
+            handles.push_back(Thread::create<StormClient, &StormClient::run>(&client).handle);
+        }
+        for (auto &handle : handles) {
+            handle.wait();
+        }
+
+        unsigned failures = 0;
+        std::vector<double> latencies{};
+        for (auto &client : clients) {
+            failures += client.failures;
+            latencies.insert(latencies.end(), client.latencies_ms.begin(), client.latencies_ms.end());
+        }
+
+        // Connections that made it into the backlog may still be waiting to be accepted
+        while (acceptor.accepted() + acceptor.errors() < total - failures && time.seconds() < 30) {
+            Sleep(1);
+        }
+        double seconds = time.seconds();
+
+        printf("  %s: %u threads x %u pending\n", label, threads, pending);
+        printf("    accepted:  %llu of %u (%llu errors, %u failed connects)\n", acceptor.accepted(), total, acceptor.errors(), failures);
+        printf("    rate:      %.0f connections/s\n", seconds > 0 ? acceptor.accepted() / seconds : 0);
+        printf("    connect:   p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", percentile(latencies, 50), percentile(latencies, 99), percentile(latencies, 100));
+    };
+
+    printf("accept: %u clients connecting %u times each over loopback\n", client_threads, connections_per_thread);
+    storm("single", 1, 1);
+    storm("configured", args.accept_threads, args.pending_accepts);
+}
+
+void pty(const BenchArgs &args) {
+    constexpr std::string_view marker = "rcmd-pty-check";
+    constexpr term::TerminalSize resized{.rows = 30, .cols = 100};
+
+    SocketLibGuard socket_lib_guard{};
+
+    auto listener = Socket::listen(0);
+    uint16_t port = ntohs(listener.local_address().sin_port);
+
+    ShellOptions options{.pty = true};
+    if (!args.shell.empty()) {
+        options.executable = std::string{args.shell};
+    }
+
+    PtyHost host{listener.borrow(), options};
+    auto host_thread = Thread::create<PtyHost, &PtyHost::run>(&host).handle;
+
+    Stopwatch time{};
+    auto socket = Socket::connect("127.0.0.1", port);
+
+    std::string output{};
+    auto buffer = std::make_unique<unsigned char[]>(4096);
+    // Returns false at the end of the stream
+    auto receive = [&] {
+        auto read = socket.read_into({buffer.get(), 4096});
+        output.append((const char *)buffer.get(), read.value);
+        return !read.is_eof;
+    };
+
+    // The shell's banner or prompt, drawn by the console host
+    while (output.empty() && receive()) {
+    }
+    double first_output_ms = time.seconds() * 1000;
+
+    // Enter is a carriage return on a console
+    std::string input = pty::resize_request(resized);
+    input += "echo ";
+    input += marker;
+    input += "\rexit\r";
+
+    Stopwatch round_trip{};
+    socket.write_full_from({(const unsigned char *)input.data(), input.size()});
+    socket.shutdown(SD_SEND);
+
+    // Once as the echo of the command, then as its output
+    bool alive = true;
+    while (count_occurrences(output, marker) < 2 && (alive = receive())) {
+    }
+    double round_trip_ms = round_trip.seconds() * 1000;
+
+    while (alive && receive()) {
+    }
+    double session_seconds = time.seconds();
+
+    host_thread.wait();
+    if (host.error) {
+        std::rethrow_exception(host.error);
+    }
+
+    bool echoed = count_occurrences(output, marker) >= 2;
+    bool resize_seen = host.resizes.size() == 1 && host.resizes[0].rows == resized.rows && host.resizes[0].cols == resized.cols;
+
+    printf("pty: %s on a pseudo console over loopback\n", options.executable.c_str());
+    printf("  first output: %.1f ms\n", first_output_ms);
+    printf("  round trip:   %.1f ms, from sending a command to seeing its output\n", round_trip_ms);
+    printf("  session:      %.2f s, %zu bytes of output\n", session_seconds, output.size());
+    printf("  verified:     output %s, resize %s\n", echoed ? "yes" : "NO", resize_seen ? "yes" : "NO");
+
+    if (!echoed || !resize_seen) {
+        fail("The pseudo console session misbehaved");
+    }
+}
+
+void spawn(const BenchArgs &args) {
+    constexpr unsigned rounds = 200;
+    const std::string executable = "C:\\Windows\\System32\\cmd.exe";
+
+    (void)args;
+
+    // Like a shell's, so that the inheritance setup is part of what's measured
+    auto pipe_out = Pipe::create_async(true);
+    auto pipe_in = Pipe::create_async(true);
+
+    auto measure = [&](const char *label, auto &&start) {
+        std::vector<double> latencies_ms{};
+        latencies_ms.reserve(rounds);
+
+        Stopwatch total{};
+        for (unsigned i = 0; i < rounds; ++i) {
+            Stopwatch time{};
+            Process process = start();
+            latencies_ms.push_back(time.seconds() * 1000);
+
+            process.process.wait();
+        }
+        double seconds = total.seconds();
+
+        printf("  %s:\n", label);
+        printf("    rate:   %.0f processes/s, including running them to completion\n", seconds > 0 ? rounds / seconds : 0);
+        printf("    create: p50 %.2f ms, p99 %.2f ms\n", percentile(latencies_ms, 50), percentile(latencies_ms, 99));
+    };
+
+    printf("spawn: %u runs of cmd.exe /d /c exit\n", rounds);
+
+    measure("create", [&] {
+        return Process::create(executable, "/d /c exit", "", true, CREATE_NO_WINDOW, 0, pipe_in.read, pipe_out.write, pipe_out.write);
+    });
+
+    const std::string command_line = "\"" + executable + "\" /d /c exit";
+    const std::vector<std::string> environment{"SystemRoot=C:\\Windows"};
+
+    measure("spawn", [&] {
+        return Process::spawn({
+            .executable = executable,
+            .command_line = command_line,
+            .environment = environment,
+            .std_input = pipe_in.read,
+            .std_output = pipe_out.write,
+            .std_error = pipe_out.write,
+            .creation_flags = CREATE_NO_WINDOW,
+        });
+    });
+}
+
+void record(const BenchArgs &args) {
+    constexpr size_t total = 64 * 1024 * 1024;
+    constexpr size_t chunk = 4096;
+
+    (void)args;
+
+    SocketLibGuard socket_lib_guard{};
+
+    char temp_dir[MAX_PATH + 1]{};
+    if (!GetTempPathA(sizeof(temp_dir), temp_dir)) {
+        fail("Failed to find the temporary directory");
+    }
+    const std::string path = std::string{temp_dir} + "rcmd-bench.rcmdrec";
+
+    // Returns the seconds it took to receive everything
+    auto measure = [&](record::Recorder *recorder) {
+        auto listener = Socket::listen(0);
+        uint16_t port = ntohs(listener.local_address().sin_port);
+
+        PatternSender sender{listener.borrow(), total, chunk};
+        auto sender_thread = Thread::create<PatternSender, &PatternSender::run>(&sender).handle;
+
+        auto socket = Socket::connect("127.0.0.1", port);
+
+        uint64_t received = 0;
+        Stopwatch time{};
+        ParallelAIOs tasks{
+            receive_counting(record::Tap{socket.borrow(), recorder, record::EventKind::output}, chunk, received),
+        };
+        tasks.run();
+        tasks.rethrow();
+        double seconds = time.seconds();
+
+        sender_thread.wait();
+        if (sender.error) {
+            std::rethrow_exception(sender.error);
+        }
+        if (received != total) {
+            fail("The loopback stream ended early");
+        }
+
+        return seconds;
+    };
+
+    double plain = measure(nullptr);
+
+    record::RecorderStats stats{};
+    Stopwatch recorded_time{};
+    double recorded = 0;
+    {
+        record::Recorder recorder{path};
+        recorded = measure(&recorder);
+        stats = recorder.stats();
+    }
+    // Including the final flush
+    double closed = recorded_time.seconds();
+
+    // Read back what was written
+    uint64_t output_bytes = 0;
+    uint64_t events = 0;
+    bool complete = false;
+    bool seeks = false;
+    {
+        record::Transcript transcript{path};
+        complete = transcript.complete();
+
+        uint64_t last_time_us = 0;
+        for (uint64_t offset = transcript.begin(); auto event = transcript.event_at(offset); offset = event->next) {
+            if (event->kind == record::EventKind::output) {
+                output_bytes += event->data.size();
+                last_time_us = event->time_us;
+                ++events;
+            }
+        }
+
+        // Halfway through the session, an event at or after the requested time must come back
+        auto middle = transcript.event_at(transcript.seek(last_time_us / 2));
+        seeks = middle && middle->time_us >= last_time_us / 2;
+    }
+    DeleteFileA(path.c_str());
+
+    double overhead = plain > 0 ? (recorded - plain) / plain * 100 : 0;
+
+    printf("record: %zu bytes over loopback in %zu byte reads\n", total, chunk);
+    printf("  plain:     %.1f MiB/s\n", megabytes_per_second(total, plain));
+    printf("  recorded:  %.1f MiB/s, %.1f%% overhead\n", megabytes_per_second(total, recorded), overhead);
+    printf("  closing:   %.1f ms to write out the rest\n", (closed - recorded) * 1000);
+    printf("  writer:    %llu flushes, %llu stalls, %llu bytes on disk\n", stats.flushes, stats.stalls, stats.file_bytes);
+    printf("  verified:  %s (%llu output events, %s, %s)\n",
+        output_bytes == total && complete && seeks ? "yes" : "NO",
+        events,
+        complete ? "trailer found" : "no trailer",
+        seeks ? "seek ok" : "seek FAILED");
+
+    if (output_bytes != total || !complete || !seeks) {
+        fail("The recording doesn't match what was sent");
+    }
+}
+
+void metrics(const BenchArgs &args) {
+    constexpr unsigned rounds = 10'000'000;
+
+    (void)args;
+
+    unsigned thread_counts[] = {1, std::clamp<unsigned>(GetActiveProcessorCount(ALL_PROCESSOR_GROUPS), 2, 16)};
+
+    auto before = metrics::snapshot();
+    uint64_t expected_adds = 0;
+    uint64_t expected_records = 0;
+
+    auto measure = [&](const char *label, CountingWorker::Mode mode, unsigned threads) {
+        std::atomic<uint64_t> shared{0};
+        std::vector<CountingWorker> workers(threads, CountingWorker{mode, rounds, &shared});
+
+        std::vector<OwningHandle> handles{};
+        for (auto &worker : workers) {
+            handles.push_back(Thread::create<CountingWorker, &CountingWorker::run>(&worker).handle);
+        }
+        for (auto &handle : handles) {
+            handle.wait();
+        }
+
+        double slowest = 0;
+        for (auto &worker : workers) {
+            slowest = std::max(slowest, worker.seconds);
+        }
+
+        printf("  %-8s %2u threads: %6.2f ns per operation per thread\n", label, threads, slowest / rounds * 1e9);
+
+        if (mode == CountingWorker::Mode::slot) {
+            expected_adds += (uint64_t)rounds * threads;
+        } else if (mode == CountingWorker::Mode::timer) {
+            expected_records += (uint64_t)rounds * threads;
+        }
+    };
+
+    printf("metrics: %u operations per thread\n", rounds);
+
+    for (unsigned threads : thread_counts) {
+        measure("slot", CountingWorker::Mode::slot, threads);
+        measure("shared", CountingWorker::Mode::shared, threads);
+        measure("timer", CountingWorker::Mode::timer, threads);
+    }
+
+    // The workers' threads are gone, but their slots keep the counts
+    auto after = metrics::snapshot();
+    uint64_t adds = after[metrics::Counter::bytes_to_clients] - before[metrics::Counter::bytes_to_clients];
+    uint64_t records = after[metrics::Latency::client_write].count - before[metrics::Latency::client_write].count;
+    bool intact = adds == expected_adds && records == expected_records;
+
+    Stopwatch snapshot_time{};
+    auto exposition = metrics::prometheus(metrics::snapshot());
+    double snapshot_ms = snapshot_time.seconds() * 1000;
+
+    printf("  scrape:    %.2f ms for a snapshot and %zu bytes of exposition\n", snapshot_ms, exposition.size());
+    printf("  verified:  %s (%llu adds, %llu records)\n", intact ? "yes" : "NO", adds, records);
+
+    if (!intact) {
+        fail("Counts were lost");
+    }
+}
+
+void trace(const BenchArgs &args) {
+    constexpr unsigned rounds = 200'000;
+
+    (void)args;
+
+    // Always signaled, so the loop never actually waits
+    auto ready = Handle::create_event(true, true);
+
+    auto measure = [&](const char *label) {
+        Stopwatch time{};
+        ParallelAIOs tasks{await_children(rounds, ready.borrow())};
+        tasks.run();
+        tasks.rethrow();
+        double seconds = time.seconds();
+
+        printf("  %-13s %7.1f ns per child coroutine\n", label, seconds / rounds * 1e9);
+    };
+
+    printf("trace: %u child coroutines, each suspending once\n", rounds);
+
+    if constexpr (!abel::trace::compiled_in) {
+        measure("compiled out:");
+        printf("  (build with ABEL_TRACING=1 to compare against tracing compiled in)\n");
+        return;
+    }
+
+    measure("disabled:");
+
+    abel::trace::start();
+    measure("enabled:");
+    abel::trace::enabled = false;
+
+    Stopwatch dump_time{};
+    std::string json = abel::trace::chrome_json();
+    double dump_ms = dump_time.seconds() * 1000;
+
+    // Each child leaves a creation and a destruction behind, so the ring has plenty of them
+    size_t events = count_occurrences(json, "\"cat\":\"coro\"");
+
+    printf("  dump:         %.2f ms for %zu bytes of JSON, %zu coroutine events\n", dump_ms, json.size(), events);
+
+    if (events == 0 || !json.ends_with("]}\n")) {
+        fail("The trace came out empty or malformed");
+    }
+}
+
+void logging(const BenchArgs &args) {
+    constexpr unsigned rounds = 200'000;
+    constexpr unsigned rate_limited_rounds = 10'000;
+    constexpr unsigned rate_limit = 100;
+
+    (void)args;
+
+    char temp_dir[MAX_PATH + 1]{};
+    if (!GetTempPathA(sizeof(temp_dir), temp_dir)) {
+        fail("Failed to find the temporary directory");
+    }
+    const std::string path = std::string{temp_dir} + "rcmd-bench.log";
+    DeleteFileA(path.c_str());
+
+    log::configure({.sink = log::Sink::file, .target = path});
+    log::set_rate_limit(log::Category::session, UINT32_MAX);
+
+    unsigned thread_counts[] = {1, std::clamp<unsigned>(GetActiveProcessorCount(ALL_PROCESSOR_GROUPS), 2, 16)};
+    uint64_t calls = 0;
+    auto before = log::stats();
+
+    printf("log: %u messages per thread, into a file\n", rounds);
+
+    for (unsigned threads : thread_counts) {
+        std::vector<LoggingWorker> workers(threads, LoggingWorker{rounds});
+
+        std::vector<OwningHandle> handles{};
+        for (auto &worker : workers) {
+            handles.push_back(Thread::create<LoggingWorker, &LoggingWorker::run>(&worker).handle);
+        }
+        for (auto &handle : handles) {
+            handle.wait();
+        }
+
+        double slowest = 0;
+        for (auto &worker : workers) {
+            slowest = std::max(slowest, worker.seconds);
+        }
+        calls += (uint64_t)rounds * threads;
+
+        printf("  %2u threads: %6.1f ns per call per thread\n", threads, slowest / rounds * 1e9);
+    }
+
+    if (!log::flush(10'000)) {
+        fail("The log writer didn't catch up");
+    }
+
+    auto after = log::stats();
+    uint64_t written = after.written - before.written;
+    uint64_t dropped = after.dropped - before.dropped;
+
+    // The writer's own notices about dropped messages are in the file too, but don't count as written.
+    // Shared for writing, since the writer still has it open.
+    auto file = Handle::open_file(path, GENERIC_READ, OPEN_EXISTING, FILE_SHARE_READ | FILE_SHARE_WRITE);
+    std::string contents(file.file_size(), '\0');
+    file.read_full_into({(unsigned char *)contents.data(), contents.size()});
+    size_t lines = count_occurrences(contents, "Bench message");
+
+    printf("  written:   %llu of %llu (%.1f%%), the rest dropped while the queue was full\n", written, calls, 100.0 * written / calls);
+    printf("  verified:  %s (%zu lines in %zu bytes)\n", lines == written && written + dropped == calls ? "yes" : "NO", lines, contents.size());
+
+    if (lines != written || written + dropped != calls) {
+        fail("Log messages were lost without being counted");
+    }
+
+    log::set_rate_limit(log::Category::session, rate_limit);
+    before = log::stats();
+
+    LoggingWorker flood{rate_limited_rounds};
+    flood.run();
+    log::flush(10'000);
+
+    after = log::stats();
+    uint64_t suppressed = after.suppressed - before.suppressed;
+    printf("  limited:   %llu of %u suppressed at %u per second, %.1f ns per call\n", suppressed, rate_limited_rounds, rate_limit, flood.seconds / rate_limited_rounds * 1e9);
+
+    // The flood may straddle a second, which lets through another second's worth
+    if (suppressed < rate_limited_rounds - 2 * rate_limit) {
+        fail("The rate limit let too much through");
+    }
+
+    // Lets go of the file
+    log::configure({});
+    file = {};
+    DeleteFileA(path.c_str());
+}
+
+void sync(const BenchArgs &args) {
+    constexpr unsigned lock_rounds = 200'000;
+    constexpr unsigned ping_rounds = 50'000;
+    constexpr unsigned signal_rounds = 1'000'000;
+    constexpr unsigned coroutines_per_thread = 4;
+
+    (void)args;
+
+    unsigned thread_counts[] = {1, 2, std::clamp<unsigned>(GetActiveProcessorCount(ALL_PROCESSOR_GROUPS), 4, 16)};
+    bool intact = true;
+
+    printf("sync: %u locks per thread, %u ping-pong round trips, %u signals\n", lock_rounds, ping_rounds, signal_rounds);
+
+    for (unsigned threads : thread_counts) {
+        auto measure = [&](const char *label, auto lock, auto unlock) {
+            uint64_t counter = 0;
+            double seconds = contend(threads, [&]() {
+                for (unsigned i = 0; i < lock_rounds; ++i) {
+                    lock();
+                    ++counter;
+                    unlock();
+                }
+            });
+
+            intact &= counter == (uint64_t)lock_rounds * threads;
+            printf("  %-14s %2u threads: %8.1f ns per lock\n", label, threads, seconds / lock_rounds / threads * 1e9);
+        };
+
+        Mutex mutex{};
+        measure("abel::Mutex", [&]() { mutex.lock(); }, [&]() { mutex.unlock(); });
+
+        std::mutex std_mutex{};
+        measure("std::mutex", [&]() { std_mutex.lock(); }, [&]() { std_mutex.unlock(); });
+
+        auto kernel_mutex = Handle::create_mutex();
+        measure("kernel mutex", [&]() { kernel_mutex.wait(); }, [&]() { ReleaseMutex(kernel_mutex.raw()); });
+
+        AsyncMutex async_mutex{};
+        uint64_t counter = 0;
+        double seconds = contend(threads, [&]() {
+            std::vector<AIO<void>> tasks{};
+            for (unsigned i = 0; i < coroutines_per_thread; ++i) {
+                tasks.push_back(count_locked(async_mutex, lock_rounds / coroutines_per_thread, counter));
+            }
+            ParallelAIOs parallel{std::move(tasks)};
+            parallel.run();
+        });
+
+        uint64_t locks = (uint64_t)lock_rounds / coroutines_per_thread * coroutines_per_thread * threads;
+        intact &= counter == locks;
+        printf("  %-14s %2u threads: %8.1f ns per lock, %u coroutines each\n", "AsyncMutex", threads, seconds / locks * 1e9, coroutines_per_thread);
+    }
+
+    // Wakes: every round trip parks and wakes a thread twice
+    {
+        Event ping{}, pong{};
+        double seconds = contend({
+            [&]() {
+                for (unsigned i = 0; i < ping_rounds; ++i) {
+                    ping.wait();
+                    pong.signal();
+                }
+            },
+            [&]() {
+                for (unsigned i = 0; i < ping_rounds; ++i) {
+                    ping.signal();
+                    pong.wait();
+                }
+            },
+        });
+        printf("  ping-pong:     abel::Event   %8.2f us per round trip\n", seconds / ping_rounds * 1e6);
+
+        auto kernel_ping_event = Handle::create_event();
+        auto kernel_pong_event = Handle::create_event();
+        seconds = contend({
+            [&]() {
+                for (unsigned i = 0; i < ping_rounds; ++i) {
+                    kernel_ping_event.wait();
+                    kernel_pong_event.signal();
+                }
+            },
+            [&]() {
+                for (unsigned i = 0; i < ping_rounds; ++i) {
+                    kernel_ping_event.signal();
+                    kernel_pong_event.wait();
+                }
+            },
+        });
+        printf("  ping-pong:     kernel event  %8.2f us per round trip\n", seconds / ping_rounds * 1e6);
+
+        Semaphore items{};
+        seconds = contend({
+            [&]() {
+                for (unsigned i = 0; i < ping_rounds; ++i) {
+                    items.release();
+                }
+            },
+            [&]() {
+                for (unsigned i = 0; i < ping_rounds; ++i) {
+                    items.acquire();
+                }
+            },
+        });
+        printf("  handoff:       abel::Semaphore %6.2f us per item\n", seconds / ping_rounds * 1e6);
+
+        auto kernel_items = OwningHandle{CreateSemaphoreA(nullptr, 0, LONG_MAX, nullptr)}.validate();
+        seconds = contend({
+            [&]() {
+                for (unsigned i = 0; i < ping_rounds; ++i) {
+                    ReleaseSemaphore(kernel_items.raw(), 1, nullptr);
+                }
+            },
+            [&]() {
+                for (unsigned i = 0; i < ping_rounds; ++i) {
+                    kernel_items.wait();
+                }
+            },
+        });
+        printf("  handoff:       kernel semaphore %5.2f us per item\n", seconds / ping_rounds * 1e6);
+    }
+
+    // The same between two coroutine loops, which can't park on anything but their env's event
+    {
+        AsyncEvent ping{true}, pong{};
+        double seconds = contend({
+            [&]() { ParallelAIOs{async_ping(ping, pong, ping_rounds)}.run(); },
+            [&]() { ParallelAIOs{async_ping(pong, ping, ping_rounds)}.run(); },
+        });
+        printf("  ping-pong:     AsyncEvent    %8.2f us per round trip\n", seconds / ping_rounds * 1e6);
+
+        auto kernel_ping_event = Handle::create_event(true, true);
+        auto kernel_pong_event = Handle::create_event(true, false);
+        seconds = contend({
+            [&]() { ParallelAIOs{kernel_ping(kernel_ping_event.borrow(), kernel_pong_event.borrow(), ping_rounds)}.run(); },
+            [&]() { ParallelAIOs{kernel_ping(kernel_pong_event.borrow(), kernel_ping_event.borrow(), ping_rounds)}.run(); },
+        });
+        printf("  ping-pong:     event_signaled %7.2f us per round trip\n", seconds / ping_rounds * 1e6);
+    }
+
+    // What a producer pays to signal a consumer that's usually busy, like the output feeding the frame encoder
+    {
+        AsyncEvent event{};
+        Stopwatch time{};
+        for (unsigned i = 0; i < signal_rounds; ++i) {
+            event.signal();
+        }
+        printf("  signal:        AsyncEvent    %8.1f ns, nobody waiting\n", time.seconds() / signal_rounds * 1e9);
+
+        auto kernel_event = Handle::create_event(true, false);
+        time = {};
+        for (unsigned i = 0; i < signal_rounds; ++i) {
+            kernel_event.signal();
+        }
+        printf("  signal:        kernel event  %8.1f ns, nobody waiting\n", time.seconds() / signal_rounds * 1e9);
+    }
+
+    printf("  verified:      %s\n", intact ? "yes" : "NO");
+
+    if (!intact) {
+        fail("A lock let two holders in at once");
+    }
+}
+
+void post(const BenchArgs &args) {
+    constexpr unsigned ping_rounds = 50'000;
+    constexpr unsigned posts_per_thread = 200'000;
+
+    (void)args;
+
+    printf("post: %u ping-pong round trips, %u posts per thread\n", ping_rounds, posts_per_thread);
+
+    {
+        Wakeup ping{}, pong{};
+        TaskQueue *left_queue = nullptr;
+        TaskQueue *right_queue = nullptr;
+        ParallelAIOs left{posted_ping(ping, pong, right_queue, ping_rounds)};
+        ParallelAIOs right{posted_ping(pong, ping, left_queue, ping_rounds)};
+        left_queue = &left.queue();
+        right_queue = &right.queue();
+        ping.wake();
+
+        double seconds = contend({
+            [&]() { left.run(); },
+            [&]() { right.run(); },
+        });
+        printf("  ping-pong:   posted Wakeup   %8.2f us per round trip\n", seconds / ping_rounds * 1e6);
+
+        auto kernel_ping_event = Handle::create_event(true, true);
+        auto kernel_pong_event = Handle::create_event(true, false);
+        seconds = contend({
+            [&]() { ParallelAIOs{kernel_ping(kernel_ping_event.borrow(), kernel_pong_event.borrow(), ping_rounds)}.run(); },
+            [&]() { ParallelAIOs{kernel_ping(kernel_pong_event.borrow(), kernel_ping_event.borrow(), ping_rounds)}.run(); },
+        });
+        printf("  ping-pong:   event_signaled  %8.2f us per round trip\n", seconds / ping_rounds * 1e6);
+    }
+
+    unsigned thread_counts[] = {1, std::clamp<unsigned>(GetActiveProcessorCount(ALL_PROCESSOR_GROUPS) - 1, 2, 16)};
+    bool intact = true;
+
+    for (unsigned threads : thread_counts) {
+        uint64_t total = (uint64_t)posts_per_thread * threads;
+        // Only touched by the loop's thread, from the callbacks
+        uint64_t received = 0;
+        Wakeup all_received{};
+
+        ParallelAIOs loop{await_wakeup(all_received)};
+        TaskQueue &queue = loop.queue();
+
+        std::vector<std::function<void()>> bodies{[&]() { loop.run(); }};
+        for (unsigned i = 0; i < threads; ++i) {
+            bodies.push_back([&]() {
+                for (unsigned j = 0; j < posts_per_thread; ++j) {
+                    queue.post([&]() {
+                        if (++received == total) {
+                            all_received.wake();
+                        }
+                    });
+                }
+            });
+        }
+
+        double seconds = contend(std::move(bodies));
+        intact &= received == total;
+        printf("  throughput:  %2u producers     %8.1f ns per post, %.1f M callbacks/s\n", threads, seconds / posts_per_thread * 1e9, total / seconds / 1e6);
+    }
+
+    printf("  verified:    %s\n", intact ? "yes" : "NO");
+
+    if (!intact) {
+        fail("Posted callbacks were lost");
+    }
+}
+
+void console(const BenchArgs &args) {
+    constexpr size_t paste = 10'000;
+
+    (void)args;
+
+    Handle input = Handle::get_stdin();
+    DWORD pending = 0;
+    if (!GetNumberOfConsoleInputEvents(input.raw(), &pending)) {
+        fail("The console benchmark needs to run in a console");
+    }
+    FlushConsoleInputBuffer(input.raw());
+
+    // What a paste looks like to the console: a key down and a key up per character
+    std::string text(paste, '\0');
+    std::vector<INPUT_RECORD> records{};
+    for (size_t i = 0; i < paste; ++i) {
+        text[i] = (char)('a' + i % 26);
+
+        INPUT_RECORD record{.EventType = KEY_EVENT};
+        record.Event.KeyEvent = {.bKeyDown = true, .wRepeatCount = 1};
+        record.Event.KeyEvent.uChar.AsciiChar = text[i];
+        records.push_back(record);
+        record.Event.KeyEvent.bKeyDown = false;
+        records.push_back(record);
+    }
+
+    for (size_t offset = 0; offset < records.size();) {
+        DWORD written = 0;
+        if (!WriteConsoleInputA(input.raw(), records.data() + offset, (DWORD)std::min<size_t>(records.size() - offset, 1024), &written)) {
+            fail("Failed to write console input");
+        }
+        offset += written;
+    }
+
+    std::string received{};
+    Stopwatch time{};
+    ParallelAIOs tasks{read_console(input.console_async_io(false), paste, received)};
+    tasks.run();
+    tasks.rethrow();
+    double seconds = time.seconds();
+
+    bool intact = received == text;
+    printf("console: a paste of %zu characters (%zu input records)\n", paste, records.size());
+    printf("  read:      %.2f ms, %.1f ns per character\n", seconds * 1000, seconds / paste * 1e9);
+    printf("  verified:  %s\n", intact ? "yes" : "NO");
+
+    if (!intact) {
+        fail("The paste came through mangled");
+    }
+
+    // Output the way a shell produces it: many short lines, each its own write
+    constexpr size_t line_count = 20'000;
+    std::vector<std::string> lines{};
+    for (size_t i = 0; i < line_count; ++i) {
+        lines.push_back("line " + std::to_string(i) + " of the console output benchmark\r\n");
+    }
+
+    Handle output = Handle::get_stdout();
+    // The results so far shouldn't end up in the middle of the lines
+    fflush(stdout);
+
+    time = {};
+    ParallelAIOs{write_lines(output.console_async_io(), lines)}.run();
+    double direct_seconds = time.seconds();
+
+    double queued_seconds = 0;
+    time = {};
+    {
+        ConsoleWriter writer{output};
+        ParallelAIOs{write_lines(output.console_async_io(false, false, &writer), lines)}.run();
+        queued_seconds = time.seconds();
+        writer.flush();
+    }
+    double flushed_seconds = time.seconds();
+
+    printf("console: %zu lines of output\n", line_count);
+    printf("  direct:    %.2f ms, the loop blocked throughout\n", direct_seconds * 1000);
+    printf("  writer:    %.2f ms for the loop, %.2f ms until all of it was on the console\n", queued_seconds * 1000, flushed_seconds * 1000);
+}
+
+void loopback(const BenchArgs &args) {
+    constexpr size_t session_counts[] = {1, 100, 10'000};
+    constexpr size_t bulk_bytes = 64 * 1024 * 1024;
+    constexpr unsigned pings = 10'000;
+    // Pings go round-robin over at most this many of the sessions
+    constexpr size_t pinged_sessions = 100;
+
+    SocketLibGuard socket_lib_guard{};
+
+    auto listener = Socket::listen(0, INADDR_LOOPBACK);
+    uint16_t port = ntohs(listener.local_address().sin_port);
+
+    EchoHost host{listener.borrow()};
+    auto host_thread = Thread::create<EchoHost, &EchoHost::run>(&host).handle;
+
+    std::vector<Measurement> results{};
+
+    printf("loopback: echo sessions, %zu bytes in bulk and %u 1-byte pings at each level\n", bulk_bytes, pings);
+
+    for (size_t count : session_counts) {
+        std::string prefix = "sessions_" + std::to_string(count) + ".";
+
+        // Both ends are in this process, so this is the cost of a session on the server plus a socket on the client
+        size_t started_before = host.started;
+        uint64_t memory_before = private_bytes();
+
+        std::vector<OwningSocket> clients{};
+        clients.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            clients.push_back(Socket::connect("127.0.0.1", port));
+        }
+
+        while (host.started - started_before < count) {
+            if (host.error) {
+                std::rethrow_exception(host.error);
+            }
+            Sleep(1);
+        }
+        double memory_per_session = (double)((int64_t)private_bytes() - (int64_t)memory_before) / count;
+
+        // Round trips of a single byte, with Nagle's algorithm out of the way
+        BOOL no_delay = true;
+        for (size_t i = 0; i < std::min(count, pinged_sessions); ++i) {
+            setsockopt(clients[i].raw(), IPPROTO_TCP, TCP_NODELAY, (const char *)&no_delay, sizeof(no_delay));
+        }
+
+        std::vector<double> rtt_us{};
+        rtt_us.reserve(pings);
+        for (unsigned i = 0; i < pings; ++i) {
+            auto &client = clients[i % std::min(count, pinged_sessions)];
+            unsigned char byte = (unsigned char)i;
+
+            Stopwatch time{};
+            client.write_full_from({&byte, 1});
+            if (client.read_full_into({&byte, 1}).is_eof) {
+                fail("An echo session ended early");
+            }
+            rtt_us.push_back(time.seconds() * 1e6);
+        }
+
+        // On a session of its own, while the others sit idle
+        auto bulk = Socket::connect("127.0.0.1", port);
+        BulkWriter writer{bulk.borrow(), bulk_bytes};
+
+        Stopwatch bulk_time{};
+        auto writer_thread = Thread::create<BulkWriter, &BulkWriter::run>(&writer).handle;
+
+        auto buffer = std::make_unique<unsigned char[]>(64 * 1024);
+        size_t received = 0;
+        // Stops at the expected size too, rather than relying on the echo's end of stream alone
+        while (received < bulk_bytes) {
+            auto read = bulk.read_into({buffer.get(), 64 * 1024});
+            received += read.value;
+            if (read.is_eof) {
+                break;
+            }
+        }
+        double bulk_seconds = bulk_time.seconds();
+
+        writer_thread.wait();
+        if (writer.error) {
+            std::rethrow_exception(writer.error);
+        }
+        if (received != bulk_bytes) {
+            fail("The bulk transfer came back short");
+        }
+
+        // Hanging up ends the sessions
+        bulk = {};
+        clients.clear();
+        host.join_sessions();
+
+        double throughput = megabytes_per_second(bulk_bytes, bulk_seconds);
+        double p50 = percentile(rtt_us, 50);
+        double p99 = percentile(rtt_us, 99);
+        double p999 = percentile(rtt_us, 99.9);
+
+        printf(
+            "  %6zu sessions: %8.1f MiB/s, rtt p50 %6.1f us, p99 %7.1f us, p999 %7.1f us, %7.1f KiB per session\n",
+            count,
+            throughput,
+            p50,
+            p99,
+            p999,
+            memory_per_session / 1024
+        );
+
+        // Tail latencies are noisy on a shared machine, so they get more leeway
+        results.push_back({prefix + "throughput_mib_s", throughput, true, 10});
+        results.push_back({prefix + "rtt_p50_us", p50, false, 20});
+        results.push_back({prefix + "rtt_p99_us", p99, false, 50});
+        results.push_back({prefix + "rtt_p999_us", p999, false, 100});
+        results.push_back({prefix + "memory_bytes_per_session", memory_per_session, false, 10});
+    }
+
+    host.stopping = true;
+    listener = {};
+    host_thread.wait();
+
+    std::string json = "{\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        char line[256] = {};
+        int size = snprintf(line, sizeof(line), "  \"%s\": %.3f%s\n", results[i].key.c_str(), results[i].value, i + 1 < results.size() ? "," : "");
+        json.append(line, (size_t)std::max(size, 0));
+    }
+    json += "}\n";
+
+    if (!args.output.empty()) {
+        auto file = Handle::open_file(std::string{args.output}, GENERIC_WRITE, CREATE_ALWAYS);
+        file.write_full_from({(const unsigned char *)json.data(), json.size()});
+        printf("  results written to %.*s\n", (int)args.output.size(), args.output.data());
+    } else {
+        printf("%s", json.c_str());
+    }
+
+    if (args.baseline.empty()) {
+        return;
+    }
+
+    auto baseline_text = read_whole_file(args.baseline);
+    auto baseline = parse_flat_json({(const char *)baseline_text.data(), baseline_text.size()});
+
+    size_t regressions = 0;
+    printf("  against %.*s:\n", (int)args.baseline.size(), args.baseline.data());
+    for (const auto &result : results) {
+        auto found = std::ranges::find(baseline, result.key, &std::pair<std::string, double>::first);
+        if (found == baseline.end() || found->second == 0) {
+            printf("    %-40s %12.3f (no baseline)\n", result.key.c_str(), result.value);
+            continue;
+        }
+
+        // Positive is worse
+        double change = (result.value - found->second) / found->second * 100;
+        double worse_by = result.higher_is_better ? -change : change;
+        bool regressed = worse_by > result.tolerance;
+        regressions += regressed;
+
+        printf(
+            "    %-40s %12.3f vs %12.3f (%+6.1f%%)%s\n",
+            result.key.c_str(),
+            result.value,
+            found->second,
+            change,
+            regressed ? "  REGRESSION" : ""
+        );
+    }
+
+    if (regressions > 0) {
+        fail("The loopback benchmark regressed against the baseline");
+    }
+}
+
+}  // namespace abel::bench
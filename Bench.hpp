@@ -0,0 +1,77 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace abel::bench {
+
+struct BenchArgs {
+    std::string_view name{};
+    std::string_view input{};
+    // Share of datagrams the udp benchmark drops on purpose, in percent
+    double udp_loss{0};
+    // Acceptor configuration the accept benchmark compares against a single blocking-style accept
+    unsigned accept_threads{1};
+    unsigned pending_accepts{8};
+    // Shell the pty benchmark runs; cmd.exe if empty
+    std::string_view shell{};
+    // Where the loopback benchmark writes its results as JSON, stdout if empty
+    std::string_view output{};
+    // Earlier results of the loopback benchmark to compare against, if any
+    std::string_view baseline{};
+};
+
+// Runs the named benchmark and prints the results
+void run(const BenchArgs &args);
+
+// Replays a recorded session output through the compression stage the way async_transfer feeds it
+void compression(const BenchArgs &args);
+
+// Compares the scalar and SIMD ChaCha20 kernels and whole-frame sealing against a plain copy
+void crypto(const BenchArgs &args);
+
+// Pushes a pattern through a pair of UDP transports over loopback, optionally with injected loss, and verifies it
+void udp(const BenchArgs &args);
+
+// Connection storm: many clients connecting at once over loopback, against a single pending accept and then the configured Acceptor
+void accept(const BenchArgs &args);
+
+// Runs a shell on a pseudo console behind a loopback connection, the way the server does, and checks
+// that a command's output and a resize request make it through
+void pty(const BenchArgs &args);
+
+// Spawn rate of short-lived processes, through Process::create against Process::spawn
+void spawn(const BenchArgs &args);
+
+// Throughput of a loopback stream read plainly against read through a session recorder, and a check of the recording
+void record(const BenchArgs &args);
+
+// Cost of counting into the per-thread metric slots, against a shared atomic, from one thread and from many
+void metrics(const BenchArgs &args);
+
+// Cost of the coroutine tracing hooks, disabled and enabled, and of dumping the trace
+void trace(const BenchArgs &args);
+
+// Cost of a log call with a few fields, from one thread and from many, against a file sink, and a check that
+// every message is either written or counted as dropped. Also checks the per-category rate limit.
+void logging(const BenchArgs &args);
+
+// Contended locks, wakes and signals through the user-space primitives and their coroutine versions,
+// against the kernel objects they replace, and a check that no lock let two holders in at once
+void sync(const BenchArgs &args);
+
+// Cross-thread posts to a loop's task queue: round trips between two loops against a kernel event each, and
+// throughput from many producers at once, with a check that every callback ran exactly once
+void post(const BenchArgs &args);
+
+// Reads a simulated paste from the console input queue through ConsoleAsyncIO, and checks that it comes
+// through intact. Then writes many short lines to the console directly, and through a ConsoleWriter.
+// Needs a console.
+void console(const BenchArgs &args);
+
+// The transfer path end to end: bulk throughput, 1-byte round trips and memory per session, with 1, 100 and
+// 10k echo sessions open over loopback. Results are written as JSON, and compared against a baseline if given,
+// which fails the benchmark on regressions.
+void loopback(const BenchArgs &args);
+
+}  // namespace abel::bench
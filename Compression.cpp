@@ -0,0 +1,322 @@
+#include "Compression.hpp"
+
+#include "Error.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace abel {
+
+#pragma region LZ
+// The block format is LZ4's: sequences of (token, literals, offset, match length), where
+// the last sequence only has literals. Offsets may reach back before the block's start.
+static constexpr size_t history_size = 64 * 1024;
+static constexpr size_t window_capacity = history_size + FrameCompressor::max_chunk;
+
+static constexpr size_t min_match = 4;
+static constexpr size_t last_literals = 5;
+static constexpr size_t match_safety = 12;
+static constexpr size_t max_distance = 65535;
+static constexpr unsigned hash_log = 12;
+
+static constexpr size_t compress_bound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+static uint32_t read_u32(const unsigned char *data) {
+    uint32_t result = 0;
+    memcpy(&result, data, sizeof(result));
+    return result;
+}
+
+static uint32_t lz_hash(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - hash_log);
+}
+
+static unsigned char *write_length(unsigned char *out, size_t length) {
+    for (; length >= 255; length -= 255) {
+        *out++ = 255;
+    }
+    *out++ = (unsigned char)length;
+    return out;
+}
+
+// Compresses window[start, end), using window[0, start) as the dictionary.
+// `base` is the stream offset of window[0], which is what the hash table stores.
+static size_t lz_compress(const unsigned char *window, size_t start, size_t end, uint64_t base, uint64_t *table, unsigned char *out_start) {
+    unsigned char *out = out_start;
+    size_t anchor = start;
+    size_t ip = start;
+
+    if (end - start > match_safety) {
+        const size_t match_limit = end - match_safety;
+        const size_t extend_limit = end - last_literals;
+        unsigned misses = 0;
+
+        while (ip < match_limit) {
+            uint32_t sequence = read_u32(window + ip);
+            uint32_t hash = lz_hash(sequence);
+            uint64_t candidate = table[hash];
+            uint64_t position = base + ip;
+            table[hash] = position;
+
+            if (candidate < base || candidate >= position || position - candidate > max_distance ||
+                read_u32(window + (candidate - base)) != sequence) {
+                // Incompressible regions are skipped over faster and faster
+                ip += 1 + (misses++ >> 6);
+                continue;
+            }
+            misses = 0;
+
+            size_t ref = (size_t)(candidate - base);
+            while (ip > anchor && ref > 0 && window[ip - 1] == window[ref - 1]) {
+                --ip;
+                --ref;
+            }
+
+            size_t length = min_match;
+            while (ip + length < extend_limit && window[ip + length] == window[ref + length]) {
+                ++length;
+            }
+
+            size_t literals = ip - anchor;
+            unsigned char *token = out++;
+            *token = (unsigned char)((std::min<size_t>(literals, 15) << 4) | std::min<size_t>(length - min_match, 15));
+            if (literals >= 15) {
+                out = write_length(out, literals - 15);
+            }
+            memcpy(out, window + anchor, literals);
+            out += literals;
+
+            size_t offset = ip - ref;
+            *out++ = (unsigned char)(offset & 0xff);
+            *out++ = (unsigned char)(offset >> 8);
+
+            if (length - min_match >= 15) {
+                out = write_length(out, length - min_match - 15);
+            }
+
+            ip += length;
+            anchor = ip;
+
+            table[lz_hash(read_u32(window + ip - 2))] = base + ip - 2;
+        }
+    }
+
+    size_t literals = end - anchor;
+    *out++ = (unsigned char)(std::min<size_t>(literals, 15) << 4);
+    if (literals >= 15) {
+        out = write_length(out, literals - 15);
+    }
+    memcpy(out, window + anchor, literals);
+    out += literals;
+
+    return out - out_start;
+}
+
+// Decompresses `in` into window[start, start + raw_size). Validates everything, since the input is untrusted.
+static bool lz_decompress(std::span<const unsigned char> in, unsigned char *window, size_t start, size_t raw_size) {
+    size_t ip = 0;
+    size_t op = start;
+    const size_t out_end = start + raw_size;
+
+    auto read_length = [&](size_t &length) {
+        unsigned char byte = 255;
+        while (byte == 255) {
+            if (ip >= in.size()) {
+                return false;
+            }
+            byte = in[ip++];
+            length += byte;
+        }
+        return true;
+    };
+
+    while (true) {
+        if (ip >= in.size()) {
+            return false;
+        }
+        unsigned char token = in[ip++];
+
+        size_t literals = token >> 4;
+        if (literals == 15 && !read_length(literals)) {
+            return false;
+        }
+        if (literals > in.size() - ip || literals > out_end - op) {
+            return false;
+        }
+        memcpy(window + op, in.data() + ip, literals);
+        ip += literals;
+        op += literals;
+
+        if (ip == in.size()) {
+            return op == out_end;
+        }
+
+        if (in.size() - ip < 2) {
+            return false;
+        }
+        size_t offset = in[ip] | ((size_t)in[ip + 1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > op) {
+            return false;
+        }
+
+        size_t length = token & 15;
+        if (length == 15 && !read_length(length)) {
+            return false;
+        }
+        length += min_match;
+        if (length > out_end - op) {
+            return false;
+        }
+
+        const unsigned char *ref = window + op - offset;
+        if (offset >= length) {
+            memcpy(window + op, ref, length);
+        } else {
+            // Overlapping matches repeat the last `offset` bytes
+            for (size_t i = 0; i < length; ++i) {
+                window[op + i] = ref[i];
+            }
+        }
+        op += length;
+    }
+}
+
+// Makes room for `size` more bytes, keeping at least the last history_size bytes.
+// Returns how many bytes were dropped from the front.
+static size_t slide_window(std::vector<unsigned char> &window, size_t &window_size, size_t size) {
+    if (window_size + size <= window.size()) {
+        return 0;
+    }
+
+    size_t kept = std::min(window_size, history_size);
+    size_t dropped = window_size - kept;
+    memmove(window.data(), window.data() + dropped, kept);
+    window_size = kept;
+
+    return dropped;
+}
+#pragma endregion LZ
+
+#pragma region Compressor
+// Compression is turned off once frames stop saving at least this fraction on average
+static constexpr double disable_ratio = 0.9;
+static constexpr uint64_t min_backoff = 64 * 1024;
+static constexpr uint64_t max_backoff = 16 * 1024 * 1024;
+
+FrameCompressor::FrameCompressor() :
+    window(window_capacity),
+    table{std::make_unique<uint64_t[]>(hash_size)},
+    frame(sizeof(CompressedFrameHeader) + compress_bound(max_chunk)),
+    backoff{min_backoff},
+    ratio{0.5} {
+
+    std::fill_n(table.get(), hash_size, (uint64_t)-1);
+}
+
+std::span<const unsigned char> FrameCompressor::append_to_window(std::span<const unsigned char> chunk) {
+    window_base += slide_window(window, window_size, chunk.size());
+
+    auto result = std::span{window}.subspan(window_size, chunk.size());
+    std::copy(chunk.begin(), chunk.end(), result.begin());
+    window_size += chunk.size();
+
+    return result;
+}
+
+void FrameCompressor::record_ratio(size_t raw_size, size_t stored_size) {
+    bool was_probing = ratio >= disable_ratio;
+    ratio = 0.75 * ratio + 0.25 * ((double)stored_size / raw_size);
+
+    if (ratio < disable_ratio) {
+        if (was_probing) {
+            // The probe went well, so the next backoff starts small again
+            backoff = min_backoff;
+        }
+        return;
+    }
+
+    // Looks incompressible. Check again after a while, waiting longer each time it still is.
+    resume_at = stats_.raw_bytes + backoff;
+    backoff = std::min(backoff * 2, max_backoff);
+    ++stats_.times_disabled;
+}
+
+std::span<const unsigned char> FrameCompressor::encode(std::span<const unsigned char> chunk) {
+    assert(chunk.size() <= max_chunk);
+
+    CompressedFrameHeader header{
+        .stored_size = (uint16_t)chunk.size(),
+        .raw_size = (uint16_t)chunk.size(),
+    };
+    std::span<const unsigned char> payload = chunk;
+
+    bool attempt = chunk.size() >= min_compressed_chunk && enabled();
+    if (attempt) {
+        append_to_window(chunk);
+        size_t start = window_size - chunk.size();
+        size_t stored_size = lz_compress(window.data(), start, window_size, window_base, table.get(), frame.data() + sizeof(header));
+
+        if (stored_size < chunk.size()) {
+            header.stored_size = (uint16_t)stored_size;
+            payload = std::span{frame}.subspan(sizeof(header), stored_size);
+            ++stats_.frames_compressed;
+        } else {
+            ++stats_.frames_stored;
+        }
+
+        stats_.raw_bytes += chunk.size();
+        record_ratio(chunk.size(), header.stored_size);
+    } else {
+        // The decompressor keeps the history either way
+        append_to_window(chunk);
+        stats_.raw_bytes += chunk.size();
+        ++stats_.frames_bypassed;
+    }
+
+    memcpy(frame.data(), &header, sizeof(header));
+    if (payload.data() != frame.data() + sizeof(header)) {
+        memcpy(frame.data() + sizeof(header), payload.data(), payload.size());
+    }
+
+    size_t frame_size = sizeof(header) + payload.size();
+    stats_.wire_bytes += frame_size;
+
+    return std::span{frame}.first(frame_size);
+}
+#pragma endregion Compressor
+
+#pragma region Decompressor
+FrameDecompressor::FrameDecompressor() :
+    window(window_capacity),
+    payload(FrameCompressor::max_chunk) {
+}
+
+std::span<unsigned char> FrameDecompressor::payload_buffer(const CompressedFrameHeader &header) {
+    if (header.raw_size > FrameCompressor::max_chunk || header.stored_size > header.raw_size) {
+        fail("Invalid compressed frame header");
+    }
+
+    return std::span{payload}.first(header.stored_size);
+}
+
+std::span<const unsigned char> FrameDecompressor::decode(const CompressedFrameHeader &header) {
+    slide_window(window, window_size, header.raw_size);
+
+    auto result = std::span{window}.subspan(window_size, header.raw_size);
+
+    if (header.stored_size == header.raw_size) {
+        std::copy_n(payload.begin(), header.raw_size, result.begin());
+    } else if (!lz_decompress(std::span{payload}.first(header.stored_size), window.data(), window_size, header.raw_size)) {
+        fail("Corrupted compressed frame");
+    }
+
+    window_size += header.raw_size;
+
+    return result;
+}
+#pragma endregion Decompressor
+
+}  // namespace abel
@@ -0,0 +1,178 @@
+#pragma once
+
+#include "IOBase.hpp"
+#include "Error.hpp"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <memory>
+
+namespace abel {
+
+template <typename T>
+class AIO;
+
+struct CompressionStats {
+    uint64_t raw_bytes{0};
+    uint64_t wire_bytes{0};
+    // Frames that got smaller
+    uint64_t frames_compressed{0};
+    // Frames that were compressed, but didn't get smaller
+    uint64_t frames_stored{0};
+    // Frames sent as-is without trying, either because they are tiny or because compression was off
+    uint64_t frames_bypassed{0};
+    // How many times compression was switched off for incompressible data
+    uint64_t times_disabled{0};
+};
+
+// Precedes each frame on the wire. The frame is compressed iff stored_size < raw_size.
+struct CompressedFrameHeader {
+    uint16_t stored_size;
+    uint16_t raw_size;
+};
+
+static_assert(sizeof(CompressedFrameHeader) == 4);
+
+// The compressed stream consists of LZ4-format blocks, one per frame, each of which may refer back
+// into the previous 64 KiB of the stream. Both sides keep that history, including stored frames.
+class FrameCompressor {
+public:
+    static constexpr size_t max_chunk = 16 * 1024;
+    // Keystrokes and other small frames are never compressed
+    static constexpr size_t min_compressed_chunk = 64;
+
+protected:
+    static constexpr size_t hash_size = 1 << 12;
+
+    std::vector<unsigned char> window;
+    size_t window_size{0};
+    uint64_t window_base{0};
+    std::unique_ptr<uint64_t[]> table;
+    std::vector<unsigned char> frame;
+    CompressionStats stats_{};
+
+    // Compression is skipped until raw_bytes reaches this
+    uint64_t resume_at{0};
+    uint64_t backoff;
+    double ratio;
+
+    std::span<const unsigned char> append_to_window(std::span<const unsigned char> chunk);
+
+    void record_ratio(size_t raw_size, size_t stored_size);
+
+public:
+    FrameCompressor();
+
+    FrameCompressor(const FrameCompressor &) = delete;
+    FrameCompressor &operator=(const FrameCompressor &) = delete;
+    FrameCompressor(FrameCompressor &&) noexcept = default;
+    FrameCompressor &operator=(FrameCompressor &&) noexcept = default;
+
+    // Turns a chunk of at most max_chunk bytes into a frame, header included.
+    // The result stays valid until the next call.
+    std::span<const unsigned char> encode(std::span<const unsigned char> chunk);
+
+    bool enabled() const noexcept {
+        return stats_.raw_bytes >= resume_at;
+    }
+
+    const CompressionStats &stats() const noexcept {
+        return stats_;
+    }
+};
+
+class FrameDecompressor {
+protected:
+    std::vector<unsigned char> window;
+    size_t window_size{0};
+    std::vector<unsigned char> payload;
+
+public:
+    FrameDecompressor();
+
+    FrameDecompressor(const FrameDecompressor &) = delete;
+    FrameDecompressor &operator=(const FrameDecompressor &) = delete;
+    FrameDecompressor(FrameDecompressor &&) noexcept = default;
+    FrameDecompressor &operator=(FrameDecompressor &&) noexcept = default;
+
+    // Where the frame's payload should be read into
+    std::span<unsigned char> payload_buffer(const CompressedFrameHeader &header);
+
+    // Decodes the frame whose payload was read into payload_buffer().
+    // The result stays valid until the next call.
+    std::span<const unsigned char> decode(const CompressedFrameHeader &header);
+};
+
+// Compresses everything written through it into frames for the underlying stream
+template <async_writable D>
+class CompressWriter : public IOBase {
+protected:
+    D inner;
+    std::unique_ptr<FrameCompressor> compressor = std::make_unique<FrameCompressor>();
+
+public:
+    explicit CompressWriter(D inner) :
+        inner(std::move(inner)) {
+    }
+
+    const CompressionStats &stats() const noexcept {
+        return compressor->stats();
+    }
+
+    AIO<eof<size_t>> write_async_from(std::span<const unsigned char> data) {
+        size_t written = 0;
+
+        while (written < data.size()) {
+            auto chunk = data.subspan(written, std::min(data.size() - written, FrameCompressor::max_chunk));
+            auto frame = compressor->encode(chunk);
+
+            if ((co_await inner.write_async_full_from(frame)).is_eof) {
+                co_return eof(written, true);
+            }
+
+            written += chunk.size();
+        }
+
+        co_return eof(written, false);
+    }
+};
+
+// Undoes CompressWriter
+template <async_readable S>
+class DecompressReader : public IOBase {
+protected:
+    S inner;
+    std::unique_ptr<FrameDecompressor> decompressor = std::make_unique<FrameDecompressor>();
+    std::span<const unsigned char> pending{};
+
+public:
+    explicit DecompressReader(S inner) :
+        inner(std::move(inner)) {
+    }
+
+    AIO<eof<size_t>> read_async_into(std::span<unsigned char> data) {
+        while (pending.empty()) {
+            CompressedFrameHeader header{};
+            auto header_bytes = std::span{(unsigned char *)&header, sizeof(header)};
+
+            // A clean end of stream may only happen between frames
+            auto first = co_await inner.read_async_into(header_bytes);
+            if (first.is_eof && first.value == 0) {
+                co_return eof((size_t)0, true);
+            }
+            co_await inner.read_async_full_into(header_bytes.subspan(first.value));
+
+            co_await inner.read_async_full_into(decompressor->payload_buffer(header));
+            pending = decompressor->decode(header);
+        }
+
+        size_t size = std::min(data.size(), pending.size());
+        std::copy_n(pending.begin(), size, data.begin());
+        pending = pending.subspan(size);
+
+        co_return eof(size, false);
+    }
+};
+
+}  // namespace abel
@@ -1,62 +1,269 @@
 #include "Concurrency.hpp"
 
+#include <cstdio>
+
 namespace abel {
 
 void AIOEnv::update_current(std::coroutine_handle<> prev, std::coroutine_handle<> coro) noexcept {
     if (current_ != prev) {
-        fail("Nonlinear use of AIOEnv detected");
+        ABEL_TRACE(trace::Kind::nonlinear, prev.address(), current_.address());
+        // The process is about to go down, and the trace is what shows how it got here
+        trace::dump();
+
+        char message[128] = {};
+        snprintf(message, sizeof(message), "Nonlinear use of AIOEnv detected: expected %p to be current, but it was %p", prev.address(), current_.address());
+        fail(message);
     }
     current_ = coro;
 }
 
-void AIOEnv::step() {
+void AIOEnv::step(bool signaled) {
     if (!current_ || current_.done()) {
         return;
     }
-    if (non_io_event_ && non_io_event_.is_signaled()) {
+    if (parked_) {
+        if (!woken_) {
+            return;
+        }
+        parked_ = woken_ = false;
+    } else if (non_io_event_ && (signaled || non_io_event_.is_signaled())) {
         // We cannot reset non_io_event_, since it might not be an event at all
         non_io_event_ = nullptr;
-    } else if (io_done_.is_signaled()) {
+    } else if (signaled || io_done_.is_signaled()) {
         io_done_.reset();
     } else {
         return;
     }
+
+    [[maybe_unused]] void *resumed = current_.address();
+    ABEL_TRACE(trace::Kind::resumed, resumed);
     current_.resume();
+    ABEL_TRACE(trace::Kind::suspended, resumed, current_.address());
+}
+
+TaskQueue::TaskQueue() :
+    head{&stub},
+    tail{&stub} {
+}
+
+TaskQueue::~TaskQueue() {
+    while (Node *node = pop()) {
+        delete node;
+    }
+}
+
+void TaskQueue::push(Node *node) noexcept {
+    node->next.store(nullptr, std::memory_order_relaxed);
+    Node *prev = head.exchange(node, std::memory_order_acq_rel);
+    // Until this store the consumer can't get past `prev`, see pop
+    prev->next.store(node, std::memory_order_seq_cst);
+}
+
+TaskQueue::Node *TaskQueue::pop() noexcept {
+    Node *first = tail;
+    Node *next = first->next.load(std::memory_order_acquire);
+
+    if (first == &stub) {
+        if (!next) {
+            return nullptr;
+        }
+        tail = next;
+        first = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        tail = next;
+        return first;
+    }
+
+    if (first != head.load(std::memory_order_acquire)) {
+        // A producer has swapped itself in, but not linked itself yet
+        return nullptr;
+    }
+
+    // `first` is the last one; the stub goes behind it, so that taking it doesn't leave the list empty
+    push(&stub);
+    next = first->next.load(std::memory_order_acquire);
+    if (next) {
+        tail = next;
+        return first;
+    }
+    return nullptr;
+}
+
+void TaskQueue::post(std::function<void()> task) {
+    auto node = std::make_unique<Node>();
+    node->task = std::move(task);
+    push(node.release());
+
+    // Sequentially consistent with prepare_wait, so that either the loop sees the task, or this sees the loop asleep
+    if (sleeping.load(std::memory_order_seq_cst) && sleeping.exchange(false, std::memory_order_seq_cst)) {
+        ring();
+    }
+}
+
+bool TaskQueue::prepare_wait() noexcept {
+    sleeping.store(true, std::memory_order_seq_cst);
+
+    Node *first = tail;
+    bool empty = first == &stub ? !first->next.load(std::memory_order_seq_cst) : false;
+    if (!empty) {
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+    return empty;
+}
+
+size_t TaskQueue::run(size_t limit) {
+    size_t ran = 0;
+    while (ran < limit) {
+        std::unique_ptr<Node> node{pop()};
+        if (!node) {
+            break;
+        }
+
+        ++ran;
+        node->task();
+    }
+    return ran;
 }
 
 ParallelAIOs::ParallelAIOs(std::vector<AIO<void>> tasks_) :
     tasks{std::move(tasks_)},
     envs{std::make_unique<AIOEnv[]>(size())},
-    events{std::make_unique<Handle[]>(size() + 1)} {
+    events{std::make_unique<Handle[]>(size() + 2)} {
 
     for (size_t i = 0; i < size(); ++i) {
         envs[i].attach(tasks[i]);
     }
 }
 
+ParallelAIOs::~ParallelAIOs() {
+    if (!waits) {
+        return;
+    }
+
+    for (size_t i = 0; i < size(); ++i) {
+        if (waits[i].wait) {
+            UnregisterWaitEx(waits[i].wait, INVALID_HANDLE_VALUE);
+        }
+    }
+}
+
+bool ParallelAIOs::runnable() const noexcept {
+    for (size_t i = 0; i < size(); ++i) {
+        if (envs[i].runnable()) {
+            return true;
+        }
+    }
+    return false;
+}
+
 void ParallelAIOs::wait_any(DWORD miliseconds) {
+    // Nothing to wait for while there's something to run already
+    if (runnable() || !queue_->prepare_wait()) {
+        return;
+    }
+
+    if (many()) {
+        wait_registered(miliseconds);
+        queue_->finish_wait();
+        return;
+    }
+
+    size_t count = 0;
+    if (until_) {
+        events[count++] = until_;
+    }
+    events[count++] = queue_->doorbell();
+
+    // Parked tasks are woken through the doorbell, and finished ones never are
     for (size_t i = 0; i < size(); ++i) {
-        events[i + 1] = envs[i].event_done();
+        if (envs[i].current() && !envs[i].parked()) {
+            events[count++] = envs[i].event_done();
+        }
     }
 
-    std::span<Handle> targets{events.get(), size() + 1};
-    if (!targets[0]) {
-        // No cancellation event
-        targets = targets.subspan(1);
+    Handle::wait_multiple(std::span{events.get(), count}, false, miliseconds);
+    queue_->finish_wait();
+}
+
+// WaitForMultipleObjects takes at most 64 handles, so past that, every task's event gets a one-shot thread pool
+// wait which rings a doorbell, and the loop waits for the doorbell instead. A task can only move on to another
+// event by being stepped, which only happens once its wait has fired, so only those tasks need new waits.
+void ParallelAIOs::wait_registered(DWORD miliseconds) {
+    if (!waits) {
+        waits = std::make_unique<RegisteredWait[]>(size());
     }
 
-    Handle::wait_multiple(targets, false, miliseconds);
+    for (size_t i = 0; i < size(); ++i) {
+        auto &wait = waits[i];
+        if (wait.wait || !envs[i].current() || envs[i].parked()) {
+            continue;
+        }
+
+        wait.fired = false;
+        wait.doorbell = queue_->doorbell().raw();
+
+        bool success = RegisterWaitForSingleObject(
+            &wait.wait,
+            envs[i].event_done().raw(),
+            &wait_fired,
+            &wait,
+            INFINITE,
+            WT_EXECUTEONLYONCE | WT_EXECUTEINWAITTHREAD
+        );
+        if (!success) {
+            fail("Failed to register a wait");
+        }
+    }
+
+    Handle targets[2] = {queue_->doorbell(), until_};
+    Handle::wait_multiple(std::span{targets, until_ ? 2u : 1u}, false, miliseconds);
+}
+
+void CALLBACK ParallelAIOs::wait_fired(void *context, BOOLEAN timed_out) {
+    (void)timed_out;
+
+    auto &wait = *(RegisteredWait *)context;
+    wait.fired = true;
+    SetEvent(wait.doorbell);
 }
 
 void ParallelAIOs::step() {
+    // First, since the callbacks may wake tasks
+    queue_->run(posted_per_step);
+
+    if (!waits) {
+        for (size_t i = 0; i < size(); ++i) {
+            envs[i].step();
+        }
+        return;
+    }
+
+    // Only the tasks whose waits fired. Their events may have been auto-reset by the wait, so they're taken as signaled.
     for (size_t i = 0; i < size(); ++i) {
-        envs[i].step();
+        if (envs[i].runnable()) {
+            envs[i].step();
+            continue;
+        }
+
+        auto &wait = waits[i];
+        if (!wait.wait || !wait.fired.load(std::memory_order_acquire)) {
+            continue;
+        }
+
+        // The callback may still be about to ring the doorbell; being past `fired`, it won't take long
+        UnregisterWaitEx(wait.wait, INVALID_HANDLE_VALUE);
+        wait.wait = nullptr;
+
+        envs[i].step(true);
     }
 }
 
 bool ParallelAIOs::done() const {
     // Short-circuit cancellation
-    if (events[0] && events[0].is_signaled()) {
+    if (until_ && until_.is_signaled()) {
         return true;
     }
 
@@ -75,4 +282,12 @@ void ParallelAIOs::run() {
     }
 }
 
+void ParallelAIOs::rethrow() {
+    for (auto &task : tasks) {
+        if (task.await_ready()) {
+            task.await_resume();
+        }
+    }
+}
+
 }  // namespace abel
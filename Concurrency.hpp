@@ -2,6 +2,7 @@
 
 #include "Handle.hpp"
 #include "Error.hpp"
+#include "Trace.hpp"
 
 #include <Windows.h>
 #include <utility>
@@ -12,6 +13,8 @@
 #include <concepts>
 #include <cassert>
 #include <memory>
+#include <atomic>
+#include <functional>
 
 namespace abel {
 
@@ -71,6 +74,8 @@ struct current_env {
 };
 
 struct io_done_signaled {
+    // What's being waited for, for tracing
+    const char *what = "io";
 };
 
 // Note: do not use auto-reset events! Non-event awaitables are fine.
@@ -84,6 +89,9 @@ protected:
     OVERLAPPED overlapped_{.hEvent = io_done_.raw()};
     Handle non_io_event_ = nullptr;
     std::coroutine_handle<> current_{nullptr};
+    // Suspended on a Wakeup, which isn't a kernel object, so the loop doesn't wait for it, just steps it once woken
+    bool parked_{false};
+    bool woken_{false};
 
 public:
     AIOEnv() = default;
@@ -111,17 +119,156 @@ public:
         return &overlapped_;
     }
 
+    // Also what wakes the env for awaitables that aren't IO, but are signaled by whoever completes them
+    Handle io_done() const noexcept {
+        return io_done_;
+    }
+
     void set_non_io_event(Handle event) noexcept {
         non_io_event_ = event;
     }
 
+    void park() noexcept {
+        parked_ = true;
+        woken_ = false;
+    }
+
+    bool parked() const noexcept {
+        return parked_;
+    }
+
+    // Only from the thread running the env
+    void wake() noexcept {
+        woken_ = parked_;
+    }
+
+    // Parked, but woken, so that stepping it will resume it
+    bool runnable() const noexcept {
+        return parked_ && woken_;
+    }
+
     std::coroutine_handle<> current() const noexcept {
         return current_;
     }
 
     void update_current(std::coroutine_handle<> prev, std::coroutine_handle<> coro) noexcept;
 
-    void step();
+    // If `signaled` is set, the current event is known to have been signaled, even if it no longer is,
+    // as happens with auto-reset events after another thread has waited on them
+    void step(bool signaled = false);
+};
+
+// Resumes a coroutine of the same loop without any kernel object: the coroutine awaits it, and another task of
+// the loop, or a callback posted to the loop's TaskQueue from any thread, calls wake(). A wake that comes before
+// the await is kept until then. Only for use from the loop's own thread, and by a single waiter at a time.
+class Wakeup {
+protected:
+    AIOEnv *waiter{nullptr};
+    bool pending{false};
+
+public:
+    Wakeup() = default;
+
+    Wakeup(const Wakeup &) = delete;
+    Wakeup &operator=(const Wakeup &) = delete;
+
+    void wake() noexcept {
+        if (waiter) {
+            std::exchange(waiter, nullptr)->wake();
+        } else {
+            pending = true;
+        }
+    }
+
+    auto operator co_await() noexcept {
+        struct Awaiter {
+            Wakeup *wakeup;
+            void *coro_address{nullptr};
+
+            bool await_ready() noexcept {
+                return std::exchange(wakeup->pending, false);
+            }
+
+            template <typename Promise>
+            void await_suspend(std::coroutine_handle<Promise> coro) {
+                AIOEnv *env = coro.promise().env;
+                // Just to verify we are the current coroutine
+                env->update_current(coro, coro);
+                env->park();
+                wakeup->waiter = env;
+                coro_address = coro.address();
+                ABEL_TRACE(trace::Kind::event_wait, coro_address, wakeup);
+            }
+
+            void await_resume() noexcept {
+                if (coro_address) {
+                    ABEL_TRACE(trace::Kind::event_done, coro_address, wakeup);
+                }
+            }
+        };
+
+        return Awaiter{this};
+    }
+};
+
+// A lock-free multi-producer single-consumer queue of callbacks for one ParallelAIOs loop, which runs them
+// between steps, on its own thread. Posting takes a single atomic exchange, plus setting the doorbell event
+// if the loop is waiting, or about to. This is the way for other threads to hand work to a loop, or to wake
+// one of its coroutines (through a Wakeup), without the loop having to wait on a kernel object of their own.
+class TaskQueue {
+protected:
+    struct Node {
+        std::atomic<Node *> next{nullptr};
+        std::function<void()> task{};
+    };
+
+    // Vyukov's intrusive queue: producers swap themselves into `head`, the consumer takes from `tail`,
+    // and the stub node keeps the list from ever running empty
+    std::atomic<Node *> head;
+    Node *tail;
+    Node stub{};
+
+    // Set by the loop before it waits, so that only then do posters make the syscall
+    std::atomic<bool> sleeping{false};
+    OwningHandle doorbell_ = Handle::create_event(false, false);
+
+    void push(Node *node) noexcept;
+
+    // nullptr if empty, or if a producer is halfway through pushing, in which case it's about to ring the doorbell
+    Node *pop() noexcept;
+
+public:
+    TaskQueue();
+
+    TaskQueue(const TaskQueue &) = delete;
+    TaskQueue &operator=(const TaskQueue &) = delete;
+
+    // Drops the callbacks that haven't run
+    ~TaskQueue();
+
+    // From any thread
+    void post(std::function<void()> task);
+
+    // Rings the doorbell regardless, for other things the loop waits on through it
+    void ring() noexcept {
+        SetEvent(doorbell_.raw());
+    }
+
+    Handle doorbell() const noexcept {
+        return doorbell_;
+    }
+
+    // Called by the loop right before it waits. Returns false if there's something to run already,
+    // in which case the loop shouldn't wait.
+    bool prepare_wait() noexcept;
+
+    void finish_wait() noexcept {
+        sleeping.store(false, std::memory_order_relaxed);
+    }
+
+    // Runs up to `limit` callbacks, so that a flood of posts doesn't starve the loop's tasks. Returns how many ran.
+    // An exception from a callback propagates to the loop's caller, which the posters don't hear about.
+    size_t run(size_t limit);
 };
 
 // AIO is a coroutine object for simple asynchronous IO on WinAPI handles.
@@ -133,8 +280,14 @@ public:
         AIOEnv *env;
         std::coroutine_handle<> parent = nullptr;
 
+        ~promise_type() {
+            ABEL_TRACE(trace::Kind::destroyed, coroutine_ptr::from_promise(*this).address());
+        }
+
         AIO get_return_object() {
-            return AIO{coroutine_ptr::from_promise(*this)};
+            auto coro = coroutine_ptr::from_promise(*this);
+            ABEL_TRACE(trace::Kind::created, coro.address());
+            return AIO{coro};
         }
 
         std::suspend_always initial_suspend() noexcept {
@@ -200,9 +353,11 @@ public:
             return Awaiter{env};
         }
 
-        auto await_transform(io_done_signaled) {
+        auto await_transform(io_done_signaled io) {
             struct Awaiter {
                 AIOEnv *env;
+                const char *what;
+                void *coro_address{nullptr};
 
                 bool await_ready() noexcept {
                     return false;
@@ -211,19 +366,23 @@ public:
                 void await_suspend(coroutine_ptr coro) {
                     // Just to verify we are the current coroutine
                     env->update_current(coro, coro);
+                    coro_address = coro.address();
+                    ABEL_TRACE(trace::Kind::io_wait, coro_address, env->overlapped(), what);
                 }
 
                 void await_resume() {
+                    ABEL_TRACE(trace::Kind::io_done, coro_address, env->overlapped(), what);
                 }
             };
 
-            return Awaiter{env};
+            return Awaiter{env, io.what};
         }
 
         auto await_transform(event_signaled event) {
             struct Awaiter {
                 AIOEnv *env;
                 Handle event;
+                void *coro_address{nullptr};
 
                 bool await_ready() noexcept {
                     return false;
@@ -233,9 +392,12 @@ public:
                     // Just to verify we are the current coroutine
                     env->update_current(coro, coro);
                     env->set_non_io_event(event);
+                    coro_address = coro.address();
+                    ABEL_TRACE(trace::Kind::event_wait, coro_address, event.raw());
                 }
 
                 void await_resume() {
+                    ABEL_TRACE(trace::Kind::event_done, coro_address, event.raw());
                 }
             };
 
@@ -318,9 +480,37 @@ public:
 
 class ParallelAIOs {
 protected:
+    // A one-shot thread pool wait on a task's current event, for when there are too many tasks for WaitForMultipleObjects
+    struct RegisteredWait {
+        HANDLE wait{nullptr};
+        // Set by the thread pool once the event is signaled
+        std::atomic<bool> fired{false};
+        HANDLE doorbell{nullptr};
+    };
+
+    // How many posted callbacks run per step at most
+    static constexpr size_t posted_per_step = 256;
+
     std::vector<AIO<void>> tasks;
     std::unique_ptr<AIOEnv[]> envs;
+    // What wait_any waits on: the cancellation event, the doorbell and the tasks' events
     std::unique_ptr<Handle[]> events;
+    Handle until_{};
+    // Boxed, so that its address stays put for the posters while this moves
+    std::unique_ptr<TaskQueue> queue_ = std::make_unique<TaskQueue>();
+    // Only used past MAXIMUM_WAIT_OBJECTS, see wait_registered
+    std::unique_ptr<RegisteredWait[]> waits{};
+
+    bool many() const noexcept {
+        return size() + 2 > MAXIMUM_WAIT_OBJECTS;
+    }
+
+    // Any task woken by a Wakeup, which means there's no waiting until it's stepped
+    bool runnable() const noexcept;
+
+    void wait_registered(DWORD miliseconds);
+
+    static void CALLBACK wait_fired(void *context, BOOLEAN timed_out);
 
 public:
     template <std::same_as<AIO<void>> ... T>
@@ -330,16 +520,29 @@ public:
 
     ParallelAIOs(std::vector<AIO<void>> tasks);
 
+    ParallelAIOs(const ParallelAIOs &) = delete;
+    ParallelAIOs &operator=(const ParallelAIOs &) = delete;
+    ParallelAIOs(ParallelAIOs &&) noexcept = default;
+    ParallelAIOs &operator=(ParallelAIOs &&) noexcept = default;
+
+    // Waits for the registered waits' callbacks, if there are any, since they point into this
+    ~ParallelAIOs();
+
     size_t size() const {
         return tasks.size();
     }
 
     template <typename Self>
     decltype(auto) until(this Self &&self, Handle event) {
-        self.events[0] = event;
+        self.until_ = event;
         return std::forward<Self>(self);
     }
 
+    // For other threads to post callbacks to this loop. Stays valid while the loop exists, even if it's moved.
+    TaskQueue &queue() noexcept {
+        return *queue_;
+    }
+
     void wait_any(DWORD miliseconds = INFINITE);
 
     void step();
@@ -347,6 +550,9 @@ public:
     bool done() const;
 
     void run();
+
+    // Rethrows the first exception that escaped a finished task, if any
+    void rethrow();
 };
 
 }  // namespace abel
@@ -0,0 +1,115 @@
+#include "ConsoleWriter.hpp"
+
+#include "Concurrency.hpp"
+#include "Thread.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <exception>
+
+namespace abel {
+
+ConsoleWriter::ConsoleWriter(Handle console, size_t capacity) :
+    console{console},
+    ring{std::make_unique<unsigned char[]>(capacity)},
+    capacity{capacity} {
+
+    thread = Thread::create<ConsoleWriter, &ConsoleWriter::run>(this, ThreadOptions{.name = "console writer"}).handle;
+}
+
+ConsoleWriter::~ConsoleWriter() {
+    {
+        std::lock_guard lock{mutex};
+        stopping = true;
+    }
+    pending.signal();
+    thread.wait();
+}
+
+size_t ConsoleWriter::queue(std::span<const unsigned char> data) {
+    std::lock_guard lock{mutex};
+
+    size_t queued = std::min(data.size(), capacity - size);
+    if (queued > 0) {
+        size_t tail = (head + size) % capacity;
+        size_t first = std::min(queued, capacity - tail);
+        std::memcpy(ring.get() + tail, data.data(), first);
+        std::memcpy(ring.get(), data.data() + first, queued - first);
+
+        size += queued;
+        idle.reset();
+    }
+
+    if (size == capacity) {
+        // Under the lock, so that it can't undo the signal of a write that has just made room
+        space.reset();
+    }
+    return queued;
+}
+
+AIO<eof<size_t>> ConsoleWriter::write_async_from(std::span<const unsigned char> data) {
+    size_t total = data.size();
+
+    while (!data.empty()) {
+        if (failed) {
+            co_return eof(total - data.size(), true);
+        }
+
+        size_t queued = queue(data);
+        if (queued > 0) {
+            pending.signal();
+            data = data.subspan(queued);
+        }
+
+        if (!data.empty()) {
+            co_await space.wait_async();
+        }
+    }
+
+    co_return eof(total, false);
+}
+
+void ConsoleWriter::run() {
+    while (true) {
+        pending.wait();
+
+        while (true) {
+            std::span<const unsigned char> chunk{};
+            {
+                std::lock_guard lock{mutex};
+                if (size == 0) {
+                    idle.signal();
+                    if (stopping) {
+                        return;
+                    }
+                    break;
+                }
+
+                // Up to the end of the ring; the rest is taken on the next round
+                chunk = {ring.get() + head, std::min({size, capacity - head, max_write})};
+            }
+
+            try {
+                console.write_full_from(chunk);
+            } catch (std::exception &) {
+                // E.g. the console is gone. Whatever's queued is dropped, and the writers hear of it from now on.
+                std::lock_guard lock{mutex};
+                failed = true;
+                head = size = 0;
+                idle.signal();
+                space.signal();
+                return;
+            }
+
+            {
+                std::lock_guard lock{mutex};
+                head = (head + chunk.size()) % capacity;
+                size -= chunk.size();
+            }
+            space.signal();
+        }
+    }
+}
+
+}  // namespace abel
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Handle.hpp"
+#include "IOBase.hpp"
+#include "Sync.hpp"
+
+#include <Windows.h>
+#include <atomic>
+#include <memory>
+#include <span>
+
+namespace abel {
+
+// The client's output stage: writes are copied into a bounded ring buffer and return right away, and a thread of
+// its own writes them to the console, taking everything that has piled up in one go. A slow or paused console
+// then only holds up that thread, and the loop keeps reading keystrokes and the socket until the ring fills up,
+// after which writers wait for room.
+class ConsoleWriter {
+protected:
+    // The most written to the console at once, so that a backlog goes out in pieces that it renders promptly
+    static constexpr size_t max_write = 64 * 1024;
+
+    Handle console;
+    std::unique_ptr<unsigned char[]> ring;
+    size_t capacity;
+
+    // Guards the ring, which writers copy into under it, while the thread writes the queued part out without it,
+    // since nobody else touches that part until it's given back
+    Mutex mutex{};
+    size_t head{0};
+    size_t size{0};
+    bool stopping{false};
+    std::atomic<bool> failed{false};
+
+    // Signaled by writers, auto-reset
+    Event pending{};
+    // Signaled while the ring has room
+    AsyncEvent space{true};
+    // Signaled while nothing is queued
+    Event idle{true, true};
+    OwningHandle thread{};
+
+    void run();
+
+    // Copies as much as fits, returns how much did
+    size_t queue(std::span<const unsigned char> data);
+
+public:
+    static constexpr size_t default_capacity = 1024 * 1024;
+
+    explicit ConsoleWriter(Handle console, size_t capacity = default_capacity);
+
+    ConsoleWriter(const ConsoleWriter &) = delete;
+    ConsoleWriter &operator=(const ConsoleWriter &) = delete;
+
+    // Writes out what's still queued first, however long the console takes
+    ~ConsoleWriter();
+
+    // Returns once all of data is queued. Reaches the end if writing to the console has failed.
+    AIO<eof<size_t>> write_async_from(std::span<const unsigned char> data);
+
+    // Waits until everything queued so far has been written. Returns false on timeout.
+    bool flush(DWORD miliseconds = INFINITE) {
+        return idle.wait_timeout(miliseconds);
+    }
+};
+
+}  // namespace abel
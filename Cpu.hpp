@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define ABEL_ARCH_X64 1
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#include <immintrin.h>
+#elif defined(_M_ARM64) || defined(__aarch64__)
+#define ABEL_ARCH_ARM64 1
+#include <arm_neon.h>
+#endif
+
+// MSVC allows intrinsics for any instruction set in any function, while
+// GCC and Clang want the function to be marked explicitly
+#if defined(__GNUC__) || defined(__clang__)
+#define ABEL_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define ABEL_TARGET_AVX2
+#endif
+
+namespace abel::cpu {
+
+#if ABEL_ARCH_X64
+namespace _impl {
+
+inline void cpuid(int leaf, int subleaf, int (&regs)[4]) {
+#if defined(_MSC_VER)
+    __cpuidex(regs, leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+inline bool detect_avx2() {
+    int regs[4] = {};
+
+    cpuid(0, 0, regs);
+    if (regs[0] < 7) {
+        return false;
+    }
+
+    // The OS must also save the ymm registers on context switches
+    cpuid(1, 0, regs);
+    constexpr int osxsave = 1 << 27;
+    constexpr int avx = 1 << 28;
+    if ((regs[2] & (osxsave | avx)) != (osxsave | avx)) {
+        return false;
+    }
+
+#if defined(_MSC_VER)
+    uint64_t xcr0 = _xgetbv(0);
+#else
+    uint32_t xcr0_lo = 0, xcr0_hi = 0;
+    __asm__("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    uint64_t xcr0 = ((uint64_t)xcr0_hi << 32) | xcr0_lo;
+#endif
+    if ((xcr0 & 0b110) != 0b110) {
+        return false;
+    }
+
+    cpuid(7, 0, regs);
+    return (regs[1] & (1 << 5)) != 0;
+}
+
+}  // namespace _impl
+#endif
+
+// Tells whether AVX2 kernels may be used. The check only runs once.
+inline bool has_avx2() {
+#if ABEL_ARCH_X64
+    static const bool result = _impl::detect_avx2();
+    return result;
+#else
+    return false;
+#endif
+}
+
+// NEON is mandatory on ARM64, so no runtime check is needed
+constexpr bool has_neon() {
+#if ABEL_ARCH_ARM64
+    return true;
+#else
+    return false;
+#endif
+}
+
+}  // namespace abel::cpu
@@ -0,0 +1,741 @@
+#include "Crypto.hpp"
+
+#include "Concurrency.hpp"
+#include "Handle.hpp"
+#include "Cpu.hpp"
+#include "Error.hpp"
+
+#include <Windows.h>
+#include <bcrypt.h>
+#include <cstring>
+#include <algorithm>
+#include <cassert>
+
+namespace abel::crypto {
+
+#pragma region ChaCha20
+static constexpr uint32_t sigma[4] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+
+static uint32_t load_le32(const unsigned char *data) {
+    uint32_t result = 0;
+    memcpy(&result, data, sizeof(result));
+    return result;
+}
+
+static void store_le32(unsigned char *data, uint32_t value) {
+    memcpy(data, &value, sizeof(value));
+}
+
+static constexpr uint32_t rotl32(uint32_t value, int shift) {
+    return (value << shift) | (value >> (32 - shift));
+}
+
+static constexpr void quarter_round(uint32_t *x, int a, int b, int c, int d) {
+    x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 16);
+    x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 12);
+    x[a] += x[b]; x[d] = rotl32(x[d] ^ x[a], 8);
+    x[c] += x[d]; x[b] = rotl32(x[b] ^ x[c], 7);
+}
+
+static void double_rounds(uint32_t *x) {
+    for (int i = 0; i < 10; ++i) {
+        quarter_round(x, 0, 4, 8, 12);
+        quarter_round(x, 1, 5, 9, 13);
+        quarter_round(x, 2, 6, 10, 14);
+        quarter_round(x, 3, 7, 11, 15);
+        quarter_round(x, 0, 5, 10, 15);
+        quarter_round(x, 1, 6, 11, 12);
+        quarter_round(x, 2, 7, 8, 13);
+        quarter_round(x, 3, 4, 9, 14);
+    }
+}
+
+static void init_state(uint32_t *state, const Key &key, uint32_t counter, const Nonce &nonce) {
+    memcpy(state, sigma, sizeof(sigma));
+    for (int i = 0; i < 8; ++i) {
+        state[4 + i] = load_le32(key.data() + 4 * i);
+    }
+    state[12] = counter;
+    for (int i = 0; i < 3; ++i) {
+        state[13 + i] = load_le32(nonce.data() + 4 * i);
+    }
+}
+
+// Processes whole and partial blocks one at a time. Returns the next counter value.
+static uint32_t chacha20_blocks_scalar(uint32_t *state, const unsigned char *in, unsigned char *out, size_t size) {
+    while (size > 0) {
+        uint32_t x[16];
+        memcpy(x, state, sizeof(x));
+        double_rounds(x);
+
+        unsigned char keystream[64];
+        for (int i = 0; i < 16; ++i) {
+            store_le32(keystream + 4 * i, x[i] + state[i]);
+        }
+
+        size_t block = std::min<size_t>(size, 64);
+        for (size_t i = 0; i < block; ++i) {
+            out[i] = in[i] ^ keystream[i];
+        }
+
+        in += block;
+        out += block;
+        size -= block;
+        ++state[12];
+    }
+
+    return state[12];
+}
+
+#if ABEL_ARCH_X64
+// 8 blocks at a time, one per 32-bit lane. Word i of all the blocks lives in x[i].
+ABEL_TARGET_AVX2 static __m256i rotl_avx2(__m256i value, int shift) {
+    return _mm256_or_si256(_mm256_slli_epi32(value, shift), _mm256_srli_epi32(value, 32 - shift));
+}
+
+ABEL_TARGET_AVX2 static void quarter_round_avx2(__m256i *x, int a, int b, int c, int d, __m256i rot16, __m256i rot8) {
+    x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot16);
+    x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = rotl_avx2(_mm256_xor_si256(x[b], x[c]), 12);
+    x[a] = _mm256_add_epi32(x[a], x[b]); x[d] = _mm256_shuffle_epi8(_mm256_xor_si256(x[d], x[a]), rot8);
+    x[c] = _mm256_add_epi32(x[c], x[d]); x[b] = rotl_avx2(_mm256_xor_si256(x[b], x[c]), 7);
+}
+
+// Turns 8 vectors of one word per block into 8 vectors of 8 consecutive words of one block
+ABEL_TARGET_AVX2 static void transpose8_avx2(__m256i *rows) {
+    __m256i t[8], u[8];
+    for (int i = 0; i < 8; i += 2) {
+        t[i] = _mm256_unpacklo_epi32(rows[i], rows[i + 1]);
+        t[i + 1] = _mm256_unpackhi_epi32(rows[i], rows[i + 1]);
+    }
+    for (int i = 0; i < 8; i += 4) {
+        u[i] = _mm256_unpacklo_epi64(t[i], t[i + 2]);
+        u[i + 1] = _mm256_unpackhi_epi64(t[i], t[i + 2]);
+        u[i + 2] = _mm256_unpacklo_epi64(t[i + 1], t[i + 3]);
+        u[i + 3] = _mm256_unpackhi_epi64(t[i + 1], t[i + 3]);
+    }
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x20);
+        rows[i + 4] = _mm256_permute2x128_si256(u[i], u[i + 4], 0x31);
+    }
+}
+
+ABEL_TARGET_AVX2 static size_t chacha20_blocks_avx2(uint32_t *state, const unsigned char *in, unsigned char *out, size_t size) {
+    constexpr size_t stride = 8 * 64;
+
+    const __m256i rot16 = _mm256_setr_epi8(
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+        2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13
+    );
+    const __m256i rot8 = _mm256_setr_epi8(
+        3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+        3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14
+    );
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    size_t done = 0;
+    for (; size - done >= stride; done += stride) {
+        __m256i initial[16];
+        for (int i = 0; i < 16; ++i) {
+            initial[i] = _mm256_set1_epi32((int)state[i]);
+        }
+        initial[12] = _mm256_add_epi32(initial[12], lanes);
+
+        __m256i x[16];
+        memcpy(x, initial, sizeof(x));
+
+        for (int i = 0; i < 10; ++i) {
+            quarter_round_avx2(x, 0, 4, 8, 12, rot16, rot8);
+            quarter_round_avx2(x, 1, 5, 9, 13, rot16, rot8);
+            quarter_round_avx2(x, 2, 6, 10, 14, rot16, rot8);
+            quarter_round_avx2(x, 3, 7, 11, 15, rot16, rot8);
+            quarter_round_avx2(x, 0, 5, 10, 15, rot16, rot8);
+            quarter_round_avx2(x, 1, 6, 11, 12, rot16, rot8);
+            quarter_round_avx2(x, 2, 7, 8, 13, rot16, rot8);
+            quarter_round_avx2(x, 3, 4, 9, 14, rot16, rot8);
+        }
+
+        for (int i = 0; i < 16; ++i) {
+            x[i] = _mm256_add_epi32(x[i], initial[i]);
+        }
+
+        transpose8_avx2(x);
+        transpose8_avx2(x + 8);
+
+        // Block j is x[j] followed by x[8 + j]
+        for (int j = 0; j < 8; ++j) {
+            for (int half = 0; half < 2; ++half) {
+                size_t offset = done + 64 * j + 32 * half;
+                __m256i data = _mm256_loadu_si256((const __m256i *)(in + offset));
+                _mm256_storeu_si256((__m256i *)(out + offset), _mm256_xor_si256(data, x[8 * half + j]));
+            }
+        }
+
+        state[12] += 8;
+    }
+
+    return done;
+}
+#endif
+
+#if ABEL_ARCH_ARM64
+// 4 blocks at a time, one per 32-bit lane
+template <int shift>
+static uint32x4_t rotl_neon(uint32x4_t value) {
+    return vsriq_n_u32(vshlq_n_u32(value, shift), value, 32 - shift);
+}
+
+static void quarter_round_neon(uint32x4_t *x, int a, int b, int c, int d) {
+    x[a] = vaddq_u32(x[a], x[b]); x[d] = rotl_neon<16>(veorq_u32(x[d], x[a]));
+    x[c] = vaddq_u32(x[c], x[d]); x[b] = rotl_neon<12>(veorq_u32(x[b], x[c]));
+    x[a] = vaddq_u32(x[a], x[b]); x[d] = rotl_neon<8>(veorq_u32(x[d], x[a]));
+    x[c] = vaddq_u32(x[c], x[d]); x[b] = rotl_neon<7>(veorq_u32(x[b], x[c]));
+}
+
+// Turns 4 vectors of one word per block into 4 vectors of 4 consecutive words of one block
+static void transpose4_neon(uint32x4_t *rows) {
+    uint32x4x2_t t01 = vtrnq_u32(rows[0], rows[1]);
+    uint32x4x2_t t23 = vtrnq_u32(rows[2], rows[3]);
+    rows[0] = vcombine_u32(vget_low_u32(t01.val[0]), vget_low_u32(t23.val[0]));
+    rows[1] = vcombine_u32(vget_low_u32(t01.val[1]), vget_low_u32(t23.val[1]));
+    rows[2] = vcombine_u32(vget_high_u32(t01.val[0]), vget_high_u32(t23.val[0]));
+    rows[3] = vcombine_u32(vget_high_u32(t01.val[1]), vget_high_u32(t23.val[1]));
+}
+
+static size_t chacha20_blocks_neon(uint32_t *state, const unsigned char *in, unsigned char *out, size_t size) {
+    constexpr size_t stride = 4 * 64;
+    static constexpr uint32_t lane_offsets[4] = {0, 1, 2, 3};
+    const uint32x4_t lanes = vld1q_u32(lane_offsets);
+
+    size_t done = 0;
+    for (; size - done >= stride; done += stride) {
+        uint32x4_t initial[16];
+        for (int i = 0; i < 16; ++i) {
+            initial[i] = vdupq_n_u32(state[i]);
+        }
+        initial[12] = vaddq_u32(initial[12], lanes);
+
+        uint32x4_t x[16];
+        for (int i = 0; i < 16; ++i) {
+            x[i] = initial[i];
+        }
+
+        for (int i = 0; i < 10; ++i) {
+            quarter_round_neon(x, 0, 4, 8, 12);
+            quarter_round_neon(x, 1, 5, 9, 13);
+            quarter_round_neon(x, 2, 6, 10, 14);
+            quarter_round_neon(x, 3, 7, 11, 15);
+            quarter_round_neon(x, 0, 5, 10, 15);
+            quarter_round_neon(x, 1, 6, 11, 12);
+            quarter_round_neon(x, 2, 7, 8, 13);
+            quarter_round_neon(x, 3, 4, 9, 14);
+        }
+
+        for (int i = 0; i < 16; ++i) {
+            x[i] = vaddq_u32(x[i], initial[i]);
+        }
+
+        for (int group = 0; group < 4; ++group) {
+            transpose4_neon(x + 4 * group);
+        }
+
+        // Block j is x[j], x[4 + j], x[8 + j], x[12 + j]
+        for (int j = 0; j < 4; ++j) {
+            for (int group = 0; group < 4; ++group) {
+                size_t offset = done + 64 * j + 16 * group;
+                uint8x16_t data = vld1q_u8(in + offset);
+                uint8x16_t keystream = vreinterpretq_u8_u32(x[4 * group + j]);
+                vst1q_u8(out + offset, veorq_u8(data, keystream));
+            }
+        }
+
+        state[12] += 4;
+    }
+
+    return done;
+}
+#endif
+
+void chacha20_xor_scalar(const Key &key, uint32_t counter, const Nonce &nonce, std::span<const unsigned char> in, std::span<unsigned char> out) {
+    assert(in.size() == out.size());
+
+    uint32_t state[16];
+    init_state(state, key, counter, nonce);
+    chacha20_blocks_scalar(state, in.data(), out.data(), in.size());
+}
+
+void chacha20_xor(const Key &key, uint32_t counter, const Nonce &nonce, std::span<const unsigned char> in, std::span<unsigned char> out) {
+    assert(in.size() == out.size());
+
+    uint32_t state[16];
+    init_state(state, key, counter, nonce);
+
+    size_t done = 0;
+#if ABEL_ARCH_X64
+    if (cpu::has_avx2()) {
+        done = chacha20_blocks_avx2(state, in.data(), out.data(), in.size());
+    }
+#elif ABEL_ARCH_ARM64
+    done = chacha20_blocks_neon(state, in.data(), out.data(), in.size());
+#endif
+
+    chacha20_blocks_scalar(state, in.data() + done, out.data() + done, in.size() - done);
+}
+
+Key hchacha20(const Key &key, std::span<const unsigned char, 16> nonce) {
+    uint32_t x[16];
+    memcpy(x, sigma, sizeof(sigma));
+    for (int i = 0; i < 8; ++i) {
+        x[4 + i] = load_le32(key.data() + 4 * i);
+    }
+    for (int i = 0; i < 4; ++i) {
+        x[12 + i] = load_le32(nonce.data() + 4 * i);
+    }
+
+    double_rounds(x);
+
+    Key result{};
+    for (int i = 0; i < 4; ++i) {
+        store_le32(result.data() + 4 * i, x[i]);
+        store_le32(result.data() + 16 + 4 * i, x[12 + i]);
+    }
+    return result;
+}
+#pragma endregion ChaCha20
+
+#pragma region Poly1305
+// 26-bit limbs, so that all the products fit into 64 bits on any platform
+Poly1305::Poly1305(std::span<const unsigned char, 32> key) {
+    const unsigned char *k = key.data();
+
+    r[0] = (load_le32(k + 0)) & 0x3ffffff;
+    r[1] = (load_le32(k + 3) >> 2) & 0x3ffff03;
+    r[2] = (load_le32(k + 6) >> 4) & 0x3ffc0ff;
+    r[3] = (load_le32(k + 9) >> 6) & 0x3f03fff;
+    r[4] = (load_le32(k + 12) >> 8) & 0x00fffff;
+
+    for (int i = 0; i < 4; ++i) {
+        pad[i] = load_le32(k + 16 + 4 * i);
+    }
+}
+
+void Poly1305::blocks(const unsigned char *data, size_t size, bool final) {
+    constexpr uint32_t mask = 0x3ffffff;
+    const uint32_t hibit = final ? 0 : (1 << 24);
+
+    const uint64_t r0 = r[0], r1 = r[1], r2 = r[2], r3 = r[3], r4 = r[4];
+    const uint64_t s1 = r1 * 5, s2 = r2 * 5, s3 = r3 * 5, s4 = r4 * 5;
+    uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+
+    for (; size >= 16; data += 16, size -= 16) {
+        h0 += (load_le32(data + 0)) & mask;
+        h1 += (load_le32(data + 3) >> 2) & mask;
+        h2 += (load_le32(data + 6) >> 4) & mask;
+        h3 += (load_le32(data + 9) >> 6) & mask;
+        h4 += (load_le32(data + 12) >> 8) | hibit;
+
+        uint64_t d0 = h0 * r0 + h1 * s4 + h2 * s3 + h3 * s2 + h4 * s1;
+        uint64_t d1 = h0 * r1 + h1 * r0 + h2 * s4 + h3 * s3 + h4 * s2;
+        uint64_t d2 = h0 * r2 + h1 * r1 + h2 * r0 + h3 * s4 + h4 * s3;
+        uint64_t d3 = h0 * r3 + h1 * r2 + h2 * r1 + h3 * r0 + h4 * s4;
+        uint64_t d4 = h0 * r4 + h1 * r3 + h2 * r2 + h3 * r1 + h4 * r0;
+
+        uint64_t carry = d0 >> 26;
+        h0 = (uint32_t)d0 & mask;
+        d1 += carry;
+        carry = d1 >> 26;
+        h1 = (uint32_t)d1 & mask;
+        d2 += carry;
+        carry = d2 >> 26;
+        h2 = (uint32_t)d2 & mask;
+        d3 += carry;
+        carry = d3 >> 26;
+        h3 = (uint32_t)d3 & mask;
+        d4 += carry;
+        carry = d4 >> 26;
+        h4 = (uint32_t)d4 & mask;
+        h0 += (uint32_t)carry * 5;
+        carry = h0 >> 26;
+        h0 &= mask;
+        h1 += (uint32_t)carry;
+    }
+
+    h[0] = h0, h[1] = h1, h[2] = h2, h[3] = h3, h[4] = h4;
+}
+
+void Poly1305::update(std::span<const unsigned char> data) {
+    if (buffered > 0) {
+        size_t taken = std::min(sizeof(buffer) - buffered, data.size());
+        memcpy(buffer + buffered, data.data(), taken);
+        buffered += taken;
+        data = data.subspan(taken);
+
+        if (buffered < sizeof(buffer)) {
+            return;
+        }
+
+        blocks(buffer, sizeof(buffer));
+        buffered = 0;
+    }
+
+    size_t whole = data.size() & ~(size_t)15;
+    blocks(data.data(), whole);
+    data = data.subspan(whole);
+
+    memcpy(buffer, data.data(), data.size());
+    buffered = data.size();
+}
+
+void Poly1305::pad16() {
+    if (buffered > 0) {
+        memset(buffer + buffered, 0, sizeof(buffer) - buffered);
+        blocks(buffer, sizeof(buffer));
+        buffered = 0;
+    }
+}
+
+Tag Poly1305::finish() {
+    constexpr uint32_t mask = 0x3ffffff;
+
+    if (buffered > 0) {
+        buffer[buffered] = 1;
+        memset(buffer + buffered + 1, 0, sizeof(buffer) - buffered - 1);
+        blocks(buffer, sizeof(buffer), true);
+        buffered = 0;
+    }
+
+    uint32_t h0 = h[0], h1 = h[1], h2 = h[2], h3 = h[3], h4 = h[4];
+
+    // Fully carry h
+    uint32_t carry = h1 >> 26;
+    h1 &= mask;
+    h2 += carry;
+    carry = h2 >> 26;
+    h2 &= mask;
+    h3 += carry;
+    carry = h3 >> 26;
+    h3 &= mask;
+    h4 += carry;
+    carry = h4 >> 26;
+    h4 &= mask;
+    h0 += carry * 5;
+    carry = h0 >> 26;
+    h0 &= mask;
+    h1 += carry;
+
+    // Compute h - p, and pick it if it doesn't underflow, in constant time
+    uint32_t g0 = h0 + 5;
+    carry = g0 >> 26;
+    g0 &= mask;
+    uint32_t g1 = h1 + carry;
+    carry = g1 >> 26;
+    g1 &= mask;
+    uint32_t g2 = h2 + carry;
+    carry = g2 >> 26;
+    g2 &= mask;
+    uint32_t g3 = h3 + carry;
+    carry = g3 >> 26;
+    g3 &= mask;
+    uint32_t g4 = h4 + carry - (1 << 26);
+
+    uint32_t select = (g4 >> 31) - 1;
+    h0 = (h0 & ~select) | (g0 & select);
+    h1 = (h1 & ~select) | (g1 & select);
+    h2 = (h2 & ~select) | (g2 & select);
+    h3 = (h3 & ~select) | (g3 & select);
+    h4 = (h4 & ~select) | (g4 & select);
+
+    // h = (h + pad) % 2^128
+    uint32_t words[4] = {
+        h0 | (h1 << 26),
+        (h1 >> 6) | (h2 << 20),
+        (h2 >> 12) | (h3 << 14),
+        (h3 >> 18) | (h4 << 8),
+    };
+
+    Tag tag{};
+    uint64_t sum = 0;
+    for (int i = 0; i < 4; ++i) {
+        sum = (uint64_t)words[i] + pad[i] + (sum >> 32);
+        store_le32(tag.data() + 4 * i, (uint32_t)sum);
+    }
+
+    return tag;
+}
+#pragma endregion Poly1305
+
+#pragma region AEAD
+static Poly1305 aead_mac_init(const Key &key, const Nonce &nonce) {
+    unsigned char poly_key[64] = {};
+    chacha20_xor_scalar(key, 0, nonce, poly_key, poly_key);
+    return Poly1305{std::span<const unsigned char, 32>{poly_key, 32}};
+}
+
+static Tag aead_mac_finish(Poly1305 &mac, size_t aad_size, size_t data_size) {
+    mac.pad16();
+
+    unsigned char lengths[16] = {};
+    uint64_t sizes[2] = {aad_size, data_size};
+    memcpy(lengths, sizes, sizeof(sizes));
+    mac.update(lengths);
+
+    return mac.finish();
+}
+
+Tag seal(const Key &key, const Nonce &nonce, std::span<const unsigned char> aad, std::span<const unsigned char> in, std::span<unsigned char> out) {
+    Poly1305 mac = aead_mac_init(key, nonce);
+    mac.update(aad);
+    mac.pad16();
+
+    chacha20_xor(key, 1, nonce, in, out);
+    mac.update(out);
+
+    return aead_mac_finish(mac, aad.size(), out.size());
+}
+
+bool open(const Key &key, const Nonce &nonce, std::span<const unsigned char> aad, std::span<unsigned char> data, const Tag &tag) {
+    Poly1305 mac = aead_mac_init(key, nonce);
+    mac.update(aad);
+    mac.pad16();
+    mac.update(data);
+
+    Tag expected = aead_mac_finish(mac, aad.size(), data.size());
+
+    // Constant time comparison
+    unsigned char difference = 0;
+    for (size_t i = 0; i < tag.size(); ++i) {
+        difference |= expected[i] ^ tag[i];
+    }
+    if (difference != 0) {
+        return false;
+    }
+
+    chacha20_xor(key, 1, nonce, data, data);
+    return true;
+}
+
+Nonce FrameNonces::next() {
+    Nonce result{};
+    memcpy(result.data(), &direction, sizeof(direction));
+    memcpy(result.data() + sizeof(direction), &counter, sizeof(counter));
+    ++counter;
+    return result;
+}
+#pragma endregion AEAD
+
+#pragma region SelfTest
+template <size_t N>
+static std::array<unsigned char, N> from_hex(const char (&hex)[N * 2 + 1]) {
+    auto nibble = [](char c) -> unsigned char {
+        return c <= '9' ? c - '0' : (c | 0x20) - 'a' + 10;
+    };
+
+    std::array<unsigned char, N> result{};
+    for (size_t i = 0; i < N; ++i) {
+        result[i] = (unsigned char)(nibble(hex[2 * i]) << 4 | nibble(hex[2 * i + 1]));
+    }
+    return result;
+}
+
+template <typename A, typename B>
+static bool same_bytes(const A &a, const B &b) {
+    return a.size() == b.size() && memcmp(a.data(), b.data(), a.size()) == 0;
+}
+
+static Key sequential_key() {
+    Key key{};
+    for (size_t i = 0; i < key.size(); ++i) {
+        key[i] = (unsigned char)i;
+    }
+    return key;
+}
+
+bool self_test() {
+    // RFC 8439, 2.3.2: the block function
+    {
+        Key key = sequential_key();
+        Nonce nonce = from_hex<12>("000000090000004a00000000");
+        auto expected = from_hex<64>(
+            "10f1e7e4d13b5915500fdd1fa32071c4c7d1f4c733c068030422aa9ac3d46c4e"
+            "d2826446079faa0914c2d705d98b02a2b5129cd1de164eb9cbd083e8a2503c4e"
+        );
+
+        std::array<unsigned char, 64> block{};
+        chacha20_xor(key, 1, nonce, block, block);
+        if (!same_bytes(block, expected)) {
+            return false;
+        }
+    }
+
+    // RFC 8439, 2.5.2: Poly1305
+    {
+        auto key = from_hex<32>("85d6be7857556d337f4452fe42d506a80103808afb0db2fd4abff6af4149f51b");
+        auto expected = from_hex<16>("a8061dc1305136c6c22b8baf0c0127a9");
+        std::string_view message = "Cryptographic Forum Research Group";
+
+        Poly1305 mac{key};
+        mac.update({(const unsigned char *)message.data(), message.size()});
+        if (!same_bytes(mac.finish(), expected)) {
+            return false;
+        }
+    }
+
+    // RFC 8439, 2.8.2: the AEAD construction
+    {
+        Key key{};
+        for (size_t i = 0; i < key.size(); ++i) {
+            key[i] = (unsigned char)(0x80 + i);
+        }
+        Nonce nonce = from_hex<12>("070000004041424344454647");
+        auto aad = from_hex<12>("50515253c0c1c2c3c4c5c6c7");
+        std::string_view plaintext =
+            "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for the future, sunscreen would be it.";
+        auto expected_tag = from_hex<16>("1ae10b594f09e26a7e902ecbd0600691");
+        auto expected_start = from_hex<16>("d31a8d34648e60db7b86afbc53ef7ec2");
+
+        std::vector<unsigned char> data(plaintext.begin(), plaintext.end());
+        Tag tag = seal(key, nonce, aad, data, data);
+        if (!same_bytes(tag, expected_tag) || memcmp(data.data(), expected_start.data(), expected_start.size()) != 0) {
+            return false;
+        }
+
+        if (!open(key, nonce, aad, data, tag) || !same_bytes(data, plaintext)) {
+            return false;
+        }
+
+        tag[0] ^= 1;
+        if (open(key, nonce, aad, data, tag)) {
+            return false;
+        }
+    }
+
+    // draft-irtf-cfrg-xchacha, 2.2.1: HChaCha20
+    {
+        Key key = sequential_key();
+        auto nonce = from_hex<16>("000000090000004a0000000031415927");
+        auto expected = from_hex<32>("82413b4227b27bfed30e42508a877d73a0f9e4d58a74a853c12ec41326d3ecdc");
+
+        if (!same_bytes(hchacha20(key, nonce), expected)) {
+            return false;
+        }
+    }
+
+    // The SIMD kernels must agree with the scalar ones, including around their stride boundaries
+    {
+        Key key = sequential_key();
+        Nonce nonce = from_hex<12>("000000000000004a00000000");
+
+        std::vector<unsigned char> input(1500);
+        for (size_t i = 0; i < input.size(); ++i) {
+            input[i] = (unsigned char)(i * 7);
+        }
+
+        for (size_t size : {0, 1, 63, 64, 255, 256, 511, 512, 513, 1024, 1500}) {
+            auto in = std::span{input}.first(size);
+            std::vector<unsigned char> fast(size), slow(size);
+            chacha20_xor(key, 0xfffffffe, nonce, in, fast);
+            chacha20_xor_scalar(key, 0xfffffffe, nonce, in, slow);
+            if (fast != slow) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+void ensure_self_test() {
+    static const bool passed = self_test();
+    if (!passed) {
+        fail("Cryptography self-test failed");
+    }
+}
+#pragma endregion SelfTest
+
+#pragma region Keys
+void random_bytes(std::span<unsigned char> data) {
+    NTSTATUS status = BCryptGenRandom(nullptr, data.data(), (ULONG)data.size(), BCRYPT_USE_SYSTEM_PREFERRED_RNG);
+    if (!BCRYPT_SUCCESS(status)) {
+        fail("Failed to generate random bytes");
+    }
+}
+
+Key parse_key(std::string_view hex) {
+    Key result{};
+    if (hex.size() != result.size() * 2) {
+        fail("A key must be 64 hex digits");
+    }
+
+    auto nibble = [](char c) -> unsigned char {
+        if ('0' <= c && c <= '9') {
+            return c - '0';
+        }
+        if ('a' <= (c | 0x20) && (c | 0x20) <= 'f') {
+            return (c | 0x20) - 'a' + 10;
+        }
+        fail("A key must be 64 hex digits");
+    };
+
+    for (size_t i = 0; i < result.size(); ++i) {
+        result[i] = (unsigned char)(nibble(hex[2 * i]) << 4 | nibble(hex[2 * i + 1]));
+    }
+    return result;
+}
+
+Key load_key_file(const std::string &path) {
+    auto file = Handle::open_file(path);
+
+    char contents[80] = {};
+    size_t size = 0;
+    while (size < sizeof(contents)) {
+        auto result = file.read_into({(unsigned char *)contents + size, sizeof(contents) - size});
+        size += result.value;
+        if (result.is_eof) {
+            break;
+        }
+    }
+
+    Key result{};
+    if (size == result.size()) {
+        memcpy(result.data(), contents, result.size());
+        return result;
+    }
+
+    std::string_view hex{contents, size};
+    while (!hex.empty() && (hex.back() == '\n' || hex.back() == '\r' || hex.back() == ' ')) {
+        hex.remove_suffix(1);
+    }
+    return parse_key(hex);
+}
+
+using HandshakeNonce = std::array<unsigned char, 16>;
+
+static Key derive_session_key(const Key &psk, const HandshakeNonce &client, const HandshakeNonce &server) {
+    return hchacha20(hchacha20(psk, client), server);
+}
+
+Key handshake_client(Socket socket, const Key &psk) {
+    ensure_self_test();
+
+    HandshakeNonce client{}, server{};
+    random_bytes(client);
+
+    socket.write_full_from(client);
+    socket.read_full_into(server);
+
+    return derive_session_key(psk, client, server);
+}
+
+Key handshake_server(Socket socket, const Key &psk) {
+    ensure_self_test();
+
+    HandshakeNonce client{}, server{};
+    random_bytes(server);
+
+    socket.read_full_into(client);
+    socket.write_full_from(server);
+
+    return derive_session_key(psk, client, server);
+}
+#pragma endregion Keys
+
+}  // namespace abel::crypto
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "IOBase.hpp"
+#include "Socket.hpp"
+#include "Error.hpp"
+#include "Protocol.hpp"
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <memory>
+#include <string_view>
+#include <string>
+#include <cstring>
+#include <algorithm>
+
+#pragma comment(lib, "Bcrypt.lib")
+
+namespace abel {
+
+template <typename T>
+class AIO;
+
+// ChaCha20-Poly1305 (RFC 8439) and the session encryption layer built on it
+namespace crypto {
+
+using Key = std::array<unsigned char, 32>;
+using Tag = std::array<unsigned char, 16>;
+using Nonce = std::array<unsigned char, 12>;
+
+// XORs `in` with the keystream into `out`. `in` and `out` may be the same buffer.
+void chacha20_xor(const Key &key, uint32_t counter, const Nonce &nonce, std::span<const unsigned char> in, std::span<unsigned char> out);
+
+// Same as chacha20_xor, but never uses the SIMD kernels. Exists for testing and benchmarking.
+void chacha20_xor_scalar(const Key &key, uint32_t counter, const Nonce &nonce, std::span<const unsigned char> in, std::span<unsigned char> out);
+
+// Derives a subkey from a key and a 16-byte nonce
+Key hchacha20(const Key &key, std::span<const unsigned char, 16> nonce);
+
+class Poly1305 {
+protected:
+    uint32_t r[5]{};
+    uint32_t h[5]{};
+    uint32_t pad[4]{};
+    unsigned char buffer[16]{};
+    size_t buffered{0};
+
+    void blocks(const unsigned char *data, size_t size, bool final = false);
+
+public:
+    explicit Poly1305(std::span<const unsigned char, 32> key);
+
+    void update(std::span<const unsigned char> data);
+
+    // Feeds zeros up to the next multiple of 16 bytes, as the AEAD construction requires
+    void pad16();
+
+    Tag finish();
+};
+
+// Encrypts `in` into `out` (possibly in place) and returns the tag that authenticates it along with `aad`
+Tag seal(const Key &key, const Nonce &nonce, std::span<const unsigned char> aad, std::span<const unsigned char> in, std::span<unsigned char> out);
+
+// Verifies the tag, and only then decrypts `data` in place. Returns false if verification fails.
+[[nodiscard]] bool open(const Key &key, const Nonce &nonce, std::span<const unsigned char> aad, std::span<unsigned char> data, const Tag &tag);
+
+// Runs the RFC 8439 known-answer tests, plus a check that the SIMD kernels agree with the scalar ones
+bool self_test();
+
+// Fails unless self_test() passes. Only actually tests once per process.
+void ensure_self_test();
+
+void random_bytes(std::span<unsigned char> data);
+
+// Parses 64 hex digits
+Key parse_key(std::string_view hex);
+
+// Reads a key file containing either the 32 raw key bytes or their hex representation
+Key load_key_file(const std::string &path);
+
+// Both sides contribute a random nonce, and the session key is derived from those and the pre-shared key.
+// A client with the wrong key is only detected on the first frame, since that fails authentication.
+Key handshake_client(Socket socket, const Key &psk);
+Key handshake_server(Socket socket, const Key &psk);
+
+enum class Direction : uint32_t {
+    client_to_server = 0,
+    server_to_client = 1,
+};
+
+// Frames are laid out as [u32 length][ciphertext][tag], with the length authenticated as well.
+// The nonce is the direction followed by a frame counter, so frames can't be replayed or reordered.
+struct SealedFrameHeader {
+    uint32_t length;
+};
+
+constexpr size_t max_sealed_frame = 16 * 1024;
+
+class FrameNonces {
+protected:
+    Direction direction;
+    uint64_t counter{0};
+
+public:
+    explicit FrameNonces(Direction direction) :
+        direction{direction} {
+    }
+
+    Nonce next();
+};
+
+// Encrypts everything written through it into frames for the underlying stream
+template <async_writable D>
+class SealWriter : public IOBase {
+protected:
+    D inner;
+    Key key;
+    FrameNonces nonces;
+    std::unique_ptr<unsigned char[]> frame = std::make_unique<unsigned char[]>(sizeof(SealedFrameHeader) + max_sealed_frame + sizeof(Tag));
+
+public:
+    SealWriter(D inner, const Key &key, Direction direction) :
+        inner(std::move(inner)),
+        key{key},
+        nonces{direction} {
+    }
+
+    AIO<eof<size_t>> write_async_from(std::span<const unsigned char> data) {
+        size_t written = 0;
+
+        while (written < data.size()) {
+            auto chunk = data.subspan(written, std::min(data.size() - written, max_sealed_frame));
+
+            SealedFrameHeader header{.length = (uint32_t)chunk.size()};
+            memcpy(frame.get(), &header, sizeof(header));
+
+            auto aad = std::span{frame.get(), sizeof(header)};
+            auto body = std::span{frame.get() + sizeof(header), chunk.size()};
+            Tag tag = seal(key, nonces.next(), aad, chunk, body);
+            memcpy(body.data() + body.size(), tag.data(), tag.size());
+
+            if ((co_await inner.write_async_full_from({frame.get(), sizeof(header) + chunk.size() + tag.size()})).is_eof) {
+                co_return eof(written, true);
+            }
+
+            written += chunk.size();
+        }
+
+        co_return eof(written, false);
+    }
+};
+
+// Undoes SealWriter. Fails if anything was tampered with.
+template <async_readable S>
+class OpenReader : public IOBase {
+protected:
+    S inner;
+    Key key;
+    FrameNonces nonces;
+    std::unique_ptr<unsigned char[]> buffer = std::make_unique<unsigned char[]>(max_sealed_frame);
+    std::span<const unsigned char> pending{};
+
+public:
+    OpenReader(S inner, const Key &key, Direction direction) :
+        inner(std::move(inner)),
+        key{key},
+        nonces{direction} {
+    }
+
+    AIO<eof<size_t>> read_async_into(std::span<unsigned char> data) {
+        if (pending.empty()) {
+            SealedFrameHeader header{};
+            auto header_bytes = bytes_of(header);
+
+            // A clean end of stream may only happen between frames
+            auto first = co_await inner.read_async_into(header_bytes);
+            if (first.is_eof && first.value == 0) {
+                co_return eof((size_t)0, true);
+            }
+            co_await inner.read_async_full_into(header_bytes.subspan(first.value));
+
+            if (header.length > max_sealed_frame) {
+                fail("Invalid sealed frame header");
+            }
+
+            // Frames that fit are decrypted right in the caller's buffer
+            bool direct = header.length <= data.size();
+            auto body = direct ? data.first(header.length) : std::span{buffer.get(), header.length};
+
+            Tag tag{};
+            co_await inner.read_async_full_into(body);
+            co_await inner.read_async_full_into(tag);
+
+            if (!open(key, nonces.next(), bytes_of(header), body, tag)) {
+                fail("Session frame failed authentication (wrong key?)");
+            }
+
+            if (direct) {
+                co_return eof(body.size(), false);
+            }
+            pending = body;
+        }
+
+        size_t size = std::min(data.size(), pending.size());
+        std::copy_n(pending.begin(), size, data.begin());
+        pending = pending.subspan(size);
+
+        co_return eof(size, false);
+    }
+};
+
+}  // namespace crypto
+
+}  // namespace abel
@@ -0,0 +1,619 @@
+#include "Datagram.hpp"
+
+#include "Concurrency.hpp"
+#include "Thread.hpp"
+#include "Crypto.hpp"
+#include "Error.hpp"
+
+#include <mstcpip.h>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+namespace abel::udp {
+
+#pragma region Setup
+static OwningSocket create_udp_socket() {
+    OwningSocket result = OwningSocket(
+        WSASocketA(
+            AF_INET,
+            SOCK_DGRAM,
+            IPPROTO_UDP,
+            nullptr,
+            0,
+            WSA_FLAG_NO_HANDLE_INHERIT
+        )
+    ).validate();
+
+    // Otherwise an ICMP port unreachable from an earlier send fails the next recv with WSAECONNRESET
+    BOOL report = false;
+    DWORD returned = 0;
+    WSAIoctl(result.raw(), SIO_UDP_CONNRESET, &report, sizeof(report), nullptr, 0, &returned, nullptr, nullptr);
+
+    return result;
+}
+
+static void set_receive_timeout(Socket socket, DWORD miliseconds) {
+    int status = setsockopt(socket.raw(), SOL_SOCKET, SO_RCVTIMEO, (const char *)&miliseconds, sizeof(miliseconds));
+    if (status == SOCKET_ERROR) {
+        fail_ws("Failed to set socket receive timeout");
+    }
+}
+
+static std::optional<PacketHeader> parse_header(std::span<const unsigned char> packet, uint32_t session_id) {
+    PacketHeader header{};
+    if (packet.size() < sizeof(header)) {
+        return std::nullopt;
+    }
+
+    memcpy(&header, packet.data(), sizeof(header));
+    if (header.session_id != session_id || header.length != packet.size() - sizeof(header)) {
+        return std::nullopt;
+    }
+
+    return header;
+}
+
+Transport::Transport(OwningSocket socket, uint32_t session_id, TransportOptions options) :
+    socket{std::move(socket)},
+    session_id{session_id},
+    options{options} {
+}
+
+Transport::~Transport() {
+    stopping = true;
+    wake.signal();
+
+    if (thread) {
+        thread.wait();
+    }
+}
+
+void Transport::start() {
+    // Note: this also makes the socket non-blocking
+    int status = WSAEventSelect(socket.raw(), socket_event.raw(), FD_READ);
+    if (status == SOCKET_ERROR) {
+        fail_ws("Failed to select socket events");
+    }
+
+    thread = Thread::create<Transport, &Transport::pump>(this).handle;
+}
+
+std::unique_ptr<Transport> Transport::listen(TransportOptions options) {
+    OwningSocket socket = create_udp_socket();
+
+    sockaddr_in addr{
+        .sin_family = AF_INET,
+        .sin_port = 0,
+    };
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    int status = ::bind(socket.raw(), (sockaddr *)&addr, sizeof(addr));
+    if (status == SOCKET_ERROR) {
+        fail_ws("Failed to bind datagram socket");
+    }
+
+    uint32_t session_id = 0;
+    crypto::random_bytes({(unsigned char *)&session_id, sizeof(session_id)});
+
+    return std::unique_ptr<Transport>(new Transport(std::move(socket), session_id, options));
+}
+
+UdpOffer Transport::offer() const {
+    sockaddr_in addr{};
+    int size = sizeof(addr);
+
+    int status = getsockname(socket.raw(), (sockaddr *)&addr, &size);
+    if (status == SOCKET_ERROR) {
+        fail_ws("Failed to get datagram socket address");
+    }
+
+    return UdpOffer{.port = ntohs(addr.sin_port), .session_id = session_id};
+}
+
+void Transport::accept_peer(DWORD timeout_ms) {
+    set_receive_timeout(socket, 200);
+
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    unsigned char buffer[sizeof(PacketHeader) + max_payload];
+
+    while (true) {
+        if (Clock::now() >= deadline) {
+            fail("Timed out waiting for the datagram client");
+        }
+
+        sockaddr_in from{};
+        int from_size = sizeof(from);
+        int received = recvfrom(socket.raw(), (char *)buffer, sizeof(buffer), 0, (sockaddr *)&from, &from_size);
+        if (received == SOCKET_ERROR) {
+            continue;
+        }
+
+        auto header = parse_header({buffer, (size_t)received}, session_id);
+        if (!header || header->type != PacketType::hello) {
+            continue;
+        }
+
+        // From now on, only this peer's packets are received
+        int status = ::connect(socket.raw(), (sockaddr *)&from, sizeof(from));
+        if (status == SOCKET_ERROR) {
+            fail_ws("Failed to connect datagram socket");
+        }
+        break;
+    }
+
+    {
+        std::lock_guard lock{mutex};
+        last_received = Clock::now();
+        send_ack();
+    }
+
+    start();
+}
+
+std::unique_ptr<Transport> Transport::connect(sockaddr_in server, UdpOffer offer, TransportOptions options, DWORD timeout_ms) {
+    OwningSocket socket = create_udp_socket();
+
+    server.sin_port = htons(offer.port);
+    int status = ::connect(socket.raw(), (sockaddr *)&server, sizeof(server));
+    if (status == SOCKET_ERROR) {
+        fail_ws("Failed to connect datagram socket");
+    }
+
+    std::unique_ptr<Transport> result(new Transport(std::move(socket), offer.session_id, options));
+    set_receive_timeout(result->socket, 200);
+
+    auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms);
+    unsigned char buffer[sizeof(PacketHeader) + max_payload];
+
+    // Hellos may get lost too, so keep sending them until the server answers
+    while (true) {
+        if (Clock::now() >= deadline) {
+            fail("Timed out waiting for the datagram server");
+        }
+
+        std::lock_guard lock{result->mutex};
+        result->send_packet(PacketType::hello, 0);
+
+        int received = recv(result->socket.raw(), (char *)buffer, sizeof(buffer), 0);
+        if (received == SOCKET_ERROR) {
+            continue;
+        }
+
+        if (parse_header({buffer, (size_t)received}, offer.session_id)) {
+            // May as well be data, if the server has started talking already
+            result->handle_packet({buffer, (size_t)received});
+            break;
+        }
+    }
+
+    result->start();
+    return result;
+}
+
+Stream Transport::stream() {
+    return Stream{*this};
+}
+
+void Transport::close(DWORD linger_ms) {
+    auto deadline = Clock::now() + std::chrono::milliseconds(linger_ms);
+
+    while (Clock::now() < deadline) {
+        {
+            std::lock_guard lock{mutex};
+            if (unacked.empty() || peer_closed) {
+                break;
+            }
+        }
+        Sleep(10);
+    }
+
+    std::lock_guard lock{mutex};
+    closed = true;
+
+    // Best effort; if all of them get lost, the peer times out eventually
+    for (int i = 0; i < 3; ++i) {
+        send_packet(PacketType::close, next_seq);
+    }
+
+    readable.signal();
+    writable.signal();
+}
+
+TransportStats Transport::stats() {
+    std::lock_guard lock{mutex};
+
+    TransportStats result = stats_;
+    result.srtt_ms = srtt_ms;
+    result.cwnd = cwnd;
+    return result;
+}
+#pragma endregion Setup
+
+#pragma region Protocol
+void Transport::send_packet(PacketType type, uint32_t seq, uint32_t sack, uint32_t window, std::span<const unsigned char> payload) {
+    if (options.loss_percent > 0 && std::uniform_real_distribution<double>(0, 100)(rng) < options.loss_percent) {
+        ++stats_.dropped_by_injector;
+        return;
+    }
+
+    PacketHeader header{
+        .session_id = session_id,
+        .type = type,
+        .length = (uint16_t)payload.size(),
+        .seq = seq,
+        .sack = sack,
+        .window = window,
+    };
+
+    unsigned char packet[sizeof(PacketHeader) + max_payload];
+    memcpy(packet, &header, sizeof(header));
+    memcpy(packet + sizeof(header), payload.data(), payload.size());
+
+    // A failed send is no different from a lost packet, and is recovered from the same way
+    ::send(socket.raw(), (const char *)packet, (int)(sizeof(header) + payload.size()), 0);
+
+    ++stats_.packets_sent;
+    last_sent = Clock::now();
+}
+
+void Transport::send_ack() {
+    uint32_t sack = 0;
+    for (uint32_t i = 0; i < 32; ++i) {
+        if (out_of_order.contains(recv_next + 1 + i)) {
+            sack |= 1u << i;
+        }
+    }
+
+    uint32_t room = receive_window();
+    send_packet(PacketType::ack, recv_next, sack, room);
+    advertised_window_end = recv_next + room;
+    ack_pending = false;
+    last_ack = Clock::now();
+}
+
+void Transport::handle_packet(std::span<const unsigned char> packet) {
+    auto header = parse_header(packet, session_id);
+    if (!header) {
+        return;
+    }
+
+    ++stats_.packets_received;
+    last_received = Clock::now();
+
+    auto payload = packet.subspan(sizeof(PacketHeader));
+
+    switch (header->type) {
+    case PacketType::hello:
+        // The client hasn't heard from us yet
+        ack_pending = true;
+        break;
+
+    case PacketType::data:
+        on_data(header->seq, payload);
+        break;
+
+    case PacketType::ack:
+        on_ack(header->seq, header->sack, header->window);
+        break;
+
+    case PacketType::close:
+        on_peer_closed();
+        break;
+    }
+}
+
+void Transport::on_data(uint32_t seq, std::span<const unsigned char> payload) {
+    ack_pending = true;
+
+    if (seq < recv_next || out_of_order.contains(seq)) {
+        ++stats_.duplicates;
+        return;
+    }
+
+    // The sender is sending again, and the ack to this carries the window anyway
+    window_update_pending = false;
+
+    if (seq >= recv_next + receive_window()) {
+        // Past what was advertised, which a well-behaved sender doesn't send. It will have to retransmit it.
+        return;
+    }
+
+    if (seq != recv_next) {
+        out_of_order.emplace(seq, std::vector<unsigned char>(payload.begin(), payload.end()));
+        return;
+    }
+
+    ready.insert(ready.end(), payload.begin(), payload.end());
+    ++recv_next;
+
+    for (auto it = out_of_order.begin(); it != out_of_order.end() && it->first == recv_next; it = out_of_order.erase(it)) {
+        ready.insert(ready.end(), it->second.begin(), it->second.end());
+        ++recv_next;
+    }
+
+    readable.signal();
+}
+
+void Transport::on_ack(uint32_t ack, uint32_t sack, uint32_t window) {
+    auto now = Clock::now();
+
+    // Acks may arrive out of order, and an older one mustn't take back room a newer one has given
+    peer_window_end = std::max(peer_window_end, ack + window);
+
+    auto acknowledged = [&](Segment &segment) {
+        // Karn's algorithm: retransmitted segments give ambiguous samples
+        if (!segment.retransmitted) {
+            on_rtt_sample(std::chrono::duration<double, std::milli>(now - segment.sent).count());
+        }
+
+        cwnd += cwnd < ssthresh ? 1 : 1 / cwnd;
+        cwnd = std::min<double>(cwnd, window);
+    };
+
+    while (!unacked.empty() && unacked.front().seq < ack) {
+        if (!unacked.front().sacked) {
+            acknowledged(unacked.front());
+        }
+        unacked.pop_front();
+    }
+
+    for (Segment &segment : unacked) {
+        uint32_t bit = segment.seq - ack - 1;
+        if (segment.seq > ack && bit < 32 && (sack >> bit) & 1 && !segment.sacked) {
+            segment.sacked = true;
+            acknowledged(segment);
+        }
+    }
+
+    // A hole with 3 or more segments acknowledged past it is most likely a loss, so don't wait for the timeout
+    bool reduced = false;
+    unsigned sacked_after = 0;
+    for (auto it = unacked.rbegin(); it != unacked.rend(); ++it) {
+        if (it->sacked) {
+            ++sacked_after;
+            continue;
+        }
+
+        if (sacked_after >= 3 && !it->fast_retransmitted) {
+            send_packet(PacketType::data, it->seq, 0, 0, {it->payload, it->length});
+            it->retransmitted = true;
+            it->fast_retransmitted = true;
+            it->sent = now;
+            ++stats_.retransmits;
+            ++stats_.fast_retransmits;
+
+            if (!reduced) {
+                ssthresh = std::max(cwnd / 2, 2.0);
+                cwnd = ssthresh;
+                reduced = true;
+            }
+        }
+    }
+
+    if (window_open()) {
+        writable.signal();
+    }
+}
+
+void Transport::on_rtt_sample(double sample_ms) {
+    // RFC 6298
+    if (!have_rtt) {
+        srtt_ms = sample_ms;
+        rttvar_ms = sample_ms / 2;
+        have_rtt = true;
+    } else {
+        rttvar_ms = 0.75 * rttvar_ms + 0.25 * std::abs(srtt_ms - sample_ms);
+        srtt_ms = 0.875 * srtt_ms + 0.125 * sample_ms;
+    }
+
+    rto_ms = std::clamp(srtt_ms + 4 * rttvar_ms, min_rto_ms, max_rto_ms);
+}
+
+void Transport::on_peer_closed() {
+    peer_closed = true;
+    readable.signal();
+    writable.signal();
+}
+
+bool Transport::window_open() const noexcept {
+    return unacked.size() < std::min<uint32_t>((uint32_t)cwnd, window) && next_seq < peer_window_end;
+}
+
+uint32_t Transport::receive_window() const noexcept {
+    size_t unread = ready.size() - ready_offset;
+    return unread >= max_unread ? 0 : (uint32_t)((max_unread - unread) / max_payload);
+}
+
+void Transport::check_timers(Clock::time_point now) {
+    auto rto = std::chrono::duration<double, std::milli>(rto_ms);
+
+    // Don't flood the link with a whole window of retransmissions at once
+    size_t budget = std::max<size_t>(1, (size_t)cwnd);
+    bool timed_out = false;
+
+    for (Segment &segment : unacked) {
+        if (budget == 0) {
+            break;
+        }
+        if (segment.sacked || now - segment.sent < rto) {
+            continue;
+        }
+
+        send_packet(PacketType::data, segment.seq, 0, 0, {segment.payload, segment.length});
+        segment.retransmitted = true;
+        segment.sent = now;
+        ++stats_.retransmits;
+        --budget;
+        timed_out = true;
+    }
+
+    if (timed_out) {
+        ++stats_.timeouts;
+        ssthresh = std::max(cwnd / 2, 2.0);
+        cwnd = 2;
+        rto_ms = std::min(rto_ms * 2, max_rto_ms);
+    }
+
+    if (now - last_sent >= keepalive_interval || (window_update_pending && now - last_ack >= rto)) {
+        send_ack();
+    }
+
+    if (!peer_closed && now - last_received >= peer_timeout) {
+        on_peer_closed();
+    }
+}
+
+Clock::time_point Transport::next_deadline() const {
+    auto rto = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(rto_ms));
+
+    Clock::time_point result = std::min(last_sent + keepalive_interval, last_received + peer_timeout);
+    if (window_update_pending) {
+        result = std::min(result, last_ack + rto);
+    }
+    for (const Segment &segment : unacked) {
+        if (!segment.sacked) {
+            result = std::min(result, segment.sent + rto);
+        }
+    }
+
+    return result;
+}
+
+void Transport::pump() {
+    Handle events[2] = {socket_event, wake};
+    unsigned char buffer[sizeof(PacketHeader) + max_payload];
+
+    while (!stopping) {
+        DWORD timeout = 0;
+        {
+            std::lock_guard lock{mutex};
+            auto now = Clock::now();
+            auto deadline = next_deadline();
+            if (deadline > now) {
+                timeout = (DWORD)std::chrono::ceil<std::chrono::milliseconds>(deadline - now).count();
+            }
+        }
+
+        Handle::wait_multiple(events, false, timeout);
+        if (stopping) {
+            break;
+        }
+
+        std::lock_guard lock{mutex};
+
+        // Winsock has no recvmmsg; draining everything that's queued before acknowledging gets most of the benefit,
+        // since a single ack then covers the whole batch
+        while (true) {
+            int received = recv(socket.raw(), (char *)buffer, sizeof(buffer), 0);
+            if (received == SOCKET_ERROR) {
+                int error = WSAGetLastError();
+                if (error == WSAEMSGSIZE || error == WSAECONNRESET) {
+                    continue;
+                }
+                break;
+            }
+
+            handle_packet({buffer, (size_t)received});
+        }
+
+        if (ack_pending) {
+            send_ack();
+        }
+
+        check_timers(Clock::now());
+    }
+}
+#pragma endregion Protocol
+
+#pragma region Stream
+std::optional<eof<size_t>> Transport::try_read(std::span<unsigned char> data) {
+    std::lock_guard lock{mutex};
+
+    size_t available = ready.size() - ready_offset;
+    if (available > 0) {
+        size_t size = std::min(available, data.size());
+        std::copy_n(ready.begin() + ready_offset, size, data.begin());
+        ready_offset += size;
+
+        if (ready_offset == ready.size()) {
+            ready.clear();
+            ready_offset = 0;
+        } else if (ready_offset >= 64 * 1024) {
+            ready.erase(ready.begin(), ready.begin() + ready_offset);
+            ready_offset = 0;
+        }
+
+        // Once a good part of the window has reopened, the sender hears of it right away rather than with the next
+        // data, of which there may be none while it's waiting for room. Receiver-side silly window avoidance.
+        if (recv_next + receive_window() >= advertised_window_end + window / 4) {
+            ack_pending = true;
+            window_update_pending = true;
+            wake.signal();
+        }
+
+        return eof(size, false);
+    }
+
+    if (peer_closed || closed) {
+        return eof((size_t)0, true);
+    }
+
+    // Reset under the lock, so a signal from the pump can't get lost in between
+    readable.reset();
+    return std::nullopt;
+}
+
+std::optional<eof<size_t>> Transport::try_write(std::span<const unsigned char> data) {
+    std::lock_guard lock{mutex};
+
+    if (peer_closed || closed) {
+        return eof((size_t)0, true);
+    }
+
+    size_t written = 0;
+    while (written < data.size() && window_open()) {
+        auto chunk = data.subspan(written, std::min(data.size() - written, max_payload));
+
+        Segment &segment = unacked.emplace_back();
+        segment.seq = next_seq++;
+        segment.length = (uint16_t)chunk.size();
+        segment.sent = Clock::now();
+        std::ranges::copy(chunk, segment.payload);
+
+        send_packet(PacketType::data, segment.seq, 0, 0, chunk);
+        written += chunk.size();
+    }
+
+    if (written == 0) {
+        writable.reset();
+        return std::nullopt;
+    }
+
+    // The pump has to pick up the new retransmission deadline
+    wake.signal();
+    return eof(written, false);
+}
+
+AIO<eof<size_t>> Stream::read_async_into(std::span<unsigned char> data) {
+    while (true) {
+        if (auto result = transport->try_read(data)) {
+            co_return *result;
+        }
+
+        co_await event_signaled{transport->readable.borrow()};
+    }
+}
+
+AIO<eof<size_t>> Stream::write_async_from(std::span<const unsigned char> data) {
+    while (true) {
+        if (auto result = transport->try_write(data)) {
+            co_return *result;
+        }
+
+        co_await event_signaled{transport->writable.borrow()};
+    }
+}
+#pragma endregion Stream
+
+}  // namespace abel::udp
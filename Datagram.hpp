@@ -0,0 +1,228 @@
+#pragma once
+
+#include "Socket.hpp"
+#include "Handle.hpp"
+#include "IOBase.hpp"
+#include "Error.hpp"
+
+#include <WinSock2.h>
+#include <Windows.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <span>
+#include <vector>
+
+namespace abel {
+
+template <typename T>
+class AIO;
+
+// A reliable, ordered byte stream over UDP, for sessions on links where TCP's head-of-line blocking hurts.
+// It has its own sequencing, selective acknowledgements with fast retransmission, and AIMD congestion control.
+// Each transport runs a pump thread that receives packets and handles retransmissions; the streams only
+// touch the shared state under its mutex, and wait on events that the pump signals.
+namespace udp {
+
+using Clock = std::chrono::steady_clock;
+
+// Small enough to avoid IP fragmentation on any sane path, VPNs included
+constexpr size_t max_payload = 1200;
+
+enum class PacketType : uint8_t {
+    // Client -> server, until answered, so that the server learns the client's address
+    hello = 0,
+    data = 1,
+    ack = 2,
+    close = 3,
+};
+
+struct PacketHeader {
+    uint32_t session_id;
+    PacketType type;
+    uint8_t reserved;
+    uint16_t length;
+    // For data, this segment's sequence number. For acks, all segments before it have arrived.
+    uint32_t seq;
+    // For acks, bit i means that segment seq + 1 + i has arrived as well
+    uint32_t sack;
+    // For acks, how many segments from seq on the receiver has room for
+    uint32_t window;
+};
+
+static_assert(sizeof(PacketHeader) == 20);
+
+// Server -> client over the TCP connection, if session_udp is set
+struct UdpOffer {
+    uint16_t port;
+    uint16_t reserved;
+    uint32_t session_id;
+};
+
+struct TransportOptions {
+    // Percentage of outgoing packets to drop on purpose, for testing on a clean link
+    double loss_percent{0};
+};
+
+struct TransportStats {
+    uint64_t packets_sent{0};
+    uint64_t packets_received{0};
+    uint64_t retransmits{0};
+    uint64_t fast_retransmits{0};
+    uint64_t timeouts{0};
+    uint64_t duplicates{0};
+    uint64_t dropped_by_injector{0};
+    double srtt_ms{0};
+    double cwnd{0};
+};
+
+class Stream;
+
+class Transport {
+public:
+    // Segments in flight and out-of-order segments held, at most
+    static constexpr uint32_t window = 256;
+
+protected:
+    struct Segment {
+        uint32_t seq;
+        uint16_t length;
+        bool sacked;
+        bool retransmitted;
+        bool fast_retransmitted;
+        Clock::time_point sent;
+        unsigned char payload[max_payload];
+    };
+
+    // At most this much is held received but not yet read. Acks advertise the room that's left, so that a slow
+    // reader holds the sender back, rather than have its data dropped and taken for congestion.
+    static constexpr size_t max_unread = window * max_payload;
+
+    static constexpr double min_rto_ms = 50;
+    static constexpr double max_rto_ms = 2000;
+    static constexpr auto keepalive_interval = std::chrono::seconds(5);
+    static constexpr auto peer_timeout = std::chrono::seconds(30);
+
+    OwningSocket socket;
+    uint32_t session_id;
+    TransportOptions options;
+
+    std::mutex mutex{};
+    OwningHandle readable = Handle::create_event(true, false);
+    OwningHandle writable = Handle::create_event(true, true);
+    OwningHandle socket_event = Handle::create_event(false, false);
+    OwningHandle wake = Handle::create_event(false, false);
+    OwningHandle thread{};
+    std::atomic<bool> stopping{false};
+
+    // Sending side
+    std::deque<Segment> unacked{};
+    uint32_t next_seq{0};
+    // Segments from here on don't fit into the peer's receive window yet
+    uint32_t peer_window_end{window};
+    double cwnd{10};
+    double ssthresh{window};
+    double srtt_ms{0};
+    double rttvar_ms{0};
+    double rto_ms{200};
+    bool have_rtt{false};
+
+    // Receiving side
+    uint32_t recv_next{0};
+    std::map<uint32_t, std::vector<unsigned char>> out_of_order{};
+    std::vector<unsigned char> ready{};
+    size_t ready_offset{0};
+    // The end of the receive window, as of the last ack sent
+    uint32_t advertised_window_end{window};
+    // The window has reopened, and the sender may still be waiting for that ack, which is repeated every RTO
+    // until data comes in again, since a lost one would leave both sides waiting
+    bool window_update_pending{false};
+    Clock::time_point last_ack{};
+    bool ack_pending{false};
+    bool peer_closed{false};
+    bool closed{false};
+
+    Clock::time_point last_received{Clock::now()};
+    Clock::time_point last_sent{Clock::now()};
+
+    std::minstd_rand rng{std::random_device{}()};
+    TransportStats stats_{};
+
+    Transport(OwningSocket socket, uint32_t session_id, TransportOptions options);
+
+    // Switches the socket to event-driven mode and starts the pump thread
+    void start();
+
+    // The rest expect the mutex to be held
+    void send_packet(PacketType type, uint32_t seq, uint32_t sack = 0, uint32_t window = 0, std::span<const unsigned char> payload = {});
+    void send_ack();
+    void handle_packet(std::span<const unsigned char> packet);
+    void on_ack(uint32_t ack, uint32_t sack, uint32_t window);
+    void on_data(uint32_t seq, std::span<const unsigned char> payload);
+    void on_rtt_sample(double sample_ms);
+    void on_peer_closed();
+    void check_timers(Clock::time_point now);
+    Clock::time_point next_deadline() const;
+    bool window_open() const noexcept;
+    // In segments, from recv_next on
+    uint32_t receive_window() const noexcept;
+
+    void pump();
+
+    friend Stream;
+
+    // Used by Stream. Return nullopt after resetting the corresponding event if the call would block.
+    std::optional<eof<size_t>> try_read(std::span<unsigned char> data);
+    std::optional<eof<size_t>> try_write(std::span<const unsigned char> data);
+
+public:
+    Transport(const Transport &) = delete;
+    Transport &operator=(const Transport &) = delete;
+    Transport(Transport &&) = delete;
+    Transport &operator=(Transport &&) = delete;
+
+    ~Transport();
+
+    // Binds an ephemeral port for a client to connect to. Call offer() and then accept_peer().
+    static std::unique_ptr<Transport> listen(TransportOptions options = {});
+
+    UdpOffer offer() const;
+
+    // Waits for the client's hello, and starts the transport
+    void accept_peer(DWORD timeout_ms = 10'000);
+
+    // `server` is the server's address, e.g. the peer address of the TCP connection the offer came from
+    static std::unique_ptr<Transport> connect(sockaddr_in server, UdpOffer offer, TransportOptions options = {}, DWORD timeout_ms = 10'000);
+
+    Stream stream();
+
+    // Waits (up to `linger_ms`) for everything written to be acknowledged, then tells the peer the stream has ended
+    void close(DWORD linger_ms = 2'000);
+
+    TransportStats stats();
+};
+
+// A non-owning view of a transport that satisfies async_readable and async_writable
+class Stream : public IOBase {
+protected:
+    Transport *transport;
+
+public:
+    explicit Stream(Transport &transport) :
+        transport{&transport} {
+    }
+
+    AIO<eof<size_t>> read_async_into(std::span<unsigned char> data);
+
+    AIO<eof<size_t>> write_async_from(std::span<const unsigned char> data);
+};
+
+}  // namespace udp
+
+}  // namespace abel
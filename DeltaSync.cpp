@@ -0,0 +1,768 @@
+#include "DeltaSync.hpp"
+
+#include "Concurrency.hpp"
+#include "Protocol.hpp"
+#include "Cpu.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <cctype>
+#include <cstring>
+#include <cmath>
+
+namespace abel::delta {
+
+#pragma region Wire
+// Client -> server, followed by `path_length` bytes of the destination path
+struct PushRequest {
+    uint64_t file_size;
+    uint32_t path_length;
+    uint32_t reserved;
+};
+
+// Server -> client, followed by `block_count` BlockSignatures. Nothing follows if `status` isn't push_ok.
+struct SignatureHeader {
+    uint32_t block_size;
+    uint32_t status;
+    uint64_t block_count;
+};
+
+enum class OpKind : uint8_t {
+    // `block` holds the checksum of the whole file
+    end = 0,
+    // Followed by `length` bytes of data
+    literal = 1,
+    // `length` consecutive blocks starting at `block` of the receiver's copy
+    copy = 2,
+};
+
+// Client -> server, repeated until an `end` op
+struct DeltaOp {
+    OpKind kind;
+    uint8_t reserved[3];
+    uint32_t length;
+    uint64_t block;
+};
+
+// Server -> client, sent after the `end` op is applied
+struct PushResult {
+    uint32_t status;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(DeltaOp) == 16);
+
+constexpr uint32_t push_ok = 0;
+constexpr uint32_t push_checksum_mismatch = 1;
+constexpr uint32_t push_path_refused = 2;
+
+constexpr uint32_t max_path_length = 32 * 1024;
+constexpr uint64_t max_block_count = 1ull << 26;
+constexpr uint32_t min_block_size = 1024;
+constexpr uint32_t max_block_size = 128 * 1024;
+constexpr size_t max_literal = 64 * 1024;
+constexpr size_t signature_batch = 1024;
+#pragma endregion Wire
+
+#pragma region Checksums
+static WeakSum weak_sums_scalar(std::span<const unsigned char> block, WeakSum sums = {}) {
+    // b is the sum of all prefix sums, which is exactly what the weighting gives
+    for (unsigned char byte : block) {
+        sums.a += byte;
+        sums.b += sums.a;
+    }
+    return sums;
+}
+
+#if ABEL_ARCH_X64
+ABEL_TARGET_AVX2 static uint32_t hsum_epi32(__m256i value) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(value), _mm256_extracti128_si256(value, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (uint32_t)_mm_cvtsi128_si32(sum);
+}
+
+ABEL_TARGET_AVX2 static WeakSum weak_sums_avx2(std::span<const unsigned char> block) {
+    constexpr size_t stride = 32;
+    const size_t chunks = block.size() / stride;
+
+    const __m256i weights = _mm256_setr_epi8(
+        32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17,
+        16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1
+    );
+    const __m256i ones = _mm256_set1_epi16(1);
+    const __m256i zero = _mm256_setzero_si256();
+
+    // Per chunk: b += stride * a_before + sum((stride - j) * x_j), a += sum(x_j)
+    __m256i sum_a = zero;
+    __m256i sum_a_before = zero;
+    __m256i sum_weighted = zero;
+
+    for (size_t i = 0; i < chunks; ++i) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *)(block.data() + i * stride));
+
+        sum_a_before = _mm256_add_epi32(sum_a_before, sum_a);
+        sum_a = _mm256_add_epi32(sum_a, _mm256_sad_epu8(bytes, zero));
+        sum_weighted = _mm256_add_epi32(sum_weighted, _mm256_madd_epi16(_mm256_maddubs_epi16(bytes, weights), ones));
+    }
+
+    WeakSum sums{
+        .a = hsum_epi32(sum_a),
+        .b = (uint32_t)stride * hsum_epi32(sum_a_before) + hsum_epi32(sum_weighted),
+    };
+
+    return weak_sums_scalar(block.subspan(chunks * stride), sums);
+}
+#endif
+
+#if ABEL_ARCH_ARM64
+static WeakSum weak_sums_neon(std::span<const unsigned char> block) {
+    constexpr size_t stride = 16;
+    const size_t chunks = block.size() / stride;
+
+    static constexpr uint8_t weights[stride] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+    const uint8x8_t weights_lo = vld1_u8(weights);
+    const uint8x8_t weights_hi = vld1_u8(weights + 8);
+
+    uint32x4_t sum_a = vdupq_n_u32(0);
+    uint32x4_t sum_a_before = vdupq_n_u32(0);
+    uint32x4_t sum_weighted = vdupq_n_u32(0);
+
+    for (size_t i = 0; i < chunks; ++i) {
+        uint8x16_t bytes = vld1q_u8(block.data() + i * stride);
+
+        sum_a_before = vaddq_u32(sum_a_before, sum_a);
+        sum_a = vpadalq_u16(sum_a, vpaddlq_u8(bytes));
+
+        uint16x8_t products = vmull_u8(vget_low_u8(bytes), weights_lo);
+        products = vmlal_u8(products, vget_high_u8(bytes), weights_hi);
+        sum_weighted = vpadalq_u16(sum_weighted, products);
+    }
+
+    WeakSum sums{
+        .a = vaddvq_u32(sum_a),
+        .b = (uint32_t)stride * vaddvq_u32(sum_a_before) + vaddvq_u32(sum_weighted),
+    };
+
+    return weak_sums_scalar(block.subspan(chunks * stride), sums);
+}
+#endif
+
+WeakSum weak_sums(std::span<const unsigned char> block) {
+#if ABEL_ARCH_X64
+    if (cpu::has_avx2()) {
+        return weak_sums_avx2(block);
+    }
+#elif ABEL_ARCH_ARM64
+    return weak_sums_neon(block);
+#endif
+    return weak_sums_scalar(block);
+}
+
+static constexpr uint64_t xxh_prime1 = 0x9E3779B185EBCA87ull;
+static constexpr uint64_t xxh_prime2 = 0xC2B2AE3D27D4EB4Full;
+static constexpr uint64_t xxh_prime3 = 0x165667B19E3779F9ull;
+static constexpr uint64_t xxh_prime4 = 0x85EBCA77C2B2AE63ull;
+static constexpr uint64_t xxh_prime5 = 0x27D4EB2F165667C5ull;
+
+static constexpr uint64_t rotl64(uint64_t value, int shift) {
+    return (value << shift) | (value >> (64 - shift));
+}
+
+static uint64_t read_u64(const unsigned char *data) {
+    uint64_t result = 0;
+    memcpy(&result, data, sizeof(result));
+    return result;
+}
+
+static uint32_t read_u32(const unsigned char *data) {
+    uint32_t result = 0;
+    memcpy(&result, data, sizeof(result));
+    return result;
+}
+
+static constexpr uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * xxh_prime2;
+    acc = rotl64(acc, 31);
+    return acc * xxh_prime1;
+}
+
+static constexpr uint64_t xxh_merge(uint64_t hash, uint64_t acc) {
+    hash ^= xxh_round(0, acc);
+    return hash * xxh_prime1 + xxh_prime4;
+}
+
+Xxh64::Xxh64(uint64_t seed) :
+    acc{seed + xxh_prime1 + xxh_prime2, seed + xxh_prime2, seed, seed - xxh_prime1},
+    seed{seed} {
+}
+
+void Xxh64::update(std::span<const unsigned char> data) {
+    total += data.size();
+
+    auto consume = [this](const unsigned char *input) {
+        for (size_t i = 0; i < 4; ++i) {
+            acc[i] = xxh_round(acc[i], read_u64(input + i * 8));
+        }
+    };
+
+    if (stripe_size > 0) {
+        size_t taken = std::min(sizeof(stripe) - stripe_size, data.size());
+        memcpy(stripe + stripe_size, data.data(), taken);
+        stripe_size += taken;
+        data = data.subspan(taken);
+
+        if (stripe_size < sizeof(stripe)) {
+            return;
+        }
+
+        consume(stripe);
+        stripe_size = 0;
+    }
+
+    while (data.size() >= sizeof(stripe)) {
+        consume(data.data());
+        data = data.subspan(sizeof(stripe));
+    }
+
+    memcpy(stripe, data.data(), data.size());
+    stripe_size = data.size();
+}
+
+uint64_t Xxh64::digest() const {
+    uint64_t hash = 0;
+
+    if (total >= sizeof(stripe)) {
+        hash = rotl64(acc[0], 1) + rotl64(acc[1], 7) + rotl64(acc[2], 12) + rotl64(acc[3], 18);
+        for (size_t i = 0; i < 4; ++i) {
+            hash = xxh_merge(hash, acc[i]);
+        }
+    } else {
+        hash = seed + xxh_prime5;
+    }
+
+    hash += total;
+
+    const unsigned char *tail = stripe;
+    size_t left = stripe_size;
+
+    for (; left >= 8; tail += 8, left -= 8) {
+        hash ^= xxh_round(0, read_u64(tail));
+        hash = rotl64(hash, 27) * xxh_prime1 + xxh_prime4;
+    }
+
+    if (left >= 4) {
+        hash ^= (uint64_t)read_u32(tail) * xxh_prime1;
+        hash = rotl64(hash, 23) * xxh_prime2 + xxh_prime3;
+        tail += 4;
+        left -= 4;
+    }
+
+    for (; left > 0; ++tail, --left) {
+        hash ^= *tail * xxh_prime5;
+        hash = rotl64(hash, 11) * xxh_prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= xxh_prime2;
+    hash ^= hash >> 29;
+    hash *= xxh_prime3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+uint64_t Xxh64::hash(std::span<const unsigned char> data, uint64_t seed) {
+    Xxh64 state{seed};
+    state.update(data);
+    return state.digest();
+}
+
+uint32_t choose_block_size(uint64_t file_size) {
+    // Keeps blocks a multiple of the widest SIMD stride
+    constexpr uint32_t granularity = 64;
+
+    uint64_t block = (uint64_t)std::sqrt((double)file_size);
+    block -= block % granularity;
+
+    return (uint32_t)std::clamp<uint64_t>(block, min_block_size, max_block_size);
+}
+#pragma endregion Checksums
+
+#pragma region Sender
+namespace {
+
+// Maps weak checksums to the receiver's blocks
+class SignatureIndex {
+protected:
+    static constexpr uint32_t npos = (uint32_t)-1;
+
+    std::vector<BlockSignature> signatures{};
+    std::unordered_map<uint32_t, uint32_t> heads{};
+    std::vector<uint32_t> next{};
+
+public:
+    explicit SignatureIndex(std::vector<BlockSignature> signatures_) :
+        signatures{std::move(signatures_)},
+        next(signatures.size(), npos) {
+
+        heads.reserve(signatures.size());
+        for (size_t i = signatures.size(); i-- > 0;) {
+            auto [it, inserted] = heads.try_emplace(signatures[i].weak, (uint32_t)i);
+            if (!inserted) {
+                next[i] = it->second;
+                it->second = (uint32_t)i;
+            }
+        }
+    }
+
+    // Returns the index of a block matching the window, or -1. `preferred` is tried first,
+    // so that runs of consecutive blocks are kept together.
+    int64_t find(uint32_t weak, std::span<const unsigned char> window, int64_t preferred) const {
+        auto head = heads.find(weak);
+        if (head == heads.end()) {
+            return -1;
+        }
+
+        uint64_t strong = Xxh64::hash(window);
+
+        if (0 <= preferred && preferred < (int64_t)signatures.size()) {
+            const auto &signature = signatures[preferred];
+            if (signature.weak == weak && signature.strong == strong) {
+                return preferred;
+            }
+        }
+
+        for (uint32_t i = head->second; i != npos; i = next[i]) {
+            if (signatures[i].strong == strong) {
+                return i;
+            }
+        }
+
+        return -1;
+    }
+};
+
+// Stages delta ops and sends them in large writes. Adjacent block references are merged.
+class OpWriter {
+protected:
+    static constexpr size_t flush_threshold = 128 * 1024;
+
+    Channel &channel;
+    std::vector<unsigned char> staged{};
+    uint64_t copy_first{0};
+    uint32_t copy_count{0};
+
+    void stage_op(const DeltaOp &op, std::span<const unsigned char> payload = {}) {
+        auto header = bytes_of(op);
+        staged.insert(staged.end(), header.begin(), header.end());
+        staged.insert(staged.end(), payload.begin(), payload.end());
+    }
+
+    void stage_pending_copy() {
+        if (copy_count == 0) {
+            return;
+        }
+
+        stage_op(DeltaOp{.kind = OpKind::copy, .length = copy_count, .block = copy_first});
+        copy_count = 0;
+    }
+
+public:
+    explicit OpWriter(Channel &channel) :
+        channel{channel} {
+
+        staged.reserve(flush_threshold + max_literal + sizeof(DeltaOp));
+    }
+
+    void stage_literal(std::span<const unsigned char> data) {
+        stage_pending_copy();
+
+        while (data.size() > 0) {
+            auto part = data.first(std::min(data.size(), max_literal));
+            stage_op(DeltaOp{.kind = OpKind::literal, .length = (uint32_t)part.size()}, part);
+            data = data.subspan(part.size());
+        }
+    }
+
+    void stage_copy(uint64_t block) {
+        if (copy_count > 0 && block == copy_first + copy_count && copy_count < UINT32_MAX) {
+            ++copy_count;
+            return;
+        }
+
+        stage_pending_copy();
+        copy_first = block;
+        copy_count = 1;
+    }
+
+    void stage_end(uint64_t checksum) {
+        stage_pending_copy();
+        stage_op(DeltaOp{.kind = OpKind::end, .length = 0, .block = checksum});
+    }
+
+    bool should_flush() const noexcept {
+        return staged.size() >= flush_threshold;
+    }
+
+    AIO<void> flush() {
+        co_await channel.write_full(staged);
+        staged.clear();
+    }
+};
+
+}  // namespace
+
+AIO<void> push_file(Channel channel, Handle source, std::string dest, PushStats &stats) {
+    stats = PushStats{.file_size = source.file_size()};
+
+    PushRequest request{
+        .file_size = stats.file_size,
+        .path_length = (uint32_t)dest.size(),
+    };
+    co_await channel.write_full(bytes_of(request));
+    co_await channel.write_full({(const unsigned char *)dest.data(), dest.size()});
+
+    SignatureHeader header{};
+    co_await channel.read_full(bytes_of(header));
+    if (header.status == push_path_refused) {
+        fail("Server refused the destination path");
+    }
+    // The receiver only signs as many blocks as the source could fill, so a larger table can't be honest
+    if (header.status != push_ok || header.block_size < min_block_size || header.block_size > max_block_size ||
+        header.block_count > std::min(max_block_count, stats.file_size / header.block_size + 1)) {
+        fail("Invalid signature header");
+    }
+    stats.block_size = header.block_size;
+
+    std::vector<BlockSignature> signatures(header.block_count);
+    co_await channel.read_full({(unsigned char *)signatures.data(), signatures.size() * sizeof(BlockSignature)});
+
+    SignatureIndex index{std::move(signatures)};
+    OpWriter writer{channel};
+    Xxh64 checksum{};
+
+    const size_t block = header.block_size;
+    std::vector<unsigned char> buf(std::max<size_t>(block * 4, 256 * 1024));
+
+    // The window is [pos, pos + block). Bytes in [literal_start, pos) haven't matched anything yet.
+    size_t pos = 0;
+    size_t end = 0;
+    size_t literal_start = 0;
+    bool source_eof = false;
+    RollingChecksum rolling{};
+    bool rolling_valid = false;
+    int64_t next_block = -1;
+
+    auto stage_literal = [&](size_t until) {
+        auto literal = std::span{buf}.subspan(literal_start, until - literal_start);
+        writer.stage_literal(literal);
+        stats.literal_bytes += literal.size();
+        literal_start = until;
+    };
+
+    while (true) {
+        if (end - pos < block && !source_eof) {
+            // Compact the buffer and read some more of the file
+            stage_literal(pos);
+            std::memmove(buf.data(), buf.data() + pos, end - pos);
+            end -= pos;
+            pos = 0;
+            literal_start = 0;
+
+            while (end < buf.size() && !source_eof) {
+                auto result = source.read_into(std::span{buf}.subspan(end));
+                checksum.update(std::span{buf}.subspan(end, result.value));
+                end += result.value;
+                source_eof = result.is_eof;
+            }
+        }
+
+        if (end - pos < block) {
+            // The tail is shorter than a block, so it can only be sent as is
+            break;
+        }
+
+        auto window = std::span{buf}.subspan(pos, block);
+
+        if (!rolling_valid) {
+            rolling = RollingChecksum{window};
+            rolling_valid = true;
+        }
+
+        int64_t match = index.find(rolling.digest(), window, next_block);
+        if (match >= 0) {
+            stage_literal(pos);
+            writer.stage_copy((uint64_t)match);
+            stats.matched_bytes += block;
+
+            pos += block;
+            literal_start = pos;
+            rolling_valid = false;
+            next_block = match + 1;
+        } else {
+            if (pos + block < end) {
+                rolling.roll(buf[pos], buf[pos + block]);
+            } else {
+                rolling_valid = false;
+            }
+            ++pos;
+            next_block = -1;
+
+            if (pos - literal_start >= max_literal) {
+                stage_literal(pos);
+            }
+        }
+
+        if (writer.should_flush()) {
+            co_await writer.flush();
+        }
+    }
+
+    stage_literal(end);
+    writer.stage_end(checksum.digest());
+    co_await writer.flush();
+
+    PushResult result{};
+    co_await channel.read_full(bytes_of(result));
+
+    switch (result.status) {
+    case push_ok:
+        break;
+    case push_checksum_mismatch:
+        fail("Pushed file failed verification on the server");
+    default:
+        fail("Server failed to apply the push");
+    }
+}
+#pragma endregion Sender
+
+#pragma region Receiver
+namespace {
+
+// Whether `name` is one of the DOS device names, which Windows resolves in any directory and with any extension
+bool is_device_name(std::string_view name) {
+    // Spaces before the extension are dropped too, e.g. "NUL .txt" is a device
+    name = name.substr(0, name.find('.'));
+    name = name.substr(0, name.find_last_not_of(' ') + 1);
+
+    auto equals = [](std::string_view a, std::string_view b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](char x, char y) {
+            return std::toupper((unsigned char)x) == std::toupper((unsigned char)y);
+        });
+    };
+
+    for (std::string_view device : {"CON", "PRN", "AUX", "NUL", "CONIN$", "CONOUT$"}) {
+        if (equals(name, device)) {
+            return true;
+        }
+    }
+
+    return name.size() == 4 && (equals(name.substr(0, 3), "COM") || equals(name.substr(0, 3), "LPT")) &&
+           '1' <= name[3] && name[3] <= '9';
+}
+
+// Resolves a pushed path under `root`. Only plain relative paths are accepted: no drives, UNC or device
+// prefixes, alternate data streams, `..` or device names, so a client can't write outside of the root.
+std::optional<std::string> confine_path(const std::string &root, std::string_view path) {
+    if (root.empty() || path.empty() || path.find_first_of(std::string_view{":\0", 2}) != std::string_view::npos ||
+        path.front() == '\\' || path.front() == '/') {
+        return std::nullopt;
+    }
+
+    std::string result = root;
+    while (!path.empty()) {
+        size_t end = std::min(path.find_first_of("\\/"), path.size());
+        std::string_view component = path.substr(0, end);
+        path = path.substr(std::min(end + 1, path.size()));
+
+        if (component.empty() || component == ".") {
+            continue;
+        }
+
+        // Windows drops trailing dots and spaces, which would turn e.g. ".. " into ".."
+        if (component.back() == '.' || component.back() == ' ' || is_device_name(component)) {
+            return std::nullopt;
+        }
+
+        if (result.back() != '\\' && result.back() != '/') {
+            result += '\\';
+        }
+        result += component;
+    }
+
+    if (result.size() == root.size()) {
+        return std::nullopt;
+    }
+
+    return result;
+}
+
+// The file a push is assembled in, next to the destination. Deleted unless it replaces the destination, so that
+// a push that fails on the way, e.g. on a dropped connection, doesn't leave it behind.
+class PartFile {
+protected:
+    std::string path;
+    bool kept{false};
+
+public:
+    OwningHandle output{};
+
+    explicit PartFile(std::string path) :
+        path{std::move(path)} {
+
+        output = Handle::open_file(this->path, GENERIC_WRITE, CREATE_ALWAYS, 0);
+    }
+
+    PartFile(const PartFile &) = delete;
+    PartFile &operator=(const PartFile &) = delete;
+
+    ~PartFile() {
+        discard();
+    }
+
+    void discard() noexcept {
+        if (!kept) {
+            // Not shared for deletion, so it has to be closed first
+            output = {};
+            DeleteFileA(path.c_str());
+            kept = true;
+        }
+    }
+
+    void replace(const std::string &destination) {
+        output.close();
+        if (!MoveFileExA(path.c_str(), destination.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+            fail_ec("Failed to replace the pushed file");
+        }
+        kept = true;
+    }
+};
+
+}  // namespace
+
+AIO<void> receive_push(Channel channel, std::string root) {
+    PushRequest request{};
+    co_await channel.read_full(bytes_of(request));
+    if (request.path_length == 0 || request.path_length > max_path_length) {
+        fail("Invalid push request");
+    }
+
+    std::string requested(request.path_length, '\0');
+    co_await channel.read_full({(unsigned char *)requested.data(), requested.size()});
+
+    std::optional<std::string> confined = confine_path(root, requested);
+    if (!confined) {
+        SignatureHeader refusal{.block_size = 0, .status = push_path_refused, .block_count = 0};
+        co_await channel.write_full(bytes_of(refusal));
+        fail("Push destination refused");
+    }
+    const std::string &path = *confined;
+
+    OwningHandle existing{};
+    uint64_t existing_size = 0;
+    if (GetFileAttributesA(path.c_str()) != INVALID_FILE_ATTRIBUTES) {
+        existing = Handle::open_file(path);
+        existing_size = existing.file_size();
+    }
+
+    // Only whole blocks get signatures; the sender handles the tail as a literal anyway. Blocks past what the
+    // pushed file could fill are left out, since the sender won't take a larger table.
+    SignatureHeader header{
+        .block_size = choose_block_size(existing_size),
+        .status = push_ok,
+        .block_count = 0,
+    };
+    header.block_count = std::min(existing_size / header.block_size, request.file_size / header.block_size + 1);
+    co_await channel.write_full(bytes_of(header));
+
+    const size_t block = header.block_size;
+    std::vector<unsigned char> buf(std::max<size_t>(block, max_literal));
+    std::vector<BlockSignature> signatures{};
+    signatures.reserve(signature_batch);
+
+    for (uint64_t i = 0; i < header.block_count; ++i) {
+        auto window = std::span{buf}.first(block);
+        existing.read_full_into(window);
+
+        signatures.push_back(BlockSignature{
+            .weak = weak_sums(window).digest(),
+            .reserved = 0,
+            .strong = Xxh64::hash(window),
+        });
+
+        if (signatures.size() == signature_batch || i + 1 == header.block_count) {
+            co_await channel.write_full({(const unsigned char *)signatures.data(), signatures.size() * sizeof(BlockSignature)});
+            signatures.clear();
+        }
+    }
+
+    // The result is assembled next to the destination, then moved over it
+    PartFile part{path + ".rcmd-part"};
+    Xxh64 checksum{};
+    uint64_t written = 0;
+
+    auto append = [&](std::span<const unsigned char> data) {
+        part.output.write_full_from(data);
+        checksum.update(data);
+        written += data.size();
+    };
+
+    DeltaOp op{};
+    while (true) {
+        co_await channel.read_full(bytes_of(op));
+
+        if (op.kind == OpKind::end) {
+            break;
+        }
+
+        switch (op.kind) {
+        case OpKind::literal: {
+            if (op.length > max_literal) {
+                fail("Delta literal too long");
+            }
+            auto literal = std::span{buf}.first(op.length);
+            co_await channel.read_full(literal);
+            append(literal);
+        } break;
+
+        case OpKind::copy: {
+            // Not as op.block + op.length, which a hostile block could overflow
+            if (op.block > header.block_count || op.length > header.block_count - op.block) {
+                fail("Delta references a nonexistent block");
+            }
+            auto window = std::span{buf}.first(block);
+            existing.seek(op.block * block);
+            for (uint32_t i = 0; i < op.length; ++i) {
+                existing.read_full_into(window);
+                append(window);
+            }
+        } break;
+
+        default:
+            fail("Unknown delta op");
+        }
+    }
+
+    if (existing) {
+        existing.close();
+    }
+
+    bool verified = written == request.file_size && checksum.digest() == op.block;
+    if (verified) {
+        part.replace(path);
+    } else {
+        // Before the result goes out, since the client may retry right away
+        part.discard();
+    }
+
+    PushResult result{.status = verified ? push_ok : push_checksum_mismatch};
+    co_await channel.write_full(bytes_of(result));
+}
+#pragma endregion Receiver
+
+}  // namespace abel::delta
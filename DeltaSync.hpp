@@ -0,0 +1,127 @@
+#pragma once
+
+#include "Handle.hpp"
+#include "IOBase.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <span>
+#include <string>
+
+namespace abel {
+
+template <typename T>
+class AIO;
+
+// rsync-style delta transfer. The receiver sends signatures of the blocks of its
+// existing copy, and the sender replies with a stream of literal runs and references
+// to blocks the receiver already has. Both sides stream the files, so only the
+// signature table has to be kept in memory.
+namespace delta {
+
+// The weak rolling checksum. `a` is the plain byte sum, while `b` weighs each
+// byte by its distance from the end of the block. All arithmetic wraps around.
+struct WeakSum {
+    uint32_t a{0};
+    uint32_t b{0};
+
+    constexpr uint32_t digest() const noexcept {
+        return (a & 0xffff) | (b << 16);
+    }
+};
+
+// Computes the weak sums of a whole block. Uses SIMD kernels when available.
+WeakSum weak_sums(std::span<const unsigned char> block);
+
+class RollingChecksum {
+protected:
+    WeakSum sums{};
+    uint32_t length{0};
+
+public:
+    constexpr RollingChecksum() noexcept {
+    }
+
+    explicit RollingChecksum(std::span<const unsigned char> block) :
+        sums{weak_sums(block)},
+        length{(uint32_t)block.size()} {
+    }
+
+    // Slides the window one byte forward
+    constexpr void roll(unsigned char out, unsigned char in) noexcept {
+        sums.a += (uint32_t)in - (uint32_t)out;
+        sums.b += sums.a - length * (uint32_t)out;
+    }
+
+    constexpr uint32_t digest() const noexcept {
+        return sums.digest();
+    }
+};
+
+// Streaming XXH64. Serves both as the strong block checksum and the whole-file checksum.
+class Xxh64 {
+protected:
+    uint64_t acc[4]{};
+    unsigned char stripe[32]{};
+    size_t stripe_size{0};
+    uint64_t total{0};
+    uint64_t seed{0};
+
+public:
+    explicit Xxh64(uint64_t seed = 0);
+
+    void update(std::span<const unsigned char> data);
+
+    uint64_t digest() const;
+
+    static uint64_t hash(std::span<const unsigned char> data, uint64_t seed = 0);
+};
+
+struct BlockSignature {
+    uint32_t weak;
+    uint32_t reserved;
+    uint64_t strong;
+};
+
+static_assert(sizeof(BlockSignature) == 16);
+
+struct PushStats {
+    uint64_t file_size{0};
+    uint64_t literal_bytes{0};
+    uint64_t matched_bytes{0};
+    uint32_t block_size{0};
+};
+
+// Picks the block size for a file, like rsync does: roughly the square root of its size, within sane bounds
+uint32_t choose_block_size(uint64_t file_size);
+
+// The streams a push runs over, with whatever session stages sit on the socket.
+// Type-erased, so that the transfer itself needn't live in the header.
+struct Channel {
+    std::function<AIO<void>(std::span<unsigned char>)> read_full{};
+    std::function<AIO<void>(std::span<const unsigned char>)> write_full{};
+};
+
+// The streams must outlive the channel
+template <async_readable R, async_writable W>
+Channel channel_of(R &reader, W &writer) {
+    return Channel{
+        .read_full = [&reader](std::span<unsigned char> buf) -> AIO<void> {
+            co_await reader.read_async_full_into(buf);
+        },
+        .write_full = [&writer](std::span<const unsigned char> buf) -> AIO<void> {
+            co_await writer.write_async_full_from(buf);
+        },
+    };
+}
+
+// Client side. Pushes `source` to `dest` on the server. The session hello must have been sent already.
+AIO<void> push_file(Channel channel, Handle source, std::string dest, PushStats &stats);
+
+// Server side counterpart of push_file. The session hello must have been consumed already.
+// The destination has to be a relative path, which is resolved under `root`. Refuses every push if `root` is empty.
+AIO<void> receive_push(Channel channel, std::string root);
+
+}  // namespace delta
+
+}  // namespace abel
@@ -2,6 +2,11 @@
 
 #include "Error.hpp"
 #include "Concurrency.hpp"
+#include "ConsoleWriter.hpp"
+#include "Pty.hpp"
+
+#include <algorithm>
+#include <cstdio>
 
 namespace abel {
 
@@ -73,11 +78,20 @@ AIO<eof<size_t>> Handle::read_async_into(std::span<unsigned char> data) {
         overlapped
     );
 
-    if (!success && GetLastError() != ERROR_IO_PENDING) {
-        fail("Failed to initiate asynchronous read from handle");
+    if (!success) {
+        switch (GetLastError()) {
+        case ERROR_IO_PENDING:
+            break;
+        // All writers of a pipe are gone
+        case ERROR_BROKEN_PIPE:
+        case ERROR_HANDLE_EOF:
+            co_return eof((size_t)0, true);
+        default:
+            fail("Failed to initiate asynchronous read from handle");
+        }
     }
 
-    co_await io_done_signaled{};
+    co_await io_done_signaled{"ReadFile"};
 
     DWORD transmitted = 0;
     success = GetOverlappedResultEx(
@@ -89,7 +103,13 @@ AIO<eof<size_t>> Handle::read_async_into(std::span<unsigned char> data) {
     );
 
     if (!success) {
-        fail("Failed to get overlapped operation result");
+        switch (GetLastError()) {
+        case ERROR_BROKEN_PIPE:
+        case ERROR_HANDLE_EOF:
+            co_return eof((size_t)transmitted, true);
+        default:
+            fail("Failed to get overlapped operation result");
+        }
     }
 
     // TODO: Perhaps a GetLastError check is necessary instead?
@@ -112,7 +132,7 @@ AIO<eof<size_t>> Handle::write_async_from(std::span<const unsigned char> data) {
         fail("Failed to initiate asynchronous write to handle");
     }
 
-    co_await io_done_signaled{};
+    co_await io_done_signaled{"WriteFile"};
 
     DWORD transmitted = 0;
     success = GetOverlappedResultEx(
@@ -132,6 +152,48 @@ AIO<eof<size_t>> Handle::write_async_from(std::span<const unsigned char> data) {
 }
 #pragma endregion IO
 
+#pragma region File
+OwningHandle Handle::open_file(const std::string &path, DWORD access, DWORD creation, DWORD shareMode, DWORD flags) {
+    OwningHandle result{CreateFileA(
+        path.c_str(),
+        access,
+        shareMode,
+        nullptr,
+        creation,
+        flags,
+        NULL
+    )};
+
+    if (result.raw() == INVALID_HANDLE_VALUE) {
+        // Otherwise the destructor would try to close an invalid handle
+        *result.raw_ptr() = NULL;
+        fail_ec("Failed to open file");
+    }
+
+    return result;
+}
+
+uint64_t Handle::file_size() const {
+    LARGE_INTEGER result{};
+    bool success = GetFileSizeEx(raw(), &result);
+
+    if (!success) {
+        fail("Failed to get file size");
+    }
+
+    return (uint64_t)result.QuadPart;
+}
+
+void Handle::seek(uint64_t position) {
+    LARGE_INTEGER distance{.QuadPart = (LONGLONG)position};
+    bool success = SetFilePointerEx(raw(), distance, nullptr, FILE_BEGIN);
+
+    if (!success) {
+        fail("Failed to seek file");
+    }
+}
+#pragma endregion File
+
 #pragma region Synchronization
 OwningHandle Handle::create_event(bool manualReset, bool initialState, bool inheritHandle) {
     SECURITY_ATTRIBUTES sa{
@@ -153,6 +215,20 @@ OwningHandle Handle::create_mutex(bool initialOwner, bool inheritHandle) {
     return OwningHandle(CreateMutex(&sa, initialOwner, nullptr)).validate();
 }
 
+OwningHandle Handle::create_timer(bool manualReset) {
+    return OwningHandle(CreateWaitableTimerA(nullptr, manualReset, nullptr)).validate();
+}
+
+void Handle::set_timer(DWORD miliseconds) {
+    // Negative means relative, in 100ns units
+    LARGE_INTEGER due{.QuadPart = -(LONGLONG)miliseconds * 10'000};
+    bool success = SetWaitableTimer(raw(), &due, 0, nullptr, nullptr, false);
+
+    if (!success) {
+        fail("Failed to set timer");
+    }
+}
+
 void Handle::signal() {
     bool success = SetEvent(raw());
     if (!success) {
@@ -304,6 +380,28 @@ INPUT_RECORD Handle::read_console_input() {
     return result;
 }
 
+size_t Handle::peek_console_input(std::span<INPUT_RECORD> records) {
+    DWORD read = 0;
+    bool success = PeekConsoleInputA(raw(), records.data(), (DWORD)records.size(), &read);
+
+    if (!success) {
+        fail("Failed to peek console input");
+    }
+
+    return read;
+}
+
+size_t Handle::read_console_input(std::span<INPUT_RECORD> records) {
+    DWORD read = 0;
+    bool success = ReadConsoleInputA(raw(), records.data(), (DWORD)records.size(), &read);
+
+    if (!success) {
+        fail("Failed to read console input");
+    }
+
+    return read;
+}
+
 size_t Handle::console_input_queue_size() const {
     DWORD result = 0;
     bool success = GetNumberOfConsoleInputEvents(raw(), &result);
@@ -315,8 +413,8 @@ size_t Handle::console_input_queue_size() const {
     return result;
 }
 
-ConsoleAsyncIO Handle::console_async_io() {
-    return ConsoleAsyncIO{*this};
+ConsoleAsyncIO Handle::console_async_io(bool local_echo, bool report_resize, ConsoleWriter *writer) {
+    return ConsoleAsyncIO{*this, local_echo, report_resize, writer};
 }
 
 AIO<eof<size_t>> ConsoleAsyncIO::read_async_into(std::span<unsigned char> data) {
@@ -324,14 +422,39 @@ AIO<eof<size_t>> ConsoleAsyncIO::read_async_into(std::span<unsigned char> data)
 
     co_await abel::event_signaled{handle};
 
-    size_t read = 0;
-    bool any_text = false;
+    if (!records) {
+        records = std::make_shared<INPUT_RECORD[]>(input_batch);
+    }
 
-    size_t queue_size = handle.console_input_queue_size();
+    size_t read = 0;
+    // Only the typed part gets echoed
+    size_t typed = 0;
+
+    // The whole batch is looked at first, and only the records that made it into `data` are removed afterwards,
+    // which takes two calls however long the paste, instead of two per record
+    size_t peeked = handle.peek_console_input({records.get(), input_batch});
+    size_t consumed = 0;
+
+    for (; consumed < peeked; ++consumed) {
+        const auto &event = records[consumed];
+
+        if (event.EventType == WINDOW_BUFFER_SIZE_EVENT && report_resize) {
+            // The event carries the buffer size, but the window is what the other end should fill
+            COORD size = Handle::get_stdout().console_window_size();
+
+            // The same one the server's ResizeFilter looks for
+            std::string request = pty::resize_request({.rows = (uint16_t)size.Y, .cols = (uint16_t)size.X});
+            if (request.size() > data.size()) {
+                break;
+            }
+
+            std::ranges::copy(request, data.begin());
+            read += request.size();
+            // Ends the read, so that the request doesn't end up in the middle of the echo
+            ++consumed;
+            break;
+        }
 
-    for (size_t i = 0; i < queue_size; ++i) {
-        auto input = handle.peek_console_input();
-        auto event = input.event();
         if (event.EventType != KEY_EVENT) {
             continue;
         }
@@ -341,10 +464,6 @@ AIO<eof<size_t>> ConsoleAsyncIO::read_async_into(std::span<unsigned char> data)
             continue;
         }
 
-        /*any_text = true;
-        input.reject();
-        break;*/
-
         char chr = key_event.uChar.AsciiChar;
         if (chr == 0) {
             // Things like shift, ctrl, etc.
@@ -357,15 +476,20 @@ AIO<eof<size_t>> ConsoleAsyncIO::read_async_into(std::span<unsigned char> data)
         // If the event doesn't fit in the buffer's remainder, don't consume it either
         unsigned repeats = key_event.wRepeatCount;
         if (repeats > data.size()) {
-            input.reject();
             break;
         }
 
         read += repeats;
+        typed += repeats;
         std::fill_n(data.begin(), repeats, chr);
         data = data.subspan(repeats);
     }
 
+    // Nobody else reads this console, so the front of the queue is still what was peeked
+    if (consumed > 0) {
+        handle.read_console_input({records.get(), consumed});
+    }
+
     /*DWORD read = 0;
     bool success = ReadConsoleA(handle.raw(), data.data(), (DWORD)data.size(), &read, nullptr);
     if (!success) {
@@ -376,7 +500,13 @@ AIO<eof<size_t>> ConsoleAsyncIO::read_async_into(std::span<unsigned char> data)
     // With this, echo is doubled because cmd.exe's echo cannot be suppressed either...?
     // Wait, but it can. We just gotta pass /q... Alternatively, perhaps double echo is better, since
     // it handles backspace & stuff correctly
-    WriteConsoleA(Handle::get_stdout().raw(), data.data() - read, (DWORD)read, nullptr, nullptr);
+    // Note: the client's predictive echo (Prediction.hpp) turns this off and does a better job
+    if (local_echo && writer) {
+        // Behind whatever output is still queued, where it belongs
+        co_await writer->write_async_from({data.data() - typed, typed});
+    } else if (local_echo) {
+        WriteConsoleA(Handle::get_stdout().raw(), data.data() - typed, (DWORD)typed, nullptr, nullptr);
+    }
 
     // TODO: Detect eof from ctrl-something?
     // Note: read == 0 does NOT mean eof here, we could've just got exclusively mouse & etc. events
@@ -408,10 +538,14 @@ ConsoleEventPeek::~ConsoleEventPeek() {
     }
 }
 
-// Note: actually sync under the hood; is needed to fake async transfers into console output
+// Note: without a writer, actually sync under the hood; is needed to fake async transfers into console output
 AIO<eof<size_t>> ConsoleAsyncIO::write_async_from(std::span<const unsigned char> data) {
     // printf("!!! console %p: writing...\n", handle.raw());
 
+    if (writer) {
+        co_return co_await writer->write_async_from(data);
+    }
+
     co_return handle.write_from(data);
 }
 
@@ -433,6 +567,20 @@ void Handle::set_console_mode(DWORD mode) {
         fail("Failed to set console mode");
     }
 }
+
+COORD Handle::console_window_size() const {
+    CONSOLE_SCREEN_BUFFER_INFO info{};
+    bool success = GetConsoleScreenBufferInfo(raw(), &info);
+
+    if (!success) {
+        fail("Failed to get console screen buffer info");
+    }
+
+    return COORD{
+        .X = (SHORT)(info.srWindow.Right - info.srWindow.Left + 1),
+        .Y = (SHORT)(info.srWindow.Bottom - info.srWindow.Top + 1),
+    };
+}
 #pragma endregion Console
 
 }  // namespace abel
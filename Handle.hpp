@@ -11,6 +11,7 @@
 #include <optional>
 #include <concepts>
 #include <memory>
+#include <string>
 
 
 namespace abel {
@@ -22,6 +23,7 @@ class AIO;
 
 class ConsoleAsyncIO;
 class ConsoleEventPeek;
+class ConsoleWriter;
 
 // Handle is a non-owning wrapper around a WinAPI HANDLE
 class Handle : public IOBase {
@@ -90,12 +92,34 @@ public:
     AIO<eof<size_t>> write_async_from(std::span<const unsigned char> data);
 #pragma endregion IO
 
+#pragma region File
+    // Thin wrapper over CreateFileA. The default flags open an existing file for synchronous reading.
+    static OwningHandle open_file(
+        const std::string &path,
+        DWORD access = GENERIC_READ,
+        DWORD creation = OPEN_EXISTING,
+        DWORD shareMode = FILE_SHARE_READ,
+        DWORD flags = FILE_ATTRIBUTE_NORMAL
+    );
+
+    uint64_t file_size() const;
+
+    // Moves the file pointer to an absolute position
+    void seek(uint64_t position);
+#pragma endregion File
+
 #pragma region Synchronization
     static OwningHandle create_event(bool manualReset = false, bool initialState = false, bool inheritHandle = false);
 
     // TODO: CRITICAL_SECTION appears to be a lighter-weight single-process alternative
     static OwningHandle create_mutex(bool initialOwner = false, bool inheritHandle = false);
 
+    // Manual-reset by default, so that it can be awaited via event_signaled
+    static OwningHandle create_timer(bool manualReset = true);
+
+    // Arms a waitable timer to fire once after the delay. Also resets it.
+    void set_timer(DWORD miliseconds);
+
     // Sets an event
     void signal();
 
@@ -162,13 +186,25 @@ public:
 
     INPUT_RECORD read_console_input();
 
+    // Copies as many records as fit from the front of the input queue, without removing them. Doesn't block.
+    size_t peek_console_input(std::span<INPUT_RECORD> records);
+
+    // Removes records from the front of the input queue. Blocks until there's at least one.
+    size_t read_console_input(std::span<INPUT_RECORD> records);
+
     size_t console_input_queue_size() const;
 
-    ConsoleAsyncIO console_async_io();
+    // With local_echo, whatever is read gets written straight to the console output as well.
+    // With report_resize, window size changes are read as CSI 8 ; rows ; cols t (needs ENABLE_WINDOW_INPUT).
+    // With a writer, writes and the echo go through it instead of straight to the console.
+    ConsoleAsyncIO console_async_io(bool local_echo = true, bool report_resize = false, ConsoleWriter *writer = nullptr);
 
     DWORD get_console_mode() const;
 
     void set_console_mode(DWORD mode);
+
+    // Size of the visible part of the console screen buffer, as (columns, rows)
+    COORD console_window_size() const;
 #pragma endregion Console
 };
 
@@ -215,10 +251,18 @@ public:
 
 class ConsoleAsyncIO : public IOBase {
 protected:
+    // Records taken from the input queue at once. A paste arrives as a key down and a key up per character.
+    static constexpr size_t input_batch = 512;
+
     Handle handle;
+    bool local_echo;
+    bool report_resize;
+    // Reused across reads, and shared by copies, which are expected to take turns
+    std::shared_ptr<INPUT_RECORD[]> records{};
+    ConsoleWriter *writer;
 
 public:
-    ConsoleAsyncIO(Handle handle) : handle(handle) {}
+    ConsoleAsyncIO(Handle handle, bool local_echo = true, bool report_resize = false, ConsoleWriter *writer = nullptr) : handle(handle), local_echo(local_echo), report_resize(report_resize), writer(writer) {}
 
     ConsoleAsyncIO(const ConsoleAsyncIO &) = default;
     ConsoleAsyncIO &operator=(const ConsoleAsyncIO &) = default;
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+
+namespace abel {
+
+// Derive T from this to make it linkable into an IntrusiveList<T>
+template <typename T>
+class IntrusiveListNode {
+private:
+    T *prev_{nullptr};
+    T *next_{nullptr};
+
+    template <typename>
+    friend class IntrusiveList;
+};
+
+// A doubly-linked list threaded through the elements themselves, for O(1) removal without any lookup.
+// Doesn't own the elements, nor synchronize access; an element may only be in one list at a time.
+template <typename T>
+class IntrusiveList {
+protected:
+    T *head{nullptr};
+    T *tail{nullptr};
+    size_t size_{0};
+
+    static IntrusiveListNode<T> &node(T *element) noexcept {
+        return *static_cast<IntrusiveListNode<T> *>(element);
+    }
+
+public:
+    IntrusiveList() = default;
+
+    IntrusiveList(const IntrusiveList &) = delete;
+    IntrusiveList &operator=(const IntrusiveList &) = delete;
+
+    void push_front(T *element) noexcept {
+        node(element).prev_ = nullptr;
+        node(element).next_ = head;
+        if (head) {
+            node(head).prev_ = element;
+        } else {
+            tail = element;
+        }
+        head = element;
+        ++size_;
+    }
+
+    void push_back(T *element) noexcept {
+        node(element).prev_ = tail;
+        node(element).next_ = nullptr;
+        if (tail) {
+            node(tail).next_ = element;
+        } else {
+            head = element;
+        }
+        tail = element;
+        ++size_;
+    }
+
+    // nullptr if empty
+    T *front() const noexcept {
+        return head;
+    }
+
+    void remove(T *element) noexcept {
+        auto &links = node(element);
+        if (links.prev_) {
+            node(links.prev_).next_ = links.next_;
+        } else {
+            head = links.next_;
+        }
+        if (links.next_) {
+            node(links.next_).prev_ = links.prev_;
+        } else {
+            tail = links.prev_;
+        }
+
+        links.prev_ = links.next_ = nullptr;
+        --size_;
+    }
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    // `f` must not remove elements other than the one it's given
+    template <typename F>
+    void for_each(F &&f) {
+        for (T *element = head; element;) {
+            T *next = node(element).next_;
+            f(*element);
+            element = next;
+        }
+    }
+};
+
+}  // namespace abel
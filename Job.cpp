@@ -0,0 +1,138 @@
+#include "Job.hpp"
+
+#include "Error.hpp"
+
+#include <cstdio>
+
+namespace abel {
+
+Job Job::create(JobLimits limits) {
+    Job result{};
+    result.limits_ = limits;
+
+    result.object = OwningHandle{CreateJobObjectA(nullptr, nullptr)};
+    if (!result.object) {
+        fail("Failed to create job object");
+    }
+
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION info{};
+    info.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+
+    if (limits.cpu_seconds) {
+        info.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_TIME;
+        // In 100 ns units
+        info.BasicLimitInformation.PerJobUserTimeLimit.QuadPart = (LONGLONG)limits.cpu_seconds * 10'000'000;
+    }
+    if (limits.memory_mb) {
+        info.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_JOB_MEMORY;
+        info.JobMemoryLimit = (SIZE_T)limits.memory_mb * 1024 * 1024;
+    }
+    if (limits.processes) {
+        info.BasicLimitInformation.LimitFlags |= JOB_OBJECT_LIMIT_ACTIVE_PROCESS;
+        info.BasicLimitInformation.ActiveProcessLimit = limits.processes;
+    }
+
+    if (!SetInformationJobObject(result.object.raw(), JobObjectExtendedLimitInformation, &info, sizeof(info))) {
+        fail("Failed to set job limits");
+    }
+
+    result.port = OwningHandle{CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1)};
+    if (!result.port) {
+        fail("Failed to create job completion port");
+    }
+
+    JOBOBJECT_ASSOCIATE_COMPLETION_PORT association{
+        .CompletionKey = result.object.raw(),
+        .CompletionPort = result.port.raw(),
+    };
+
+    if (!SetInformationJobObject(result.object.raw(), JobObjectAssociateCompletionPortInformation, &association, sizeof(association))) {
+        fail("Failed to associate job completion port");
+    }
+
+    return result;
+}
+
+JobUsage Job::usage() const {
+    JOBOBJECT_BASIC_AND_IO_ACCOUNTING_INFORMATION accounting{};
+    if (!QueryInformationJobObject(object.raw(), JobObjectBasicAndIoAccountingInformation, &accounting, sizeof(accounting), nullptr)) {
+        fail("Failed to query job accounting");
+    }
+
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits{};
+    if (!QueryInformationJobObject(object.raw(), JobObjectExtendedLimitInformation, &limits, sizeof(limits), nullptr)) {
+        fail("Failed to query job limits");
+    }
+
+    auto &basic = accounting.BasicInfo;
+    return JobUsage{
+        .cpu_seconds = (basic.TotalUserTime.QuadPart + basic.TotalKernelTime.QuadPart) / 1e7,
+        .peak_memory_bytes = limits.PeakJobMemoryUsed,
+        .active_processes = basic.ActiveProcesses,
+        .total_processes = basic.TotalProcesses,
+    };
+}
+
+std::optional<JobLimit> Job::poll_limit() {
+    DWORD message = 0;
+    ULONG_PTR key = 0;
+    LPOVERLAPPED detail = nullptr;
+
+    // Skips past the notifications that aren't about limits, e.g. processes starting and exiting
+    while (GetQueuedCompletionStatus(port.raw(), &message, &key, &detail, 0)) {
+        std::optional<JobLimit> limit{};
+
+        switch (message) {
+        case JOB_OBJECT_MSG_END_OF_JOB_TIME:
+            limit = JobLimit::cpu_time;
+            break;
+
+        case JOB_OBJECT_MSG_JOB_MEMORY_LIMIT:
+            limit = JobLimit::memory;
+            break;
+
+        case JOB_OBJECT_MSG_ACTIVE_PROCESS_LIMIT:
+            limit = JobLimit::processes;
+            break;
+
+        default:
+            continue;
+        }
+
+        uint8_t bit = 1 << (uint8_t)*limit;
+        if (!(reported & bit)) {
+            reported |= bit;
+            return limit;
+        }
+    }
+
+    return std::nullopt;
+}
+
+void Job::terminate(UINT exit_code) {
+    if (!TerminateJobObject(object.raw(), exit_code)) {
+        fail("Failed to terminate job");
+    }
+}
+
+std::string Job::describe(JobLimit limit) const {
+    char text[128] = {};
+
+    switch (limit) {
+    case JobLimit::cpu_time:
+        snprintf(text, sizeof(text), "CPU time limit of %u s: everything the session ran has been terminated", limits_.cpu_seconds);
+        break;
+
+    case JobLimit::memory:
+        snprintf(text, sizeof(text), "memory limit of %u MiB: allocations beyond it fail", limits_.memory_mb);
+        break;
+
+    case JobLimit::processes:
+        snprintf(text, sizeof(text), "limit of %u processes: starting more fails", limits_.processes);
+        break;
+    }
+
+    return text;
+}
+
+}  // namespace abel
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Handle.hpp"
+
+#include <Windows.h>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace abel {
+
+// Limits for everything a session runs. 0 means unlimited.
+struct JobLimits {
+    // User mode CPU time, summed over all processes. The job is terminated once it's used up.
+    uint32_t cpu_seconds{0};
+    // Committed memory, summed over all processes. Allocations beyond it fail.
+    uint32_t memory_mb{0};
+    // Processes running at once. Starting more fails.
+    uint32_t processes{0};
+};
+
+struct JobUsage {
+    // User and kernel time, summed over all processes, including the ones that have exited
+    double cpu_seconds{0};
+    uint64_t peak_memory_bytes{0};
+    uint32_t active_processes{0};
+    uint32_t total_processes{0};
+};
+
+enum class JobLimit : uint8_t {
+    cpu_time,
+    memory,
+    processes,
+};
+
+// A job object confining a process and everything it starts. Whatever is still running in it is killed
+// when the job is destroyed, so nothing a session started outlives it.
+class Job {
+protected:
+    OwningHandle object{};
+    // Receives the job's notifications, including limit hits
+    OwningHandle port{};
+    JobLimits limits_{};
+    // Bit per JobLimit, so that each is only reported once
+    uint8_t reported{0};
+
+public:
+    Job() = default;
+
+    Job(const Job &) = delete;
+    Job &operator=(const Job &) = delete;
+    Job(Job &&) noexcept = default;
+    Job &operator=(Job &&) noexcept = default;
+
+    static Job create(JobLimits limits);
+
+    explicit operator bool() const noexcept {
+        return (bool)object;
+    }
+
+    // For Process::spawn, which puts the process into the job as it's created
+    Handle handle() const noexcept {
+        return object;
+    }
+
+    const JobLimits &limits() const noexcept {
+        return limits_;
+    }
+
+    JobUsage usage() const;
+
+    // The next limit the job has run into, if there is one that hasn't been returned before. Doesn't block.
+    std::optional<JobLimit> poll_limit();
+
+    // Kills every process in the job
+    void terminate(UINT exit_code = (UINT)-1);
+
+    // A line for the session, e.g. "memory limit of 512 MiB: allocations beyond it fail"
+    std::string describe(JobLimit limit) const;
+};
+
+}  // namespace abel
@@ -0,0 +1,297 @@
+#include "Load.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+
+namespace abel::load {
+
+#pragma region Script
+void Script::add(Step step) {
+    if (step.weight == 0) {
+        return;
+    }
+
+    total_weight += step.weight;
+    steps.push_back(std::move(step));
+}
+
+Script Script::standard() {
+    Script script{};
+
+    script.add({.kind = Step::Kind::type, .text = "echo hello", .weight = 6});
+    script.add({.kind = Step::Kind::type, .text = "cd", .weight = 4});
+    script.add({.kind = Step::Kind::type, .text = "dir", .weight = 4});
+    script.add({.kind = Step::Kind::type, .text = "type C:\\Windows\\win.ini", .weight = 2});
+    // Bursts of a few hundred KiB
+    script.add({.kind = Step::Kind::type, .text = "dir /s C:\\Windows\\System32\\drivers", .weight = 1});
+    script.add({.kind = Step::Kind::type, .text = "set", .weight = 2});
+    script.add({.kind = Step::Kind::idle, .idle_ms = 3'000, .weight = 6});
+    script.add({.kind = Step::Kind::idle, .idle_ms = 15'000, .weight = 1});
+
+    return script;
+}
+
+Script Script::parse(std::string_view text) {
+    Script script{};
+
+    unsigned line_number = 0;
+    while (!text.empty()) {
+        size_t end = std::min(text.find('\n'), text.size());
+        std::string_view line = text.substr(0, end);
+        text.remove_prefix(std::min(end + 1, text.size()));
+        ++line_number;
+
+        if (line.ends_with('\r')) {
+            line.remove_suffix(1);
+        }
+        if (line.empty() || line.starts_with('#')) {
+            continue;
+        }
+
+        auto invalid = [&]() {
+            fail("Invalid load script, line " + std::to_string(line_number) + ": expected `<weight> type <command>` or `<weight> idle <ms>`");
+        };
+
+        Step step{};
+        auto [weight_end, weight_error] = std::from_chars(line.data(), line.data() + line.size(), step.weight);
+        if (weight_error != std::errc{}) {
+            invalid();
+        }
+        line.remove_prefix(weight_end - line.data());
+
+        if (line.starts_with(" type ")) {
+            step.kind = Step::Kind::type;
+            step.text = std::string{line.substr(6)};
+        } else if (line.starts_with(" idle ")) {
+            step.kind = Step::Kind::idle;
+            line.remove_prefix(6);
+
+            auto [idle_end, idle_error] = std::from_chars(line.data(), line.data() + line.size(), step.idle_ms);
+            if (idle_error != std::errc{} || idle_end != line.data() + line.size()) {
+                invalid();
+            }
+        } else {
+            invalid();
+        }
+
+        script.add(std::move(step));
+    }
+
+    if (script.total_weight == 0) {
+        fail("The load script has no steps");
+    }
+
+    return script;
+}
+
+Script Script::load_file(const std::string &path) {
+    auto file = Handle::open_file(path);
+
+    std::string contents(file.file_size(), '\0');
+    size_t size = 0;
+    while (size < contents.size()) {
+        auto result = file.read_into({(unsigned char *)contents.data() + size, contents.size() - size});
+        size += result.value;
+        if (result.is_eof) {
+            break;
+        }
+    }
+    contents.resize(size);
+
+    return parse(contents);
+}
+
+const Step &Script::pick(std::mt19937 &rng) const {
+    unsigned choice = std::uniform_int_distribution<unsigned>{0, total_weight - 1}(rng);
+
+    for (const auto &step : steps) {
+        if (choice < step.weight) {
+            return step;
+        }
+        choice -= step.weight;
+    }
+
+    return steps.back();
+}
+#pragma endregion Script
+
+#pragma region Session
+void Session::sent(unsigned char key) {
+    ++keystrokes;
+    pending.push_back({key, Clock::now()});
+}
+
+void Session::received(std::span<const unsigned char> data) {
+    auto now = Clock::now();
+
+    if (!data.empty()) {
+        if (bytes_received == 0) {
+            first_output = now;
+            ready.signal();
+        }
+        bytes_received += data.size();
+        last_output = now;
+    }
+
+    while (!pending.empty() && now - pending.front().sent > expire_after) {
+        pending.pop_front();
+        ++expired;
+    }
+
+    for (unsigned char ch : data) {
+        // A pseudo console moves the cursor around and sets colors between the characters it draws
+        switch (sequence) {
+        case Sequence::escape:
+            sequence = ch == '[' ? Sequence::csi : ch == ']' ? Sequence::osc : Sequence::none;
+            continue;
+
+        case Sequence::csi:
+            if (0x40 <= ch && ch <= 0x7e) {
+                sequence = Sequence::none;
+            }
+            continue;
+
+        case Sequence::osc:
+            // Ended by BEL, or by ST, whose ESC is taken for the start of a sequence and its backslash skipped
+            if (ch == '\a' || ch == '\x1b') {
+                sequence = ch == '\x1b' ? Sequence::escape : Sequence::none;
+            }
+            continue;
+
+        case Sequence::none:
+            break;
+        }
+
+        if (ch == '\x1b') {
+            sequence = Sequence::escape;
+            continue;
+        }
+
+        if (pending.empty()) {
+            continue;
+        }
+
+        // Enter comes back as a line break; other control characters, like BEL, draw nothing
+        unsigned char key = pending.front().key;
+        bool line_break = ch == '\r' || ch == '\n';
+        if (key == '\r' ? !line_break : ch != key) {
+            if (!line_break && ch >= 0x20) {
+                pending.pop_front();
+                ++unmatched;
+            }
+            continue;
+        }
+
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(now - pending.front().sent).count();
+        latencies_us.push_back((uint32_t)std::clamp<int64_t>(us, 0, UINT32_MAX));
+        pending.pop_front();
+        ++echoed;
+    }
+}
+
+void Session::fail(const std::exception &e) {
+    if (failure.empty()) {
+        failure = e.what();
+    }
+    closed = true;
+}
+
+DWORD jitter(std::mt19937 &rng, double average_ms, double min, double max) {
+    return (DWORD)std::uniform_real_distribution<double>{average_ms * min, average_ms * max}(rng);
+}
+#pragma endregion Session
+
+#pragma region Report
+void report(std::span<const std::unique_ptr<Session>> sessions, double seconds) {
+    std::vector<uint32_t> latencies{};
+    std::vector<double> throughputs{};
+    uint64_t keystrokes = 0;
+    uint64_t expired = 0;
+    uint64_t unmatched = 0;
+    uint64_t bytes = 0;
+    size_t failed = 0;
+
+    for (const auto &session : sessions) {
+        latencies.insert(latencies.end(), session->latencies_us.begin(), session->latencies_us.end());
+        keystrokes += session->keystrokes;
+        expired += session->expired;
+        unmatched += session->unmatched;
+        bytes += session->bytes_received;
+        failed += !session->failure.empty();
+
+        double active = std::chrono::duration<double>(session->last_output - session->first_output).count();
+        throughputs.push_back(active > 0 ? session->bytes_received / active : 0);
+    }
+
+    std::ranges::sort(latencies);
+    auto percentile_ms = [&](double p) {
+        if (latencies.empty()) {
+            return 0.0;
+        }
+        size_t rank = std::min(latencies.size() - 1, (size_t)(p / 100 * latencies.size()));
+        return latencies[rank] / 1000.0;
+    };
+
+    printf("Ran %zu sessions for %.1f s: %llu keystrokes, %zu echoed, %llu mixed into other output, %llu expired\n", sessions.size(), seconds, keystrokes, latencies.size(), unmatched, expired);
+    printf(
+        "Keystroke to echo: p50 %.1f ms, p90 %.1f ms, p99 %.1f ms, max %.1f ms\n",
+        percentile_ms(50),
+        percentile_ms(90),
+        percentile_ms(99),
+        latencies.empty() ? 0.0 : latencies.back() / 1000.0
+    );
+
+    auto sorted = throughputs;
+    std::ranges::sort(sorted);
+    if (!sorted.empty()) {
+        printf(
+            "Output per session: min %.1f KiB/s, median %.1f KiB/s, max %.1f KiB/s; %.1f MiB in total\n",
+            sorted.front() / 1024,
+            sorted[sorted.size() / 2] / 1024,
+            sorted.back() / 1024,
+            bytes / 1048576.0
+        );
+    }
+
+    // Only a handful of sessions fit in a table
+    if (sessions.size() <= 20) {
+        printf("%8s %10s %10s %10s %12s %12s\n", "session", "keys", "echoed", "p50 ms", "p99 ms", "KiB/s");
+        for (size_t i = 0; i < sessions.size(); ++i) {
+            auto own = sessions[i]->latencies_us;
+            std::ranges::sort(own);
+            auto own_ms = [&](double p) {
+                return own.empty() ? 0.0 : own[std::min(own.size() - 1, (size_t)(p / 100 * own.size()))] / 1000.0;
+            };
+
+            printf(
+                "%8u %10llu %10llu %10.1f %12.1f %12.1f\n",
+                sessions[i]->index,
+                sessions[i]->keystrokes,
+                sessions[i]->echoed,
+                own_ms(50),
+                own_ms(99),
+                throughputs[i] / 1024
+            );
+        }
+    }
+
+    if (failed) {
+        printf("%zu sessions failed:\n", failed);
+
+        size_t shown = 0;
+        for (const auto &session : sessions) {
+            if (session->failure.empty()) {
+                continue;
+            }
+            if (++shown > 10) {
+                printf("  ...\n");
+                break;
+            }
+            printf("  session %u: %s\n", session->index, session->failure.c_str());
+        }
+    }
+}
+#pragma endregion Report
+
+}  // namespace abel::load
@@ -0,0 +1,197 @@
+#pragma once
+
+#include "Concurrency.hpp"
+#include "Handle.hpp"
+#include "IOBase.hpp"
+#include "Error.hpp"
+
+#include <Windows.h>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace abel {
+
+// Synthetic users, for capacity planning: many shell sessions driven from a single event loop, each typing from
+// a weighted mix of commands and idle periods, while the time from every keystroke to its echo is measured.
+// Nothing here touches a console, so it runs just as well from a scheduled task or over a redirected ssh.
+// Only a server running its shells on a pseudo console echoes every keystroke as it's typed.
+namespace load {
+
+using Clock = std::chrono::steady_clock;
+
+struct Step {
+    enum class Kind : uint8_t {
+        // Types `text`, followed by Enter
+        type,
+        // Does nothing for `idle_ms`
+        idle,
+    };
+
+    Kind kind{Kind::type};
+    std::string text{};
+    DWORD idle_ms{0};
+    unsigned weight{1};
+};
+
+class Script {
+protected:
+    std::vector<Step> steps{};
+    unsigned total_weight{0};
+
+public:
+    Script() = default;
+
+    void add(Step step);
+
+    // Short commands, a few with bursty output, and idle periods of a user reading or thinking
+    static Script standard();
+
+    // One step per line, as `<weight> type <command>` or `<weight> idle <ms>`. Empty lines and ones starting with # are skipped.
+    static Script parse(std::string_view text);
+
+    static Script load_file(const std::string &path);
+
+    // With a probability proportional to the step's weight
+    const Step &pick(std::mt19937 &rng) const;
+};
+
+struct Options {
+    unsigned sessions{1};
+    unsigned duration_s{60};
+    // Average typing speed, in keystrokes per second
+    double cps{8};
+};
+
+// Shared by a session's two coroutines
+struct Session {
+    struct Pending {
+        unsigned char key;
+        Clock::time_point sent;
+    };
+
+    // Keystrokes not echoed by then are given up on, e.g. because the shell was busy with a command's output
+    static constexpr auto expire_after = std::chrono::seconds(5);
+
+    unsigned index;
+    std::mt19937 rng;
+    // Signaled by the first output, i.e. once the shell is up, since typing into the void would skew the latencies
+    OwningHandle ready = Handle::create_event(true, false);
+    OwningHandle timer = Handle::create_timer();
+    // Waiting for their echo, oldest first
+    std::deque<Pending> pending{};
+    bool closed{false};
+
+    // Where the output is in a VT sequence, which received() skips
+    enum class Sequence : uint8_t {
+        none,
+        escape,
+        csi,
+        osc,
+    };
+    Sequence sequence{Sequence::none};
+
+    uint64_t keystrokes{0};
+    uint64_t echoed{0};
+    uint64_t expired{0};
+    // Whose echo didn't come first, e.g. typed ahead while a command's output was streaming
+    uint64_t unmatched{0};
+    uint64_t bytes_received{0};
+    std::vector<uint32_t> latencies_us{};
+    Clock::time_point first_output{};
+    Clock::time_point last_output{};
+    // Why the session ended early, if it did
+    std::string failure{};
+
+    explicit Session(unsigned index) :
+        index{index},
+        rng{index} {
+    }
+
+    void sent(unsigned char key);
+
+    // Matches the output against the oldest pending keystroke. Only a key that is the very next character drawn,
+    // VT sequences aside, counts as echoed; anything else drawn first means the echo is mixed up with other output,
+    // and the key isn't timed at all, rather than matched against whatever byte happens to be equal.
+    void received(std::span<const unsigned char> data);
+
+    void fail(const std::exception &e);
+};
+
+// Waits between `min` and `max` times the average
+DWORD jitter(std::mt19937 &rng, double average_ms, double min = 0.5, double max = 1.5);
+
+template <async_writable W>
+AIO<void> type_script(W to_server, const Script &script, const Options &options, Session &session, Clock::time_point stop_at) {
+    try {
+        co_await event_signaled{session.ready};
+
+        // So that the sessions don't all type in lockstep
+        session.timer.set_timer(jitter(session.rng, 1000, 0, 1));
+        co_await event_signaled{session.timer};
+
+        double key_ms = 1000 / options.cps;
+
+        while (!session.closed && Clock::now() < stop_at) {
+            const Step &step = script.pick(session.rng);
+
+            if (step.kind == Step::Kind::idle) {
+                session.timer.set_timer(step.idle_ms);
+                co_await event_signaled{session.timer};
+                continue;
+            }
+
+            for (char ch : step.text + "\r") {
+                unsigned char key = (unsigned char)ch;
+                session.sent(key);
+                co_await to_server.write_async_full_from({&key, 1});
+
+                session.timer.set_timer(jitter(session.rng, key_ms));
+                co_await event_signaled{session.timer};
+            }
+        }
+
+        // Lets the server end the session the way a user would, and the output coroutine see it to the end
+        if (!session.closed) {
+            static constexpr unsigned char bye[] = {'e', 'x', 'i', 't', '\r'};
+            co_await to_server.write_async_full_from(bye);
+        }
+    } catch (const std::exception &e) {
+        session.fail(e);
+    }
+}
+
+template <async_readable R>
+AIO<void> receive_echoes(R from_server, Session &session) {
+    try {
+        auto buffer = std::make_unique<unsigned char[]>(4096);
+
+        while (!session.closed) {
+            auto read = co_await from_server.read_async_into({buffer.get(), 4096});
+            session.received({buffer.get(), read.value});
+
+            if (read.is_eof) {
+                break;
+            }
+        }
+    } catch (const std::exception &e) {
+        session.fail(e);
+    }
+
+    session.closed = true;
+    // In case it's still waiting for the shell
+    session.ready.signal();
+}
+
+// Prints the latency distribution over all keystrokes, the spread of the sessions' throughput, and any failures
+void report(std::span<const std::unique_ptr<Session>> sessions, double seconds);
+
+}  // namespace load
+
+}  // namespace abel
@@ -0,0 +1,627 @@
+#include "Log.hpp"
+
+#include "Handle.hpp"
+#include "Thread.hpp"
+#include "Socket.hpp"
+#include "Error.hpp"
+
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+
+namespace abel::log {
+
+namespace {
+
+struct StoredField {
+    const char *key;
+    Field::Type type;
+    union {
+        int64_t int_value;
+        uint64_t uint_value;
+        double float_value;
+        // Into Record::text
+        struct {
+            uint16_t offset;
+            uint16_t size;
+        } text;
+    };
+};
+
+// Fixed-size, so that the queue needs no allocations. Longer messages and text fields are cut short.
+struct Record {
+    static constexpr size_t max_fields = 8;
+    static constexpr size_t text_capacity = 256;
+
+    FILETIME time;
+    DWORD tid;
+    Level level;
+    Category category;
+    uint8_t field_count;
+    uint16_t message_size;
+    uint16_t text_size;
+    StoredField fields[max_fields];
+    char text[text_capacity];
+
+    std::string_view message() const noexcept {
+        return {text, message_size};
+    }
+
+    std::string_view field_text(const StoredField &field) const noexcept {
+        return {text + field.text.offset, field.text.size};
+    }
+
+    // Returns where the copy starts
+    uint16_t append_text(std::string_view value) noexcept {
+        uint16_t offset = text_size;
+        size_t size = std::min(value.size(), text_capacity - text_size);
+        memcpy(text + text_size, value.data(), size);
+        text_size += (uint16_t)size;
+        return offset;
+    }
+};
+
+// A bounded multi-producer queue after Dmitry Vyukov's: each cell's sequence number says whose turn it is, so that
+// producers only contend on the enqueue position, and the single consumer doesn't need to touch it at all
+class Queue {
+protected:
+    struct Cell {
+        std::atomic<uint64_t> sequence;
+        Record record;
+    };
+
+    static constexpr size_t capacity = 4096;
+    static_assert(std::has_single_bit(capacity));
+
+    std::unique_ptr<Cell[]> cells = std::make_unique<Cell[]>(capacity);
+    alignas(64) std::atomic<uint64_t> enqueue_pos{0};
+    alignas(64) uint64_t dequeue_pos{0};
+
+public:
+    Queue() {
+        for (size_t i = 0; i < capacity; ++i) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // Returns nullptr if the queue is full. The record is published by commit().
+    Record *claim(uint64_t &position) noexcept {
+        position = enqueue_pos.load(std::memory_order_relaxed);
+
+        while (true) {
+            Cell &cell = cells[position & (capacity - 1)];
+            int64_t diff = (int64_t)cell.sequence.load(std::memory_order_acquire) - (int64_t)position;
+
+            if (diff == 0) {
+                if (enqueue_pos.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    return &cell.record;
+                }
+            } else if (diff < 0) {
+                return nullptr;
+            } else {
+                position = enqueue_pos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void commit(uint64_t position) noexcept {
+        cells[position & (capacity - 1)].sequence.store(position + 1, std::memory_order_release);
+    }
+
+    // Consumer only. Returns nullptr if the next record isn't there yet.
+    const Record *peek() const noexcept {
+        const Cell &cell = cells[dequeue_pos & (capacity - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos + 1) {
+            return nullptr;
+        }
+        return &cell.record;
+    }
+
+    // Consumer only, after peek()
+    void pop() noexcept {
+        cells[dequeue_pos & (capacity - 1)].sequence.store(dequeue_pos + capacity, std::memory_order_release);
+        ++dequeue_pos;
+    }
+
+    uint64_t enqueued() const noexcept {
+        return enqueue_pos.load(std::memory_order_relaxed);
+    }
+
+    // Consumer only, once everything popped so far has been written out
+    void mark_consumed() noexcept {
+        consumed_.store(dequeue_pos, std::memory_order_release);
+    }
+
+    uint64_t consumed() const noexcept {
+        return consumed_.load(std::memory_order_acquire);
+    }
+
+    bool filling_up(uint64_t position) const noexcept {
+        return position - consumed_.load(std::memory_order_relaxed) > capacity / 2;
+    }
+
+protected:
+    alignas(64) std::atomic<uint64_t> consumed_{0};
+};
+
+// Fixed one-second windows, rather than a token bucket, since the limits only need to stop floods
+struct alignas(64) RateLimit {
+    std::atomic<uint64_t> window{0};
+    std::atomic<uint32_t> count{0};
+    std::atomic<uint32_t> per_second{100};
+    std::atomic<uint64_t> suppressed{0};
+};
+
+constexpr const char *level_names[] = {"debug", "info", "warning", "error"};
+constexpr const char *category_names[] = {"service", "session", "admission", "pool", "usage"};
+static_assert(std::size(category_names) == category_count);
+
+// Leaked on purpose, like the writer: threads may still log while static destructors run at exit
+Queue &queue = *new Queue{};
+std::array<RateLimit, category_count> rate_limits{};
+std::atomic<uint64_t> dropped{0};
+std::atomic<uint64_t> written{0};
+
+#pragma region Output
+void append_time(std::string &out, FILETIME time) {
+    SYSTEMTIME utc{};
+    FileTimeToSystemTime(&time, &utc);
+
+    char buffer[32] = {};
+    int size = snprintf(
+        buffer,
+        sizeof(buffer),
+        "%04u-%02u-%02uT%02u:%02u:%02u.%03uZ",
+        utc.wYear,
+        utc.wMonth,
+        utc.wDay,
+        utc.wHour,
+        utc.wMinute,
+        utc.wSecond,
+        utc.wMilliseconds
+    );
+    out.append(buffer, (size_t)std::max(size, 0));
+}
+
+// Quoted only if it has to be, the way logfmt does it
+void append_value(std::string &out, std::string_view value) {
+    bool quote = value.empty() || value.find_first_of(" =\"\\\r\n\t") != std::string_view::npos;
+    if (!quote) {
+        out += value;
+        return;
+    }
+
+    out += '"';
+    for (char ch : value) {
+        switch (ch) {
+        case '"':
+        case '\\':
+            out += '\\';
+            out += ch;
+            break;
+        case '\r':
+            out += "\\r";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        case '\t':
+            out += "\\t";
+            break;
+        default:
+            out += ch;
+        }
+    }
+    out += '"';
+}
+
+// `<level> <category>: <message> key=value...`, without the time or a line break
+void append_record(std::string &out, const Record &record) {
+    out += level_names[(size_t)record.level];
+    out += ' ';
+    out += category_names[(size_t)record.category];
+    out += ": ";
+    out += record.message();
+
+    for (size_t i = 0; i < record.field_count; ++i) {
+        const auto &field = record.fields[i];
+        out += ' ';
+        out += field.key;
+        out += '=';
+
+        char buffer[32] = {};
+        int size = 0;
+        switch (field.type) {
+        case Field::Type::int_:
+            size = snprintf(buffer, sizeof(buffer), "%lld", field.int_value);
+            break;
+        case Field::Type::uint_:
+            size = snprintf(buffer, sizeof(buffer), "%llu", field.uint_value);
+            break;
+        case Field::Type::float_:
+            size = snprintf(buffer, sizeof(buffer), "%.6g", field.float_value);
+            break;
+        case Field::Type::text:
+            append_value(out, record.field_text(field));
+            continue;
+        }
+        out.append(buffer, (size_t)std::max(size, 0));
+    }
+}
+
+class Output {
+protected:
+    Config config{};
+    OwningHandle file{};
+    OwningSocket syslog{};
+    HANDLE event_source{nullptr};
+    std::string hostname{};
+    // Scratch space
+    std::string batch{};
+    std::string line{};
+
+    void open_syslog() {
+        std::string_view target = config.target;
+        std::string host{target};
+        std::string port = "514";
+        if (auto colon = target.rfind(':'); colon != std::string_view::npos) {
+            host = std::string{target.substr(0, colon)};
+            port = std::string{target.substr(colon + 1)};
+        }
+
+        addrinfo hints{.ai_family = AF_INET, .ai_socktype = SOCK_DGRAM, .ai_protocol = IPPROTO_UDP};
+        addrinfo *address = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &address) != 0 || !address) {
+            fail_ws("Failed to resolve the syslog server");
+        }
+
+        syslog = OwningSocket(WSASocketA(AF_INET, SOCK_DGRAM, IPPROTO_UDP, nullptr, 0, WSA_FLAG_NO_HANDLE_INHERIT)).validate();
+        int status = ::connect(syslog.raw(), address->ai_addr, (int)address->ai_addrlen);
+        freeaddrinfo(address);
+        if (status == SOCKET_ERROR) {
+            fail_ws("Failed to connect to the syslog server");
+        }
+
+        char name[MAX_COMPUTERNAME_LENGTH + 1] = {};
+        DWORD size = sizeof(name);
+        hostname = GetComputerNameA(name, &size) ? std::string{name, size} : "-";
+    }
+
+    void write_syslog(const Record &record) {
+        // Facility daemon; the severities of error, warning, informational and debug
+        constexpr int facility = 3;
+        constexpr int severities[] = {7, 6, 4, 3};
+
+        line.clear();
+        line += '<' + std::to_string(facility * 8 + severities[(size_t)record.level]) + ">1 ";
+        append_time(line, record.time);
+        line += ' ' + hostname + " RemoteCMD " + std::to_string(GetCurrentProcessId()) + " - - ";
+        append_record(line, record);
+
+        // Best effort, like syslog over UDP itself
+        send(syslog.raw(), line.data(), (int)line.size(), 0);
+    }
+
+    void write_event(const Record &record) {
+        constexpr WORD types[] = {EVENTLOG_INFORMATION_TYPE, EVENTLOG_INFORMATION_TYPE, EVENTLOG_WARNING_TYPE, EVENTLOG_ERROR_TYPE};
+
+        line.clear();
+        append_record(line, record);
+        const char *strings[] = {line.c_str()};
+
+        ReportEventA(event_source, types[(size_t)record.level], 0, 0, nullptr, 1, 0, strings, nullptr);
+    }
+
+public:
+    explicit Output(Config config_) :
+        config{std::move(config_)} {
+
+        switch (config.sink) {
+        case Sink::console:
+            break;
+
+        case Sink::file:
+            file = Handle::open_file(config.target, FILE_APPEND_DATA, OPEN_ALWAYS, FILE_SHARE_READ);
+            break;
+
+        case Sink::syslog:
+            open_syslog();
+            break;
+
+        case Sink::event_log:
+            event_source = RegisterEventSourceA(nullptr, config.target.c_str());
+            if (!event_source) {
+                fail("Failed to register the event source");
+            }
+            break;
+        }
+    }
+
+    Output(const Output &) = delete;
+    Output &operator=(const Output &) = delete;
+
+    ~Output() {
+        if (event_source) {
+            DeregisterEventSource(event_source);
+        }
+    }
+
+    // The text sinks collect the records into a batch, which finish() writes out at once
+    void add(const Record &record) {
+        switch (config.sink) {
+        case Sink::console:
+        case Sink::file:
+            append_time(batch, record.time);
+            batch += ' ';
+            append_record(batch, record);
+            batch += config.sink == Sink::file ? "\r\n" : "\n";
+            break;
+
+        case Sink::syslog:
+            write_syslog(record);
+            break;
+
+        case Sink::event_log:
+            write_event(record);
+            break;
+        }
+    }
+
+    void finish() {
+        if (batch.empty()) {
+            return;
+        }
+
+        try {
+            auto target = config.sink == Sink::file ? file.borrow() : Handle::get_stdout();
+            target.write_full_from({(const unsigned char *)batch.data(), batch.size()});
+        } catch (std::exception &) {
+            // Nowhere left to report it
+        }
+        batch.clear();
+    }
+};
+#pragma endregion Output
+
+#pragma region Writer
+class Writer {
+protected:
+    static constexpr DWORD flush_interval_ms = 100;
+    static constexpr size_t max_batch = 256;
+
+    std::mutex mutex{};
+    std::unique_ptr<Output> output{};
+    OwningHandle thread{};
+    std::atomic<bool> started_{false};
+
+    std::array<uint64_t, category_count> reported_suppressed{};
+    uint64_t reported_dropped{0};
+
+    void report_loss(Category category, uint64_t lost, std::string_view what) {
+        Record record{};
+        GetSystemTimeAsFileTime(&record.time);
+        record.tid = GetCurrentThreadId();
+        record.level = Level::warning;
+        record.category = category;
+        record.append_text(what);
+        record.message_size = record.text_size;
+        record.fields[0].key = "count";
+        record.fields[0].type = Field::Type::uint_;
+        record.fields[0].uint_value = lost;
+        record.field_count = 1;
+
+        output->add(record);
+    }
+
+    // What was dropped since the last time, as records of its own
+    void report_losses() {
+        for (size_t i = 0; i < category_count; ++i) {
+            uint64_t total = rate_limits[i].suppressed.load(std::memory_order_relaxed);
+            if (total != reported_suppressed[i]) {
+                report_loss((Category)i, total - reported_suppressed[i], "Messages suppressed by the rate limit");
+                reported_suppressed[i] = total;
+            }
+        }
+
+        uint64_t total = dropped.load(std::memory_order_relaxed);
+        if (total != reported_dropped) {
+            report_loss(Category::service, total - reported_dropped, "Messages dropped, since the log queue was full");
+            reported_dropped = total;
+        }
+    }
+
+    void run() {
+        while (true) {
+            wake.wait_timeout(flush_interval_ms);
+
+            std::lock_guard lock{mutex};
+
+            uint64_t count = 0;
+            while (const Record *record = queue.peek()) {
+                output->add(*record);
+                queue.pop();
+
+                if (++count % max_batch == 0) {
+                    output->finish();
+                }
+            }
+
+            report_losses();
+            output->finish();
+
+            written.fetch_add(count, std::memory_order_relaxed);
+            queue.mark_consumed();
+        }
+    }
+
+public:
+    // Producers only ring it for errors and when the queue is filling up; otherwise the writer comes by every flush_interval_ms
+    OwningHandle wake = Handle::create_event(false, false);
+
+    void configure(Config config) {
+        auto next = std::make_unique<Output>(config);
+        min_level = config.min_level;
+
+        std::lock_guard lock{mutex};
+        output = std::move(next);
+        if (!thread) {
+            thread = Thread::create<Writer, &Writer::run>(this).handle;
+            started_ = true;
+        }
+    }
+
+    bool started() const noexcept {
+        return started_;
+    }
+};
+
+// Leaked on purpose: its thread is never stopped, so it must outlive the static destructors, and whatever is
+// still queued by then is only written if someone calls flush()
+Writer &writer = *new Writer{};
+#pragma endregion Writer
+
+}  // namespace
+
+Config parse_target(std::string_view spec, std::string_view default_source) {
+    Config config{};
+
+    auto after = [&](std::string_view prefix) {
+        return spec.starts_with(prefix) && spec.size() > prefix.size() ? std::optional{spec.substr(prefix.size())} : std::nullopt;
+    };
+
+    if (spec.empty() || spec == "console") {
+        config.sink = Sink::console;
+    } else if (auto path = after("file:")) {
+        config.sink = Sink::file;
+        config.target = std::string{*path};
+    } else if (auto host = after("syslog:")) {
+        config.sink = Sink::syslog;
+        config.target = std::string{*host};
+    } else if (spec == "eventlog") {
+        config.sink = Sink::event_log;
+        config.target = std::string{default_source};
+    } else if (auto source = after("eventlog:")) {
+        config.sink = Sink::event_log;
+        config.target = std::string{*source};
+    } else {
+        fail("Invalid log target; expected console, file:<path>, syslog:<host>[:<port>] or eventlog[:<source>]");
+    }
+
+    return config;
+}
+
+void configure(Config config) {
+    writer.configure(std::move(config));
+}
+
+void set_rate_limit(Category category, unsigned per_second) {
+    rate_limits[(size_t)category].per_second.store(per_second, std::memory_order_relaxed);
+}
+
+void write(Level level, Category category, std::string_view message, std::initializer_list<Field> fields) noexcept {
+    if (level < min_level.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Whoever notices the new second first starts its count over; the others' increments may land on either side
+    auto &limit = rate_limits[(size_t)category];
+    uint64_t second = GetTickCount64() / 1000;
+    uint64_t window = limit.window.load(std::memory_order_relaxed);
+    if (window != second && limit.window.compare_exchange_strong(window, second, std::memory_order_relaxed)) {
+        limit.count.store(0, std::memory_order_relaxed);
+    }
+    if (limit.count.fetch_add(1, std::memory_order_relaxed) >= limit.per_second.load(std::memory_order_relaxed)) {
+        limit.suppressed.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    uint64_t position = 0;
+    Record *record = queue.claim(position);
+    if (!record) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    GetSystemTimeAsFileTime(&record->time);
+    record->tid = GetCurrentThreadId();
+    record->level = level;
+    record->category = category;
+    record->text_size = 0;
+    record->append_text(message);
+    record->message_size = record->text_size;
+    record->field_count = 0;
+
+    for (const auto &field : fields) {
+        if (record->field_count == Record::max_fields) {
+            break;
+        }
+
+        auto &stored = record->fields[record->field_count++];
+        stored.key = field.key;
+        stored.type = field.type;
+
+        switch (field.type) {
+        case Field::Type::int_:
+            stored.int_value = field.int_value;
+            break;
+        case Field::Type::uint_:
+            stored.uint_value = field.uint_value;
+            break;
+        case Field::Type::float_:
+            stored.float_value = field.float_value;
+            break;
+        case Field::Type::text:
+            stored.text.offset = record->append_text(field.text_value);
+            stored.text.size = record->text_size - stored.text.offset;
+            break;
+        }
+    }
+
+    queue.commit(position);
+
+    // Errors are usually followed by the process going away, and a full queue drops messages
+    if (level == Level::error || queue.filling_up(position)) {
+        SetEvent(writer.wake.raw());
+    }
+}
+
+bool flush(DWORD timeout_ms) noexcept {
+    if (!writer.started()) {
+        return false;
+    }
+
+    uint64_t position = queue.enqueued();
+    SetEvent(writer.wake.raw());
+
+    auto deadline = GetTickCount64() + timeout_ms;
+    while (queue.consumed() < position) {
+        if (GetTickCount64() >= deadline) {
+            return false;
+        }
+        Sleep(1);
+    }
+
+    return true;
+}
+
+Stats stats() noexcept {
+    Stats result{};
+    result.written = written.load(std::memory_order_relaxed);
+    result.dropped = dropped.load(std::memory_order_relaxed);
+    for (const auto &limit : rate_limits) {
+        result.suppressed += limit.suppressed.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+}  // namespace abel::log
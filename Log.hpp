@@ -0,0 +1,154 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+namespace abel {
+
+// Server diagnostics, kept off the hot paths: a log call copies its message and fields into a slot of a bounded
+// lock-free queue and returns, and a writer thread formats the records and writes them out in batches. When the
+// queue is full, or a category is over its rate limit, messages are dropped and counted instead of holding up
+// the caller; the writer reports how many from time to time.
+namespace log {
+
+enum class Level : uint8_t {
+    debug,
+    info,
+    warning,
+    error,
+};
+
+enum class Category : uint8_t {
+    // Service control and the server's lifetime
+    service,
+    // Single sessions, from admission to their shell's exit
+    session,
+    admission,
+    pool,
+    // The periodic traffic and job usage reports
+    usage,
+
+    count_
+};
+
+constexpr size_t category_count = (size_t)Category::count_;
+
+// Written as key=value after the message. Keys must be string literals; text values are copied.
+struct Field {
+    enum class Type : uint8_t {
+        int_,
+        uint_,
+        float_,
+        text,
+    };
+
+    const char *key;
+    Type type;
+    int64_t int_value{0};
+    uint64_t uint_value{0};
+    double float_value{0};
+    std::string_view text_value{};
+
+    template <std::signed_integral T>
+    Field(const char *key, T value) :
+        key{key},
+        type{Type::int_},
+        int_value{value} {
+    }
+
+    template <std::unsigned_integral T>
+    Field(const char *key, T value) :
+        key{key},
+        type{Type::uint_},
+        uint_value{value} {
+    }
+
+    Field(const char *key, double value) :
+        key{key},
+        type{Type::float_},
+        float_value{value} {
+    }
+
+    Field(const char *key, std::string_view value) :
+        key{key},
+        type{Type::text},
+        text_value{value} {
+    }
+
+    Field(const char *key, const char *value) :
+        Field(key, std::string_view{value}) {
+    }
+
+    Field(const char *key, const std::string &value) :
+        Field(key, std::string_view{value}) {
+    }
+};
+
+enum class Sink : uint8_t {
+    // Standard output
+    console,
+    file,
+    // RFC 5424 over UDP
+    syslog,
+    event_log,
+};
+
+struct Config {
+    Sink sink{Sink::console};
+    // The path for Sink::file, `host[:port]` for Sink::syslog, the event source for Sink::event_log
+    std::string target{};
+    Level min_level{Level::info};
+};
+
+// Parses --log's value: `console`, `file:<path>`, `syslog:<host>[:<port>]` or `eventlog[:<source>]`
+Config parse_target(std::string_view spec, std::string_view default_source);
+
+// Starts the writer on first use, and switches it over to the new sink after that. Anything logged before
+// the first call waits in the queue. Syslog needs the socket library to be initialized.
+void configure(Config config);
+
+// Messages per second a category may log, after which the rest of the second's are dropped (default: 100)
+void set_rate_limit(Category category, unsigned per_second);
+
+inline std::atomic<Level> min_level{Level::info};
+
+void write(Level level, Category category, std::string_view message, std::initializer_list<Field> fields = {}) noexcept;
+
+inline void debug(Category category, std::string_view message, std::initializer_list<Field> fields = {}) noexcept {
+    write(Level::debug, category, message, fields);
+}
+
+inline void info(Category category, std::string_view message, std::initializer_list<Field> fields = {}) noexcept {
+    write(Level::info, category, message, fields);
+}
+
+inline void warning(Category category, std::string_view message, std::initializer_list<Field> fields = {}) noexcept {
+    write(Level::warning, category, message, fields);
+}
+
+inline void error(Category category, std::string_view message, std::initializer_list<Field> fields = {}) noexcept {
+    write(Level::error, category, message, fields);
+}
+
+// Waits until everything logged before the call has been written out, or the timeout runs out.
+// Returns false on timeout, or if the writer was never started.
+bool flush(DWORD timeout_ms = 2000) noexcept;
+
+struct Stats {
+    uint64_t written{0};
+    // Because the queue was full
+    uint64_t dropped{0};
+    // Because of the rate limits
+    uint64_t suppressed{0};
+};
+
+Stats stats() noexcept;
+
+}  // namespace log
+
+}  // namespace abel
@@ -0,0 +1,282 @@
+#include "Metrics.hpp"
+
+#include "Thread.hpp"
+#include "Trace.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string_view>
+
+namespace abel::metrics {
+
+namespace {
+
+// Written by a single thread at a time, so the atomics are only there to make reading them from others well-defined
+struct alignas(64) Slot {
+    struct Histogram {
+        std::array<std::atomic<uint64_t>, histogram::bucket_count> buckets{};
+        std::atomic<uint64_t> sum_us{0};
+    };
+
+    std::array<std::atomic<uint64_t>, counter_count> counters{};
+    std::array<Histogram, latency_count> latencies{};
+
+    std::atomic<bool> in_use{true};
+    // Slots are never freed, so the list only ever grows at the head
+    Slot *next{nullptr};
+};
+
+std::atomic<Slot *> slots{nullptr};
+
+Slot *acquire_slot() {
+    for (Slot *slot = slots.load(std::memory_order_acquire); slot; slot = slot->next) {
+        bool expected = false;
+        if (!slot->in_use.load(std::memory_order_relaxed) && slot->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return slot;
+        }
+    }
+
+    Slot *slot = new Slot{};
+    slot->next = slots.load(std::memory_order_relaxed);
+    while (!slots.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    return slot;
+}
+
+// Hands the slot back when its thread exits. The slot keeps its counts, so they stay in the totals,
+// and the next thread to take it carries on from there. This keeps the number of slots at the peak
+// number of threads, even as the session pool's threads idle out and get started again.
+struct SlotLease {
+    Slot *slot = acquire_slot();
+
+    ~SlotLease() {
+        slot->in_use.store(false, std::memory_order_release);
+    }
+};
+
+Slot &my_slot() {
+    thread_local SlotLease lease{};
+    return *lease.slot;
+}
+
+// No other thread writes to the slot, so this needn't be a locked read-modify-write
+void bump(std::atomic<uint64_t> &value, uint64_t amount) noexcept {
+    value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+}
+
+struct LatencyInfo {
+    const char *name;
+    const char *help;
+};
+
+constexpr std::array<LatencyInfo, latency_count> latency_info{{
+    {"rcmd_client_write_seconds", "Time a single write to a client's connection takes to complete"},
+    {"rcmd_accept_handoff_seconds", "Time from accepting a connection until its session thread is started"},
+    {"rcmd_shell_spawn_seconds", "Time taken to start a shell, including its job and pseudo console"},
+}};
+
+// The histograms are exposed with a bucket per power of two, since Prometheus needs the same buckets in every
+// scrape, and the finer ones would add lines without helping its quantile estimates much
+constexpr unsigned exposed_min_exponent = 2;
+constexpr unsigned exposed_max_exponent = 30;
+
+void append_format(std::string &out, const char *format, auto... args) {
+    char buffer[256] = {};
+    int size = snprintf(buffer, sizeof(buffer), format, args...);
+    out.append(buffer, (size_t)std::clamp(size, 0, (int)sizeof(buffer) - 1));
+}
+
+void append_family(std::string &out, const char *name, const char *type, const char *help) {
+    append_format(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+}  // namespace
+
+double HistogramSnapshot::percentile_ms(double p) const {
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = std::clamp<uint64_t>((uint64_t)std::ceil(p / 100 * count), 1, count);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen < rank) {
+            continue;
+        }
+
+        // The middle of the bucket
+        uint64_t low = histogram::lower_bound(i);
+        uint64_t high = i + 1 < buckets.size() ? histogram::lower_bound(i + 1) : low + 1;
+        return (low + high - 1) / 2.0 / 1000;
+    }
+
+    return histogram::max_value_us / 1000.0;
+}
+
+void add(Counter counter, uint64_t amount) noexcept {
+    bump(my_slot().counters[(size_t)counter], amount);
+}
+
+void record(Latency latency, std::chrono::steady_clock::duration duration) noexcept {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+    uint64_t value = us > 0 ? (uint64_t)us : 0;
+
+    auto &counts = my_slot().latencies[(size_t)latency];
+    bump(counts.buckets[histogram::bucket_of(value)], 1);
+    bump(counts.sum_us, value);
+}
+
+Snapshot snapshot() {
+    Snapshot result{};
+
+    for (Slot *slot = slots.load(std::memory_order_acquire); slot; slot = slot->next) {
+        for (size_t i = 0; i < counter_count; ++i) {
+            result.counters[i] += slot->counters[i].load(std::memory_order_relaxed);
+        }
+
+        for (size_t i = 0; i < latency_count; ++i) {
+            auto &from = slot->latencies[i];
+            auto &to = result.latencies[i];
+
+            for (size_t j = 0; j < histogram::bucket_count; ++j) {
+                uint64_t count = from.buckets[j].load(std::memory_order_relaxed);
+                to.buckets[j] += count;
+                to.count += count;
+            }
+            to.sum_us += from.sum_us.load(std::memory_order_relaxed);
+        }
+    }
+
+    return result;
+}
+
+std::string prometheus(const Snapshot &snapshot) {
+    std::string out{};
+    out.reserve(8192);
+
+    // Counted as the difference, so that keeping track of it costs the sessions nothing extra
+    uint64_t started = snapshot[Counter::sessions_started];
+    uint64_t active = started - std::min(started, snapshot[Counter::sessions_finished]);
+    append_family(out, "rcmd_sessions_active", "gauge", "Connections currently being served, including ones waiting for admission");
+    append_format(out, "rcmd_sessions_active %llu\n", active);
+
+    append_family(out, "rcmd_sessions_total", "counter", "Connections served to completion or still being served");
+    append_format(out, "rcmd_sessions_total %llu\n", snapshot[Counter::sessions_started]);
+
+    append_family(out, "rcmd_connections_accepted_total", "counter", "Connections accepted");
+    append_format(out, "rcmd_connections_accepted_total %llu\n", snapshot[Counter::connections_accepted]);
+
+    append_family(out, "rcmd_bytes_total", "counter", "Bytes moved over client connections, after compression and encryption");
+    append_format(out, "rcmd_bytes_total{direction=\"from_clients\"} %llu\n", snapshot[Counter::bytes_from_clients]);
+    append_format(out, "rcmd_bytes_total{direction=\"to_clients\"} %llu\n", snapshot[Counter::bytes_to_clients]);
+
+    append_family(out, "rcmd_shells_spawned_total", "counter", "Shells started, for sessions or for the pool");
+    append_format(out, "rcmd_shells_spawned_total %llu\n", snapshot[Counter::shells_spawned]);
+
+    for (size_t i = 0; i < latency_count; ++i) {
+        const auto &info = latency_info[i];
+        const auto &latency = snapshot.latencies[i];
+
+        append_family(out, info.name, "histogram", info.help);
+
+        uint64_t cumulative = 0;
+        size_t bucket = 0;
+        for (unsigned exponent = exposed_min_exponent; exponent <= exposed_max_exponent; ++exponent) {
+            // Everything below 2^exponent us
+            size_t end = histogram::bucket_of(1ull << exponent);
+            for (; bucket < end; ++bucket) {
+                cumulative += latency.buckets[bucket];
+            }
+
+            append_format(out, "%s_bucket{le=\"%g\"} %llu\n", info.name, (1ull << exponent) / 1e6, cumulative);
+        }
+
+        append_format(out, "%s_bucket{le=\"+Inf\"} %llu\n", info.name, latency.count);
+        append_format(out, "%s_sum %.6f\n", info.name, latency.sum_us / 1e6);
+        append_format(out, "%s_count %llu\n", info.name, latency.count);
+    }
+
+    return out;
+}
+
+#pragma region Endpoint
+Endpoint::Endpoint(uint16_t port) {
+    listener = Socket::listen(port, INADDR_LOOPBACK);
+    thread = Thread::create<Endpoint, &Endpoint::serve>(this).handle;
+}
+
+Endpoint::~Endpoint() {
+    stopping = true;
+
+    // Fails the pending accept
+    listener = {};
+    thread.wait();
+}
+
+void Endpoint::serve() {
+    // A copy, since the destructor closes the listener from under us
+    Socket socket = listener.borrow();
+
+    while (!stopping) {
+        try {
+            auto client = socket.accept();
+            respond(client.borrow());
+            client.shutdown();
+        } catch (std::exception &) {
+            // Either we're stopping, or a scraper went away mid-request, which doesn't concern the server
+        }
+    }
+}
+
+void Endpoint::respond(Socket client) {
+    constexpr size_t max_request = 8192;
+
+    // A scraper that never finishes its request mustn't hold up the ones after it
+    DWORD timeout_ms = 2000;
+    setsockopt(client.raw(), SOL_SOCKET, SO_RCVTIMEO, (const char *)&timeout_ms, sizeof(timeout_ms));
+
+    // Only the request line matters, but the whole request is read, so that closing doesn't reset the connection
+    std::string request{};
+    unsigned char buffer[1024] = {};
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < max_request) {
+        auto read = client.read_into(buffer);
+        request.append((const char *)buffer, read.value);
+        if (read.is_eof) {
+            break;
+        }
+    }
+
+    std::string_view line{request.data(), std::min(request.size(), request.find("\r\n"))};
+    auto is_get = [&](std::string_view path) {
+        return line.starts_with("GET " + std::string{path} + " ") || line.starts_with("GET " + std::string{path} + "?");
+    };
+
+    bool found = true;
+    std::string body{};
+    const char *content_type = "text/plain; version=0.0.4; charset=utf-8";
+    if (is_get("/metrics")) {
+        body = prometheus(snapshot());
+    } else if (is_get("/trace") && trace::enabled) {
+        // The coroutine trace, for when a session seems stuck, see Trace.hpp
+        body = trace::chrome_json();
+        content_type = "application/json";
+    } else {
+        found = false;
+        body = "Not found; try /metrics, or /trace with --trace\n";
+    }
+
+    std::string response = found ? "HTTP/1.1 200 OK\r\n" : "HTTP/1.1 404 Not Found\r\n";
+    response += "Content-Type: " + std::string{content_type} + "\r\n";
+    response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    response += "Connection: close\r\n\r\n";
+    response += body;
+
+    client.write_full_from({(const unsigned char *)response.data(), response.size()});
+}
+#pragma endregion Endpoint
+
+}  // namespace abel::metrics
@@ -0,0 +1,190 @@
+#pragma once
+
+#include "Concurrency.hpp"
+#include "Handle.hpp"
+#include "IOBase.hpp"
+#include "Socket.hpp"
+
+#include <Windows.h>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace abel {
+
+// Server-wide counters and latency histograms, cheap enough to be always on. Every thread records into a slot
+// of its own, with plain loads and stores instead of locked instructions, and nothing is shared between
+// threads until someone takes a snapshot, which sums up the slots.
+namespace metrics {
+
+enum class Counter : size_t {
+    connections_accepted,
+    sessions_started,
+    sessions_finished,
+    // On the wire, i.e. after compression and encryption
+    bytes_from_clients,
+    bytes_to_clients,
+    shells_spawned,
+
+    count_
+};
+
+enum class Latency : size_t {
+    // A single write to a client's connection, until it completes
+    client_write,
+    // From a connection being accepted until it's been handed off to its session thread
+    accept_handoff,
+    // Shell::spawn, including the job and the pseudo console
+    shell_spawn,
+
+    count_
+};
+
+constexpr size_t counter_count = (size_t)Counter::count_;
+constexpr size_t latency_count = (size_t)Latency::count_;
+
+// Log-linear buckets over microseconds, like HdrHistogram's: values below 2^sub_bucket_bits get a bucket each,
+// and every power of two above that is split into 2^sub_bucket_bits buckets, which keeps them within 12.5%
+// of the value. Values past max_value_us share the last bucket.
+namespace histogram {
+
+constexpr unsigned sub_bucket_bits = 3;
+constexpr uint64_t sub_buckets = 1ull << sub_bucket_bits;
+constexpr unsigned max_exponent = 35;
+constexpr uint64_t max_value_us = (1ull << (max_exponent + 1)) - 1;
+constexpr size_t bucket_count = (max_exponent - sub_bucket_bits + 2) * sub_buckets;
+
+constexpr size_t bucket_of(uint64_t value_us) noexcept {
+    value_us = value_us < max_value_us ? value_us : max_value_us;
+    if (value_us < sub_buckets) {
+        return (size_t)value_us;
+    }
+
+    unsigned exponent = 63 - (unsigned)std::countl_zero(value_us);
+    uint64_t mantissa = (value_us >> (exponent - sub_bucket_bits)) & (sub_buckets - 1);
+    return (size_t)(((exponent - sub_bucket_bits + 1) << sub_bucket_bits) | mantissa);
+}
+
+// The smallest value that lands in the bucket
+constexpr uint64_t lower_bound(size_t bucket) noexcept {
+    if (bucket < sub_buckets) {
+        return bucket;
+    }
+
+    unsigned exponent = (unsigned)(bucket >> sub_bucket_bits) + sub_bucket_bits - 1;
+    uint64_t mantissa = bucket & (sub_buckets - 1);
+    return (sub_buckets | mantissa) << (exponent - sub_bucket_bits);
+}
+
+static_assert(bucket_of(max_value_us) == bucket_count - 1);
+static_assert(lower_bound(bucket_of(1000)) <= 1000 && 1000 < lower_bound(bucket_of(1000) + 1));
+
+}  // namespace histogram
+
+struct HistogramSnapshot {
+    std::array<uint64_t, histogram::bucket_count> buckets{};
+    uint64_t count{0};
+    uint64_t sum_us{0};
+
+    // Approximate, to within a bucket
+    double percentile_ms(double p) const;
+};
+
+struct Snapshot {
+    std::array<uint64_t, counter_count> counters{};
+    std::array<HistogramSnapshot, latency_count> latencies{};
+
+    uint64_t operator[](Counter counter) const noexcept {
+        return counters[(size_t)counter];
+    }
+
+    const HistogramSnapshot &operator[](Latency latency) const noexcept {
+        return latencies[(size_t)latency];
+    }
+};
+
+void add(Counter counter, uint64_t amount = 1) noexcept;
+
+void record(Latency latency, std::chrono::steady_clock::duration duration) noexcept;
+
+// Sums up every thread's slot. The counts of a histogram may be a few records ahead of its sum, since
+// nothing stops the threads while it's taken.
+Snapshot snapshot();
+
+// In the Prometheus text exposition format
+std::string prometheus(const Snapshot &snapshot);
+
+// Records how long it's been alive
+class ScopedTimer {
+protected:
+    Latency latency;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+public:
+    explicit ScopedTimer(Latency latency) noexcept :
+        latency{latency} {
+    }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    ~ScopedTimer() {
+        record(latency, std::chrono::steady_clock::now() - start);
+    }
+};
+
+// Counts the bytes going through a client's connection in both directions, and times the writes
+template <async_io S>
+class Metered : public IOBase {
+protected:
+    S inner;
+
+public:
+    explicit Metered(S inner) :
+        inner(std::move(inner)) {
+    }
+
+    AIO<eof<size_t>> read_async_into(std::span<unsigned char> data) {
+        auto result = co_await inner.read_async_into(data);
+        add(Counter::bytes_from_clients, result.value);
+        co_return result;
+    }
+
+    AIO<eof<size_t>> write_async_from(std::span<const unsigned char> data) {
+        auto start = std::chrono::steady_clock::now();
+        auto result = co_await inner.write_async_from(data);
+        record(Latency::client_write, std::chrono::steady_clock::now() - start);
+        add(Counter::bytes_to_clients, result.value);
+        co_return result;
+    }
+};
+
+// Serves snapshots over HTTP at /metrics, for Prometheus to scrape, and the coroutine trace at /trace while tracing.
+// Only listens on the loopback interface; anything further away should go through a proxy that takes care of access.
+class Endpoint {
+protected:
+    OwningSocket listener{};
+    OwningHandle thread{};
+    std::atomic<bool> stopping{false};
+
+    void serve();
+
+    void respond(Socket client);
+
+public:
+    explicit Endpoint(uint16_t port);
+
+    Endpoint(const Endpoint &) = delete;
+    Endpoint &operator=(const Endpoint &) = delete;
+    Endpoint(Endpoint &&) = delete;
+    Endpoint &operator=(Endpoint &&) = delete;
+
+    ~Endpoint();
+};
+
+}  // namespace metrics
+
+}  // namespace abel
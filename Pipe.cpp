@@ -33,7 +33,7 @@ Pipe Pipe::create(bool inheritHandles, DWORD bufSize) {
     return result;
 }
 
-Pipe Pipe::create_async(bool inheritHandles, DWORD bufSize) {
+Pipe Pipe::create_async(bool inheritHandles, DWORD bufSize, bool asyncRead, bool asyncWrite) {
     static std::atomic<unsigned> pipe_id{0};
 
     char name[MAX_PATH] = {};
@@ -56,7 +56,7 @@ Pipe Pipe::create_async(bool inheritHandles, DWORD bufSize) {
 
     result.read = OwningHandle(CreateNamedPipeA(
         name,
-        PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED,
+        PIPE_ACCESS_INBOUND | (asyncRead ? FILE_FLAG_OVERLAPPED : 0),
         PIPE_TYPE_BYTE | PIPE_WAIT,
         1,
         bufSize,
@@ -71,7 +71,7 @@ Pipe Pipe::create_async(bool inheritHandles, DWORD bufSize) {
         0,
         &sa,
         OPEN_EXISTING,
-        FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+        FILE_ATTRIBUTE_NORMAL | (asyncWrite ? FILE_FLAG_OVERLAPPED : 0),
         NULL
     )).validate();
 
@@ -21,7 +21,8 @@ public:
     static Pipe create(bool inheritHandles = true, DWORD bufSize = 0);
 
     // Actually creates a named pipe secretly, because unnamed pipes, as it turns out, do not support overlapped IO.
-    static Pipe create_async(bool inheritHandles = true, DWORD bufSize = 0);
+    // Either end may be left synchronous, for processes that do plain blocking IO on theirs.
+    static Pipe create_async(bool inheritHandles = true, DWORD bufSize = 0, bool asyncRead = true, bool asyncWrite = true);
 };
 
 }  // namespace abel
@@ -0,0 +1,166 @@
+#include "Prediction.hpp"
+
+#include "Concurrency.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace abel::predict {
+
+#pragma region Engine
+PredictiveEcho::PredictiveEcho(double threshold_ms, double initial_rtt_ms) :
+    threshold_ms{threshold_ms},
+    srtt_ms{initial_rtt_ms} {
+}
+
+Clock::duration PredictiveEcho::expiry() const noexcept {
+    // Generous, so that a slow moment doesn't wipe correct predictions, but short enough for passwords
+    auto milliseconds = std::clamp(3 * srtt_ms + 100, 250.0, 2000.0);
+    return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(milliseconds));
+}
+
+void PredictiveEcho::erase_shown() {
+    if (shown == 0) {
+        return;
+    }
+
+    // Step back over them and blank them out, without touching anything to the right
+    char buffer[32];
+    snprintf(buffer, sizeof(buffer), "\x1b[%zuD\x1b[%zuX", shown, shown);
+    output += buffer;
+}
+
+void PredictiveEcho::draw_shown() {
+    if (shown == 0) {
+        return;
+    }
+
+    output += "\x1b[4m";
+    for (size_t i = pending.size() - shown; i < pending.size(); ++i) {
+        output += (char)pending[i].ch;
+    }
+    output += "\x1b[24m";
+}
+
+void PredictiveEcho::drop_all() {
+    pending.clear();
+    shown = 0;
+    confident = false;
+}
+
+std::string_view PredictiveEcho::on_input(std::span<const unsigned char> typed, Clock::time_point now) {
+    output.clear();
+
+    for (unsigned char ch : typed) {
+        bool printable = 0x20 <= ch && ch < 0x7f;
+        if (!printable) {
+            confident = false;
+            continue;
+        }
+
+        ++stats_.predicted;
+        pending.push_back({ch, now});
+
+        // Predictions are still tracked while not displayed, to keep measuring the round trip time.
+        // A character is only drawn if everything typed before it is drawn too, or it would land in the wrong place.
+        if (display_enabled() && shown + 1 == pending.size()) {
+            ++shown;
+            output += "\x1b[4m";
+            output += (char)ch;
+            output += "\x1b[24m";
+        }
+    }
+
+    return output;
+}
+
+std::string_view PredictiveEcho::on_output(std::span<const unsigned char> data, Clock::time_point now) {
+    output.clear();
+
+    // Count how much of the output is the echo we predicted
+    size_t matched = 0;
+    while (matched < data.size() && matched < pending.size() && data[matched] == pending[matched].ch) {
+        ++matched;
+    }
+
+    for (size_t i = 0; i < matched; ++i) {
+        double sample = std::chrono::duration<double, std::milli>(now - pending[i].typed).count();
+        srtt_ms = srtt_ms * 0.875 + sample * 0.125;
+    }
+    stats_.confirmed += matched;
+
+    // The server's output goes where the predictions were drawn
+    erase_shown();
+    output.append((const char *)data.data(), data.size());
+
+    size_t unshown = pending.size() - shown;
+    pending.erase(pending.begin(), pending.begin() + matched);
+    shown = matched >= unshown ? shown - (matched - unshown) : shown;
+
+    if (matched > 0) {
+        confident = true;
+    }
+
+    if (matched < data.size() && !pending.empty()) {
+        // Something other than the echo came first: a prompt, a full-screen redraw, a disabled echo...
+        stats_.mispredicted += pending.size();
+        drop_all();
+    }
+
+    draw_shown();
+    return output;
+}
+
+std::string_view PredictiveEcho::expire(Clock::time_point now) {
+    output.clear();
+
+    if (!pending.empty() && now - pending.front().typed >= expiry()) {
+        stats_.expired += pending.size();
+        erase_shown();
+        drop_all();
+    }
+
+    return output;
+}
+#pragma endregion Engine
+
+#pragma region IO
+// The engine reuses its buffer on the next call, which may come while this waits for room, so it's copied first
+static AIO<void> write_console(ConsoleWriter &console, std::string_view text) {
+    if (text.empty()) {
+        co_return;
+    }
+
+    std::string copy{text};
+    auto result = co_await console.write_async_from({(const unsigned char *)copy.data(), copy.size()});
+    if (result.is_eof) {
+        fail("Failed to write to the console");
+    }
+}
+
+AIO<eof<size_t>> PredictingInput::read_async_into(std::span<unsigned char> data) {
+    auto result = co_await inner.read_async_into(data);
+    co_await write_console(*console, engine->on_input(data.first(result.value)));
+    co_return result;
+}
+
+AIO<eof<size_t>> PredictingOutput::write_async_from(std::span<const unsigned char> data) {
+    co_await write_console(*console, engine->on_output(data));
+    co_return eof(data.size(), false);
+}
+
+AIO<void> expire_predictions(PredictiveEcho &engine, ConsoleWriter &console) {
+    constexpr DWORD tick_ms = 50;
+    auto timer = Handle::create_timer();
+
+    while (!engine.closed()) {
+        timer.set_timer(tick_ms);
+        co_await event_signaled{timer};
+
+        co_await write_console(console, engine.expire());
+    }
+}
+#pragma endregion IO
+
+}  // namespace abel::predict
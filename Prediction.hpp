@@ -0,0 +1,147 @@
+#pragma once
+
+#include "Handle.hpp"
+#include "ConsoleWriter.hpp"
+#include "IOBase.hpp"
+#include "Error.hpp"
+
+#include <Windows.h>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace abel {
+
+template <typename T>
+class AIO;
+
+// Client-side predictive local echo: typed characters are shown right away, underlined as tentative,
+// and replaced by the server's own echo once it arrives. Anything unexpected in between cancels them.
+namespace predict {
+
+using Clock = std::chrono::steady_clock;
+
+struct PredictionStats {
+    uint64_t predicted{0};
+    uint64_t confirmed{0};
+    // The server's output disagreed with a prediction
+    uint64_t mispredicted{0};
+    // No echo came in time, e.g. at a password prompt
+    uint64_t expired{0};
+};
+
+class PredictiveEcho {
+protected:
+    struct Pending {
+        unsigned char ch;
+        Clock::time_point typed;
+    };
+
+    // Typed but not yet echoed by the server, oldest first
+    std::deque<Pending> pending{};
+    // How many of the newest pending characters are currently drawn after the server's output
+    size_t shown{0};
+
+    double threshold_ms;
+    // Smoothed round trip time, measured from keystrokes to their echo
+    double srtt_ms;
+    // Cleared on every misprediction, and set again by the next confirmed one.
+    // Also cleared by anything but plain characters, since editing keys and the like can't be predicted.
+    bool confident{true};
+    bool closed_{false};
+
+    std::string output{};
+    PredictionStats stats_{};
+
+    bool display_enabled() const noexcept {
+        return confident && srtt_ms >= threshold_ms;
+    }
+
+    Clock::duration expiry() const noexcept;
+
+    // Emits the sequence that wipes the shown predictions off the screen
+    void erase_shown();
+
+    // Emits the shown predictions again
+    void draw_shown();
+
+    void drop_all();
+
+public:
+    // Predictions are only drawn while the round trip time is at least `threshold_ms`
+    PredictiveEcho(double threshold_ms, double initial_rtt_ms);
+
+    // Call with what the user typed, before it's sent. Returns what to write to the console.
+    std::string_view on_input(std::span<const unsigned char> typed, Clock::time_point now = Clock::now());
+
+    // Call with the server's output instead of writing it directly. Returns what to write to the console.
+    std::string_view on_output(std::span<const unsigned char> data, Clock::time_point now = Clock::now());
+
+    // Cancels predictions that went unconfirmed for too long. Returns what to write to the console.
+    std::string_view expire(Clock::time_point now = Clock::now());
+
+    void close() noexcept {
+        closed_ = true;
+    }
+
+    bool closed() const noexcept {
+        return closed_;
+    }
+
+    double rtt_ms() const noexcept {
+        return srtt_ms;
+    }
+
+    const PredictionStats &stats() const noexcept {
+        return stats_;
+    }
+};
+
+// Reads the console like ConsoleAsyncIO does, drawing predictions instead of echoing
+class PredictingInput : public IOBase {
+protected:
+    ConsoleAsyncIO inner;
+    ConsoleWriter *console;
+    PredictiveEcho *engine;
+
+public:
+    PredictingInput(Handle input, ConsoleWriter &console, PredictiveEcho &engine) :
+        inner{input.console_async_io(false)},
+        console{&console},
+        engine{&engine} {
+    }
+
+    AIO<eof<size_t>> read_async_into(std::span<unsigned char> data);
+};
+
+// Writes the server's output to the console, reconciling it with the predictions
+class PredictingOutput : public IOBase {
+protected:
+    ConsoleWriter *console;
+    PredictiveEcho *engine;
+
+public:
+    PredictingOutput(ConsoleWriter &console, PredictiveEcho &engine) :
+        console{&console},
+        engine{&engine} {
+    }
+
+    AIO<eof<size_t>> write_async_from(std::span<const unsigned char> data);
+};
+
+// Periodically expires stale predictions until the engine is closed
+AIO<void> expire_predictions(PredictiveEcho &engine, ConsoleWriter &console);
+
+// Transfers the server's output to the console through the engine, and closes it at the end
+template <async_readable R>
+AIO<void> receive_output(R from_server, ConsoleWriter &console, PredictiveEcho &engine) {
+    co_await async_transfer(std::move(from_server), PredictingOutput{console, engine});
+    engine.close();
+}
+
+}  // namespace predict
+
+}  // namespace abel
@@ -1,11 +1,37 @@
 #include "Process.hpp"
 
 #include <utility>
+#include <algorithm>
 
 #include "Error.hpp"
 
 namespace abel {
 
+ProcessAttributes::ProcessAttributes(DWORD count) {
+    SIZE_T size = 0;
+    // Fails by design, reporting the size needed
+    InitializeProcThreadAttributeList(nullptr, count, 0, &size);
+
+    storage = std::make_unique<unsigned char[]>(size);
+
+    if (!InitializeProcThreadAttributeList(raw(), count, 0, &size)) {
+        storage.reset();
+        fail("Failed to initialize process attributes");
+    }
+}
+
+ProcessAttributes::~ProcessAttributes() {
+    if (storage) {
+        DeleteProcThreadAttributeList(raw());
+    }
+}
+
+void ProcessAttributes::set(DWORD_PTR attribute, void *value, size_t size) {
+    if (!UpdateProcThreadAttribute(raw(), 0, attribute, value, size, nullptr, nullptr)) {
+        fail("Failed to set a process attribute");
+    }
+}
+
 Process Process::create(
     const std::string &executable,
     const std::string &arguments,
@@ -16,7 +42,8 @@ Process Process::create(
     Handle stdInput,
     Handle stdOutput,
     Handle stdError,
-    std::function<void(STARTUPINFOA &)> extraParams
+    std::function<void(STARTUPINFOA &)> extraParams,
+    ProcessAttributes *attributes
 ) {
     PROCESS_INFORMATION processInfo{};
 
@@ -30,16 +57,24 @@ Process Process::create(
         startupFlags |= STARTF_USESTDHANDLES;
     }
 
-    STARTUPINFOA startupInfo{
-        .cb = sizeof(STARTUPINFOA),
-        .dwFlags = startupFlags,
-        .hStdInput = stdInput.raw(),
-        .hStdOutput = stdOutput.raw(),
-        .hStdError = stdError.raw(),
+    STARTUPINFOEXA startupInfo{
+        .StartupInfo = {
+            .cb = sizeof(STARTUPINFOA),
+            .dwFlags = startupFlags,
+            .hStdInput = stdInput.raw(),
+            .hStdOutput = stdOutput.raw(),
+            .hStdError = stdError.raw(),
+        },
     };
 
+    if (attributes) {
+        startupInfo.StartupInfo.cb = sizeof(STARTUPINFOEXA);
+        startupInfo.lpAttributeList = attributes->raw();
+        creationFlags |= EXTENDED_STARTUPINFO_PRESENT;
+    }
+
     if (extraParams) {
-        extraParams(startupInfo);
+        extraParams(startupInfo.StartupInfo);
     }
 
     bool success = CreateProcessA(
@@ -51,7 +86,7 @@ Process Process::create(
         creationFlags,
         nullptr,
         workingDirectory.size() > 0 ? workingDirectory.c_str() : nullptr,
-        &startupInfo,
+        &startupInfo.StartupInfo,
         &processInfo
     );
 
@@ -59,8 +94,80 @@ Process Process::create(
         fail("Failed to create process");
     }
 
-    OwningHandle process{processInfo.hProcess};
-    OwningHandle thread{processInfo.hThread};
+    return from_info(processInfo);
+}
+
+Process Process::spawn(const SpawnOptions &options) {
+    // CreateProcessA may write into the command line
+    std::string commandLine = options.command_line;
+
+    std::string environment{};
+    for (const std::string &entry : options.environment) {
+        environment.append(entry);
+        environment.push_back('\0');
+    }
+    // The block ends with an empty entry
+    environment.push_back('\0');
+
+    // Listing a handle twice is an error, and stdout and stderr are often the same
+    std::vector<HANDLE> inherited{};
+    for (Handle handle : {options.std_input, options.std_output, options.std_error}) {
+        if (handle && std::ranges::find(inherited, handle.raw()) == inherited.end()) {
+            inherited.push_back(handle.raw());
+        }
+    }
+
+    HPCON pseudoConsole = options.pseudo_console;
+    HANDLE job = options.job.raw();
+
+    ProcessAttributes attributes{3};
+    if (!inherited.empty()) {
+        attributes.set(PROC_THREAD_ATTRIBUTE_HANDLE_LIST, inherited.data(), inherited.size() * sizeof(HANDLE));
+    }
+    if (pseudoConsole) {
+        attributes.set(PROC_THREAD_ATTRIBUTE_PSEUDOCONSOLE, pseudoConsole, sizeof(HPCON));
+    }
+    if (job) {
+        attributes.set(PROC_THREAD_ATTRIBUTE_JOB_LIST, &job, sizeof(HANDLE));
+    }
+
+    STARTUPINFOEXA startupInfo{
+        .StartupInfo = {
+            .cb = sizeof(STARTUPINFOEXA),
+            // Even with no handles given, so that the process doesn't get our standard handles instead of a pseudo console's
+            .dwFlags = STARTF_USESTDHANDLES,
+            .hStdInput = options.std_input.raw(),
+            .hStdOutput = options.std_output.raw(),
+            .hStdError = options.std_error.raw(),
+        },
+        .lpAttributeList = attributes.raw(),
+    };
+
+    PROCESS_INFORMATION processInfo{};
+
+    bool success = CreateProcessA(
+        options.executable.c_str(),
+        commandLine.data(),
+        nullptr,
+        nullptr,
+        !inherited.empty(),
+        options.creation_flags | EXTENDED_STARTUPINFO_PRESENT,
+        options.environment.empty() ? nullptr : environment.data(),
+        options.working_directory.empty() ? nullptr : options.working_directory.c_str(),
+        &startupInfo.StartupInfo,
+        &processInfo
+    );
+
+    if (!success) {
+        fail("Failed to spawn process");
+    }
+
+    return from_info(processInfo);
+}
+
+Process Process::from_info(const PROCESS_INFORMATION &info) {
+    OwningHandle process{info.hProcess};
+    OwningHandle thread{info.hThread};
 
     process.validate();
     thread.validate();
@@ -68,9 +175,9 @@ Process Process::create(
     Process result{};
 
     result.process = std::move(process);
-    result.pid = processInfo.dwProcessId;
+    result.pid = info.dwProcessId;
     result.thread = std::move(thread);
-    result.tid = processInfo.dwThreadId;
+    result.tid = info.dwThreadId;
 
     return result;
 }
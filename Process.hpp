@@ -7,14 +7,63 @@
 #include <string>
 #include <string_view>
 #include <functional>
+#include <memory>
+#include <vector>
 
 namespace abel {
 
+// A PROC_THREAD_ATTRIBUTE_LIST, for the process creation options that STARTUPINFOA has no room for
+class ProcessAttributes {
+protected:
+    std::unique_ptr<unsigned char[]> storage{};
+
+public:
+    // Room for `count` attributes
+    explicit ProcessAttributes(DWORD count);
+
+    ProcessAttributes(const ProcessAttributes &) = delete;
+    ProcessAttributes &operator=(const ProcessAttributes &) = delete;
+    ProcessAttributes(ProcessAttributes &&) noexcept = default;
+    ProcessAttributes &operator=(ProcessAttributes &&) noexcept = default;
+
+    ~ProcessAttributes();
+
+    // Note: `value` is not copied, and has to stay alive until the process is created
+    void set(DWORD_PTR attribute, void *value, size_t size);
+
+    LPPROC_THREAD_ATTRIBUTE_LIST raw() const noexcept {
+        return (LPPROC_THREAD_ATTRIBUTE_LIST)storage.get();
+    }
+};
+
+// Everything a spawned process gets from its parent, spelled out. Nothing else is inherited.
+struct SpawnOptions {
+    // Full path, it isn't searched for
+    std::string executable{};
+    // The whole command line as the process sees it, executable name included. Passed as it is.
+    std::string command_line{};
+    std::string working_directory{};
+    // "NAME=value" entries. If empty, the process gets our environment.
+    std::vector<std::string> environment{};
+    // The only handles the process inherits, by way of PROC_THREAD_ATTRIBUTE_HANDLE_LIST.
+    // They have to be inheritable, but then none of our other inheritable handles leak into the process.
+    Handle std_input{};
+    Handle std_output{};
+    Handle std_error{};
+    // If set, the process is attached to this pseudo console instead, see Pty.hpp
+    HPCON pseudo_console{nullptr};
+    // If set, the process starts out in this job, before it can run anything, see Job.hpp
+    Handle job{};
+    DWORD creation_flags{0};
+};
+
 class Process {
 protected:
     Process() {
     }
 
+    static Process from_info(const PROCESS_INFORMATION &info);
+
 public:
     OwningHandle process{};
     DWORD pid{};
@@ -34,8 +83,13 @@ public:
         Handle stdInput = nullptr,
         Handle stdOutput = nullptr,
         Handle stdError = nullptr,
-        std::function<void(STARTUPINFOA &)> extraParams = nullptr
+        std::function<void(STARTUPINFOA &)> extraParams = nullptr,
+        ProcessAttributes *attributes = nullptr
     );
+
+    // The fast path for processes started over and over: no command line assembly, no callbacks,
+    // and an explicit handle list instead of every inheritable handle we happen to have
+    static Process spawn(const SpawnOptions &options);
 };
 
 }  // namespace abel
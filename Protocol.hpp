@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <type_traits>
+
+namespace abel {
+
+// What a connection is for. Sent by the client as part of the SessionHello.
+enum class SessionKind : uint8_t {
+    // Interactive shell; raw terminal bytes flow in both directions afterwards
+    shell = 0,
+    // Delta-sync file push, see DeltaSync.hpp
+    push = 1,
+    // Admission control queries and runtime limit changes, see Admission.hpp
+    admin = 2,
+};
+
+// Bits of SessionHello::flags
+enum SessionFlags : uint8_t {
+    // Both directions go through CompressWriter/DecompressReader, see Compression.hpp
+    session_compress = 1 << 0,
+    // The handshake from Crypto.hpp follows the hello, and both directions go through SealWriter/OpenReader
+    session_encrypt = 1 << 1,
+    // The client sends a term::TerminalSize after the hello, and receives screen diffs instead of raw output, see TermSync.hpp
+    session_termsync = 1 << 2,
+    // The server sends a udp::UdpOffer after the handshake, and the session continues over that transport, see Datagram.hpp
+    session_udp = 1 << 3,
+    // The client sends a term::TerminalSize after the hello, and later window size changes in-band, see Pty.hpp
+    session_resize = 1 << 4,
+};
+
+// Every connection starts with the client sending this
+struct SessionHello {
+    static constexpr uint32_t magic_value = 0x444D4352;  // "RCMD"
+    static constexpr uint16_t current_version = 3;
+
+    uint32_t magic = magic_value;
+    uint16_t version = current_version;
+    SessionKind kind = SessionKind::shell;
+    uint8_t flags = 0;
+
+    constexpr bool valid() const noexcept {
+        return magic == magic_value && version == current_version;
+    }
+};
+
+static_assert(sizeof(SessionHello) == 8);
+
+enum class AdmissionStatus : uint8_t {
+    admitted = 0,
+    // The server is at its session limit; another SessionAdmission follows once the session is let in or turned away
+    queued = 1,
+    rejected_queue_full = 2,
+    rejected_timeout = 3,
+    // The server is draining before it stops
+    rejected_shutdown = 4,
+};
+
+// Bits of SessionAdmission::flags
+enum AdmissionFlags : uint8_t {
+    // The shell runs on a pseudo console, which echoes the input itself, so the client mustn't echo it too
+    admission_remote_echo = 1 << 0,
+};
+
+// Server -> client, after the hello (and terminal size, if any), before anything else.
+// Sent early so that an overloaded server turns sessions away before doing any work for them.
+struct SessionAdmission {
+    AdmissionStatus status = AdmissionStatus::admitted;
+    // Bits of AdmissionFlags, once admitted
+    uint8_t flags = 0;
+    uint8_t reserved[2]{};
+    // Position in the queue, if queued
+    uint32_t position = 0;
+};
+
+static_assert(sizeof(SessionAdmission) == 8);
+
+// Views a plain wire struct as bytes, for sending or receiving it as-is.
+// Note: the protocol assumes both ends are little-endian.
+template <typename T>
+    requires std::is_trivially_copyable_v<T>
+std::span<const unsigned char> bytes_of(const T &value) noexcept {
+    return {(const unsigned char *)&value, sizeof(T)};
+}
+
+template <typename T>
+    requires std::is_trivially_copyable_v<T>
+std::span<unsigned char> bytes_of(T &value) noexcept {
+    return {(unsigned char *)&value, sizeof(T)};
+}
+
+}  // namespace abel
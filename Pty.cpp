@@ -0,0 +1,150 @@
+#include "Pty.hpp"
+
+#include "Error.hpp"
+
+#include <cstdio>
+#include <string_view>
+
+namespace abel::pty {
+
+#pragma region PseudoConsole
+PseudoConsole PseudoConsole::create(term::TerminalSize size, Handle input, Handle output) {
+    PseudoConsole result{};
+
+    HRESULT hr = CreatePseudoConsole(
+        COORD{.X = (SHORT)size.cols, .Y = (SHORT)size.rows},
+        input.raw(),
+        output.raw(),
+        0,
+        &result.value
+    );
+
+    if (FAILED(hr)) {
+        SetLastError(HRESULT_CODE(hr));
+        fail("Failed to create a pseudo console");
+    }
+
+    return result;
+}
+
+void PseudoConsole::resize(term::TerminalSize size) {
+    HRESULT hr = ResizePseudoConsole(value, COORD{.X = (SHORT)size.cols, .Y = (SHORT)size.rows});
+
+    if (FAILED(hr)) {
+        SetLastError(HRESULT_CODE(hr));
+        fail("Failed to resize the pseudo console");
+    }
+}
+
+void PseudoConsole::close() {
+    if (value) {
+        ClosePseudoConsole(std::exchange(value, nullptr));
+    }
+}
+#pragma endregion PseudoConsole
+
+#pragma region Resize requests
+namespace {
+
+enum class Match {
+    no,
+    partial,
+    complete,
+};
+
+Match match_request(std::string_view text, term::TerminalSize &size) {
+    constexpr std::string_view prefix = "\x1b[8;";
+    // Sizes are at most 1000, see TerminalSize::valid
+    constexpr unsigned max_digits = 4;
+
+    size_t compared = std::min(text.size(), prefix.size());
+    if (text.substr(0, compared) != prefix.substr(0, compared)) {
+        return Match::no;
+    }
+    if (text.size() <= prefix.size()) {
+        return Match::partial;
+    }
+
+    unsigned values[2] = {};
+    unsigned field = 0;
+    unsigned digits = 0;
+
+    for (char ch : text.substr(prefix.size())) {
+        if ('0' <= ch && ch <= '9') {
+            if (++digits > max_digits) {
+                return Match::no;
+            }
+            values[field] = values[field] * 10 + (ch - '0');
+            continue;
+        }
+
+        if (digits == 0) {
+            return Match::no;
+        }
+
+        if (ch == ';' && field == 0) {
+            field = 1;
+            digits = 0;
+            continue;
+        }
+
+        if (ch == 't' && field == 1) {
+            size = {.rows = (uint16_t)values[0], .cols = (uint16_t)values[1]};
+            return Match::complete;
+        }
+
+        return Match::no;
+    }
+
+    return Match::partial;
+}
+
+}  // namespace
+
+std::optional<term::TerminalSize> ResizeScanner::feed(std::span<const unsigned char> input, std::vector<unsigned char> &out) {
+    std::optional<term::TerminalSize> result{};
+
+    for (unsigned char ch : input) {
+        if (held.empty() && ch != '\x1b') {
+            out.push_back(ch);
+            continue;
+        }
+
+        held.push_back((char)ch);
+
+        term::TerminalSize size{};
+        switch (match_request(held, size)) {
+        case Match::partial:
+            break;
+
+        case Match::complete:
+            result = size;
+            held.clear();
+            break;
+
+        case Match::no: {
+            // The byte that broke the match may start a request of its own
+            size_t kept = held.size() > 1 && ch == '\x1b' ? 1 : 0;
+            out.insert(out.end(), held.begin(), held.end() - kept);
+            held.erase(0, held.size() - kept);
+            break;
+        }
+        }
+    }
+
+    return result;
+}
+
+void ResizeScanner::flush(std::vector<unsigned char> &out) {
+    out.insert(out.end(), held.begin(), held.end());
+    held.clear();
+}
+
+std::string resize_request(term::TerminalSize size) {
+    char request[32] = {};
+    int length = snprintf(request, sizeof(request), "\x1b[8;%u;%ut", size.rows, size.cols);
+    return std::string(request, (size_t)length);
+}
+#pragma endregion Resize requests
+
+}  // namespace abel::pty
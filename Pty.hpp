@@ -0,0 +1,133 @@
+#pragma once
+
+#include "Concurrency.hpp"
+#include "Handle.hpp"
+#include "IOBase.hpp"
+#include "TermSync.hpp"
+
+#include <Windows.h>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace abel {
+
+// Shells on a pseudo console (ConPTY). The shell sees a real console, so interactive programs work as they would
+// locally, while its input comes from one pipe and its screen is rendered as VT sequences into another.
+namespace pty {
+
+class PseudoConsole {
+protected:
+    HPCON value{nullptr};
+
+public:
+    PseudoConsole() = default;
+
+    PseudoConsole(const PseudoConsole &) = delete;
+    PseudoConsole &operator=(const PseudoConsole &) = delete;
+
+    PseudoConsole(PseudoConsole &&other) noexcept :
+        value{std::exchange(other.value, nullptr)} {
+    }
+
+    PseudoConsole &operator=(PseudoConsole &&other) noexcept {
+        std::swap(value, other.value);
+        return *this;
+    }
+
+    ~PseudoConsole() {
+        close();
+    }
+
+    // `input` and `output` are the console's own ends of the pipes. It keeps duplicates of them,
+    // so the caller may close them right away.
+    static PseudoConsole create(term::TerminalSize size, Handle input, Handle output);
+
+    explicit operator bool() const noexcept {
+        return value != nullptr;
+    }
+
+    HPCON raw() const noexcept {
+        return value;
+    }
+
+    void resize(term::TerminalSize size);
+
+    // Terminates whatever still runs on the console. Blocks until the console host has written out the rest
+    // of its output, so that has to be read meanwhile, or the read end closed.
+    void close();
+};
+
+// Picks xterm's "resize window" requests, CSI 8 ; rows ; cols t, out of the client's input.
+// The client's console reader emits one whenever its window changes size.
+class ResizeScanner {
+protected:
+    // The start of what may still turn out to be a request
+    std::string held{};
+
+public:
+    // Appends the bytes of `input` that aren't part of a request to `out`. Returns the last complete request, if any.
+    std::optional<term::TerminalSize> feed(std::span<const unsigned char> input, std::vector<unsigned char> &out);
+
+    // Gives up on a partial request, passing it on as it is, e.g. at the end of a read
+    void flush(std::vector<unsigned char> &out);
+};
+
+// The request ResizeScanner looks for
+std::string resize_request(term::TerminalSize size);
+
+// Strips resize requests out of the client's input, handing them to `on_resize` instead
+template <async_readable R>
+class ResizeFilter : public IOBase {
+protected:
+    static constexpr size_t buffer_size = 4096;
+
+    R inner;
+    std::function<void(term::TerminalSize)> on_resize;
+    ResizeScanner scanner{};
+    std::unique_ptr<unsigned char[]> buffer = std::make_unique<unsigned char[]>(buffer_size);
+    std::vector<unsigned char> pending{};
+    size_t pending_pos{0};
+
+public:
+    ResizeFilter(R inner, std::function<void(term::TerminalSize)> on_resize) :
+        inner(std::move(inner)),
+        on_resize{std::move(on_resize)} {
+    }
+
+    AIO<eof<size_t>> read_async_into(std::span<unsigned char> data) {
+        while (pending_pos == pending.size()) {
+            pending.clear();
+            pending_pos = 0;
+
+            auto read = co_await inner.read_async_into({buffer.get(), buffer_size});
+
+            if (auto size = scanner.feed({buffer.get(), read.value}, pending); size && size->valid()) {
+                on_resize(*size);
+            }
+
+            // A partial request isn't held for the next read, which may only come with the next keystroke, and would
+            // hold up a lone ESC until then. The client writes each request whole, so a split one is rare, and
+            // merely reaches the shell as typed input.
+            scanner.flush(pending);
+
+            if (read.is_eof && pending.empty()) {
+                co_return eof((size_t)0, true);
+            }
+        }
+
+        size_t size = std::min(data.size(), pending.size() - pending_pos);
+        std::copy_n(pending.begin() + pending_pos, size, data.begin());
+        pending_pos += size;
+
+        co_return eof(size, false);
+    }
+};
+
+}  // namespace pty
+
+}  // namespace abel
@@ -0,0 +1,308 @@
+#include "Recording.hpp"
+
+#include "Thread.hpp"
+#include "Log.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+namespace abel::record {
+
+#pragma region Recorder
+Recorder::Recorder(const std::string &path) :
+    path{path} {
+
+    // Readable while it's being written, so that a session can be watched live
+    file = Handle::open_file(path, GENERIC_WRITE, CREATE_ALWAYS, FILE_SHARE_READ);
+
+    FileHeader header{
+        .start_unix_ms = (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()
+        ).count(),
+    };
+    auto bytes = std::span{(const unsigned char *)&header, sizeof(header)};
+    pending.insert(pending.end(), bytes.begin(), bytes.end());
+    end_offset = sizeof(header);
+
+    thread = Thread::create<Recorder, &Recorder::write_behind>(this).handle;
+}
+
+Recorder::~Recorder() {
+    {
+        std::lock_guard lock{mutex};
+
+        close_segment();
+
+        Trailer trailer{.last_index = last_index};
+        auto bytes = std::span{(const unsigned char *)&trailer, sizeof(trailer)};
+        pending.insert(pending.end(), bytes.begin(), bytes.end());
+        end_offset += sizeof(trailer);
+
+        stopping = true;
+    }
+
+    wake.signal();
+    thread.wait();
+}
+
+void Recorder::record(EventKind kind, std::span<const unsigned char> data) {
+    uint64_t time_us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    std::unique_lock lock{mutex};
+
+    if (stats_.failed) {
+        return;
+    }
+
+    if (pending.size() >= max_pending) {
+        ++stats_.stalls;
+        drained.wait(lock, [&] { return pending.size() < max_pending || stats_.failed; });
+        if (stats_.failed) {
+            return;
+        }
+    }
+
+    append(kind, time_us, data);
+
+    if (end_offset - segment.segment_start >= segment_bytes || time_us - segment.first_time_us >= segment_us) {
+        close_segment();
+    }
+
+    if (pending.size() >= wake_bytes) {
+        wake.signal();
+    }
+}
+
+RecorderStats Recorder::stats() {
+    std::lock_guard lock{mutex};
+    return stats_;
+}
+
+void Recorder::append(EventKind kind, uint64_t time_us, std::span<const unsigned char> data) {
+    if (segment.events == 0) {
+        segment.segment_start = end_offset;
+        segment.first_time_us = time_us;
+    }
+
+    EventHeader header{.time_us = time_us, .size = (uint32_t)data.size(), .kind = kind};
+    auto header_bytes = std::span{(const unsigned char *)&header, sizeof(header)};
+    pending.insert(pending.end(), header_bytes.begin(), header_bytes.end());
+    pending.insert(pending.end(), data.begin(), data.end());
+    end_offset += sizeof(header) + data.size();
+
+    segment.last_time_us = time_us;
+    ++segment.events;
+
+    ++stats_.events;
+    stats_.payload_bytes += data.size();
+}
+
+void Recorder::close_segment() {
+    if (segment.events == 0) {
+        return;
+    }
+
+    IndexBlock block = segment;
+    block.previous = last_index;
+
+    // Not through append, since the index event isn't part of any segment itself
+    EventHeader header{.time_us = block.last_time_us, .size = sizeof(block), .kind = EventKind::index};
+    auto header_bytes = std::span{(const unsigned char *)&header, sizeof(header)};
+    auto block_bytes = std::span{(const unsigned char *)&block, sizeof(block)};
+    pending.insert(pending.end(), header_bytes.begin(), header_bytes.end());
+    pending.insert(pending.end(), block_bytes.begin(), block_bytes.end());
+
+    last_index = end_offset;
+    end_offset += sizeof(header) + sizeof(block);
+    segment = {};
+}
+
+void Recorder::write_behind() {
+    // Swapped with `pending`, so that both keep their capacity
+    std::vector<unsigned char> writing{};
+
+    while (true) {
+        wake.wait_timeout(flush_interval_ms);
+
+        bool stop = false;
+        {
+            std::lock_guard lock{mutex};
+            std::swap(writing, pending);
+            stop = stopping;
+        }
+        drained.notify_all();
+
+        if (!writing.empty()) {
+            try {
+                file.write_full_from(writing);
+            } catch (std::exception &e) {
+                // E.g. the disk is full. The session goes on unrecorded, rather than waiting on a writer that's gone.
+                log::error(log::Category::session, "Recording failed", {{"path", path}, {"error", e.what()}});
+                {
+                    std::lock_guard lock{mutex};
+                    stats_.failed = true;
+                    pending.clear();
+                }
+                drained.notify_all();
+                return;
+            }
+
+            std::lock_guard lock{mutex};
+            ++stats_.flushes;
+            stats_.file_bytes += writing.size();
+        }
+        writing.clear();
+
+        // Everything was in `pending` by the time `stopping` was set
+        if (stop) {
+            return;
+        }
+    }
+}
+#pragma endregion Recorder
+
+#pragma region Transcript
+Transcript::Transcript(const std::string &path) {
+    file = Handle::open_file(path, GENERIC_READ, OPEN_EXISTING, FILE_SHARE_READ | FILE_SHARE_WRITE);
+    size_ = file.file_size();
+
+    if (size_ < sizeof(FileHeader)) {
+        fail("Not a session recording");
+    }
+
+    mapping = OwningHandle{CreateFileMappingA(file.raw(), nullptr, PAGE_READONLY, 0, 0, nullptr)};
+    if (!mapping) {
+        fail("Failed to map the recording");
+    }
+
+    view = (const unsigned char *)MapViewOfFile(mapping.raw(), FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        fail("Failed to map the recording");
+    }
+
+    std::memcpy(&header_, view, sizeof(header_));
+    if (header_.magic != FileHeader::magic_value) {
+        fail("Not a session recording");
+    }
+
+    Trailer trailer{};
+    if (size_ >= sizeof(FileHeader) + sizeof(Trailer)) {
+        std::memcpy(&trailer, view + size_ - sizeof(trailer), sizeof(trailer));
+    }
+
+    if (trailer.magic == Trailer::magic_value) {
+        complete_ = true;
+        index_from_trailer(trailer);
+    } else {
+        index_by_walking();
+    }
+}
+
+Transcript::~Transcript() {
+    if (view) {
+        UnmapViewOfFile(view);
+    }
+}
+
+void Transcript::index_from_trailer(const Trailer &trailer) {
+    for (uint64_t offset = trailer.last_index; offset != 0;) {
+        auto event = event_at(offset);
+        if (!event || event->kind != EventKind::index || event->data.size() != sizeof(IndexBlock)) {
+            fail("Corrupted recording index");
+        }
+
+        IndexBlock block{};
+        std::memcpy(&block, event->data.data(), sizeof(block));
+        segments.push_back(block);
+
+        if (offset == trailer.last_index) {
+            unindexed = event->next;
+        }
+        offset = block.previous;
+    }
+
+    std::ranges::reverse(segments);
+}
+
+void Transcript::index_by_walking() {
+    for (uint64_t offset = begin(); auto event = event_at(offset); offset = event->next) {
+        if (event->kind != EventKind::index || event->data.size() != sizeof(IndexBlock)) {
+            continue;
+        }
+
+        IndexBlock block{};
+        std::memcpy(&block, event->data.data(), sizeof(block));
+        segments.push_back(block);
+        unindexed = event->next;
+    }
+}
+
+std::optional<Event> Transcript::event_at(uint64_t offset) const {
+    // The trailer isn't an event, and an unfinished recording may end in the middle of one
+    uint64_t end = complete_ ? size_ - sizeof(Trailer) : size_;
+    if (offset + sizeof(EventHeader) > end) {
+        return std::nullopt;
+    }
+
+    EventHeader header{};
+    std::memcpy(&header, view + offset, sizeof(header));
+
+    uint64_t next = offset + sizeof(header) + header.size;
+    if (next > end) {
+        return std::nullopt;
+    }
+
+    return Event{
+        .kind = header.kind,
+        .time_us = header.time_us,
+        .data = {view + offset + sizeof(header), header.size},
+        .next = next,
+    };
+}
+
+uint64_t Transcript::seek(uint64_t time_us) const {
+    auto segment = std::ranges::lower_bound(segments, time_us, {}, &IndexBlock::last_time_us);
+    uint64_t offset = segment != segments.end() ? segment->segment_start : unindexed;
+
+    // At most a segment's worth of events
+    while (auto event = event_at(offset)) {
+        if (event->kind != EventKind::index && event->time_us >= time_us) {
+            break;
+        }
+        offset = event->next;
+    }
+
+    return offset;
+}
+#pragma endregion Transcript
+
+#pragma region Replay
+void replay(const std::string &path, double from_seconds, Handle console) {
+    Transcript transcript{path};
+
+    uint64_t from_us = (uint64_t)(std::max(from_seconds, 0.0) * 1e6);
+    auto started = std::chrono::steady_clock::now();
+
+    for (uint64_t offset = transcript.seek(from_us); auto event = transcript.event_at(offset); offset = event->next) {
+        if (event->kind != EventKind::output) {
+            continue;
+        }
+
+        auto due = started + std::chrono::microseconds(event->time_us - std::min(event->time_us, from_us));
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(due - std::chrono::steady_clock::now()).count();
+        if (left > 0) {
+            Sleep((DWORD)left);
+        }
+
+        console.write_full_from(event->data);
+    }
+
+    if (!transcript.complete()) {
+        printf("\n(The recording ends abruptly; it was either still being written or never closed)\n");
+    }
+}
+#pragma endregion Replay
+
+}  // namespace abel::record
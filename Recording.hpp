@@ -0,0 +1,229 @@
+#pragma once
+
+#include "Concurrency.hpp"
+#include "Handle.hpp"
+#include "IOBase.hpp"
+
+#include <Windows.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace abel {
+
+// Session transcripts: timestamped input and output, appended to a file by a background thread, so that
+// recording only costs the session a copy into memory. Periodic index blocks let a viewer seek by time.
+//
+// The file is a FileHeader, then events, each an EventHeader followed by its payload, then a Trailer if the
+// recording was closed cleanly. Every so often an index event summarizes the segment of events since the
+// previous one and links back to it, and the trailer points at the last one. Without a trailer, e.g. after
+// a crash, the index events are found by walking the events instead.
+namespace record {
+
+struct FileHeader {
+    static constexpr uint64_t magic_value = 0x3143455244434D52;  // "RCMDREC1"
+
+    uint64_t magic = magic_value;
+    // When the recording started, in ms since the Unix epoch
+    uint64_t start_unix_ms = 0;
+};
+
+static_assert(sizeof(FileHeader) == 16);
+
+enum class EventKind : uint8_t {
+    // Client -> shell
+    input = 0,
+    // Shell -> client
+    output = 1,
+    // A term::TerminalSize
+    resize = 2,
+    // An IndexBlock
+    index = 3,
+};
+
+struct EventHeader {
+    // Since the start of the recording
+    uint64_t time_us = 0;
+    uint32_t size = 0;
+    EventKind kind = EventKind::output;
+    uint8_t reserved[3]{};
+};
+
+static_assert(sizeof(EventHeader) == 16);
+
+struct IndexBlock {
+    // Of the previous index event, or 0 if this is the first one
+    uint64_t previous = 0;
+    // Of the first event in the segment
+    uint64_t segment_start = 0;
+    uint64_t first_time_us = 0;
+    uint64_t last_time_us = 0;
+    uint64_t events = 0;
+};
+
+static_assert(sizeof(IndexBlock) == 40);
+
+struct Trailer {
+    static constexpr uint64_t magic_value = 0x444E45434552434D;  // "MCRECEND"
+
+    // Of the last index event
+    uint64_t last_index = 0;
+    uint64_t magic = magic_value;
+};
+
+static_assert(sizeof(Trailer) == 16);
+
+struct RecorderStats {
+    uint64_t events{0};
+    uint64_t payload_bytes{0};
+    uint64_t file_bytes{0};
+    uint64_t flushes{0};
+    // Times record() had to wait for the writer to catch up
+    uint64_t stalls{0};
+    // Writing the file has failed, and nothing has been recorded since
+    bool failed{false};
+};
+
+class Recorder {
+protected:
+    // A segment is closed with an index event once it's this large or this long, whichever comes first
+    static constexpr uint64_t segment_bytes = 64 * 1024;
+    static constexpr uint64_t segment_us = 1'000'000;
+    // The writer is woken up early once this much is pending
+    static constexpr size_t wake_bytes = 256 * 1024;
+    // Past this, record() waits for the writer instead of buffering more
+    static constexpr size_t max_pending = 16 * 1024 * 1024;
+    static constexpr DWORD flush_interval_ms = 200;
+
+    std::string path;
+    OwningHandle file{};
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    std::mutex mutex{};
+    std::condition_variable drained{};
+    // Everything recorded but not yet written
+    std::vector<unsigned char> pending{};
+    // Where the end of `pending` lands in the file
+    uint64_t end_offset{0};
+    // The segment being filled, if it has any events
+    IndexBlock segment{};
+    uint64_t last_index{0};
+    RecorderStats stats_{};
+    bool stopping{false};
+
+    OwningHandle wake = Handle::create_event(false, false);
+    OwningHandle thread{};
+
+    void write_behind();
+
+    // These expect the mutex to be held
+    void append(EventKind kind, uint64_t time_us, std::span<const unsigned char> data);
+    void close_segment();
+
+public:
+    // Creates the file, overwriting any existing one
+    explicit Recorder(const std::string &path);
+
+    Recorder(const Recorder &) = delete;
+    Recorder &operator=(const Recorder &) = delete;
+    Recorder(Recorder &&) = delete;
+    Recorder &operator=(Recorder &&) = delete;
+
+    // Writes out everything recorded, then the final index and the trailer
+    ~Recorder();
+
+    // May be called from any thread. Drops the event once writing the file has failed.
+    void record(EventKind kind, std::span<const unsigned char> data);
+
+    RecorderStats stats();
+};
+
+// Records everything read through it. A null recorder makes it a plain pass-through.
+template <async_readable R>
+class Tap : public IOBase {
+protected:
+    R inner;
+    Recorder *recorder;
+    EventKind kind;
+
+public:
+    Tap(R inner, Recorder *recorder, EventKind kind) :
+        inner(std::move(inner)),
+        recorder{recorder},
+        kind{kind} {
+    }
+
+    AIO<eof<size_t>> read_async_into(std::span<unsigned char> data) {
+        auto result = co_await inner.read_async_into(data);
+        if (recorder && result.value > 0) {
+            recorder->record(kind, data.first(result.value));
+        }
+        co_return result;
+    }
+};
+
+struct Event {
+    EventKind kind{};
+    uint64_t time_us{0};
+    std::span<const unsigned char> data{};
+    // Where the event after this one starts
+    uint64_t next{0};
+};
+
+// A recording mapped into memory, for viewing. Works on recordings still being written, up to where they've got.
+class Transcript {
+protected:
+    OwningHandle file{};
+    OwningHandle mapping{};
+    const unsigned char *view{nullptr};
+    uint64_t size_{0};
+    FileHeader header_{};
+    bool complete_{false};
+    // Oldest first
+    std::vector<IndexBlock> segments{};
+    // Where the events no index event covers start
+    uint64_t unindexed{sizeof(FileHeader)};
+
+    void index_from_trailer(const Trailer &trailer);
+    void index_by_walking();
+
+public:
+    explicit Transcript(const std::string &path);
+
+    Transcript(const Transcript &) = delete;
+    Transcript &operator=(const Transcript &) = delete;
+
+    ~Transcript();
+
+    const FileHeader &header() const noexcept {
+        return header_;
+    }
+
+    // Whether the recording was closed cleanly
+    bool complete() const noexcept {
+        return complete_;
+    }
+
+    // Where the first event is
+    static constexpr uint64_t begin() noexcept {
+        return sizeof(FileHeader);
+    }
+
+    // The event at `offset`, or nothing past the last complete one
+    std::optional<Event> event_at(uint64_t offset) const;
+
+    // Offset of the first event at or after `time_us`, found through the index
+    uint64_t seek(uint64_t time_us) const;
+};
+
+// Plays a recording's output back to the console, with the original timing, starting at `from_seconds`
+void replay(const std::string &path, double from_seconds, Handle console);
+
+}  // namespace record
+
+}  // namespace abel
@@ -5,7 +5,28 @@
 #include "ArgParse.hpp"
 #include "Socket.hpp"
 #include "Concurrency.hpp"
+#include "Sync.hpp"
+#include "ConsoleWriter.hpp"
 #include "Service.hpp"
+#include "Protocol.hpp"
+#include "DeltaSync.hpp"
+#include "Compression.hpp"
+#include "Crypto.hpp"
+#include "TermSync.hpp"
+#include "Prediction.hpp"
+#include "Datagram.hpp"
+#include "ShellPool.hpp"
+#include "Pty.hpp"
+#include "Job.hpp"
+#include "Recording.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
+#include "Log.hpp"
+#include "Acceptor.hpp"
+#include "Admission.hpp"
+#include "IntrusiveList.hpp"
+#include "Bench.hpp"
+#include "Load.hpp"
 
 #include <cstdio>
 #include <cstdint>
@@ -14,6 +35,11 @@
 #include <span>
 #include <vector>
 #include <memory>
+#include <optional>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
 
 struct Args {
     bool svc = false;
@@ -21,6 +47,45 @@ struct Args {
     bool server = false;
     std::string_view host = "127.0.0.1";
     std::uint16_t port = 12345;
+    std::string_view push = "";
+    std::string_view dest = "";
+    bool compress = false;
+    bool sync = false;
+    bool predict = false;
+    unsigned predict_threshold = 30;
+    bool udp = false;
+    double udp_loss = 0;
+    unsigned pool = 2;
+    unsigned accept_threads = 1;
+    unsigned pending_accepts = 8;
+    std::string_view pin = "none";
+    bool admin = false;
+    uint32_t max_sessions = abel::AdminRequest::keep;
+    uint32_t max_queue = abel::AdminRequest::keep;
+    uint32_t queue_timeout = abel::AdminRequest::keep;
+    unsigned drain_grace = 10'000;
+    std::string_view shell = "C:\\Windows\\System32\\cmd.exe";
+    bool pty = false;
+    uint32_t session_cpu = 0;
+    uint32_t session_memory = 0;
+    uint32_t session_processes = 0;
+    std::string_view record = "";
+    std::string_view push_root = "";
+    uint16_t metrics_port = 0;
+    std::string_view trace = "";
+    std::string_view log_target = "";
+    std::string_view replay = "";
+    double replay_from = 0;
+    std::string_view key = "";
+    std::string_view key_file = "";
+    std::string_view bench = "";
+    std::string_view input = "";
+    std::string_view output = "";
+    std::string_view baseline = "";
+    unsigned load = 0;
+    unsigned load_duration = 60;
+    double load_cps = 8;
+    std::string_view load_script = "";
 
     void parse(int argc, const char **argv) {
         using namespace abel;
@@ -29,12 +94,54 @@ struct Args {
         parser.add_arg(
             "help",
             ArgParser::handler_help(
-                "Usage: RemoteCMD.exe [-h] [--svc] (-c|-s) [--host <host>] [--port <port>]\n"
+                "Usage: RemoteCMD.exe [-h] [--svc] (-c|-s) [--host <host>] [--port <port>] [--push <file> --dest <path>] [--compress] [--sync] [--predict [--predict-threshold <ms>]] [--udp [--udp-loss <percent>]] [--pool <count>] [--accept-threads <count>] [--pending-accepts <count>] [--pin <none|node|cpu>] [--admin] [--max-sessions <count>] [--max-queue <count>] [--queue-timeout <ms>] [--drain-grace <ms>] [--shell <path>] [--pty] [--session-cpu <s>] [--session-memory <MiB>] [--session-processes <count>] [--record <dir>] [--push-root <dir>] [--metrics-port <port>] [--trace <file>] [--log <target>] [--key <hex> | --key-file <file>]\n"
+                "       RemoteCMD.exe -c --load <count> [--load-duration <s>] [--load-cps <rate>] [--load-script <file>] [--host <host>] [--port <port>] [--compress] [--key <hex> | --key-file <file>]\n"
+                "       RemoteCMD.exe --replay <file> [--replay-from <s>]\n"
+                "       RemoteCMD.exe --bench <name> [--input <file>] [--shell <path>] [--output <file>] [--baseline <file>]\n"
                 "  --svc: Run as a Windows service. Requires server mode\n"
                 "  -c, --client: Run as a client\n"
                 "  -s, --server: Run as a server\n"
                 "  --host <host>: Host to connect to (default: 127.0.0.1). Ignored for servers\n"
-                "  --port <port>: Port to connect to / listen at (default: 12345)"
+                "  --port <port>: Port to connect to / listen at (default: 12345)\n"
+                "  --push <file>: Instead of opening a shell, upload a file, only sending the parts that differ\n"
+                "  --dest <path>: Where to put the pushed file on the server, relative to its --push-root\n"
+                "  --compress: Compress the session's traffic, as long as it is compressible. Client only\n"
+                "  --sync: Only send screen updates instead of the raw shell output, at a capped frame rate. Client only\n"
+                "  --predict: Show typed characters right away, underlined until the server echoes them. Client only\n"
+                "  --predict-threshold <ms>: Round trip time below which predictions aren't shown (default: 30)\n"
+                "  --udp: Carry the shell session over UDP instead, avoiding TCP's head-of-line blocking on lossy links. Client only\n"
+                "  --udp-loss <percent>: Drop this share of outgoing datagrams on purpose, for testing. Also used by the udp benchmark\n"
+                "  --pool <count>: Shells to keep spawned ahead of time, so that sessions start faster (default: 2). Server only\n"
+                "  --accept-threads <count>: Threads accepting connections in parallel (default: 1). Server only\n"
+                "  --pending-accepts <count>: Accepts each of those threads keeps pending (default: 8, at most 63)\n"
+                "  --pin <none|node|cpu>: Keep each accepting thread and session thread on a NUMA node, or on a processor of its own, spread over the nodes (default: none). Server only\n"
+                "  --admin: Instead of opening a shell, show the server's admission stats, applying any of the limits below first\n"
+                "  --max-sessions <count>: Sessions the server runs at once; the rest wait in a queue (default: 64)\n"
+                "  --max-queue <count>: Sessions that may wait; any more are turned away (default: 64)\n"
+                "  --queue-timeout <ms>: How long a session may wait before it's turned away (default: 30000)\n"
+                "  --drain-grace <ms>: On Ctrl+C or service stop, how long sessions may keep running before their shells are terminated (default: 10000)\n"
+                "  --shell <path>: Executable to run for shell sessions (default: C:\\Windows\\System32\\cmd.exe). Server only, also used by the pty benchmark\n"
+                "  --pty: Run shells on a pseudo console, so that full-screen programs work and follow the client's window size. Server only\n"
+                "  --session-cpu <s>: CPU time each shell session may use in total, after which it's terminated (default: unlimited). Server only\n"
+                "  --session-memory <MiB>: Memory each shell session may commit in total; allocations beyond it fail (default: unlimited). Server only\n"
+                "  --session-processes <count>: Processes each shell session may run at once (default: unlimited). Server only\n"
+                "  --record <dir>: Record a transcript of every shell session into this directory. Server only\n"
+                "  --push-root <dir>: Accept pushes, placing them under this directory; --dest must be relative to it (default: pushes are refused). Server only\n"
+                "  --metrics-port <port>: Serve live metrics for Prometheus at http://127.0.0.1:<port>/metrics (default: off). Server only\n"
+                "  --trace <file>: Trace the coroutines, and write the trace to this file on exit, in Chrome's JSON format. Also served at /trace with --metrics-port. Needs a build with ABEL_TRACING=1\n"
+                "  --load <count>: Instead of opening a shell, simulate this many users typing into sessions of their own, and report the echo latency and throughput. Needs a server with --pty. Client only\n"
+                "  --load-duration <s>: How long the simulated users keep typing (default: 60)\n"
+                "  --load-cps <rate>: How fast they type on average, in keystrokes per second (default: 8)\n"
+                "  --load-script <file>: What they type, one step per line, as `<weight> type <command>` or `<weight> idle <ms>` (default: a mix of short commands, ones with lots of output, and idle periods)\n"
+                "  --log <target>: Where the server logs to: console, file:<path>, syslog:<host>[:<port>] or eventlog[:<source>] (default: console, or the event log as a service). Server only\n"
+                "  --replay <file>: Instead of connecting anywhere, play back a recorded session's output\n"
+                "  --replay-from <s>: Where to start the playback, in seconds since the session started (default: 0)\n"
+                "  --key <hex>: Pre-shared key (64 hex digits) to encrypt shell sessions with. A server with a key rejects unencrypted sessions\n"
+                "  --key-file <file>: Same as --key, but reads the key from a file\n"
+                "  --bench <name>: Run a benchmark instead. Available: compression, crypto, udp, accept, pty, spawn, record, metrics, trace, log, sync, post, console, loopback\n"
+                "  --input <file>: Input for the benchmark, e.g. a recorded session output\n"
+                "  --output <file>: Where the loopback benchmark writes its results as JSON (default: stdout)\n"
+                "  --baseline <file>: Results of an earlier loopback run to compare against; regressions fail the run"
             ),
             'h'
         );
@@ -44,14 +151,119 @@ struct Args {
         parser.add_arg("server", ArgParser::handler_store_flag(server), 's');
         parser.add_arg("host", ArgParser::handler_store_str(host));
         parser.add_arg("port", ArgParser::handler_store_int(port));
+        parser.add_arg("push", ArgParser::handler_store_str(push));
+        parser.add_arg("dest", ArgParser::handler_store_str(dest));
+        parser.add_arg("compress", ArgParser::handler_store_flag(compress));
+        parser.add_arg("sync", ArgParser::handler_store_flag(sync));
+        parser.add_arg("predict", ArgParser::handler_store_flag(predict));
+        parser.add_arg("predict-threshold", ArgParser::handler_store_int(predict_threshold));
+        parser.add_arg("udp", ArgParser::handler_store_flag(udp));
+        parser.add_arg("udp-loss", ArgParser::handler_store_float(udp_loss));
+        parser.add_arg("pool", ArgParser::handler_store_int(pool));
+        parser.add_arg("accept-threads", ArgParser::handler_store_int(accept_threads));
+        parser.add_arg("pending-accepts", ArgParser::handler_store_int(pending_accepts));
+        parser.add_arg("pin", ArgParser::handler_store_str(pin));
+        parser.add_arg("admin", ArgParser::handler_store_flag(admin));
+        parser.add_arg("max-sessions", ArgParser::handler_store_int(max_sessions));
+        parser.add_arg("max-queue", ArgParser::handler_store_int(max_queue));
+        parser.add_arg("queue-timeout", ArgParser::handler_store_int(queue_timeout));
+        parser.add_arg("drain-grace", ArgParser::handler_store_int(drain_grace));
+        parser.add_arg("shell", ArgParser::handler_store_str(shell));
+        parser.add_arg("pty", ArgParser::handler_store_flag(pty));
+        parser.add_arg("session-cpu", ArgParser::handler_store_int(session_cpu));
+        parser.add_arg("session-memory", ArgParser::handler_store_int(session_memory));
+        parser.add_arg("session-processes", ArgParser::handler_store_int(session_processes));
+        parser.add_arg("record", ArgParser::handler_store_str(record));
+        parser.add_arg("push-root", ArgParser::handler_store_str(push_root));
+        parser.add_arg("metrics-port", ArgParser::handler_store_int(metrics_port));
+        parser.add_arg("trace", ArgParser::handler_store_str(trace));
+        parser.add_arg("log", ArgParser::handler_store_str(log_target));
+        parser.add_arg("replay", ArgParser::handler_store_str(replay));
+        parser.add_arg("replay-from", ArgParser::handler_store_float(replay_from));
+        parser.add_arg("key", ArgParser::handler_store_str(key));
+        parser.add_arg("key-file", ArgParser::handler_store_str(key_file));
+        parser.add_arg("bench", ArgParser::handler_store_str(bench));
+        parser.add_arg("input", ArgParser::handler_store_str(input));
+        parser.add_arg("output", ArgParser::handler_store_str(output));
+        parser.add_arg("baseline", ArgParser::handler_store_str(baseline));
+        parser.add_arg("load", ArgParser::handler_store_int(load));
+        parser.add_arg("load-duration", ArgParser::handler_store_int(load_duration));
+        parser.add_arg("load-cps", ArgParser::handler_store_float(load_cps));
+        parser.add_arg("load-script", ArgParser::handler_store_str(load_script));
 
         parser.parse(argc, argv);
     }
+
+    std::optional<abel::crypto::Key> load_key() const {
+        if (!key.empty() && !key_file.empty()) {
+            abel::fail("Specify at most one of --key or --key-file");
+        }
+
+        if (!key.empty()) {
+            return abel::crypto::parse_key(key);
+        }
+        if (!key_file.empty()) {
+            return abel::crypto::load_key_file(std::string{key_file});
+        }
+        return std::nullopt;
+    }
+
+    abel::ShellOptions shell_options() const {
+        return {
+            .executable = std::string{shell},
+            .pty = pty,
+            .limits = {.cpu_seconds = session_cpu, .memory_mb = session_memory, .processes = session_processes},
+        };
+    }
+
+    abel::Placement placement() const {
+        if (pin == "none") {
+            return abel::Placement::none;
+        }
+        if (pin == "node") {
+            return abel::Placement::node;
+        }
+        if (pin == "cpu") {
+            return abel::Placement::cpu;
+        }
+        abel::fail("--pin must be one of none, node or cpu");
+    }
+
+    // Limits left unspecified are AdminRequest::keep
+    abel::AdmissionLimits limits() const {
+        return {.max_sessions = max_sessions, .max_queue = max_queue, .queue_timeout_ms = queue_timeout};
+    }
 };
 
+// Stacks the optional session stages over the base stream and passes the resulting reader and writer to `f`.
+// Compression sits on top of encryption, since ciphertext doesn't compress.
+template <typename B, typename F>
+void with_session_streams(B socket, uint8_t flags, const abel::crypto::Key &key, abel::crypto::Direction outgoing, F &&f) {
+    using namespace abel;
+
+    auto incoming = outgoing == crypto::Direction::client_to_server ? crypto::Direction::server_to_client : crypto::Direction::client_to_server;
+
+    auto with_compression = [&](auto reader, auto writer) {
+        if (flags & session_compress) {
+            f(DecompressReader{std::move(reader)}, CompressWriter{std::move(writer)});
+        } else {
+            f(std::move(reader), std::move(writer));
+        }
+    };
+
+    if (flags & session_encrypt) {
+        with_compression(crypto::OpenReader{socket, key, incoming}, crypto::SealWriter{socket, key, outgoing});
+    } else {
+        with_compression(socket, socket);
+    }
+}
+
 class Client {
 protected:
     abel::OwningSocket socket{};
+    std::optional<abel::crypto::Key> psk{};
+    // How long the TCP handshake took; the first estimate of the round trip time
+    double connect_ms{0};
 
 public:
     Client() {
@@ -62,14 +274,120 @@ public:
     Client(Client &&) noexcept = default;
     Client &operator=(Client &&) noexcept = default;
 
-    static Client connect(const char *host, uint16_t port) {
+    static Client connect(const char *host, uint16_t port, std::optional<abel::crypto::Key> psk = std::nullopt, bool quiet = false) {
         Client cl{};
-        printf("Connecting to server...\n");
+        cl.psk = psk;
+        if (!quiet) {
+            printf("Connecting to server...\n");
+        }
+        auto start = std::chrono::steady_clock::now();
         cl.socket = abel::Socket::connect(host, port);
+        cl.connect_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
         return cl;
     }
 
-    void run() {
+    void send_hello(abel::SessionKind kind, uint8_t flags = 0) {
+        abel::SessionHello hello{.kind = kind, .flags = flags};
+        socket.write_full_from(abel::bytes_of(hello));
+    }
+
+    // Returns the admission's flags
+    uint8_t await_admission() {
+        while (true) {
+            abel::SessionAdmission admission{};
+            if (socket.read_full_into(abel::bytes_of(admission)).is_eof) {
+                abel::fail("Server closed the connection");
+            }
+
+            switch (admission.status) {
+            case abel::AdmissionStatus::admitted:
+                return admission.flags;
+
+            case abel::AdmissionStatus::queued:
+                printf("Server is busy, waiting in line (position %u)...\n", admission.position);
+                break;
+
+            case abel::AdmissionStatus::rejected_queue_full:
+                abel::fail("Server is busy and its queue is full, try again later");
+
+            case abel::AdmissionStatus::rejected_timeout:
+                abel::fail("Timed out waiting for the server to have room");
+
+            case abel::AdmissionStatus::rejected_shutdown:
+                abel::fail("Server is shutting down");
+
+            default:
+                abel::fail("Invalid session admission");
+            }
+        }
+    }
+
+    template <abel::async_readable R, abel::async_writable W>
+    static void pump(R from_server, W to_server, bool termsync, bool local_echo, abel::predict::PredictiveEcho *prediction) {
+        auto my_stdin = abel::Handle::get_stdin();
+        auto my_stdout = abel::Handle::get_stdout();
+        // Everything shown goes through it, so that a slow console doesn't hold up the socket. Flushed on the way out.
+        abel::ConsoleWriter output{my_stdout};
+
+        if (prediction) {
+            abel::ParallelAIOs(
+                abel::async_transfer(abel::predict::PredictingInput{my_stdin, output, *prediction}, std::move(to_server)),
+                abel::predict::receive_output(std::move(from_server), output, *prediction),
+                abel::predict::expire_predictions(*prediction, output)
+            ).run();
+            return;
+        }
+
+        if (termsync) {
+            abel::ParallelAIOs(
+                abel::async_transfer(my_stdin.console_async_io(local_echo, true, &output), std::move(to_server)),
+                abel::term::receive_frames(std::move(from_server), my_stdout.console_async_io(false, false, &output))
+            ).run();
+            return;
+        }
+
+        abel::ParallelAIOs(
+            abel::async_transfer(my_stdin.console_async_io(local_echo, true, &output), std::move(to_server)),
+            abel::async_transfer(std::move(from_server), my_stdout.console_async_io(false, false, &output))
+        ).run();
+    }
+
+    void run(uint8_t flags = 0, std::optional<unsigned> predict_threshold = std::nullopt, abel::udp::TransportOptions udp_options = {}) {
+        abel::crypto::Key session_key{};
+        if (psk) {
+            flags |= abel::session_encrypt;
+        }
+
+        // Servers whose shells aren't on a pseudo console just drop the resize requests
+        flags |= abel::session_resize;
+
+        send_hello(abel::SessionKind::shell, flags);
+
+        bool termsync = flags & abel::session_termsync;
+        {
+            // Both the frames and shells on a pseudo console draw with VT sequences.
+            // The frames also need the cursor not to wrap before the next character.
+            auto my_stdout = abel::Handle::get_stdout();
+            my_stdout.set_console_mode(my_stdout.get_console_mode() | ENABLE_VIRTUAL_TERMINAL_PROCESSING | (termsync ? DISABLE_NEWLINE_AUTO_RETURN : 0));
+
+            COORD size = my_stdout.console_window_size();
+            abel::term::TerminalSize terminal_size{.rows = (uint16_t)size.Y, .cols = (uint16_t)size.X};
+            socket.write_full_from(abel::bytes_of(terminal_size));
+        }
+
+        bool local_echo = !(await_admission() & abel::admission_remote_echo);
+
+        if (flags & abel::session_encrypt) {
+            session_key = abel::crypto::handshake_client(socket.borrow(), *psk);
+        }
+
+        std::unique_ptr<abel::udp::Transport> transport{};
+        if (flags & abel::session_udp) {
+            abel::udp::UdpOffer offer{};
+            socket.read_full_into(abel::bytes_of(offer));
+            transport = abel::udp::Transport::connect(socket.peer_address(), offer, udp_options);
+        }
+
         //printf("Starting the input -> socket thread...\n");
         //auto input_thread = abel::Thread::create<Client, &Client::input_to_socket>(this, true, true).handle;
 
@@ -82,16 +400,232 @@ public:
         //abel::Handle::wait_multiple<true>(input_thread, output_thread);
 
         auto my_stdin = abel::Handle::get_stdin();
-        auto my_stdout = abel::Handle::get_stdout();
 
-        my_stdin.set_console_mode(my_stdin.get_console_mode() & ~ENABLE_ECHO_INPUT & ~ENABLE_LINE_INPUT | ENABLE_PROCESSED_INPUT);
+        my_stdin.set_console_mode(my_stdin.get_console_mode() & ~ENABLE_ECHO_INPUT & ~ENABLE_LINE_INPUT | ENABLE_PROCESSED_INPUT | ENABLE_WINDOW_INPUT);
         //my_stdin.set_console_mode(my_stdin.get_console_mode() | ENABLE_ECHO_INPUT | ENABLE_LINE_INPUT);
 
+        std::optional<abel::predict::PredictiveEcho> prediction{};
+        if (predict_threshold) {
+            if (termsync) {
+                abel::fail("Predictive echo doesn't work together with terminal state synchronization");
+            }
+
+            // The predictions are drawn with VT sequences
+            auto my_stdout = abel::Handle::get_stdout();
+            my_stdout.set_console_mode(my_stdout.get_console_mode() | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+
+            prediction.emplace((double)*predict_threshold, connect_ms);
+        }
+
+        auto with_base = [&](auto base) {
+            with_session_streams(
+                base,
+                flags,
+                session_key,
+                abel::crypto::Direction::client_to_server,
+                [&](auto from_server, auto to_server) {
+                    pump(std::move(from_server), std::move(to_server), termsync, local_echo, prediction ? &*prediction : nullptr);
+                }
+            );
+        };
+
         printf("Ready!\n");
-        abel::ParallelAIOs(
-            abel::async_transfer(my_stdin.console_async_io(), socket.borrow()),
-            abel::async_transfer(socket.borrow(), my_stdout.console_async_io())
-        ).run();
+        if (transport) {
+            with_base(transport->stream());
+            transport->close();
+        } else {
+            with_base(socket.borrow());
+        }
+
+        if (prediction) {
+            auto &stats = prediction->stats();
+            printf(
+                "Predicted %llu characters: %llu confirmed, %llu mispredicted, %llu expired (round trip %.0f ms)\n",
+                stats.predicted,
+                stats.confirmed,
+                stats.mispredicted,
+                stats.expired,
+                prediction->rtt_ms()
+            );
+        }
+    }
+
+    void push(const char *source, const char *dest, uint8_t flags = 0) {
+        abel::crypto::Key session_key{};
+        if (psk) {
+            flags |= abel::session_encrypt;
+        }
+
+        auto file = abel::Handle::open_file(source);
+        abel::delta::PushStats stats{};
+
+        send_hello(abel::SessionKind::push, flags);
+        await_admission();
+
+        if (psk) {
+            session_key = abel::crypto::handshake_client(socket.borrow(), *psk);
+        }
+
+        with_session_streams(
+            socket.borrow(),
+            flags,
+            session_key,
+            abel::crypto::Direction::client_to_server,
+            [&](auto from_server, auto to_server) {
+                abel::ParallelAIOs tasks{abel::delta::push_file(abel::delta::channel_of(from_server, to_server), file.borrow(), dest, stats)};
+                tasks.run();
+                tasks.rethrow();
+            }
+        );
+
+        printf(
+            "Pushed %llu bytes: %llu sent as literals, %llu matched (block size %u)\n",
+            stats.file_size,
+            stats.literal_bytes,
+            stats.matched_bytes,
+            stats.block_size
+        );
+    }
+
+    // Opens all the sessions one by one, then drives them from a single event loop until they've typed for long enough
+    static void load(const char *host, uint16_t port, std::optional<abel::crypto::Key> psk, uint8_t flags, const abel::load::Options &options, const abel::load::Script &script) {
+        using namespace abel;
+
+        if (flags & (session_termsync | session_udp)) {
+            fail("--load only drives plain shell sessions, without --sync or --udp");
+        }
+        if (options.sessions == 0 || options.cps <= 0) {
+            fail("--load needs at least one session, typing at a positive rate");
+        }
+
+        if (psk) {
+            flags |= session_encrypt;
+        }
+        // The size of a classic console window, for the server's pseudo console
+        flags |= session_resize;
+        term::TerminalSize terminal_size{.rows = 25, .cols = 80};
+
+        std::vector<Client> clients{};
+        std::vector<crypto::Key> session_keys(options.sessions);
+        std::vector<std::unique_ptr<load::Session>> sessions{};
+        clients.reserve(options.sessions);
+        sessions.reserve(options.sessions);
+
+        printf("Opening %u sessions...\n", options.sessions);
+        for (unsigned i = 0; i < options.sessions; ++i) {
+            sessions.push_back(std::make_unique<load::Session>(i));
+
+            bool remote_echo = true;
+            // A session the server turns away counts as a failed one, rather than ending the run
+            try {
+                auto client = connect(host, port, psk, true);
+                client.send_hello(SessionKind::shell, flags);
+                client.socket.write_full_from(bytes_of(terminal_size));
+                remote_echo = client.await_admission() & admission_remote_echo;
+
+                if (psk) {
+                    session_keys[i] = crypto::handshake_client(client.socket.borrow(), *psk);
+                }
+
+                clients.push_back(std::move(client));
+            } catch (const std::exception &e) {
+                sessions.back()->fail(e);
+                clients.emplace_back();
+            }
+
+            if (!remote_echo) {
+                // On pipes, cmd.exe only echoes a line once Enter is pressed, so there's no keystroke echo to time
+                fail("--load needs a server running its shells on a pseudo console (--pty)");
+            }
+        }
+
+        auto start = load::Clock::now();
+        auto stop_at = start + std::chrono::seconds(options.duration_s);
+
+        std::vector<AIO<void>> tasks{};
+        for (unsigned i = 0; i < options.sessions; ++i) {
+            if (!clients[i].socket) {
+                continue;
+            }
+
+            with_session_streams(
+                clients[i].socket.borrow(),
+                flags,
+                session_keys[i],
+                crypto::Direction::client_to_server,
+                [&](auto from_server, auto to_server) {
+                    tasks.push_back(load::type_script(std::move(to_server), script, options, *sessions[i], stop_at));
+                    tasks.push_back(load::receive_echoes(std::move(from_server), *sessions[i]));
+                }
+            );
+        }
+
+        printf("Typing for %u s...\n", options.duration_s);
+        {
+            // Sessions still busy with output by then are cut off
+            constexpr DWORD exit_grace_ms = 10'000;
+            auto deadline = Handle::create_timer();
+            deadline.set_timer(options.duration_s * 1000 + exit_grace_ms);
+
+            ParallelAIOs loop{std::move(tasks)};
+            loop.until(deadline.borrow()).run();
+
+            // Cancels whatever IO is left while the loop still owns the buffers
+            clients.clear();
+        }
+
+        load::report(sessions, std::chrono::duration<double>(load::Clock::now() - start).count());
+    }
+
+    template <abel::async_readable R, abel::async_writable W>
+    static abel::AIO<void> request_admin(R from_server, W to_server, abel::AdminRequest request, abel::AdmissionStats &stats) {
+        co_await to_server.write_async_full_from(abel::bytes_of(request));
+        if ((co_await from_server.read_async_full_into(abel::bytes_of(stats))).is_eof) {
+            abel::fail("Server closed the admin session");
+        }
+    }
+
+    void admin(abel::AdmissionLimits limits) {
+        uint8_t flags = psk ? abel::session_encrypt : 0;
+        abel::crypto::Key session_key{};
+
+        send_hello(abel::SessionKind::admin, flags);
+        await_admission();
+
+        if (psk) {
+            session_key = abel::crypto::handshake_client(socket.borrow(), *psk);
+        }
+
+        bool changes = limits.max_sessions != abel::AdminRequest::keep || limits.max_queue != abel::AdminRequest::keep || limits.queue_timeout_ms != abel::AdminRequest::keep;
+        abel::AdminRequest request{.op = changes ? abel::AdminOp::set_limits : abel::AdminOp::get_stats, .limits = limits};
+        abel::AdmissionStats stats{};
+
+        with_session_streams(
+            socket.borrow(),
+            flags,
+            session_key,
+            abel::crypto::Direction::client_to_server,
+            [&](auto from_server, auto to_server) {
+                abel::ParallelAIOs tasks{request_admin(std::move(from_server), std::move(to_server), request, stats)};
+                tasks.run();
+                tasks.rethrow();
+            }
+        );
+
+        printf(
+            "Sessions: %u running (limit %u), %u queued (limit %u, timeout %u ms)\n"
+            "Admitted: %llu, %llu of them after queueing\n"
+            "Rejected: %llu with a full queue, %llu timed out\n",
+            stats.active,
+            stats.limits.max_sessions,
+            stats.queued,
+            stats.limits.max_queue,
+            stats.limits.queue_timeout_ms,
+            stats.admitted,
+            stats.admitted_after_queueing,
+            stats.rejected_queue_full,
+            stats.rejected_timeout
+        );
     }
 };
 
@@ -99,62 +633,567 @@ class ServerSvc;
 
 class Server {
 protected:
-    struct ClientConn {
+    struct SessionRegistry;
+
+    // Owned by the registry from when its thread starts, and deletes itself when it's done
+    struct ClientConn : public abel::IntrusiveListNode<ClientConn> {
+        SessionRegistry *registry{};
         abel::OwningSocket socket{};
-        abel::OwningHandle thread{};
+        // Only for shells on a pseudo console. Declared before the pipes, so that it's closed after them, which keeps closing it from blocking.
+        abel::pty::PseudoConsole pty{};
+        // Set once the pseudo console is being closed, from then on resize requests are ignored
+        bool pty_closing{false};
         abel::Pipe pipe_out{};
         abel::Pipe pipe_in{};
+        abel::SessionHello hello{};
+        std::optional<abel::crypto::Key> psk{};
+        abel::crypto::Key session_key{};
+        abel::term::TerminalSize terminal_size{};
+        abel::udp::TransportOptions udp_options{};
+        std::unique_ptr<abel::udp::Transport> transport{};
+        abel::ShellPool *pool{};
+        abel::AdmissionControl *admission{};
+        // Signaled when the server starts draining
+        abel::Handle drain{};
+        DWORD drain_grace_ms{0};
+        // The shell, once it runs, and the job holding it and everything it starts. Guarded, since the server
+        // may terminate it from another thread while draining, and reports the job's usage.
+        std::mutex cmd_mutex{};
+        std::optional<abel::Process> cmd{};
+        abel::Job job{};
+        // Where to put the session's transcript, if anywhere
+        std::string record_dir{};
+        std::unique_ptr<abel::record::Recorder> recorder{};
+        // Pushed files may only land under it. Pushes are refused if it's empty.
+        std::string push_root{};
+        // Notices for the client that haven't been sent yet, see post_notice
+        std::string notices{};
+        abel::AsyncEvent notices_pending{};
+        // While a termsync session runs, which shows notices through its emulator
+        abel::term::SyncState *sync_state{nullptr};
+
+        // How long to keep sending the shell's output after it has exited
+        static constexpr DWORD flush_timeout_ms = 1000;
+        // How often the job is checked for limits it has run into
+        static constexpr DWORD limit_poll_ms = 250;
+        // What's read from the shell at once
+        static constexpr size_t output_buffer_size = 4096;
+
+        struct Usage {
+            DWORD pid{};
+            abel::JobUsage job{};
+        };
+
+        void run() {
+            abel::metrics::add(abel::metrics::Counter::sessions_started);
+            handle();
+            abel::metrics::add(abel::metrics::Counter::sessions_finished);
+
+            // Releases the socket, pipes and shell right away. `this` is gone afterwards.
+            registry->remove(this);
+        }
 
         void handle() {
             try {
-                pipe_out = abel::Pipe::create_async(true);
-                pipe_in = abel::Pipe::create_async(true);
-
-                auto cmd = abel::Process::create(
-                    "C:\\Windows\\System32\\cmd.exe",
-                    // "/q",  // Because otherwise echo is only done a newline
-                    "",
-                    "",
-                    true,
-                    CREATE_NO_WINDOW /*CREATE_NEW_CONSOLE /*DETACHED_PROCESS*/,
-                    STARTF_USESHOWWINDOW,
-                    pipe_in.read,
-                    pipe_out.write,
-                    pipe_out.write,
-                    [](STARTUPINFOA &info) {
-                        info.wShowWindow = SW_HIDE;
+                socket.read_full_into(abel::bytes_of(hello));
+                if (!hello.valid()) {
+                    abel::fail("Invalid session hello");
+                }
+
+                if (hello.flags & (abel::session_termsync | abel::session_resize)) {
+                    socket.read_full_into(abel::bytes_of(terminal_size));
+                    if (!terminal_size.valid()) {
+                        abel::fail("Invalid terminal size");
                     }
-                );
+                }
 
-                //abel::ParallelAIOs(
-                //    abel::async_transfer(socket.borrow(), socket.borrow())
-                //).run();
-                //abel::ParallelAIOs(
-                //    abel::async_transfer(socket.borrow(), pipe_in.write.borrow()),
-                //    abel::async_transfer(pipe_in.read.borrow(), socket.borrow())
-                //).run();
-                abel::ParallelAIOs(
-                    abel::async_transfer(pipe_out.read.borrow(), socket.borrow()),
-                    abel::async_transfer(socket.borrow(), pipe_in.write.borrow())
-                ).until(cmd.process).run();
-
-                // Gracefully close connection
-                socket.shutdown();
-
-                if (cmd.process.process_running()) {
-                    cmd.process.terminate_process();
+                bool encrypted = hello.flags & abel::session_encrypt;
+                if (psk && !encrypted) {
+                    abel::fail("This server only accepts encrypted sessions");
+                }
+                if (!psk && encrypted) {
+                    abel::fail("Encryption requested, but the server has no key");
+                }
+
+                // Admin sessions get through regardless, so that the limits can be raised on an overloaded server
+                abel::AdmissionSlot slot{};
+                if (hello.kind != abel::SessionKind::admin) {
+                    auto verdict = admission->enter(
+                        [&](uint32_t position) {
+                            send_admission({.status = abel::AdmissionStatus::queued, .position = position});
+                        },
+                        // The client sends nothing until it's admitted, so anything to read is its end
+                        [&]() {
+                            return socket.peer_closed();
+                        }
+                    );
+
+                    switch (verdict) {
+                    case abel::AdmissionVerdict::abandoned:
+                        return;
+
+                    case abel::AdmissionVerdict::rejected_queue_full:
+                        send_admission({.status = abel::AdmissionStatus::rejected_queue_full});
+                        socket.shutdown();
+                        return;
+
+                    case abel::AdmissionVerdict::rejected_timeout:
+                        send_admission({.status = abel::AdmissionStatus::rejected_timeout});
+                        socket.shutdown();
+                        return;
+
+                    case abel::AdmissionVerdict::rejected_shutdown:
+                        send_admission({.status = abel::AdmissionStatus::rejected_shutdown});
+                        socket.shutdown();
+                        return;
+
+                    default:
+                        slot = abel::AdmissionSlot{*admission};
+                        break;
+                    }
+                }
+                bool remote_echo = hello.kind == abel::SessionKind::shell && pool->uses_pty();
+                send_admission({.status = abel::AdmissionStatus::admitted, .flags = remote_echo ? (uint8_t)abel::admission_remote_echo : (uint8_t)0});
+
+                if (encrypted) {
+                    session_key = abel::crypto::handshake_server(socket.borrow(), *psk);
+                }
+
+                if (hello.flags & abel::session_udp) {
+                    if (hello.kind != abel::SessionKind::shell) {
+                        abel::fail("Only shell sessions can be carried over UDP");
+                    }
+
+                    transport = abel::udp::Transport::listen(udp_options);
+                    socket.write_full_from(abel::bytes_of(transport->offer()));
+                    transport->accept_peer();
+                }
+
+                switch (hello.kind) {
+                case abel::SessionKind::shell:
+                    handle_shell();
+                    break;
+
+                case abel::SessionKind::push:
+                    handle_push();
+                    break;
+
+                case abel::SessionKind::admin:
+                    handle_admin();
+                    break;
+
+                default:
+                    abel::fail("Unknown session kind");
                 }
-                cmd.process.wait();
             } catch (std::exception &e) {
-                // Note: this will crash in service mode, but that's acceptable for error handling
-                printf("Client error: %s\n", e.what());
+                abel::log::warning(abel::log::Category::session, "Session failed", {{"error", e.what()}});
+            }
+        }
+
+        void send_admission(abel::SessionAdmission reply) {
+            socket.write_full_from(abel::bytes_of(reply));
+        }
+
+        void handle_admin() {
+            with_session_streams(
+                socket.borrow(),
+                hello.flags,
+                session_key,
+                abel::crypto::Direction::server_to_client,
+                [&](auto from_client, auto to_client) {
+                    abel::ParallelAIOs tasks{serve_admin(std::move(from_client), std::move(to_client), *admission)};
+                    tasks.run();
+                    tasks.rethrow();
+                }
+            );
+
+            socket.shutdown();
+        }
+
+        template <abel::async_readable R, abel::async_writable W>
+        static abel::AIO<void> serve_admin(R from_client, W to_client, abel::AdmissionControl &admission) {
+            abel::AdminRequest request{};
+            if ((co_await from_client.read_async_full_into(abel::bytes_of(request))).is_eof) {
+                co_return;
+            }
+
+            if (request.op == abel::AdminOp::set_limits) {
+                admission.set_limits(request.limits);
+            }
+
+            abel::AdmissionStats stats = admission.stats();
+            co_await to_client.write_async_full_from(abel::bytes_of(stats));
+        }
+
+        void handle_push() {
+            with_session_streams(
+                socket.borrow(),
+                hello.flags,
+                session_key,
+                abel::crypto::Direction::server_to_client,
+                [&](auto from_client, auto to_client) {
+                    abel::ParallelAIOs tasks{abel::delta::receive_push(abel::delta::channel_of(from_client, to_client), push_root)};
+                    tasks.run();
+                    tasks.rethrow();
+                }
+            );
+
+            socket.shutdown();
+        }
+
+        // Returns true if there was a running shell to terminate
+        bool terminate_shell() {
+            std::lock_guard lock{cmd_mutex};
+            if (!cmd || !cmd->process.process_running()) {
+                return false;
+            }
+
+            // Everything the shell started goes with it
+            if (job) {
+                job.terminate();
+            } else {
+                cmd->process.terminate_process();
+            }
+            return true;
+        }
+
+        // Only for shell sessions, once the shell runs
+        std::optional<Usage> usage() {
+            std::lock_guard lock{cmd_mutex};
+            if (!cmd || !job) {
+                return std::nullopt;
+            }
+
+            return Usage{.pid = cmd->pid, .job = job.usage()};
+        }
+
+        void handle_shell() {
+            auto shell = pool->take();
+            pty = std::move(shell.pty);
+            pipe_out = std::move(shell.pipe_out);
+            pipe_in = std::move(shell.pipe_in);
+            {
+                std::lock_guard lock{cmd_mutex};
+                cmd.emplace(std::move(shell.cmd));
+                job = std::move(shell.job);
+            }
+            abel::Handle process = cmd->process;
+
+            bool sized = hello.flags & (abel::session_termsync | abel::session_resize);
+            if (pty && sized) {
+                pty.resize(terminal_size);
+            }
+
+            // A session that should be recorded but can't be fails instead of going unrecorded
+            if (!record_dir.empty()) {
+                recorder = std::make_unique<abel::record::Recorder>(recording_path());
+                if (sized) {
+                    recorder->record(abel::record::EventKind::resize, abel::bytes_of(terminal_size));
+                }
+            }
+
+            //abel::ParallelAIOs(
+            //    abel::async_transfer(socket.borrow(), socket.borrow())
+            //).run();
+            //abel::ParallelAIOs(
+            //    abel::async_transfer(socket.borrow(), pipe_in.write.borrow()),
+            //    abel::async_transfer(pipe_in.read.borrow(), socket.borrow())
+            //).run();
+            auto with_base = [&](auto base) {
+                with_session_streams(
+                    abel::metrics::Metered{std::move(base)},
+                    hello.flags,
+                    session_key,
+                    abel::crypto::Direction::server_to_client,
+                    [&](auto from_client, auto to_client) {
+                        // Without a pseudo console, the requests are still kept from reaching the shell
+                        abel::pty::ResizeFilter filtered{std::move(from_client), [this](abel::term::TerminalSize size) {
+                            if (pty && !pty_closing) {
+                                pty.resize(size);
+                            }
+                            // The frames have to follow the new size too, or they'd diverge from what the shell draws
+                            if (sync_state) {
+                                sync_state->emulator.resize(size.rows, size.cols);
+                                sync_state->dirty.signal();
+                            }
+                            if (recorder) {
+                                recorder->record(abel::record::EventKind::resize, abel::bytes_of(size));
+                            }
+                        }};
+                        abel::record::Tap recorded{std::move(filtered), recorder.get(), abel::record::EventKind::input};
+
+                        pump(std::move(to_client), std::move(recorded), process);
+                    }
+                );
+            };
+
+            if (transport) {
+                with_base(transport->stream());
+                transport->close();
+            } else {
+                with_base(socket.borrow());
             }
+
+            // Gracefully close connection
+            socket.shutdown();
+
+            terminate_shell();
+            process.wait();
+
+            // Finishes the transcript
+            recorder.reset();
+        }
+
+        std::string recording_path() const {
+            auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            return record_dir + "\\session-" + std::to_string(now) + "-" + std::to_string(cmd->pid) + ".rcmdrec";
+        }
+
+        template <abel::async_writable W, abel::async_readable R>
+        void pump(W to_client, R from_client, abel::Handle process) {
+            abel::record::Tap shell_output{pipe_out.read.borrow(), recorder.get(), abel::record::EventKind::output};
+
+            auto flushed = abel::Handle::create_timer();
+
+            if (hello.flags & abel::session_termsync) {
+                abel::term::SyncState state{terminal_size};
+                sync_state = &state;
+
+                abel::ParallelAIOs tasks(
+                    abel::term::feed_output(shell_output, state),
+                    abel::term::send_frames(to_client, state, flushed),
+                    abel::async_transfer(std::move(from_client), pipe_in.write.borrow()),
+                    notify_drain(),
+                    notify_limits()
+                );
+                // Resumed below rather than cancelled, so that a frame being written when the shell exits gets through
+                tasks.until(process).run();
+
+                if (!state.frames_done) {
+                    finish_output(tasks, flushed);
+                }
+
+                // Only if the flush timed out between frames; cut off mid-frame, the stream can't take another one
+                if (!state.frames_done && !state.sending) {
+                    abel::ParallelAIOs{abel::term::send_last_frame(to_client, state)}.run();
+                }
+                sync_state = nullptr;
+                return;
+            }
+
+            bool output_done = false;
+            // Taken for every write to the client, which the shell's output and the notices share
+            abel::AsyncMutex writing{};
+
+            abel::ParallelAIOs tasks(
+                send_output(shell_output, to_client, writing, output_done, flushed),
+                send_notices(to_client, writing),
+                abel::async_transfer(std::move(from_client), pipe_in.write.borrow()),
+                notify_drain(),
+                notify_limits()
+            );
+            tasks.until(process).run();
+
+            if (!output_done) {
+                finish_output(tasks, flushed);
+            }
+        }
+
+        // The shell is gone, but its last output may still be in the pipe. Keeps running `tasks`, which read it,
+        // until they set `flushed`, or flush_timeout_ms runs out.
+        void finish_output(abel::ParallelAIOs &tasks, abel::Handle flushed) {
+            // E.g. the CPU time limit, which may be what ended the shell. Sent after the rest of the output.
+            post_limit_notices();
+
+            // Once our own copy of the write end is closed, reading it runs into the end
+            pipe_out.write.close();
+
+            // A pseudo console holds the other copy until it's closed, which blocks until its output is read
+            abel::OwningHandle closer{};
+            if (pty) {
+                pty_closing = true;
+                closer = abel::Thread::create<abel::pty::PseudoConsole, &abel::pty::PseudoConsole::close>(&pty).handle;
+            }
+
+            flushed.set_timer(flush_timeout_ms);
+            tasks.until(flushed).run();
+
+            if (closer) {
+                // Whatever is left unread mustn't hold the console host up anymore
+                pipe_out.read.close();
+                closer.wait();
+            }
+        }
+
+        // Like async_transfer, but leaves `to_client` usable afterwards, and reports when it's done.
+        // Sends the notices still pending once the shell's output has ended.
+        template <abel::async_readable R, abel::async_writable W>
+        abel::AIO<void> send_output(R from_shell, W &to_client, abel::AsyncMutex &writing, bool &done, abel::Handle done_timer) {
+            // The session thread's own buffer, on its NUMA node, which nothing else uses while the session runs
+            std::unique_ptr<unsigned char[]> allocated{};
+            std::span<unsigned char> buffer = abel::ThreadPool::local_buffer();
+            if (buffer.size() < output_buffer_size) {
+                allocated = std::make_unique<unsigned char[]>(output_buffer_size);
+                buffer = {allocated.get(), output_buffer_size};
+            }
+            buffer = buffer.first(output_buffer_size);
+
+            while (true) {
+                auto read = co_await from_shell.read_async_into(buffer);
+                if (read.is_eof) {
+                    co_await write_notices(to_client, writing);
+                    break;
+                }
+
+                co_await writing.lock_async();
+                std::lock_guard lock{writing, std::adopt_lock};
+                if ((co_await to_client.write_async_full_from(buffer.first(read.value))).is_eof) {
+                    break;
+                }
+            }
+
+            done = true;
+            done_timer.set_timer(0);
+        }
+
+        template <abel::async_writable W>
+        abel::AIO<void> send_notices(W &to_client, abel::AsyncMutex &writing) {
+            while (true) {
+                co_await notices_pending.wait_async();
+                notices_pending.reset();
+
+                if (co_await write_notices(to_client, writing)) {
+                    break;
+                }
+            }
+        }
+
+        // Returns true if the client's end has been reached
+        template <abel::async_writable W>
+        abel::AIO<bool> write_notices(W &to_client, abel::AsyncMutex &writing) {
+            co_await writing.lock_async();
+            std::lock_guard lock{writing, std::adopt_lock};
+
+            // Taken only once the lock is held, so that whoever holds it last finds everything posted so far
+            std::string pending = std::exchange(notices, {});
+            if (pending.empty()) {
+                co_return false;
+            }
+            co_return (co_await to_client.write_async_full_from({(const unsigned char *)pending.data(), pending.size()})).is_eof;
+        }
+
+        // Shows a notice between chunks of the shell's output. It isn't written into the shell's pipe, since the
+        // session thread, which is its only reader, would block on a full one: a pseudo console only takes
+        // synchronous pipes.
+        void post_notice(std::string_view notice) {
+            auto bytes = std::span{(const unsigned char *)notice.data(), notice.size()};
+            if (recorder) {
+                recorder->record(abel::record::EventKind::output, bytes);
+            }
+
+            if (sync_state) {
+                sync_state->emulator.feed(bytes);
+                sync_state->dirty.signal();
+                return;
+            }
+
+            notices.append(notice);
+            notices_pending.signal();
+        }
+
+        abel::AIO<void> notify_drain() {
+            co_await abel::event_signaled{drain};
+
+            char notice[128] = {};
+            int size = snprintf(notice, sizeof(notice), "\r\n*** The server is shutting down; this session ends in %u s ***\r\n", drain_grace_ms / 1000);
+            post_notice({notice, (size_t)size});
+        }
+
+        // Tells the client about limits the session runs into, the same way as notify_drain does
+        abel::AIO<void> notify_limits() {
+            auto timer = abel::Handle::create_timer();
+
+            while (true) {
+                timer.set_timer(limit_poll_ms);
+                co_await abel::event_signaled{timer};
+
+                post_limit_notices();
+            }
+        }
+
+        void post_limit_notices() {
+            while (auto limit = job.poll_limit()) {
+                post_notice("\r\n*** This session has reached its " + job.describe(*limit) + " ***\r\n");
+            }
+        }
+    };
+
+    // The running sessions. They deregister themselves when done, so nothing has to poll for finished ones.
+    struct SessionRegistry {
+        std::mutex mutex{};
+        abel::IntrusiveList<ClientConn> sessions{};
+        // Signaled while there are no sessions
+        abel::Event empty{true, true};
+
+        // Expects the mutex to be held
+        void add(ClientConn *session) {
+            sessions.push_front(session);
+            empty.reset();
+        }
+
+        void remove(ClientConn *session) {
+            {
+                std::lock_guard lock{mutex};
+                sessions.remove(session);
+                if (sessions.empty()) {
+                    empty.signal();
+                }
+            }
+
+            delete session;
+        }
+
+        size_t size() {
+            std::lock_guard lock{mutex};
+            return sessions.size();
+        }
+
+        template <typename F>
+        void for_each(F &&f) {
+            std::lock_guard lock{mutex};
+            sessions.for_each(std::forward<F>(f));
         }
     };
 
     abel::OwningSocket listenSocket{};
-    std::vector<std::unique_ptr<ClientConn>> clients{};
+    // Boxed, so that Server stays movable
+    std::unique_ptr<SessionRegistry> registry = std::make_unique<SessionRegistry>();
+    uint64_t reported_sessions{0};
     bool service_mode = false;
+    std::optional<abel::crypto::Key> psk{};
+    abel::udp::TransportOptions udp_options{};
+    std::unique_ptr<abel::ShellPool> pool{};
+    // Sessions run on these, rather than on a new thread each
+    std::unique_ptr<abel::ThreadPool> session_threads{};
+    abel::Placement placement{abel::Placement::none};
+    std::unique_ptr<abel::AdmissionControl> admission{};
+    uint64_t reported_admission_events{0};
+    uint64_t reported_bytes{0};
+    abel::OwningHandle drain_event = abel::Handle::create_event(true, false);
+    DWORD drain_grace_ms{10'000};
+    std::string record_dir{};
+    std::string push_root{};
+
+    std::chrono::steady_clock::time_point usage_reported{};
+
+    static constexpr DWORD report_interval_ms = 1000;
+    static constexpr auto usage_report_interval = std::chrono::seconds(10);
+
+    // Waits for all sessions to end, or until the deadline. Returns true if they have.
+    bool wait_sessions(std::chrono::steady_clock::time_point deadline) {
+        auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        return registry->empty.wait_timeout((DWORD)std::max<long long>(left, 0));
+    }
 
 public:
     Server(bool service_mode_) :
@@ -166,42 +1205,263 @@ public:
     Server(Server &&) noexcept = default;
     Server &operator=(Server &&) noexcept = default;
 
-    static Server setup(const char *host, uint16_t port, bool service_mode = false) {
+    static Server setup(const char *host, uint16_t port, bool service_mode = false, std::optional<abel::crypto::Key> psk = std::nullopt, abel::udp::TransportOptions udp_options = {}, size_t pool_size = 0, abel::AdmissionLimits limits = {}, DWORD drain_grace_ms = 10'000, abel::ShellOptions shell = {}, std::string record_dir = "", std::string push_root = "", abel::Placement placement = abel::Placement::none) {
         Server sv{service_mode};
+        sv.psk = psk;
+        sv.udp_options = udp_options;
+        sv.pool = std::make_unique<abel::ShellPool>(pool_size, std::move(shell));
+        sv.admission = std::make_unique<abel::AdmissionControl>();
+        sv.admission->set_limits(limits);
+        sv.drain_grace_ms = drain_grace_ms;
+        sv.record_dir = std::move(record_dir);
+        sv.push_root = std::move(push_root);
+        sv.placement = placement;
+        // Admission control is what limits the sessions, and the queued ones wait on their threads too
+        sv.session_threads = std::make_unique<abel::ThreadPool>(abel::ThreadPoolOptions{
+            .min_threads = std::max<size_t>(pool_size, 1),
+            .max_threads = SIZE_MAX,
+            .placement = placement,
+            .buffer_size = ClientConn::output_buffer_size,
+            .name = "session",
+        });
         //printf("Setting up server...\n");
         (void)host;  // TODO: resolve host, bind to single address?
         sv.listenSocket = abel::Socket::listen(port);
         return sv;
     }
 
-    void serve() {
-        // TODO: Shutdown logic
-        while (true) {
-            abel::OwningSocket clientSocket = listenSocket.accept();
-
-            // Note: if no new clients have connected in a while, old ones won't be
-            // cleaned up, but that's not actually a problem, since the buffer wouldn't
-            // have grown either in that time.
-            std::erase_if(
-                clients,
-                [](const auto &client) {
-                    return !client->thread.thread_running();
+    struct DrainReport {
+        size_t sessions{0};
+        // Ended by themselves within the grace period
+        size_t finished{0};
+        size_t shells_terminated{0};
+        // Still running when the server gave up on them
+        size_t abandoned{0};
+        double seconds{0};
+    };
+
+    // Serves until drain() is called, then drains the sessions
+    DrainReport serve(size_t accept_threads = 1, size_t pending_accepts = 8) {
+        {
+            abel::Acceptor acceptor{
+                listenSocket.borrow(),
+                accept_threads,
+                pending_accepts,
+                [this](abel::OwningSocket clientSocket) {
+                    add_client(std::move(clientSocket));
+                },
+                placement
+            };
+
+            // Reporting happens here, off the accepting threads
+            while (!drain_event.wait_timeout(report_interval_ms)) {
+                if (acceptor.wait_stopped(0)) {
+                    abel::fail("An accepting thread has stopped");
+                }
+
+                if (!service_mode) {
+                    report_pool();
+                    report_admission();
+                    report_usage();
+                }
+            }
+
+            // Connections accepted from here on are turned away right after their hello
+            admission->close();
+        }
+
+        // Stop accepting altogether, so that clients fail over to other servers right away
+        listenSocket = {};
+
+        return drain_sessions();
+    }
+
+    // Starts draining. May be called from any thread.
+    void drain() {
+        drain_event.signal();
+    }
+
+    abel::Handle drain_handle() const {
+        return drain_event;
+    }
+
+    // Upper bound on how long serve() takes to return once drain() is called
+    DWORD max_drain_ms() const {
+        return drain_grace_ms + 2 * ClientConn::flush_timeout_ms;
+    }
+
+    // Sessions have been shown a notice by now. They get the grace period to finish, then their shells are
+    // terminated all at once, and their remaining output gets a moment to be flushed. Then the ones still stuck
+    // get their connections cut. The whole thing takes at most the grace period plus two flush timeouts.
+    DrainReport drain_sessions() {
+        auto start = std::chrono::steady_clock::now();
+        auto flush_timeout = std::chrono::milliseconds(ClientConn::flush_timeout_ms);
+
+        DrainReport report{.sessions = registry->size()};
+
+        if (!wait_sessions(start + std::chrono::milliseconds(drain_grace_ms))) {
+            report.finished = report.sessions - std::min(report.sessions, registry->size());
+
+            registry->for_each([&](ClientConn &session) {
+                report.shells_terminated += session.terminate_shell();
+            });
+
+            auto deadline = std::chrono::steady_clock::now() + flush_timeout;
+            if (!wait_sessions(deadline)) {
+                // E.g. pushes and admin sessions, which have no shell to terminate
+                registry->for_each([](ClientConn &session) {
+                    try {
+                        session.socket.shutdown();
+                    } catch (std::exception &) {
+                        // Already closed
+                    }
+                });
+
+                wait_sessions(deadline + flush_timeout);
+            }
+        } else {
+            report.finished = report.sessions;
+        }
+
+        report.abandoned = registry->size();
+        if (report.abandoned > 0) {
+            leak_session_state();
+        }
+        report.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return report;
+    }
+
+    // Abandoned sessions keep running on the session threads, which ~ThreadPool doesn't wait for, and still use the
+    // registry, admission control, shell pool and drain event. Those are left for the process's exit to clean up,
+    // rather than freed under the sessions. The server can't serve again afterwards.
+    void leak_session_state() {
+        (void)registry.release();
+        (void)admission.release();
+        (void)pool.release();
+        (void)session_threads.release();
+        new abel::OwningHandle{std::move(drain_event)};
+    }
+
+    void add_client(abel::OwningSocket clientSocket) {
+        // printf("Serving new client\n");
+        auto client = std::make_unique<ClientConn>();
+        client->registry = registry.get();
+        client->socket = std::move(clientSocket);
+        client->psk = psk;
+        client->udp_options = udp_options;
+        client->pool = pool.get();
+        client->admission = admission.get();
+        client->drain = drain_event;
+        client->drain_grace_ms = drain_grace_ms;
+        client->record_dir = record_dir;
+        client->push_root = push_root;
+
+        // The session can't deregister itself before it's been added, since that takes the same lock
+        std::lock_guard lock{registry->mutex};
+        session_threads->submit<ClientConn, &ClientConn::run>(client.get());
+        registry->add(client.release());
+    }
+
+    // Only printed when something has changed since the last time
+    void report_admission() {
+        auto stats = admission->stats();
+        uint64_t events = stats.admitted + stats.rejected_queue_full + stats.rejected_timeout + stats.queued;
+        if (events == reported_admission_events) {
+            return;
+        }
+        reported_admission_events = events;
+
+        abel::log::info(
+            abel::log::Category::admission,
+            "Admission",
+            {
+                {"running", stats.active},
+                {"queued", stats.queued},
+                {"admitted", stats.admitted},
+                {"admitted_after_queueing", stats.admitted_after_queueing},
+                {"rejected_queue_full", stats.rejected_queue_full},
+                {"rejected_timeout", stats.rejected_timeout},
+            }
+        );
+    }
+
+    // Printed every usage_report_interval: the traffic, if there was any, and the sessions running shells
+    void report_usage() {
+        auto now = std::chrono::steady_clock::now();
+        if (now - usage_reported < usage_report_interval) {
+            return;
+        }
+        usage_reported = now;
+
+        auto metrics = abel::metrics::snapshot();
+        uint64_t bytes_in = metrics[abel::metrics::Counter::bytes_from_clients];
+        uint64_t bytes_out = metrics[abel::metrics::Counter::bytes_to_clients];
+        if (bytes_in + bytes_out != reported_bytes) {
+            reported_bytes = bytes_in + bytes_out;
+
+            const auto &writes = metrics[abel::metrics::Latency::client_write];
+            abel::log::info(
+                abel::log::Category::usage,
+                "Traffic",
+                {
+                    {"from_clients_bytes", bytes_in},
+                    {"to_clients_bytes", bytes_out},
+                    {"write_p50_ms", writes.percentile_ms(50)},
+                    {"write_p99_ms", writes.percentile_ms(99)},
+                }
+            );
+        }
+
+        registry->for_each([](ClientConn &session) {
+            auto usage = session.usage();
+            if (!usage) {
+                return;
+            }
+
+            abel::log::info(
+                abel::log::Category::usage,
+                "Session usage",
+                {
+                    {"pid", usage->pid},
+                    {"cpu_s", usage->job.cpu_seconds},
+                    {"peak_memory_bytes", usage->job.peak_memory_bytes},
+                    {"processes_running", usage->job.active_processes},
+                    {"processes_started", usage->job.total_processes},
                 }
             );
+        });
+    }
 
-            // printf("Serving new client\n");
-            auto client = std::make_unique<ClientConn>();
-            client->socket = std::move(clientSocket);
-            client->thread = abel::Thread::create<ClientConn, &ClientConn::handle>(client.get()).handle;
-            clients.push_back(std::move(client));
+    // Only printed when there have been new sessions since the last time
+    void report_pool() {
+        auto stats = pool->stats();
+        uint64_t sessions = stats.hits + stats.misses;
+        if (sessions == reported_sessions) {
+            return;
         }
+        reported_sessions = sessions;
+
+        abel::log::info(
+            abel::log::Category::pool,
+            "Shell pool",
+            {
+                {"hits", stats.hits},
+                {"sessions", sessions},
+                {"discarded", stats.discarded},
+                {"startup_p50_ms", stats.p50_ms},
+                {"startup_p90_ms", stats.p90_ms},
+                {"startup_p99_ms", stats.p99_ms},
+            }
+        );
     }
 
 };
 
 class ServerSvc : public abel::Service<ServerSvc> {
 protected:
-    Server server{true};
+    // The running server's drain event, once there is one. Boxed, so that ServerSvc stays movable.
+    std::unique_ptr<std::atomic<HANDLE>> drain = std::make_unique<std::atomic<HANDLE>>(nullptr);
+    DWORD drain_timeout_ms{0};
 
 public:
     static constexpr const char *name = "RemoteCMDServer";
@@ -212,14 +1472,79 @@ public:
 
         abel::SocketLibGuard socket_lib_guard{};
 
-        log("Serving now");
+        if (!args.log_target.empty()) {
+            abel::log::configure(abel::log::parse_target(args.log_target, name));
+        }
+
+        if (!args.trace.empty()) {
+            abel::trace::start(std::string{args.trace});
+        }
+
+        abel::log::info(abel::log::Category::service, "Serving now", {{"port", args.port}});
+
+        std::optional<abel::metrics::Endpoint> metrics{};
+        if (args.metrics_port) {
+            metrics.emplace(args.metrics_port);
+        }
+
+        auto server = Server::setup(args.host.data(), args.port, true, args.load_key(), {.loss_percent = args.udp_loss}, args.pool, args.limits(), args.drain_grace, args.shell_options(), std::string{args.record}, std::string{args.push_root}, args.placement());
+        // With some slack for reporting
+        drain_timeout_ms = server.max_drain_ms() + 1000;
+        *drain = server.drain_handle().raw();
+
+        auto report = server.serve(args.accept_threads, args.pending_accepts);
+        *drain = nullptr;
+        abel::trace::dump();
 
-        auto server = Server::setup(args.host.data(), args.port, true);
-        server.serve();
+        abel::log::info(
+            abel::log::Category::service,
+            "Drained",
+            {
+                {"sessions", report.sessions},
+                {"seconds", report.seconds},
+                {"finished", report.finished},
+                {"shells_terminated", report.shells_terminated},
+                {"abandoned", report.abandoned},
+            }
+        );
     }
 
+    DWORD stop() {
+        HANDLE event = *drain;
+        if (!event) {
+            return 0;
+        }
+
+        abel::Handle{event}.signal();
+        return drain_timeout_ms;
+    }
 };
 
+// Ctrl+C, Ctrl+Break and closing the console drain the server instead of killing it outright
+static abel::Handle console_drain{};
+static abel::OwningHandle console_drained = abel::Handle::create_event(true, false);
+// Windows kills the process about 5 s after a close event regardless, so the drain only gets this long
+static constexpr DWORD close_drain_ms = 4000;
+
+static BOOL WINAPI console_ctrl_handler(DWORD type) {
+    switch (type) {
+    case CTRL_C_EVENT:
+    case CTRL_BREAK_EVENT:
+        console_drain.signal();
+        return true;
+
+    case CTRL_CLOSE_EVENT:
+        // The process is killed as soon as this returns, so wait for the drain, as far as Windows allows.
+        // Sessions still running by then are cut off, but have at least been shown the notice.
+        console_drain.signal();
+        console_drained.wait_timeout(close_drain_ms);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
 
 int main(int argc, const char **argv) {
     try {
@@ -228,6 +1553,20 @@ int main(int argc, const char **argv) {
         Args args{};
         args.parse(argc, argv);
 
+        if (!args.bench.empty()) {
+            bench::run(bench::BenchArgs{.name = args.bench, .input = args.input, .udp_loss = args.udp_loss, .accept_threads = args.accept_threads, .pending_accepts = args.pending_accepts, .shell = args.shell, .output = args.output, .baseline = args.baseline});
+            return 0;
+        }
+
+        if (!args.replay.empty()) {
+            // Recordings are full of VT sequences
+            auto my_stdout = Handle::get_stdout();
+            my_stdout.set_console_mode(my_stdout.get_console_mode() | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+
+            record::replay(std::string{args.replay}, args.replay_from, my_stdout);
+            return 0;
+        }
+
         if (args.server + args.client != 1) {
             fail("Specify exactly one of --client or --server");
         }
@@ -237,22 +1576,79 @@ int main(int argc, const char **argv) {
             return 0;
         }
 
+        if (!args.trace.empty()) {
+            trace::start(std::string{args.trace});
+        }
+
         SocketLibGuard socket_lib_guard{};
 
         if (args.server) {
             printf("Running as server...\n");
 
-            auto server = Server::setup(args.host.data(), args.port);
-            server.serve();
+            log::configure(log::parse_target(args.log_target, "RemoteCMD"));
+
+            std::optional<metrics::Endpoint> metrics_endpoint{};
+            if (args.metrics_port) {
+                metrics_endpoint.emplace(args.metrics_port);
+                printf("Serving metrics at http://127.0.0.1:%u/metrics\n", args.metrics_port);
+            }
+
+            auto server = Server::setup(args.host.data(), args.port, false, args.load_key(), {.loss_percent = args.udp_loss}, args.pool, args.limits(), args.drain_grace, args.shell_options(), std::string{args.record}, std::string{args.push_root}, args.placement());
+
+            console_drain = server.drain_handle();
+            SetConsoleCtrlHandler(&console_ctrl_handler, true);
+
+            auto report = server.serve(args.accept_threads, args.pending_accepts);
+            printf(
+                "Drained %zu sessions in %.1f s: %zu finished, %zu shells terminated, %zu abandoned\n",
+                report.sessions,
+                report.seconds,
+                report.finished,
+                report.shells_terminated,
+                report.abandoned
+            );
+            console_drained.signal();
         } else {
             printf("Running as client...\n");
 
-            auto client = Client::connect(args.host.data(), args.port);
-            client.run();
+            if (args.load) {
+                Client::load(
+                    args.host.data(),
+                    args.port,
+                    args.load_key(),
+                    (args.compress ? session_compress : 0) | (args.sync ? session_termsync : 0) | (args.udp ? session_udp : 0),
+                    {.sessions = args.load, .duration_s = args.load_duration, .cps = args.load_cps},
+                    args.load_script.empty() ? load::Script::standard() : load::Script::load_file(std::string{args.load_script})
+                );
+
+                trace::dump();
+                printf("Done\n");
+                return 0;
+            }
+
+            auto client = Client::connect(args.host.data(), args.port, args.load_key());
+            if (args.admin) {
+                client.admin(args.limits());
+            } else if (!args.push.empty()) {
+                if (args.dest.empty()) {
+                    fail("--push requires --dest");
+                }
+                client.push(args.push.data(), args.dest.data(), args.compress ? session_compress : 0);
+            } else {
+                client.run(
+                    (args.compress ? session_compress : 0) | (args.sync ? session_termsync : 0) | (args.udp ? session_udp : 0),
+                    args.predict ? std::optional{args.predict_threshold} : std::nullopt,
+                    {.loss_percent = args.udp_loss}
+                );
+            }
         }
 
+        abel::trace::dump();
+        abel::log::flush();
         printf("Done\n");
     } catch (const std::exception &e) {
+        abel::trace::dump();
+        abel::log::flush();
         printf("ERROR! %s\n", e.what());
         return -1;
     }
@@ -3,11 +3,13 @@
 #include "Error.hpp"
 #include "Handle.hpp"
 #include "Thread.hpp"
+#include "Log.hpp"
 
 #include <Windows.h>
 #include <utility>
 #include <concepts>
 #include <optional>
+#include <algorithm>
 
 namespace abel {
 
@@ -41,6 +43,10 @@ protected:
         try {
             argc = argc_;
             argv = argv_;
+
+            // Until work() picks a target of its own
+            log::configure({.sink = log::Sink::event_log, .target = T::name});
+
             status_handle = RegisterServiceCtrlHandlerA(T::name, &control_handler);
 
             if (!status_handle) {
@@ -57,16 +63,47 @@ protected:
 
             Handle::wait_multiple(thread, stop_event);
 
+            // T may define `DWORD stop()`, which asks work() to wind down and returns how long that may take at most
+            if constexpr (requires(T &t) { { t.stop() } -> std::convertible_to<DWORD>; }) {
+                if (thread.thread_running()) {
+                    wait_for_stop(thread, get().stop());
+                }
+            }
+
             // Probably not necessary, as the kernel will clean up all our threads anyway
-            thread.terminate_thread();
+            if (thread.thread_running()) {
+                thread.terminate_thread();
+            }
 
+            log::flush();
             report_status(SERVICE_STOPPED, 0);
         } catch (std::exception &e) {
-            log<EVENTLOG_ERROR_TYPE>("ERROR! %s", e.what());
+            log::error(log::Category::service, "Service failed", {{"error", e.what()}});
+            log::flush();
             report_status(SERVICE_STOPPED, 1);
         }
     }
 
+    // Keeps the SCM posted while the work thread winds down, so that it doesn't consider the service hung
+    void wait_for_stop(Handle thread, DWORD timeout) {
+        constexpr DWORD checkpoint_interval = 1000;
+
+        auto deadline = GetTickCount64() + timeout;
+        while (true) {
+            auto now = GetTickCount64();
+            if (now >= deadline) {
+                return;
+            }
+
+            DWORD left = (DWORD)(deadline - now);
+            report_status(SERVICE_STOP_PENDING, 0, left + checkpoint_interval);
+
+            if (thread.wait_timeout(std::min(left, checkpoint_interval))) {
+                return;
+            }
+        }
+    }
+
     static void control_handler(DWORD control) {
         get().control_handler_(control);
     }
@@ -87,7 +124,7 @@ protected:
                 break;
             }
         } catch (std::exception &e) {
-            log<EVENTLOG_ERROR_TYPE>("ERROR processing control %u! %s", control, e.what());
+            log::error(log::Category::service, "Failed to process a service control", {{"control", control}, {"error", e.what()}});
         }
     }
 
@@ -143,31 +180,6 @@ public:
 
         StartServiceCtrlDispatcherA(service_table);
     }
-
-    template <DWORD kind = EVENTLOG_INFORMATION_TYPE, typename... Args>
-    void log(const char *message, Args... args) {
-        auto eventSource = Handle{RegisterEventSourceA(nullptr, T::name)};
-
-        char buf[4096] = {};
-        int offset = sprintf_s(buf, sizeof(buf), "%s: (err=%d wsaerr=%d) -- ", T::name, GetLastError(), WSAGetLastError());
-        sprintf_s(buf + offset, sizeof(buf) - offset, message, args...);
-
-        const char *pbuf = buf;
-
-        ReportEventA(
-            eventSource.raw(),  // event log handle
-            kind,               // event type
-            0,                  // event category
-            0,                  // event identifier
-            nullptr,            // no security identifier
-            1,                  // size of lpszStrings array
-            0,                  // no binary data
-            &pbuf,              // array of strings
-            nullptr             // no binary data
-        );
-
-        DeregisterEventSource(eventSource.raw());
-    }
 };
 
 template <typename T>
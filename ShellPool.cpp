@@ -0,0 +1,180 @@
+#include "ShellPool.hpp"
+
+#include "Metrics.hpp"
+#include "Thread.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <optional>
+
+namespace abel {
+
+namespace {
+
+std::string command_line(const ShellOptions &options) {
+    return "\"" + options.executable + "\"";
+}
+
+}  // namespace
+
+Shell Shell::spawn(const ShellOptions &options) {
+    metrics::ScopedTimer timer{metrics::Latency::shell_spawn};
+    metrics::add(metrics::Counter::shells_spawned);
+
+    auto job = Job::create(options.limits);
+
+    if (options.pty) {
+        // The console host does plain blocking IO on its ends of the pipes, and it duplicates them, so nothing is inherited
+        auto pipe_out = Pipe::create_async(false, 0, true, false);
+        auto pipe_in = Pipe::create_async(false, 0, false, true);
+
+        auto console = pty::PseudoConsole::create(default_size, pipe_in.read, pipe_out.write);
+        // Our copy of pipe_out.write stays open, just like for a shell on pipes, and the server closes it once the
+        // shell is gone. Being synchronous, it's never written to, see ClientConn::post_notice.
+        pipe_in.read.close();
+
+        auto cmd = Process::spawn({
+            .executable = options.executable,
+            .command_line = command_line(options),
+            .pseudo_console = console.raw(),
+            .job = job.handle(),
+        });
+
+        return Shell{std::move(job), std::move(console), std::move(pipe_out), std::move(pipe_in), std::move(cmd)};
+    }
+
+    // Only the shell's ends are handed down, though ours are inheritable too
+    auto pipe_out = Pipe::create_async(true);
+    auto pipe_in = Pipe::create_async(true);
+
+    auto cmd = Process::spawn({
+        .executable = options.executable,
+        // "/q" would turn off cmd.exe's echo, which is otherwise only done on a newline
+        .command_line = command_line(options),
+        .std_input = pipe_in.read,
+        .std_output = pipe_out.write,
+        .std_error = pipe_out.write,
+        .job = job.handle(),
+        .creation_flags = CREATE_NO_WINDOW,
+    });
+
+    return Shell{std::move(job), {}, std::move(pipe_out), std::move(pipe_in), std::move(cmd)};
+}
+
+ShellPool::ShellPool(size_t target, ShellOptions options) :
+    target{target},
+    options{std::move(options)} {
+    latencies_ms.reserve(latency_samples);
+    thread = Thread::create<ShellPool, &ShellPool::refill>(this).handle;
+}
+
+ShellPool::~ShellPool() {
+    stopping = true;
+    wanted.signal();
+    thread.wait();
+
+    for (Shell &shell : ready) {
+        if (shell.cmd.process.process_running()) {
+            shell.cmd.process.terminate_process();
+        }
+    }
+}
+
+void ShellPool::refill() {
+    while (true) {
+        wanted.wait();
+        if (stopping) {
+            return;
+        }
+
+        while (!stopping) {
+            {
+                std::lock_guard lock{mutex};
+                if (ready.size() >= target) {
+                    break;
+                }
+            }
+
+            // Spawned outside the lock, since this is the slow part the pool exists to hide
+            try {
+                Shell shell = Shell::spawn(options);
+
+                std::lock_guard lock{mutex};
+                ready.push_back(std::move(shell));
+            } catch (std::exception &) {
+                // Sessions will spawn their own shells until the next refill succeeds
+                break;
+            }
+        }
+    }
+}
+
+Shell ShellPool::take() {
+    auto start = std::chrono::steady_clock::now();
+
+    std::optional<Shell> result{};
+    {
+        std::lock_guard lock{mutex};
+
+        while (!ready.empty()) {
+            Shell shell = std::move(ready.front());
+            ready.pop_front();
+
+            // E.g. killed by someone in the meantime
+            if (!shell.cmd.process.process_running()) {
+                ++stats_.discarded;
+                continue;
+            }
+
+            result.emplace(std::move(shell));
+            break;
+        }
+
+        ++(result ? stats_.hits : stats_.misses);
+    }
+
+    wanted.signal();
+
+    if (!result) {
+        result.emplace(Shell::spawn(options));
+    }
+
+    record_latency(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    return std::move(*result);
+}
+
+void ShellPool::record_latency(double ms) {
+    std::lock_guard lock{mutex};
+
+    if (latencies_ms.size() < latency_samples) {
+        latencies_ms.push_back(ms);
+    } else {
+        latencies_ms[next_latency] = ms;
+    }
+    next_latency = (next_latency + 1) % latency_samples;
+}
+
+ShellPoolStats ShellPool::stats() {
+    std::lock_guard lock{mutex};
+
+    ShellPoolStats result = stats_;
+    if (latencies_ms.empty()) {
+        return result;
+    }
+
+    std::vector<double> sorted = latencies_ms;
+    std::ranges::sort(sorted);
+
+    auto percentile = [&](double p) {
+        size_t index = (size_t)std::ceil(p / 100 * sorted.size());
+        return sorted[std::clamp<size_t>(index, 1, sorted.size()) - 1];
+    };
+
+    result.p50_ms = percentile(50);
+    result.p90_ms = percentile(90);
+    result.p99_ms = percentile(99);
+    return result;
+}
+
+}  // namespace abel
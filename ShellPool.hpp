@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Handle.hpp"
+#include "Job.hpp"
+#include "Pipe.hpp"
+#include "Process.hpp"
+#include "Pty.hpp"
+#include "Sync.hpp"
+
+#include <Windows.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace abel {
+
+struct ShellOptions {
+    std::string executable{"C:\\Windows\\System32\\cmd.exe"};
+    // Run the shell on a pseudo console instead of plain pipes, see Pty.hpp
+    bool pty{false};
+    // For the shell and everything started from it
+    JobLimits limits{};
+};
+
+// A shell process with its standard streams wired to pipes, or to a pseudo console which is wired to them
+struct Shell {
+    // Holds the shell and whatever it starts. Declared first, so that they're killed last.
+    Job job{};
+    // Unused without a pseudo console. Declared first, so that it's closed after the pipes, which keeps closing it from blocking.
+    pty::PseudoConsole pty{};
+    Pipe pipe_out{};
+    Pipe pipe_in{};
+    Process cmd;
+
+    // Size of a pseudo console until the session it's handed to resizes it
+    static constexpr term::TerminalSize default_size{.rows = 25, .cols = 80};
+
+    // Starts a fresh shell. Its banner waits in pipe_out until someone reads it.
+    static Shell spawn(const ShellOptions &options);
+};
+
+struct ShellPoolStats {
+    uint64_t hits{0};
+    uint64_t misses{0};
+    // Dead shells that were thrown away instead of being handed out
+    uint64_t discarded{0};
+    // Time taken by take(), over the most recent sessions
+    double p50_ms{0};
+    double p90_ms{0};
+    double p99_ms{0};
+};
+
+// Keeps a number of shells spawned ahead of time, so that a session only has to wait
+// for process creation and shell initialization when the pool runs dry.
+// A background thread refills the pool whenever a shell is taken.
+class ShellPool {
+protected:
+    // How many of the most recent latencies the percentiles are computed from
+    static constexpr size_t latency_samples = 1024;
+
+    size_t target;
+    ShellOptions options;
+
+    std::mutex mutex{};
+    std::deque<Shell> ready{};
+    std::vector<double> latencies_ms{};
+    size_t next_latency{0};
+    ShellPoolStats stats_{};
+
+    // Signaled on every take, which mostly finds the refill thread busy or already awake, and then costs no syscall
+    Event wanted{false, true};
+    OwningHandle thread{};
+    std::atomic<bool> stopping{false};
+
+    void refill();
+
+    void record_latency(double ms);
+
+public:
+    // Keeps `target` shells ready
+    explicit ShellPool(size_t target, ShellOptions options = {});
+
+    ShellPool(const ShellPool &) = delete;
+    ShellPool &operator=(const ShellPool &) = delete;
+    ShellPool(ShellPool &&) = delete;
+    ShellPool &operator=(ShellPool &&) = delete;
+
+    // Terminates the shells nobody took
+    ~ShellPool();
+
+    // Hands out a pooled shell, or spawns one right away if there are none
+    Shell take();
+
+    // Whether the shells run on a pseudo console
+    bool uses_pty() const noexcept {
+        return options.pty;
+    }
+
+    ShellPoolStats stats();
+};
+
+}  // namespace abel
@@ -1,5 +1,6 @@
 #include "Socket.hpp"
 
+#include <MSWSock.h>
 #include <memory>
 
 #include "Concurrency.hpp"
@@ -32,14 +33,14 @@ OwningSocket Socket::connect(std::string host, uint16_t port) {
     return result;
 }
 
-OwningSocket Socket::listen(uint16_t port) {
+OwningSocket Socket::listen(uint16_t port, ULONG address) {
     OwningSocket result = Socket::create();
 
     sockaddr_in addr{
         .sin_family = AF_INET,
         .sin_port = htons(port),
-        .sin_addr = INADDR_ANY,
     };
+    addr.sin_addr.s_addr = htonl(address);
 
     int status = ::bind(result.raw(), (sockaddr *)&addr, sizeof(addr));
     if (status == SOCKET_ERROR) {
@@ -58,6 +59,49 @@ OwningSocket Socket::accept() {
     return OwningSocket(::accept(raw(), nullptr, nullptr)).validate();
 }
 
+sockaddr_in Socket::peer_address() const {
+    sockaddr_in result{};
+    int size = sizeof(result);
+
+    int status = getpeername(raw(), (sockaddr *)&result, &size);
+    if (status == SOCKET_ERROR) {
+        fail_ws("Failed to get peer address");
+    }
+
+    return result;
+}
+
+bool Socket::peer_closed() const {
+    WSAPOLLFD fd{.fd = raw(), .events = POLLRDNORM};
+    int status = WSAPoll(&fd, 1, 0);
+    if (status == SOCKET_ERROR) {
+        fail_ws("Failed to poll socket");
+    }
+
+    if (fd.revents & (POLLHUP | POLLERR | POLLNVAL)) {
+        return true;
+    }
+    if (!(fd.revents & POLLRDNORM)) {
+        return false;
+    }
+
+    // Readable: either data, or the end of the stream
+    char byte = 0;
+    return recv(raw(), &byte, 1, MSG_PEEK) <= 0;
+}
+
+sockaddr_in Socket::local_address() const {
+    sockaddr_in result{};
+    int size = sizeof(result);
+
+    int status = getsockname(raw(), (sockaddr *)&result, &size);
+    if (status == SOCKET_ERROR) {
+        fail_ws("Failed to get local address");
+    }
+
+    return result;
+}
+
 eof<size_t> Socket::read_into(std::span<unsigned char> data) {
     int read = ::recv(raw(), (char *)data.data(), (int)data.size(), 0);
     if (read == SOCKET_ERROR) {
@@ -120,7 +164,7 @@ AIO<eof<size_t>> Socket::read_async_into(std::span<unsigned char> data) {
         }
     }
 
-    co_await io_done_signaled{};
+    co_await io_done_signaled{"WSARecv"};
 
     DWORD transmitted = 0;
     DWORD flags = 0;
@@ -174,7 +218,7 @@ AIO<eof<size_t>> Socket::write_async_from(std::span<const unsigned char> data) {
         }
     }
 
-    co_await io_done_signaled{};
+    co_await io_done_signaled{"WSASend"};
 
     DWORD transmitted = 0;
     DWORD flags = 0;
@@ -199,6 +243,58 @@ AIO<eof<size_t>> Socket::write_async_from(std::span<const unsigned char> data) {
     co_return eof((size_t)transmitted, transmitted == 0);
 }
 
+AIO<OwningSocket> Socket::accept_async() {
+    auto &env = *co_await current_env{};
+    WSAOVERLAPPED *overlapped = (WSAOVERLAPPED *)env.overlapped();
+
+    OwningSocket result = Socket::create();
+
+    // AcceptEx needs room for both addresses, each 16 bytes more than the largest one
+    constexpr DWORD address_size = sizeof(sockaddr_storage) + 16;
+    auto addresses = std::make_unique<unsigned char[]>(2 * address_size);
+
+    DWORD received = 0;
+    bool success = AcceptEx(
+        raw(),
+        result.raw(),
+        addresses.get(),
+        0,
+        address_size,
+        address_size,
+        &received,
+        overlapped
+    );
+
+    if (!success && WSAGetLastError() != WSA_IO_PENDING) {
+        fail_ws("Failed to initiate asynchronous accept");
+    }
+
+    co_await io_done_signaled{"AcceptEx"};
+
+    DWORD transmitted = 0;
+    DWORD flags = 0;
+    success = WSAGetOverlappedResult(
+        raw(),
+        overlapped,
+        &transmitted,
+        false,
+        &flags
+    );
+
+    if (!success) {
+        fail_ws("Failed to accept connection");
+    }
+
+    // Otherwise the new socket doesn't know it's connected, and getpeername, shutdown and the like fail on it
+    SOCKET listener = raw();
+    int status = setsockopt(result.raw(), SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (const char *)&listener, sizeof(listener));
+    if (status == SOCKET_ERROR) {
+        fail_ws("Failed to update accepted socket context");
+    }
+
+    co_return std::move(result);
+}
+
 void Socket::shutdown(int how) {
     int status = ::shutdown(raw(), how);
     if (status == SOCKET_ERROR) {
@@ -41,7 +41,8 @@ public:
     static OwningSocket connect(std::string host, uint16_t port);
 
     // TODO: Accept host?
-    static OwningSocket listen(uint16_t port);
+    // `address` is in host byte order, e.g. INADDR_LOOPBACK to keep other machines out
+    static OwningSocket listen(uint16_t port, ULONG address = INADDR_ANY);
 
     constexpr operator bool() const noexcept {
         return socket != INVALID_SOCKET;
@@ -61,6 +62,19 @@ public:
 
     OwningSocket accept();
 
+    // Same as accept, but returns an awaitable. Several may be pending on the same socket at once.
+    AIO<OwningSocket> accept_async();
+
+    // The address of the other end of a connected socket
+    sockaddr_in peer_address() const;
+
+    // The address this socket is bound to, e.g. to find out which port listen(0) picked
+    sockaddr_in local_address() const;
+
+    // Whether the other end has closed or reset the connection, without blocking. Only reliable while the peer
+    // isn't expected to send anything, since unread data hides the end behind it.
+    bool peer_closed() const;
+
 #pragma region IO
     // Technically allowed by WinAPI, but may involve overhead delays depending on the implementation
     Handle io_handle() const noexcept {
@@ -0,0 +1,251 @@
+#include "Sync.hpp"
+
+namespace abel {
+
+namespace {
+
+// Polls `ready` up to spin_count times, pausing in between, so that a short wait doesn't get to the syscall
+template <typename F>
+bool spin(F &&ready) noexcept {
+    for (unsigned i = 0; i < spin_count; ++i) {
+        if (ready()) {
+            return true;
+        }
+        YieldProcessor();
+    }
+    return false;
+}
+
+class Deadline {
+protected:
+    DWORD miliseconds;
+    ULONGLONG start = GetTickCount64();
+
+public:
+    explicit Deadline(DWORD miliseconds) :
+        miliseconds{miliseconds} {
+    }
+
+    // INFINITE stays INFINITE
+    DWORD left() const noexcept {
+        if (miliseconds == INFINITE) {
+            return INFINITE;
+        }
+
+        ULONGLONG elapsed = GetTickCount64() - start;
+        return elapsed >= miliseconds ? 0 : (DWORD)(miliseconds - elapsed);
+    }
+};
+
+// Sleeps while `value` still holds `undesired`, which may also end spuriously. Returns false on timeout.
+bool park(std::atomic<uint32_t> &value, uint32_t undesired, DWORD miliseconds) noexcept {
+    return WaitOnAddress(&value, &undesired, sizeof(undesired), miliseconds) || GetLastError() != ERROR_TIMEOUT;
+}
+
+}  // namespace
+
+#pragma region Mutex
+void Mutex::lock_contended() noexcept {
+    if (spin([this]() { return state.load(std::memory_order_relaxed) == 0 && try_lock(); })) {
+        return;
+    }
+
+    // From here on the lock is marked as possibly having waiters, so that unlock() knows to wake one.
+    // The mark is kept even when there's none left, which only costs an unnecessary wake.
+    while (state.exchange(2, std::memory_order_acquire) != 0) {
+        park(state, 2, INFINITE);
+    }
+}
+
+void Mutex::unlock() noexcept {
+    if (state.exchange(0, std::memory_order_release) == 2) {
+        WakeByAddressSingle(&state);
+    }
+}
+#pragma endregion Mutex
+
+#pragma region Event
+bool Event::try_consume() noexcept {
+    if (manual_reset) {
+        return state.load(std::memory_order_acquire) != 0;
+    }
+
+    uint32_t expected = 1;
+    return state.compare_exchange_strong(expected, 0, std::memory_order_acquire, std::memory_order_relaxed);
+}
+
+void Event::signal() noexcept {
+    // Sequentially consistent, so that it can't miss a waiter that has just registered, see wait_timeout
+    state.store(1, std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_seq_cst) == 0) {
+        return;
+    }
+
+    if (manual_reset) {
+        WakeByAddressAll(&state);
+    } else {
+        WakeByAddressSingle(&state);
+    }
+}
+
+bool Event::wait_timeout(DWORD miliseconds) noexcept {
+    if (spin([this]() { return try_consume(); })) {
+        return true;
+    }
+
+    Deadline deadline{miliseconds};
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+
+    bool result = true;
+    while (!try_consume()) {
+        DWORD left = deadline.left();
+        if (left == 0 || !park(state, 0, left)) {
+            // One last look, in case it was signaled right as the time ran out
+            result = try_consume();
+            break;
+        }
+    }
+
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+    return result;
+}
+#pragma endregion Event
+
+#pragma region Semaphore
+bool Semaphore::try_acquire() noexcept {
+    uint32_t current = count.load(std::memory_order_relaxed);
+    while (current > 0) {
+        if (count.compare_exchange_weak(current, current - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Semaphore::acquire_timeout(DWORD miliseconds) noexcept {
+    if (spin([this]() { return try_acquire(); })) {
+        return true;
+    }
+
+    Deadline deadline{miliseconds};
+    waiters.fetch_add(1, std::memory_order_seq_cst);
+
+    bool result = true;
+    while (!try_acquire()) {
+        DWORD left = deadline.left();
+        if (left == 0 || !park(count, 0, left)) {
+            result = try_acquire();
+            break;
+        }
+    }
+
+    waiters.fetch_sub(1, std::memory_order_relaxed);
+    return result;
+}
+
+void Semaphore::release(uint32_t released) noexcept {
+    count.fetch_add(released, std::memory_order_seq_cst);
+    if (waiters.load(std::memory_order_seq_cst) == 0) {
+        return;
+    }
+
+    if (released == 1) {
+        WakeByAddressSingle(&count);
+    } else {
+        WakeByAddressAll(&count);
+    }
+}
+#pragma endregion Semaphore
+
+#pragma region AsyncWaitList
+void AsyncWaitList::push(Waiter &waiter, Handle wake) {
+    waiter.wake = wake;
+    waiter.queued = true;
+    waiter.granted = false;
+    waiters.push_back(&waiter);
+}
+
+void AsyncWaitList::remove(Waiter &waiter) noexcept {
+    waiters.remove(&waiter);
+    waiter.queued = false;
+}
+
+Handle AsyncWaitList::grant() noexcept {
+    Waiter *first = waiters.front();
+    if (!first) {
+        return nullptr;
+    }
+
+    remove(*first);
+    first->granted = true;
+    // The waiter may be resumed and gone as soon as the mutex is released, so the handle is copied out
+    return first->wake;
+}
+#pragma endregion AsyncWaitList
+
+#pragma region Async
+void AsyncMutex::unlock() noexcept {
+    Handle next = nullptr;
+    {
+        std::lock_guard lock{waiters.mutex};
+        next = waiters.grant();
+        // Handed over without ever being unlocked, so that nobody can barge in before the waiter resumes
+        locked = (bool)next;
+    }
+
+    AsyncWaitList::wake(next);
+}
+
+void AsyncSemaphore::release(uint32_t released) noexcept {
+    {
+        std::lock_guard lock{waiters.mutex};
+        count += released;
+    }
+
+    // One waiter at a time, so that the wakes happen outside the lock without having to be collected anywhere
+    while (true) {
+        Handle next = nullptr;
+        {
+            std::lock_guard lock{waiters.mutex};
+            if (count == 0) {
+                return;
+            }
+
+            next = waiters.grant();
+            if (!next) {
+                return;
+            }
+            --count;
+        }
+
+        AsyncWaitList::wake(next);
+    }
+}
+
+void AsyncEvent::signal() noexcept {
+    {
+        std::lock_guard lock{waiters.mutex};
+        signaled = true;
+    }
+
+    // New waiters see it signaled and don't queue, so this ends
+    while (true) {
+        Handle next = nullptr;
+        {
+            std::lock_guard lock{waiters.mutex};
+            if (!signaled) {
+                return;
+            }
+
+            next = waiters.grant();
+            if (!next) {
+                return;
+            }
+        }
+
+        AsyncWaitList::wake(next);
+    }
+}
+#pragma endregion Async
+
+}  // namespace abel
@@ -0,0 +1,355 @@
+#pragma once
+
+#include "Handle.hpp"
+#include "Concurrency.hpp"
+#include "IntrusiveList.hpp"
+#include "Trace.hpp"
+
+#include <Windows.h>
+#include <atomic>
+#include <coroutine>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+#pragma comment(lib, "Synchronization.lib")
+
+namespace abel {
+
+// In-process replacements for kernel events, mutexes and semaphores. They stay in user space while uncontended,
+// spin for a little while when contended, and only then park the thread with WaitOnAddress, which costs a syscall
+// just for the threads that actually have to sleep, and for waking them. Unlike the kernel objects, they can't be
+// waited on together with handles, nor shared with other processes.
+
+// How many times a contended operation polls before parking the thread. Enough to ride out a short critical
+// section on another processor, and short enough not to matter when the holder has been preempted.
+constexpr unsigned spin_count = 128;
+
+// Same interface as std::mutex, so that it works with std::lock_guard and friends
+class Mutex {
+protected:
+    // 0: unlocked, 1: locked, 2: locked, and somebody may be parked waiting for it
+    std::atomic<uint32_t> state{0};
+
+    void lock_contended() noexcept;
+
+public:
+    Mutex() = default;
+
+    Mutex(const Mutex &) = delete;
+    Mutex &operator=(const Mutex &) = delete;
+
+    bool try_lock() noexcept {
+        uint32_t expected = 0;
+        return state.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void lock() noexcept {
+        if (!try_lock()) {
+            lock_contended();
+        }
+    }
+
+    void unlock() noexcept;
+};
+
+// Same semantics as a kernel event, including auto-reset ones
+class Event {
+protected:
+    std::atomic<uint32_t> state;
+    // Threads that got past spinning, so that signal() only makes a syscall when there's somebody to wake
+    std::atomic<uint32_t> waiters{0};
+    bool manual_reset;
+
+    bool try_consume() noexcept;
+
+public:
+    explicit Event(bool manualReset = false, bool initialState = false) :
+        state{initialState},
+        manual_reset{manualReset} {
+    }
+
+    Event(const Event &) = delete;
+    Event &operator=(const Event &) = delete;
+
+    void signal() noexcept;
+
+    void reset() noexcept {
+        state.store(0, std::memory_order_relaxed);
+    }
+
+    bool is_signaled() const noexcept {
+        return state.load(std::memory_order_acquire) != 0;
+    }
+
+    void wait() noexcept {
+        wait_timeout(INFINITE);
+    }
+
+    // Returns false on timeout. Consumes the signal of an auto-reset event.
+    bool wait_timeout(DWORD miliseconds) noexcept;
+};
+
+class Semaphore {
+protected:
+    std::atomic<uint32_t> count;
+    std::atomic<uint32_t> waiters{0};
+
+public:
+    explicit Semaphore(uint32_t initialCount = 0) :
+        count{initialCount} {
+    }
+
+    Semaphore(const Semaphore &) = delete;
+    Semaphore &operator=(const Semaphore &) = delete;
+
+    bool try_acquire() noexcept;
+
+    void acquire() noexcept {
+        acquire_timeout(INFINITE);
+    }
+
+    // Returns false on timeout
+    bool acquire_timeout(DWORD miliseconds) noexcept;
+
+    void release(uint32_t count = 1) noexcept;
+};
+
+#pragma region Async
+// Coroutines waiting on one of the async primitives below, in the order they came. A waiter is woken through
+// its env's io_done event, which every env has anyway, so the primitives themselves own no kernel objects,
+// and only waking a suspended coroutine on another loop costs a syscall.
+class AsyncWaitList {
+public:
+    struct Waiter : public IntrusiveListNode<Waiter> {
+        Handle wake{};
+        bool queued{false};
+        // Handed what it waited for, but not resumed yet
+        bool granted{false};
+    };
+
+protected:
+    IntrusiveList<Waiter> waiters{};
+
+public:
+    // Guards the list, and the state of the primitive that owns it
+    Mutex mutex{};
+
+    // Expects the mutex to be held
+    void push(Waiter &waiter, Handle wake);
+
+    // Expects the mutex to be held
+    void remove(Waiter &waiter) noexcept;
+
+    // Expects the mutex to be held. Marks the first waiter as granted, and returns the handle to wake it with,
+    // which has to be signaled after the mutex is released. nullptr if there are no waiters.
+    Handle grant() noexcept;
+
+    static void wake(Handle handle) noexcept {
+        if (handle) {
+            SetEvent(handle.raw());
+        }
+    }
+};
+
+// The awaitable behind lock_async, acquire_async and wait_async. P provides:
+// - `bool try_take_locked()`, called with the list's mutex held;
+// - `void give_back()`, for a grant that a destroyed coroutine never got to use.
+template <typename P>
+class _impl_async_take {
+protected:
+    P *primitive;
+    const char *what;
+    AsyncWaitList::Waiter waiter{};
+    bool suspended{false};
+    void *coro_address{nullptr};
+
+public:
+    _impl_async_take(P *primitive, const char *what) :
+        primitive{primitive},
+        what{what} {
+    }
+
+    _impl_async_take(const _impl_async_take &) = delete;
+    _impl_async_take &operator=(const _impl_async_take &) = delete;
+
+    // Only for a coroutine that got destroyed while waiting, e.g. by its ParallelAIOs being cancelled
+    ~_impl_async_take() {
+        if (!suspended) {
+            return;
+        }
+
+        bool give_back = false;
+        {
+            std::lock_guard lock{primitive->waiters.mutex};
+            if (waiter.queued) {
+                primitive->waiters.remove(waiter);
+            }
+            give_back = waiter.granted;
+        }
+
+        if (give_back) {
+            primitive->give_back();
+        }
+    }
+
+    bool await_ready() noexcept {
+        std::lock_guard lock{primitive->waiters.mutex};
+        return primitive->try_take_locked();
+    }
+
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> coro) {
+        AIOEnv *env = coro.promise().env;
+        // Just to verify we are the current coroutine
+        env->update_current(coro, coro);
+        // Before it's queued, so that the wake can't be lost
+        env->io_done().reset();
+
+        std::lock_guard lock{primitive->waiters.mutex};
+        if (primitive->try_take_locked()) {
+            return false;
+        }
+
+        primitive->waiters.push(waiter, env->io_done());
+        suspended = true;
+        coro_address = coro.address();
+        ABEL_TRACE(trace::Kind::io_wait, coro_address, &waiter, what);
+        return true;
+    }
+
+    void await_resume() noexcept {
+        if (coro_address) {
+            ABEL_TRACE(trace::Kind::io_done, coro_address, &waiter, what);
+        }
+
+        // The mutex isn't needed: the grant is only ever set before the wake that resumed us
+        waiter.granted = false;
+        suspended = false;
+    }
+};
+
+// A mutex for coroutines: lock_async suspends the AIO while another holder has it, instead of blocking the
+// thread, which may be running other tasks. The lock isn't tied to a thread, so it may be held across awaits,
+// and unlocked from anywhere.
+class AsyncMutex {
+protected:
+    AsyncWaitList waiters{};
+    bool locked{false};
+
+    bool try_take_locked() noexcept {
+        return !std::exchange(locked, true);
+    }
+
+    void give_back() noexcept {
+        unlock();
+    }
+
+    friend class _impl_async_take<AsyncMutex>;
+
+public:
+    AsyncMutex() = default;
+
+    AsyncMutex(const AsyncMutex &) = delete;
+    AsyncMutex &operator=(const AsyncMutex &) = delete;
+
+    // Must be awaited from an AIO
+    [[nodiscard]] _impl_async_take<AsyncMutex> lock_async() noexcept {
+        return {this, "mutex"};
+    }
+
+    bool try_lock() noexcept {
+        std::lock_guard lock{waiters.mutex};
+        return try_take_locked();
+    }
+
+    // Hands the lock straight to the first waiter, if any
+    void unlock() noexcept;
+};
+
+// A counting semaphore for coroutines, e.g. to bound how many tasks do something at once
+class AsyncSemaphore {
+protected:
+    AsyncWaitList waiters{};
+    uint32_t count;
+
+    bool try_take_locked() noexcept {
+        if (count == 0) {
+            return false;
+        }
+        --count;
+        return true;
+    }
+
+    void give_back() noexcept {
+        release();
+    }
+
+    friend class _impl_async_take<AsyncSemaphore>;
+
+public:
+    explicit AsyncSemaphore(uint32_t initialCount = 0) :
+        count{initialCount} {
+    }
+
+    AsyncSemaphore(const AsyncSemaphore &) = delete;
+    AsyncSemaphore &operator=(const AsyncSemaphore &) = delete;
+
+    // Must be awaited from an AIO
+    [[nodiscard]] _impl_async_take<AsyncSemaphore> acquire_async() noexcept {
+        return {this, "semaphore"};
+    }
+
+    bool try_acquire() noexcept {
+        std::lock_guard lock{waiters.mutex};
+        return try_take_locked();
+    }
+
+    void release(uint32_t count = 1) noexcept;
+};
+
+// A manual-reset event for coroutines. Signaling it while nobody waits is just a store under an uncontended lock,
+// which makes it cheap to signal on every chunk of data, unlike a kernel event.
+class AsyncEvent {
+protected:
+    AsyncWaitList waiters{};
+    bool signaled;
+
+    bool try_take_locked() noexcept {
+        return signaled;
+    }
+
+    void give_back() noexcept {
+    }
+
+    friend class _impl_async_take<AsyncEvent>;
+
+public:
+    explicit AsyncEvent(bool initialState = false) :
+        signaled{initialState} {
+    }
+
+    AsyncEvent(const AsyncEvent &) = delete;
+    AsyncEvent &operator=(const AsyncEvent &) = delete;
+
+    // Must be awaited from an AIO
+    [[nodiscard]] _impl_async_take<AsyncEvent> wait_async() noexcept {
+        return {this, "event"};
+    }
+
+    // Wakes every waiting coroutine
+    void signal() noexcept;
+
+    void reset() noexcept {
+        std::lock_guard lock{waiters.mutex};
+        signaled = false;
+    }
+
+    bool is_signaled() noexcept {
+        std::lock_guard lock{waiters.mutex};
+        return signaled;
+    }
+};
+#pragma endregion Async
+
+}  // namespace abel
@@ -0,0 +1,829 @@
+#include "TermSync.hpp"
+
+#include "Concurrency.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <ranges>
+
+namespace abel::term {
+
+#pragma region Screen
+void Screen::scroll_up(uint16_t top, uint16_t bottom, uint16_t count, Cell blank) {
+    if (top > bottom || bottom >= rows_) {
+        return;
+    }
+    count = std::min<uint16_t>(count, bottom - top + 1);
+
+    for (uint16_t i = top; i + count <= bottom; ++i) {
+        std::ranges::copy(row(i + count), row(i).begin());
+    }
+    for (uint16_t i = bottom - count + 1; i <= bottom; ++i) {
+        fill(i, 0, cols_, blank);
+    }
+}
+
+void Screen::scroll_down(uint16_t top, uint16_t bottom, uint16_t count, Cell blank) {
+    if (top > bottom || bottom >= rows_) {
+        return;
+    }
+    count = std::min<uint16_t>(count, bottom - top + 1);
+
+    for (uint16_t i = bottom; i >= top + count; --i) {
+        std::ranges::copy(row(i - count), row(i).begin());
+    }
+    for (uint16_t i = top; i < top + count; ++i) {
+        fill(i, 0, cols_, blank);
+    }
+}
+
+void Screen::fill(uint16_t row_index, uint16_t from, uint16_t to, Cell blank) {
+    auto cells = row(row_index);
+    to = std::min(to, cols_);
+    if (from < to) {
+        std::fill(cells.begin() + from, cells.begin() + to, blank);
+    }
+}
+
+void Screen::resize(uint16_t rows, uint16_t cols, uint16_t first) {
+    Screen next{rows, cols};
+    for (uint16_t i = 0; i < rows && first + i < rows_; ++i) {
+        std::ranges::copy(row(first + i).first(std::min(cols, cols_)), next.row(i).begin());
+    }
+
+    next.cursor_row = cursor_row;
+    next.cursor_col = cursor_col;
+    next.cursor_visible = cursor_visible;
+    *this = std::move(next);
+}
+#pragma endregion Screen
+
+#pragma region Emulator
+Emulator::Emulator(uint16_t rows, uint16_t cols) :
+    screen_{rows, cols},
+    scroll_bottom{(uint16_t)(rows - 1)} {
+}
+
+void Emulator::feed(std::span<const unsigned char> data) {
+    for (unsigned char byte : data) {
+        switch (state) {
+        case State::ground:
+            if (utf8_remaining > 0) {
+                if ((byte & 0xc0) == 0x80) {
+                    utf8_codepoint = (utf8_codepoint << 6) | (byte & 0x3f);
+                    if (--utf8_remaining == 0) {
+                        put(utf8_codepoint);
+                    }
+                    break;
+                }
+
+                // Truncated sequence; the current byte starts something new
+                utf8_remaining = 0;
+                put(0xfffd);
+            }
+
+            if (byte < 0x20 || byte == 0x7f) {
+                control(byte);
+            } else if (byte < 0x80) {
+                put(byte);
+            } else if ((byte & 0xe0) == 0xc0) {
+                utf8_codepoint = byte & 0x1f;
+                utf8_remaining = 1;
+            } else if ((byte & 0xf0) == 0xe0) {
+                utf8_codepoint = byte & 0x0f;
+                utf8_remaining = 2;
+            } else if ((byte & 0xf8) == 0xf0) {
+                utf8_codepoint = byte & 0x07;
+                utf8_remaining = 3;
+            } else {
+                put(0xfffd);
+            }
+            break;
+
+        case State::escape:
+            escape_dispatch(byte);
+            break;
+
+        case State::escape_intermediate:
+            state = State::ground;
+            break;
+
+        case State::csi:
+            if ('0' <= byte && byte <= '9') {
+                if (param_count == 0) {
+                    param_count = 1;
+                }
+                uint32_t value = params[param_count - 1] * 10u + (byte - '0');
+                params[param_count - 1] = (uint16_t)std::min<uint32_t>(value, UINT16_MAX);
+            } else if (byte == ';' || byte == ':') {
+                if (param_count == 0) {
+                    param_count = 1;
+                }
+                if (param_count < max_params) {
+                    params[param_count++] = 0;
+                }
+            } else if (0x3c <= byte && byte <= 0x3f) {
+                private_marker = true;
+            } else if (0x40 <= byte && byte <= 0x7e) {
+                state = State::ground;
+                csi_dispatch(byte);
+            } else if (byte == 0x1b) {
+                state = State::escape;
+            } else if (byte < 0x20) {
+                control(byte);
+            }
+            // Intermediate bytes are ignored
+            break;
+
+        case State::osc:
+            if (byte == 0x07) {
+                state = State::ground;
+            } else if (byte == 0x1b) {
+                state = State::osc_escape;
+            }
+            break;
+
+        case State::osc_escape:
+            // Normally a string terminator, but any other escape sequence ends the OSC too
+            state = State::escape;
+            escape_dispatch(byte);
+            break;
+        }
+    }
+}
+
+void Emulator::put(uint32_t ch) {
+    if (wrap_pending) {
+        screen_.cursor_col = 0;
+        line_feed();
+    }
+
+    screen_.row(screen_.cursor_row)[screen_.cursor_col] = Cell{ch, attrs};
+
+    if (screen_.cursor_col + 1 < screen_.cols()) {
+        ++screen_.cursor_col;
+    } else {
+        wrap_pending = autowrap;
+    }
+}
+
+void Emulator::control(unsigned char byte) {
+    switch (byte) {
+    case '\b':
+        if (screen_.cursor_col > 0) {
+            --screen_.cursor_col;
+        }
+        wrap_pending = false;
+        break;
+
+    case '\t':
+        screen_.cursor_col = std::min<uint16_t>((screen_.cursor_col / 8 + 1) * 8, screen_.cols() - 1);
+        wrap_pending = false;
+        break;
+
+    case '\n':
+    case '\v':
+    case '\f':
+        line_feed();
+        break;
+
+    case '\r':
+        screen_.cursor_col = 0;
+        wrap_pending = false;
+        break;
+
+    case 0x1b:
+        state = State::escape;
+        break;
+
+    default:
+        // BEL and the rest are ignored
+        break;
+    }
+}
+
+void Emulator::line_feed() {
+    wrap_pending = false;
+
+    if (screen_.cursor_row == scroll_bottom) {
+        screen_.scroll_up(scroll_top, scroll_bottom, 1, blank());
+    } else if (screen_.cursor_row + 1 < screen_.rows()) {
+        ++screen_.cursor_row;
+    }
+}
+
+void Emulator::reverse_line_feed() {
+    wrap_pending = false;
+
+    if (screen_.cursor_row == scroll_top) {
+        screen_.scroll_down(scroll_top, scroll_bottom, 1, blank());
+    } else if (screen_.cursor_row > 0) {
+        --screen_.cursor_row;
+    }
+}
+
+void Emulator::move_cursor(int row, int col) {
+    screen_.cursor_row = (uint16_t)std::clamp(row, 0, screen_.rows() - 1);
+    screen_.cursor_col = (uint16_t)std::clamp(col, 0, screen_.cols() - 1);
+    wrap_pending = false;
+}
+
+void Emulator::escape_dispatch(unsigned char byte) {
+    state = State::ground;
+
+    switch (byte) {
+    case '[':
+        state = State::csi;
+        param_count = 0;
+        private_marker = false;
+        std::ranges::fill(params, 0);
+        break;
+
+    case ']':
+        state = State::osc;
+        break;
+
+    case '7':
+        saved_row = screen_.cursor_row;
+        saved_col = screen_.cursor_col;
+        saved_attrs = attrs;
+        break;
+
+    case '8':
+        move_cursor(saved_row, saved_col);
+        attrs = saved_attrs;
+        break;
+
+    case 'D':
+        line_feed();
+        break;
+
+    case 'E':
+        screen_.cursor_col = 0;
+        line_feed();
+        break;
+
+    case 'M':
+        reverse_line_feed();
+        break;
+
+    case 'c':
+        reset();
+        break;
+
+    default:
+        if (0x20 <= byte && byte <= 0x2f) {
+            state = State::escape_intermediate;
+        }
+        break;
+    }
+}
+
+void Emulator::csi_dispatch(unsigned char byte) {
+    const int row = screen_.cursor_row;
+    const int col = screen_.cursor_col;
+    const uint16_t rows = screen_.rows();
+    const uint16_t cols = screen_.cols();
+
+    if (private_marker) {
+        if (byte != 'h' && byte != 'l') {
+            return;
+        }
+
+        bool enable = byte == 'h';
+        for (size_t i = 0; i < param_count; ++i) {
+            switch (params[i]) {
+            case 7:
+                autowrap = enable;
+                wrap_pending = false;
+                break;
+
+            case 25:
+                screen_.cursor_visible = enable;
+                break;
+
+            case 47:
+            case 1047:
+            case 1049:
+                // The alternate screen is not kept separately; switching just clears the screen
+                for (uint16_t r = 0; r < rows; ++r) {
+                    screen_.fill(r, 0, cols, blank());
+                }
+                move_cursor(0, 0);
+                break;
+            }
+        }
+        return;
+    }
+
+    switch (byte) {
+    case 'A':
+        move_cursor(row - param(0, 1), col);
+        break;
+
+    case 'B':
+    case 'e':
+        move_cursor(row + param(0, 1), col);
+        break;
+
+    case 'C':
+    case 'a':
+        move_cursor(row, col + param(0, 1));
+        break;
+
+    case 'D':
+        move_cursor(row, col - param(0, 1));
+        break;
+
+    case 'E':
+        move_cursor(row + param(0, 1), 0);
+        break;
+
+    case 'F':
+        move_cursor(row - param(0, 1), 0);
+        break;
+
+    case 'G':
+    case '`':
+        move_cursor(row, param(0, 1) - 1);
+        break;
+
+    case 'H':
+    case 'f':
+        move_cursor(param(0, 1) - 1, param(1, 1) - 1);
+        break;
+
+    case 'd':
+        move_cursor(param(0, 1) - 1, col);
+        break;
+
+    case 'J': {
+        uint16_t mode = param(0, 0);
+        uint16_t from = mode == 0 ? row + 1 : 0;
+        uint16_t to = mode == 1 ? row : rows;
+        for (uint16_t i = from; i < to; ++i) {
+            screen_.fill(i, 0, cols, blank());
+        }
+        if (mode == 0) {
+            screen_.fill(row, col, cols, blank());
+        } else if (mode == 1) {
+            screen_.fill(row, 0, col + 1, blank());
+        }
+        wrap_pending = false;
+        break;
+    }
+
+    case 'K': {
+        uint16_t mode = param(0, 0);
+        screen_.fill(row, mode == 0 ? col : 0, mode == 1 ? col + 1 : cols, blank());
+        wrap_pending = false;
+        break;
+    }
+
+    case 'L':
+        if (scroll_top <= row && row <= scroll_bottom) {
+            screen_.scroll_down(row, scroll_bottom, param(0, 1), blank());
+            move_cursor(row, 0);
+        }
+        break;
+
+    case 'M':
+        if (scroll_top <= row && row <= scroll_bottom) {
+            screen_.scroll_up(row, scroll_bottom, param(0, 1), blank());
+            move_cursor(row, 0);
+        }
+        break;
+
+    case 'P': {
+        auto cells = screen_.row(row);
+        uint16_t count = std::min<uint16_t>(param(0, 1), cols - col);
+        std::copy(cells.begin() + col + count, cells.end(), cells.begin() + col);
+        screen_.fill(row, cols - count, cols, blank());
+        wrap_pending = false;
+        break;
+    }
+
+    case '@': {
+        auto cells = screen_.row(row);
+        uint16_t count = std::min<uint16_t>(param(0, 1), cols - col);
+        std::copy_backward(cells.begin() + col, cells.end() - count, cells.end());
+        screen_.fill(row, col, col + count, blank());
+        wrap_pending = false;
+        break;
+    }
+
+    case 'X':
+        screen_.fill(row, col, (uint16_t)std::min<int>(col + param(0, 1), cols), blank());
+        wrap_pending = false;
+        break;
+
+    case 'S':
+        screen_.scroll_up(scroll_top, scroll_bottom, param(0, 1), blank());
+        break;
+
+    case 'T':
+        screen_.scroll_down(scroll_top, scroll_bottom, param(0, 1), blank());
+        break;
+
+    case 'm':
+        select_graphic_rendition();
+        break;
+
+    case 'r': {
+        uint16_t top = param(0, 1) - 1;
+        uint16_t bottom = param(1, rows) - 1;
+        if (top < bottom && bottom < rows) {
+            scroll_top = top;
+            scroll_bottom = bottom;
+            move_cursor(0, 0);
+        }
+        break;
+    }
+
+    case 's':
+        saved_row = screen_.cursor_row;
+        saved_col = screen_.cursor_col;
+        break;
+
+    case 'u':
+        move_cursor(saved_row, saved_col);
+        break;
+
+    default:
+        // Window manipulation, device status reports and the like are ignored
+        break;
+    }
+}
+
+void Emulator::select_graphic_rendition() {
+    if (param_count == 0) {
+        attrs = 0;
+        return;
+    }
+
+    auto set_fg = [&](uint32_t index) {
+        attrs = (attrs & ~attr::fg_mask) | (index & 0xff) | attr::fg_set;
+    };
+    auto set_bg = [&](uint32_t index) {
+        attrs = (attrs & ~attr::bg_mask) | ((index & 0xff) << attr::bg_shift) | attr::bg_set;
+    };
+
+    // Parses the tail of 38/48 into a 256-color palette index. Truecolor is mapped into the 6x6x6 cube.
+    auto extended_color = [&](size_t &i) -> int {
+        if (i + 2 < param_count && params[i + 1] == 5) {
+            i += 2;
+            return params[i];
+        }
+        if (i + 4 < param_count && params[i + 1] == 2) {
+            auto level = [](uint16_t value) {
+                return std::min<uint16_t>(value, 255) * 5 / 255;
+            };
+            int index = 16 + 36 * level(params[i + 2]) + 6 * level(params[i + 3]) + level(params[i + 4]);
+            i += 4;
+            return index;
+        }
+        i = param_count;
+        return -1;
+    };
+
+    for (size_t i = 0; i < param_count; ++i) {
+        uint16_t value = params[i];
+
+        if (30 <= value && value <= 37) {
+            set_fg(value - 30);
+        } else if (40 <= value && value <= 47) {
+            set_bg(value - 40);
+        } else if (90 <= value && value <= 97) {
+            set_fg(value - 90 + 8);
+        } else if (100 <= value && value <= 107) {
+            set_bg(value - 100 + 8);
+        } else {
+            switch (value) {
+            case 0:
+                attrs = 0;
+                break;
+            case 1:
+                attrs |= attr::bold;
+                break;
+            case 4:
+                attrs |= attr::underline;
+                break;
+            case 7:
+                attrs |= attr::inverse;
+                break;
+            case 22:
+                attrs &= ~attr::bold;
+                break;
+            case 24:
+                attrs &= ~attr::underline;
+                break;
+            case 27:
+                attrs &= ~attr::inverse;
+                break;
+            case 38:
+                if (int index = extended_color(i); index >= 0) {
+                    set_fg(index);
+                }
+                break;
+            case 39:
+                attrs &= ~(attr::fg_mask | attr::fg_set);
+                break;
+            case 48:
+                if (int index = extended_color(i); index >= 0) {
+                    set_bg(index);
+                }
+                break;
+            case 49:
+                attrs &= ~(attr::bg_mask | attr::bg_set);
+                break;
+            }
+        }
+    }
+}
+
+void Emulator::resize(uint16_t rows, uint16_t cols) {
+    if (rows == screen_.rows() && cols == screen_.cols()) {
+        return;
+    }
+
+    // Like a console window, keeps the cursor's row on the screen by dropping rows from the top
+    uint16_t first = screen_.cursor_row >= rows ? screen_.cursor_row - rows + 1 : 0;
+    screen_.resize(rows, cols, first);
+
+    screen_.cursor_row -= first;
+    screen_.cursor_col = std::min<uint16_t>(screen_.cursor_col, cols - 1);
+    wrap_pending = false;
+    scroll_top = 0;
+    scroll_bottom = rows - 1;
+    saved_row = std::min<uint16_t>(saved_row, rows - 1);
+    saved_col = std::min<uint16_t>(saved_col, cols - 1);
+}
+
+void Emulator::reset() {
+    screen_ = Screen{screen_.rows(), screen_.cols()};
+    attrs = 0;
+    wrap_pending = false;
+    autowrap = true;
+    scroll_top = 0;
+    scroll_bottom = screen_.rows() - 1;
+    saved_row = saved_col = 0;
+    saved_attrs = 0;
+}
+#pragma endregion Emulator
+
+#pragma region Encoder
+static uint64_t hash_row(std::span<const Cell> cells) {
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325;
+    for (const Cell &cell : cells) {
+        for (uint32_t word : {cell.ch, cell.attrs}) {
+            hash = (hash ^ word) * 0x100000001b3;
+        }
+    }
+    return hash;
+}
+
+uint16_t FrameEncoder::detect_scroll(const Screen &current) {
+    uint16_t rows = current.rows();
+
+    sent_hashes.resize(rows);
+    current_hashes.resize(rows);
+    for (uint16_t i = 0; i < rows; ++i) {
+        sent_hashes[i] = hash_row(sent.row(i));
+        current_hashes[i] = hash_row(current.row(i));
+    }
+
+    // Blank rows match anything, so they don't count
+    std::vector<Cell> blank_row(current.cols());
+    uint64_t blank_hash = hash_row(blank_row);
+
+    auto score = [&](uint16_t shift) {
+        unsigned matched = 0;
+        for (uint16_t i = 0; i + shift < rows; ++i) {
+            matched += current_hashes[i] == sent_hashes[i + shift] && current_hashes[i] != blank_hash;
+        }
+        return matched;
+    };
+
+    uint16_t best_shift = 0;
+    unsigned best_score = score(0);
+    for (uint16_t shift = 1; shift < rows; ++shift) {
+        unsigned shift_score = score(shift);
+        if (shift_score > best_score) {
+            best_shift = shift;
+            best_score = shift_score;
+        }
+    }
+
+    return best_shift;
+}
+
+std::span<const unsigned char> FrameEncoder::encode(const Screen &current) {
+    FrameHeader header{};
+
+    bool resized = sent.rows() != current.rows() || sent.cols() != current.cols();
+    if (resized) {
+        sent = Screen{current.rows(), current.cols()};
+    }
+
+    header.scroll = resized ? 0 : detect_scroll(current);
+    if (header.scroll > 0) {
+        sent.scroll_up(0, sent.rows() - 1, header.scroll);
+    }
+
+    frame.resize(sizeof(FrameHeader));
+
+    for (uint16_t i = 0; i < current.rows(); ++i) {
+        auto before = sent.row(i);
+        auto after = current.row(i);
+
+        auto first = std::ranges::mismatch(before, after).in2;
+        if (first == after.end()) {
+            continue;
+        }
+        auto last = std::ranges::mismatch(before | std::views::reverse, after | std::views::reverse).in2.base();
+
+        SpanHeader span{
+            .row = i,
+            .col = (uint16_t)(first - after.begin()),
+            .length = (uint16_t)(last - first),
+        };
+
+        auto cells = std::span{first, last};
+        auto span_bytes = bytes_of(span);
+        frame.insert(frame.end(), span_bytes.begin(), span_bytes.end());
+        frame.insert(frame.end(), (const unsigned char *)cells.data(), (const unsigned char *)(cells.data() + cells.size()));
+
+        std::ranges::copy(cells, before.begin() + span.col);
+        ++header.span_count;
+    }
+
+    bool cursor_moved = sent.cursor_row != current.cursor_row || sent.cursor_col != current.cursor_col ||
+                        sent.cursor_visible != current.cursor_visible;
+
+    if (!resized && header.scroll == 0 && header.span_count == 0 && !cursor_moved) {
+        frame.clear();
+        return {};
+    }
+
+    sent.cursor_row = current.cursor_row;
+    sent.cursor_col = current.cursor_col;
+    sent.cursor_visible = current.cursor_visible;
+
+    header.payload_size = (uint32_t)(frame.size() - sizeof(FrameHeader));
+    header.rows = current.rows();
+    header.cols = current.cols();
+    header.cursor_row = current.cursor_row;
+    header.cursor_col = current.cursor_col;
+    header.cursor_visible = current.cursor_visible;
+    memcpy(frame.data(), &header, sizeof(header));
+
+    return frame;
+}
+#pragma endregion Encoder
+
+#pragma region Decoder
+std::span<unsigned char> FrameDecoder::payload_buffer(const FrameHeader &header) {
+    if (header.payload_size > max_payload) {
+        fail("Invalid terminal frame");
+    }
+
+    payload.resize(header.payload_size);
+    return payload;
+}
+
+void FrameDecoder::render_attrs(uint32_t attrs) {
+    if (attrs == rendered_attrs) {
+        return;
+    }
+
+    output += "\x1b[0";
+    if (attrs & attr::bold) {
+        output += ";1";
+    }
+    if (attrs & attr::underline) {
+        output += ";4";
+    }
+    if (attrs & attr::inverse) {
+        output += ";7";
+    }
+
+    auto color = [&](uint32_t index, int base, int bright_base, int extended) {
+        char buffer[16];
+        if (index < 8) {
+            snprintf(buffer, sizeof(buffer), ";%u", base + index);
+        } else if (index < 16) {
+            snprintf(buffer, sizeof(buffer), ";%u", bright_base + index - 8);
+        } else {
+            snprintf(buffer, sizeof(buffer), ";%d;5;%u", extended, index);
+        }
+        output += buffer;
+    };
+
+    if (attrs & attr::fg_set) {
+        color(attrs & attr::fg_mask, 30, 90, 38);
+    }
+    if (attrs & attr::bg_set) {
+        color((attrs & attr::bg_mask) >> attr::bg_shift, 40, 100, 48);
+    }
+
+    output += 'm';
+    rendered_attrs = attrs;
+}
+
+void FrameDecoder::render_char(uint32_t ch) {
+    if (ch < 0x20 || ch == 0x7f) {
+        ch = ' ';
+    } else if (ch > 0x10ffff || (0xd800 <= ch && ch <= 0xdfff)) {
+        ch = 0xfffd;
+    }
+
+    if (ch < 0x80) {
+        output += (char)ch;
+    } else if (ch < 0x800) {
+        output += (char)(0xc0 | (ch >> 6));
+        output += (char)(0x80 | (ch & 0x3f));
+    } else if (ch < 0x10000) {
+        output += (char)(0xe0 | (ch >> 12));
+        output += (char)(0x80 | ((ch >> 6) & 0x3f));
+        output += (char)(0x80 | (ch & 0x3f));
+    } else {
+        output += (char)(0xf0 | (ch >> 18));
+        output += (char)(0x80 | ((ch >> 12) & 0x3f));
+        output += (char)(0x80 | ((ch >> 6) & 0x3f));
+        output += (char)(0x80 | (ch & 0x3f));
+    }
+}
+
+std::string_view FrameDecoder::apply(const FrameHeader &header) {
+    TerminalSize size{header.rows, header.cols};
+    if (!size.valid() || header.scroll > header.rows || header.cursor_row >= header.rows || header.cursor_col >= header.cols) {
+        fail("Invalid terminal frame");
+    }
+
+    char buffer[32];
+    output.clear();
+
+    // Keep the cursor from flickering around while drawing
+    output += "\x1b[?25l";
+
+    if (screen.rows() != header.rows || screen.cols() != header.cols) {
+        screen = Screen{header.rows, header.cols};
+        output += "\x1b[0m\x1b[2J";
+        rendered_attrs = 0;
+    }
+
+    if (header.scroll > 0) {
+        screen.scroll_up(0, screen.rows() - 1, header.scroll);
+        render_attrs(0);
+        snprintf(buffer, sizeof(buffer), "\x1b[%dS", header.scroll);
+        output += buffer;
+    }
+
+    std::span<const unsigned char> rest = payload;
+    for (uint16_t i = 0; i < header.span_count; ++i) {
+        SpanHeader span{};
+        if (rest.size() < sizeof(span)) {
+            fail("Invalid terminal frame");
+        }
+        memcpy(&span, rest.data(), sizeof(span));
+        rest = rest.subspan(sizeof(span));
+
+        size_t cells_size = (size_t)span.length * sizeof(Cell);
+        if (span.row >= screen.rows() || span.col + span.length > screen.cols() || rest.size() < cells_size) {
+            fail("Invalid terminal frame");
+        }
+
+        auto cells = screen.row(span.row).subspan(span.col, span.length);
+        memcpy(cells.data(), rest.data(), cells_size);
+        rest = rest.subspan(cells_size);
+
+        snprintf(buffer, sizeof(buffer), "\x1b[%d;%dH", span.row + 1, span.col + 1);
+        output += buffer;
+        for (const Cell &cell : cells) {
+            render_attrs(cell.attrs);
+            render_char(cell.ch);
+        }
+    }
+
+    if (!rest.empty()) {
+        fail("Invalid terminal frame");
+    }
+
+    screen.cursor_row = header.cursor_row;
+    screen.cursor_col = header.cursor_col;
+    screen.cursor_visible = header.cursor_visible;
+
+    snprintf(buffer, sizeof(buffer), "\x1b[%d;%dH", header.cursor_row + 1, header.cursor_col + 1);
+    output += buffer;
+    if (header.cursor_visible) {
+        output += "\x1b[?25h";
+    }
+
+    return output;
+}
+#pragma endregion Decoder
+
+}  // namespace abel::term
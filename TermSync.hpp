@@ -0,0 +1,347 @@
+#pragma once
+
+#include "Concurrency.hpp"
+#include "Handle.hpp"
+#include "Sync.hpp"
+#include "IOBase.hpp"
+#include "Error.hpp"
+#include "Protocol.hpp"
+
+#include <cstdint>
+#include <span>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+
+namespace abel {
+
+// Terminal state synchronization: instead of forwarding the shell's output byte by byte, the server runs
+// it through a terminal emulator and only sends what changed on the screen, at most once per frame interval.
+namespace term {
+
+// Bits of Cell::attrs
+namespace attr {
+constexpr uint32_t fg_mask = 0xff;
+constexpr uint32_t fg_set = 1 << 8;
+constexpr uint32_t bg_shift = 9;
+constexpr uint32_t bg_mask = 0xff << bg_shift;
+constexpr uint32_t bg_set = 1 << 17;
+constexpr uint32_t bold = 1 << 18;
+constexpr uint32_t underline = 1 << 19;
+constexpr uint32_t inverse = 1 << 20;
+}  // namespace attr
+
+struct Cell {
+    // A Unicode code point. Every cell is assumed to be one column wide.
+    uint32_t ch = ' ';
+    uint32_t attrs = 0;
+
+    constexpr bool operator==(const Cell &other) const = default;
+};
+
+static_assert(sizeof(Cell) == 8);
+
+class Screen {
+protected:
+    uint16_t rows_{0};
+    uint16_t cols_{0};
+    std::vector<Cell> cells{};
+
+public:
+    uint16_t cursor_row{0};
+    uint16_t cursor_col{0};
+    bool cursor_visible{true};
+
+    Screen() = default;
+
+    Screen(uint16_t rows, uint16_t cols) :
+        rows_{rows},
+        cols_{cols},
+        cells((size_t)rows * cols) {
+    }
+
+    uint16_t rows() const noexcept {
+        return rows_;
+    }
+
+    uint16_t cols() const noexcept {
+        return cols_;
+    }
+
+    std::span<Cell> row(uint16_t index) noexcept {
+        return {cells.data() + (size_t)index * cols_, cols_};
+    }
+
+    std::span<const Cell> row(uint16_t index) const noexcept {
+        return {cells.data() + (size_t)index * cols_, cols_};
+    }
+
+    // Moves the rows [top, bottom] up by `count`, filling the freed ones with `blank`
+    void scroll_up(uint16_t top, uint16_t bottom, uint16_t count, Cell blank = {});
+
+    // Moves the rows [top, bottom] down by `count`, filling the freed ones with `blank`
+    void scroll_down(uint16_t top, uint16_t bottom, uint16_t count, Cell blank = {});
+
+    void fill(uint16_t row, uint16_t from, uint16_t to, Cell blank = {});
+
+    // Keeps the cells that still fit, taking the rows from `first` on, and blanks the new ones. Leaves the cursor be.
+    void resize(uint16_t rows, uint16_t cols, uint16_t first = 0);
+};
+
+// A VT100/xterm subset: enough for cmd.exe, PowerShell and the usual full-screen tools
+class Emulator {
+protected:
+    enum class State : uint8_t {
+        ground,
+        escape,
+        // ESC followed by an intermediate byte, like a charset designation; one more byte to skip
+        escape_intermediate,
+        csi,
+        osc,
+        osc_escape,
+    };
+
+    static constexpr size_t max_params = 16;
+
+    Screen screen_;
+    State state{State::ground};
+    uint32_t attrs{0};
+
+    uint16_t params[max_params]{};
+    size_t param_count{0};
+    bool private_marker{false};
+
+    uint32_t utf8_codepoint{0};
+    int utf8_remaining{0};
+
+    // Set after writing into the last column, so that the wrap only happens if another character follows
+    bool wrap_pending{false};
+    bool autowrap{true};
+    uint16_t scroll_top{0};
+    uint16_t scroll_bottom;
+    uint16_t saved_row{0};
+    uint16_t saved_col{0};
+    uint32_t saved_attrs{0};
+
+    Cell blank() const noexcept {
+        return Cell{' ', attrs & (attr::bg_mask | attr::bg_set)};
+    }
+
+    uint16_t param(size_t index, uint16_t fallback) const noexcept {
+        return index < param_count && params[index] != 0 ? params[index] : fallback;
+    }
+
+    void put(uint32_t ch);
+    void control(unsigned char byte);
+    void line_feed();
+    void reverse_line_feed();
+    void move_cursor(int row, int col);
+    void escape_dispatch(unsigned char byte);
+    void csi_dispatch(unsigned char byte);
+    void select_graphic_rendition();
+    void reset();
+
+public:
+    Emulator(uint16_t rows, uint16_t cols);
+
+    void feed(std::span<const unsigned char> data);
+
+    // Clips the screen rather than reflowing it, since the shell redraws after a resize anyway
+    void resize(uint16_t rows, uint16_t cols);
+
+    const Screen &screen() const noexcept {
+        return screen_;
+    }
+};
+
+// Server -> client, once per frame. Followed by `payload_size` bytes of spans.
+struct FrameHeader {
+    uint32_t payload_size;
+    uint16_t rows;
+    uint16_t cols;
+    uint16_t cursor_row;
+    uint16_t cursor_col;
+    // The client scrolls its whole screen up by this many lines before applying the spans
+    uint16_t scroll;
+    uint16_t span_count;
+    uint8_t cursor_visible;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(FrameHeader) == 20);
+
+// Followed by `length` Cells that replace the ones starting at (row, col)
+struct SpanHeader {
+    uint16_t row;
+    uint16_t col;
+    uint16_t length;
+    uint16_t reserved;
+};
+
+static_assert(sizeof(SpanHeader) == 8);
+
+// Client -> server, right after the SessionHello, if session_termsync or session_resize is set
+struct TerminalSize {
+    uint16_t rows;
+    uint16_t cols;
+
+    bool valid() const noexcept {
+        return 0 < rows && rows <= 1000 && 0 < cols && cols <= 1000;
+    }
+};
+
+// Tracks what the client has seen and turns the current screen into diffs against that
+class FrameEncoder {
+protected:
+    Screen sent{};
+    std::vector<unsigned char> frame{};
+    std::vector<uint64_t> sent_hashes{};
+    std::vector<uint64_t> current_hashes{};
+
+    // How far the screen moved up since the last frame, if it looks like it did
+    uint16_t detect_scroll(const Screen &current);
+
+public:
+    // Returns an empty span if nothing changed. The result stays valid until the next call.
+    std::span<const unsigned char> encode(const Screen &current);
+};
+
+// Keeps a copy of the server's screen and renders the diffs as VT sequences for the local console
+class FrameDecoder {
+protected:
+    Screen screen{};
+    std::vector<unsigned char> payload{};
+    std::string output{};
+    uint32_t rendered_attrs{0};
+
+    void render_attrs(uint32_t attrs);
+    void render_char(uint32_t ch);
+
+public:
+    static constexpr size_t max_payload = 16 * 1024 * 1024;
+
+    // Where the payload of the frame should be read into
+    std::span<unsigned char> payload_buffer(const FrameHeader &header);
+
+    // Applies the frame whose payload has been read, and returns the text to write to the console.
+    // The result stays valid until the next call.
+    std::string_view apply(const FrameHeader &header);
+
+    // Restores the console's attributes and cursor, for when the session ends
+    static std::string_view restore_sequence() noexcept {
+        return "\x1b[0m\x1b[?25h\r\n";
+    }
+};
+
+// Everything the server-side coroutines of one session share. They all run on the same thread.
+struct SyncState {
+    // Frames are sent at most this often. Output that arrives in between only costs emulator time.
+    static constexpr DWORD frame_interval_ms = 20;
+
+    Emulator emulator;
+    FrameEncoder encoder{};
+    // Signaled for every chunk of output, so a kernel event would cost a syscall each time
+    AsyncEvent dirty{};
+    OwningHandle pace = Handle::create_timer();
+    // The shell's output has reached its end
+    bool output_done{false};
+    // A frame is being written, so the stream can't take another one until it's through
+    bool sending{false};
+    // send_frames has returned, having sent everything or run into the client's end
+    bool frames_done{false};
+
+    SyncState(TerminalSize size) :
+        emulator{size.rows, size.cols} {
+    }
+};
+
+// Feeds the shell's output into the emulator as fast as it arrives
+template <async_readable R>
+AIO<void> feed_output(R output, SyncState &state) {
+    constexpr size_t buffer_size = 16 * 1024;
+    std::unique_ptr<unsigned char[]> buffer = std::make_unique<unsigned char[]>(buffer_size);
+
+    while (true) {
+        auto result = co_await output.read_async_into({buffer.get(), buffer_size});
+        if (result.value > 0) {
+            state.emulator.feed({buffer.get(), result.value});
+            state.dirty.signal();
+        }
+        if (result.is_eof) {
+            break;
+        }
+    }
+
+    state.output_done = true;
+    // So that send_frames comes around once more and sees it
+    state.dirty.signal();
+}
+
+// Returns once the frame of the final output is sent, and sets done_timer then, like send_output does.
+// Cancelling it is only safe while it isn't `sending`, since the encoder counts a frame as sent once it's encoded.
+template <async_writable W>
+AIO<void> send_frames(W &to_client, SyncState &state, Handle done_timer) {
+    while (true) {
+        co_await state.dirty.wait_async();
+        state.dirty.reset();
+
+        auto frame = state.encoder.encode(state.emulator.screen());
+        if (!frame.empty()) {
+            state.sending = true;
+            bool eof = (co_await to_client.write_async_full_from(frame)).is_eof;
+            state.sending = false;
+            if (eof) {
+                break;
+            }
+        }
+
+        // Output fed after the frame was encoded has signaled dirty again
+        if (state.output_done && !state.dirty.is_signaled()) {
+            break;
+        }
+
+        state.pace.set_timer(SyncState::frame_interval_ms);
+        co_await event_signaled{state.pace};
+    }
+
+    state.frames_done = true;
+    done_timer.set_timer(0);
+}
+
+// Sends whatever is left unsent, for when send_frames had to be cancelled between frames
+template <async_writable W>
+AIO<void> send_last_frame(W &to_client, SyncState &state) {
+    auto frame = state.encoder.encode(state.emulator.screen());
+    if (!frame.empty()) {
+        co_await to_client.write_async_full_from(frame);
+    }
+}
+
+template <async_readable R, async_writable W>
+AIO<void> receive_frames(R from_server, W console) {
+    FrameDecoder decoder{};
+
+    while (true) {
+        FrameHeader header{};
+        auto header_bytes = bytes_of(header);
+
+        // A clean end of stream may only happen between frames
+        auto first = co_await from_server.read_async_into(header_bytes);
+        if (first.is_eof && first.value == 0) {
+            break;
+        }
+        co_await from_server.read_async_full_into(header_bytes.subspan(first.value));
+        co_await from_server.read_async_full_into(decoder.payload_buffer(header));
+
+        auto output = decoder.apply(header);
+        co_await console.write_async_full_from({(const unsigned char *)output.data(), output.size()});
+    }
+
+    auto restore = FrameDecoder::restore_sequence();
+    co_await console.write_async_full_from({(const unsigned char *)restore.data(), restore.size()});
+}
+
+}  // namespace term
+
+}  // namespace abel
@@ -1,32 +1,381 @@
 #include "Thread.hpp"
 
+#include "Log.hpp"
 #include "Error.hpp"
 
+#include <algorithm>
+#include <bit>
+
 namespace abel {
 
+#pragma region Thread
 Thread Thread::create(
     LPTHREAD_START_ROUTINE func,
     void *param,
     bool inheritHandles,
     bool startSuspended
 ) {
+    return create(func, param, ThreadOptions{.inherit_handles = inheritHandles, .start_suspended = startSuspended});
+}
+
+Thread Thread::create(LPTHREAD_START_ROUTINE func, void *param, const ThreadOptions &options) {
     Thread result{};
 
     SECURITY_ATTRIBUTES sa{
         .nLength = sizeof(SECURITY_ATTRIBUTES),
         .lpSecurityDescriptor = nullptr,
-        .bInheritHandle = inheritHandles,
+        .bInheritHandle = options.inherit_handles,
     };
 
+    // Suspended until the options are in place, so that it doesn't start off on the wrong processor
+    bool configure = options.affinity || !options.name.empty() || options.priority != THREAD_PRIORITY_NORMAL;
+
     DWORD flags = 0;
 
-    if (startSuspended) {
+    if (options.start_suspended || configure) {
         flags |= CREATE_SUSPENDED;
     }
 
-    result.handle = OwningHandle(CreateThread(&sa, 0, func, param, flags, &result.tid)).validate();
+    if (options.stack_size) {
+        flags |= STACK_SIZE_PARAM_IS_A_RESERVATION;
+    }
+
+    result.handle = OwningHandle(CreateThread(&sa, options.stack_size, func, param, flags, &result.tid)).validate();
+
+    if (configure) {
+        try {
+            if (options.affinity) {
+                set_affinity(result.handle, *options.affinity);
+            }
+            if (!options.name.empty()) {
+                set_name(result.handle, options.name);
+            }
+            if (options.priority != THREAD_PRIORITY_NORMAL) {
+                set_priority(result.handle, options.priority);
+            }
+        } catch (...) {
+            // It hasn't run yet, so nothing it might have owned is left behind
+            result.handle.terminate_thread();
+            throw;
+        }
+
+        if (!options.start_suspended) {
+            result.handle.resume_thread();
+        }
+    }
 
     return result;
 }
 
+void Thread::set_name(Handle thread, std::string_view name) {
+    int size = MultiByteToWideChar(CP_UTF8, 0, name.data(), (int)name.size(), nullptr, 0);
+    std::wstring wide(size, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, name.data(), (int)name.size(), wide.data(), size);
+
+    if (FAILED(SetThreadDescription(thread.raw(), wide.c_str()))) {
+        fail("Failed to set thread name");
+    }
+}
+
+void Thread::set_priority(Handle thread, int priority) {
+    if (!SetThreadPriority(thread.raw(), priority)) {
+        fail("Failed to set thread priority");
+    }
+}
+
+void Thread::set_affinity(Handle thread, CpuSet cpus) {
+    GROUP_AFFINITY affinity{.Mask = cpus.mask, .Group = cpus.group};
+    if (!SetThreadGroupAffinity(thread.raw(), &affinity, nullptr)) {
+        fail("Failed to set thread affinity");
+    }
+}
+
+std::vector<USHORT> Thread::numa_nodes() {
+    ULONG highest = 0;
+    if (!GetNumaHighestNodeNumber(&highest)) {
+        return {0};
+    }
+
+    std::vector<USHORT> result{};
+    for (USHORT node = 0; node <= highest; ++node) {
+        if (CpuSet::of_node(node).mask) {
+            result.push_back(node);
+        }
+    }
+
+    if (result.empty()) {
+        result.push_back(0);
+    }
+    return result;
+}
+
+std::vector<std::optional<CpuSet>> Thread::placements(Placement placement, size_t count) {
+    std::vector<std::optional<CpuSet>> result(count);
+    if (placement == Placement::none) {
+        return result;
+    }
+
+    auto nodes = numa_nodes();
+    std::vector<CpuSet> node_cpus{};
+    for (USHORT node : nodes) {
+        node_cpus.push_back(CpuSet::of_node(node));
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        const CpuSet &cpus = node_cpus[i % nodes.size()];
+        if (placement == Placement::node) {
+            result[i] = cpus;
+            continue;
+        }
+
+        // The node's processors are taken in order, and wrap around once they've all got a thread
+        size_t nth = (i / nodes.size()) % std::popcount(cpus.mask);
+        KAFFINITY mask = cpus.mask;
+        for (size_t skip = 0; skip < nth; ++skip) {
+            mask &= mask - 1;
+        }
+        result[i] = CpuSet{.group = cpus.group, .mask = mask & (~mask + 1)};
+    }
+
+    return result;
+}
+#pragma endregion Thread
+
+#pragma region CpuSet
+CpuSet CpuSet::of_node(USHORT node) {
+    GROUP_AFFINITY affinity{};
+    if (!GetNumaNodeProcessorMaskEx(node, &affinity)) {
+        fail("Failed to get the processors of a NUMA node");
+    }
+
+    return {.group = affinity.Group, .mask = affinity.Mask};
+}
+
+USHORT CpuSet::node() const {
+    PROCESSOR_NUMBER processor{.Group = group, .Number = (BYTE)std::countr_zero(mask)};
+    USHORT result = 0;
+    if (!GetNumaProcessorNodeEx(&processor, &result)) {
+        return 0;
+    }
+    return result;
+}
+#pragma endregion CpuSet
+
+#pragma region NumaBuffer
+NumaBuffer::NumaBuffer(size_t size, USHORT node) {
+    data_ = (unsigned char *)VirtualAllocExNuma(GetCurrentProcess(), nullptr, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE, node);
+    if (!data_) {
+        fail("Failed to allocate memory on a NUMA node");
+    }
+    size_ = size;
+}
+
+NumaBuffer::~NumaBuffer() {
+    if (data_) {
+        VirtualFree(data_, 0, MEM_RELEASE);
+    }
+}
+#pragma endregion NumaBuffer
+
+#pragma region ThreadPool
+namespace {
+
+// Completion keys. The work itself is passed as the OVERLAPPED pointer.
+constexpr ULONG_PTR work_key = 1;
+constexpr ULONG_PTR quit_key = 2;
+
+thread_local std::span<unsigned char> pool_buffer{};
+
+}  // namespace
+
+struct ThreadPool::State {
+    ThreadPoolOptions options;
+    std::vector<std::optional<CpuSet>> placements;
+    OwningHandle port;
+
+    std::atomic<size_t> threads{0};
+    // Idle threads not yet spoken for. submit() takes one to hand its work to, or starts a thread if there are none,
+    // and a thread that wants to exit for being idle has to take one too, so that no work is left without a thread.
+    std::atomic<size_t> available{0};
+    // Work submitted while all max_threads were busy. A thread that finishes its work takes one of these
+    // instead of becoming available, since it's about to pick that work up.
+    std::atomic<size_t> backlog{0};
+    // Just for the placements
+    std::atomic<size_t> started{0};
+
+    // Decrements the counter unless it's at `floor` already
+    static bool take(std::atomic<size_t> &counter, size_t floor = 0) noexcept {
+        size_t count = counter.load(std::memory_order_relaxed);
+        while (count > floor) {
+            if (counter.compare_exchange_weak(count, count - 1, std::memory_order_acq_rel)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+namespace {
+
+struct WorkerStart {
+    std::shared_ptr<void> state;
+    std::optional<CpuSet> placement;
+};
+
+}  // namespace
+
+ThreadPool::ThreadPool(ThreadPoolOptions options) :
+    state{std::make_shared<State>()} {
+
+    // The threads past the number of processors wrap around to the first placements
+    size_t placements = std::clamp<size_t>(options.max_threads, 1, GetActiveProcessorCount(ALL_PROCESSOR_GROUPS));
+    state->placements = Thread::placements(options.placement, options.placement == Placement::none ? 1 : placements);
+    state->options = std::move(options);
+    state->options.max_threads = std::max<size_t>(state->options.max_threads, 1);
+
+    state->port = OwningHandle{CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 0)};
+    if (!state->port) {
+        fail("Failed to create the thread pool's completion port");
+    }
+
+    for (size_t i = 0; i < state->options.min_threads; ++i) {
+        spawn();
+        ++state->available;
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    if (!state) {
+        return;
+    }
+
+    // Queued behind the work, so that it still gets done
+    size_t threads = state->threads.load();
+    for (size_t i = 0; i < threads; ++i) {
+        PostQueuedCompletionStatus(state->port.raw(), 0, quit_key, nullptr);
+    }
+}
+
+void ThreadPool::spawn() {
+    size_t index = state->started++;
+    auto start = std::make_unique<WorkerStart>(WorkerStart{.state = state, .placement = state->placements[index % state->placements.size()]});
+
+    ++state->threads;
+    try {
+        Thread::create(
+            &worker,
+            start.get(),
+            ThreadOptions{
+                .stack_size = state->options.stack_size,
+                .affinity = start->placement,
+                .name = state->options.name + " " + std::to_string(index),
+                .priority = state->options.priority,
+            }
+        );
+    } catch (...) {
+        --state->threads;
+        throw;
+    }
+
+    // Now owned by the thread
+    start.release();
+}
+
+void ThreadPool::submit(std::function<void()> work) {
+    auto boxed = std::make_unique<std::function<void()>>(std::move(work));
+
+    // Without an idle thread, start another, unless there are enough already, in which case the work waits its turn
+    if (!State::take(state->available)) {
+        if (state->threads.load() < state->options.max_threads) {
+            spawn();
+        } else {
+            ++state->backlog;
+        }
+    }
+
+    if (!PostQueuedCompletionStatus(state->port.raw(), 0, work_key, (OVERLAPPED *)boxed.get())) {
+        fail("Failed to queue work for the thread pool");
+    }
+    boxed.release();
+}
+
+size_t ThreadPool::threads() const noexcept {
+    return state ? state->threads.load() : 0;
+}
+
+std::span<unsigned char> ThreadPool::local_buffer() noexcept {
+    return pool_buffer;
+}
+
+DWORD WINAPI ThreadPool::worker(void *arg) {
+    std::unique_ptr<WorkerStart> start{(WorkerStart *)arg};
+    auto state = std::static_pointer_cast<State>(std::move(start->state));
+
+    // Allocated from the thread itself, which has already been placed, so that the memory lands on its node
+    NumaBuffer buffer{};
+    if (state->options.buffer_size) {
+        USHORT node = 0;
+        if (start->placement) {
+            node = start->placement->node();
+        } else {
+            PROCESSOR_NUMBER processor{};
+            GetCurrentProcessorNumberEx(&processor);
+            GetNumaProcessorNodeEx(&processor, &node);
+        }
+
+        try {
+            buffer = NumaBuffer{state->options.buffer_size, node};
+        } catch (std::exception &e) {
+            log::warning(log::Category::service, "Pool thread without a buffer", {{"error", e.what()}});
+        }
+    }
+    pool_buffer = buffer.span();
+
+    // An idle exit has left the thread count already
+    bool counted = true;
+    while (true) {
+        DWORD bytes = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED *overlapped = nullptr;
+        bool got = GetQueuedCompletionStatus(state->port.raw(), &bytes, &key, &overlapped, state->options.idle_timeout_ms);
+
+        if (!got && !overlapped) {
+            // Idle for long enough. If there's no available thread to take, a submit has just counted on this one.
+            // Leaving the count in the same step as checking it keeps threads idling out together from going
+            // below min_threads.
+            if (State::take(state->available)) {
+                if (State::take(state->threads, state->options.min_threads)) {
+                    counted = false;
+                    break;
+                }
+                ++state->available;
+            }
+            continue;
+        }
+
+        if (key == quit_key) {
+            break;
+        }
+
+        std::unique_ptr<std::function<void()>> work{(std::function<void()> *)overlapped};
+        try {
+            (*work)();
+        } catch (std::exception &e) {
+            log::error(log::Category::service, "Unhandled exception on a pool thread", {{"error", e.what()}});
+        }
+        work.reset();
+
+        if (!State::take(state->backlog)) {
+            ++state->available;
+        }
+    }
+
+    pool_buffer = {};
+    if (counted) {
+        --state->threads;
+    }
+    return 0;
+}
+#pragma endregion ThreadPool
+
 }  // namespace abel
@@ -4,13 +4,53 @@
 #include "Owning.hpp"
 
 #include <Windows.h>
+#include <atomic>
 #include <utility>
 #include <concepts>
 #include <functional>
 #include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace abel {
 
+// Logical processors a thread may run on. Windows splits machines with more than 64 of them into
+// processor groups, and a thread's affinity can only cover a single group.
+struct CpuSet {
+    WORD group{0};
+    KAFFINITY mask{0};
+
+    // All of the node's processors
+    static CpuSet of_node(USHORT node);
+
+    // The node of the set's lowest processor
+    USHORT node() const;
+};
+
+// How the threads of a pool or an Acceptor are spread over the machine
+enum class Placement : uint8_t {
+    // Wherever the scheduler puts them
+    none,
+    // Each confined to a NUMA node, round-robin over the nodes, so that it stays near its memory
+    node,
+    // Each pinned to a logical processor of its own, round-robin over the nodes
+    cpu,
+};
+
+struct ThreadOptions {
+    // Reserved for the stack; 0 for the executable's default, usually 1 MiB
+    SIZE_T stack_size{0};
+    std::optional<CpuSet> affinity{};
+    // Shown by debuggers and in crash dumps
+    std::string name{};
+    int priority{THREAD_PRIORITY_NORMAL};
+    bool inherit_handles{false};
+    bool start_suspended{false};
+};
+
 class Thread {
 protected:
     Thread() {
@@ -30,6 +70,9 @@ public:
         bool startSuspended = false
     );
 
+    // The options are applied before the thread gets to run
+    static Thread create(LPTHREAD_START_ROUTINE func, void *param, const ThreadOptions &options);
+
     template <typename T, void (T::*func)()>
     static Thread create(
         T *obj,
@@ -47,6 +90,18 @@ public:
         );
     }
 
+    template <typename T, void (T::*func)()>
+    static Thread create(T *obj, const ThreadOptions &options) {
+        return create(
+            [](void *arg) -> DWORD {
+                (((T *)arg)->*func)();
+                return 0;
+            },
+            obj,
+            options
+        );
+    }
+
     template <std::invocable<> F>
         requires std::same_as<std::invoke_result_t<F>, DWORD>
     [[nodiscard]] static Owning<Thread, std::unique_ptr<F>> create(
@@ -65,6 +120,105 @@ public:
             std::move(funcPtr)
         );
     }
+
+    static void set_name(Handle thread, std::string_view name);
+
+    static void set_priority(Handle thread, int priority);
+
+    static void set_affinity(Handle thread, CpuSet cpus);
+
+    // The NUMA nodes that have processors, in order. A single node on most desktops.
+    static std::vector<USHORT> numa_nodes();
+
+    // Where each of `count` threads should go; nullopt for Placement::none
+    static std::vector<std::optional<CpuSet>> placements(Placement placement, size_t count);
+};
+
+// Committed memory on a particular NUMA node, for buffers that a thread on that node works with,
+// which keeps their cache lines from crossing between sockets
+class NumaBuffer {
+protected:
+    unsigned char *data_{nullptr};
+    size_t size_{0};
+
+public:
+    NumaBuffer() = default;
+
+    NumaBuffer(size_t size, USHORT node);
+
+    NumaBuffer(const NumaBuffer &) = delete;
+    NumaBuffer &operator=(const NumaBuffer &) = delete;
+
+    NumaBuffer(NumaBuffer &&other) noexcept :
+        data_{std::exchange(other.data_, nullptr)},
+        size_{std::exchange(other.size_, 0)} {
+    }
+
+    NumaBuffer &operator=(NumaBuffer &&other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+        return *this;
+    }
+
+    ~NumaBuffer();
+
+    std::span<unsigned char> span() const noexcept {
+        return {data_, size_};
+    }
+};
+
+struct ThreadPoolOptions {
+    // Kept around even while idle
+    size_t min_threads{0};
+    // Work submitted while all of these are busy waits for one of them
+    size_t max_threads{64};
+    // How long a surplus thread may sit idle before it exits
+    DWORD idle_timeout_ms{30'000};
+    SIZE_T stack_size{0};
+    Placement placement{Placement::none};
+    // Each thread gets a buffer of this size on its NUMA node, see ThreadPool::local_buffer
+    size_t buffer_size{0};
+    // The threads are named `<name> <index>`
+    std::string name{"pool"};
+    int priority{THREAD_PRIORITY_NORMAL};
+};
+
+// Runs work on reusable threads, started as needed up to a maximum, instead of a new thread for every task.
+// The work is queued on an I/O completion port, which wakes the most recently idle thread, whose stack
+// and buffers are the likeliest to still be in the cache.
+class ThreadPool {
+protected:
+    struct State;
+
+    // Shared with the threads, which may outlive the pool while finishing their last work
+    std::shared_ptr<State> state;
+
+    static DWORD WINAPI worker(void *arg);
+
+    void spawn();
+
+public:
+    explicit ThreadPool(ThreadPoolOptions options = {});
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    ThreadPool(ThreadPool &&) noexcept = default;
+    ThreadPool &operator=(ThreadPool &&) noexcept = default;
+
+    // Lets the threads go once they're done with what's been submitted so far, without waiting for them
+    ~ThreadPool();
+
+    void submit(std::function<void()> work);
+
+    template <typename T, void (T::*func)()>
+    void submit(T *obj) {
+        submit([obj]() { (obj->*func)(); });
+    }
+
+    size_t threads() const noexcept;
+
+    // The calling thread's buffer, if it's one of a pool's threads, and the pool has buffer_size set
+    static std::span<unsigned char> local_buffer() noexcept;
 };
 
 }  // namespace abel
@@ -0,0 +1,234 @@
+#include "Trace.hpp"
+
+#include "Handle.hpp"
+#include "Error.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+
+namespace abel::trace {
+
+namespace {
+
+struct Record {
+    int64_t ticks;
+    const void *coro;
+    const void *detail;
+    const char *label;
+    DWORD tid;
+    Kind kind;
+};
+
+// Written by a single thread at a time. Allocated on a thread's first event, so that threads
+// that never run a coroutine while tracing is on don't pay for one.
+struct Ring {
+    // About 160 KiB per thread
+    static constexpr size_t capacity = 4096;
+    // When a ring has wrapped around, these many of the oldest records may be overwritten while being dumped
+    static constexpr size_t overwrite_margin = 64;
+
+    std::unique_ptr<Record[]> records = std::make_unique<Record[]>(capacity);
+    std::atomic<uint64_t> written{0};
+    std::atomic<bool> in_use{true};
+    // Rings are never freed, so the list only ever grows at the head
+    Ring *next{nullptr};
+};
+
+std::atomic<Ring *> rings{nullptr};
+
+std::mutex dump_mutex{};
+std::string dump_path{};
+
+// Same as the metrics slots: a thread hands its ring back when it exits, and the next one carries on
+// writing into it, which keeps the number of rings at the peak number of threads
+Ring *acquire_ring() {
+    for (Ring *ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        bool expected = false;
+        if (!ring->in_use.load(std::memory_order_relaxed) && ring->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+            return ring;
+        }
+    }
+
+    Ring *ring = new Ring{};
+    ring->next = rings.load(std::memory_order_relaxed);
+    while (!rings.compare_exchange_weak(ring->next, ring, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+    return ring;
+}
+
+struct RingLease {
+    Ring *ring = acquire_ring();
+
+    ~RingLease() {
+        ring->in_use.store(false, std::memory_order_release);
+    }
+};
+
+Ring &my_ring() {
+    thread_local RingLease lease{};
+    return *lease.ring;
+}
+
+int64_t now_ticks() noexcept {
+    LARGE_INTEGER value{};
+    QueryPerformanceCounter(&value);
+    return value.QuadPart;
+}
+
+void append_event(std::string &out, const Record &record, double ts_us, DWORD pid) {
+    const char *name = "";
+    const char *category = "";
+    const char *phase = "";
+    bool async = false;
+
+    switch (record.kind) {
+    case Kind::created:
+    case Kind::destroyed:
+        name = "coroutine";
+        category = "coro";
+        phase = record.kind == Kind::created ? "b" : "e";
+        async = true;
+        break;
+
+    case Kind::resumed:
+    case Kind::suspended:
+        name = "resume";
+        category = "loop";
+        phase = record.kind == Kind::resumed ? "B" : "E";
+        break;
+
+    case Kind::io_wait:
+    case Kind::io_done:
+        name = record.label ? record.label : "io";
+        category = "io";
+        phase = record.kind == Kind::io_wait ? "b" : "e";
+        async = true;
+        break;
+
+    case Kind::event_wait:
+    case Kind::event_done:
+        name = "event";
+        category = "wait";
+        phase = record.kind == Kind::event_wait ? "b" : "e";
+        async = true;
+        break;
+
+    case Kind::nonlinear:
+        name = "nonlinear use";
+        category = "error";
+        phase = "i";
+        break;
+    }
+
+    char buffer[512] = {};
+    int size = snprintf(
+        buffer,
+        sizeof(buffer),
+        "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%.3f,\"pid\":%lu,\"tid\":%lu",
+        name,
+        category,
+        phase,
+        ts_us,
+        pid,
+        record.tid
+    );
+    out.append(buffer, (size_t)std::max(size, 0));
+
+    if (async) {
+        size = snprintf(buffer, sizeof(buffer), ",\"id\":\"%p\"", record.coro);
+        out.append(buffer, (size_t)std::max(size, 0));
+    }
+    if (record.kind == Kind::nonlinear) {
+        out += ",\"s\":\"t\"";
+    }
+
+    size = snprintf(buffer, sizeof(buffer), ",\"args\":{\"coro\":\"%p\",\"detail\":\"%p\"}},\n", record.coro, record.detail);
+    out.append(buffer, (size_t)std::max(size, 0));
+}
+
+}  // namespace
+
+void start(std::string path) {
+    if constexpr (!compiled_in) {
+        (void)path;
+        fail("This build has no tracing; rebuild with ABEL_TRACING=1");
+    } else {
+        {
+            std::lock_guard lock{dump_mutex};
+            dump_path = std::move(path);
+        }
+        enabled = true;
+    }
+}
+
+void emit(Kind kind, const void *coro, const void *detail, const char *label) noexcept {
+    Ring &ring = my_ring();
+
+    uint64_t index = ring.written.load(std::memory_order_relaxed);
+    ring.records[index % Ring::capacity] = Record{
+        .ticks = now_ticks(),
+        .coro = coro,
+        .detail = detail,
+        .label = label,
+        .tid = GetCurrentThreadId(),
+        .kind = kind,
+    };
+    ring.written.store(index + 1, std::memory_order_release);
+}
+
+std::string chrome_json() {
+    LARGE_INTEGER frequency{};
+    QueryPerformanceFrequency(&frequency);
+    DWORD pid = GetCurrentProcessId();
+
+    // Timestamps are relative to the oldest event, which keeps them short
+    int64_t origin = INT64_MAX;
+    for (Ring *ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        uint64_t written = ring->written.load(std::memory_order_acquire);
+        uint64_t first = written > Ring::capacity ? written - Ring::capacity + Ring::overwrite_margin : 0;
+        if (first < written) {
+            origin = std::min(origin, ring->records[first % Ring::capacity].ticks);
+        }
+    }
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+    for (Ring *ring = rings.load(std::memory_order_acquire); ring; ring = ring->next) {
+        uint64_t written = ring->written.load(std::memory_order_acquire);
+        uint64_t first = written > Ring::capacity ? written - Ring::capacity + Ring::overwrite_margin : 0;
+
+        for (uint64_t i = first; i < written; ++i) {
+            const Record &record = ring->records[i % Ring::capacity];
+            double ts_us = (double)(record.ticks - origin) * 1e6 / (double)frequency.QuadPart;
+            append_event(out, record, ts_us, pid);
+        }
+    }
+
+    // JSON has no trailing commas
+    if (out.ends_with(",\n")) {
+        out.resize(out.size() - 2);
+    }
+    out += "\n]}\n";
+    return out;
+}
+
+bool dump() noexcept {
+    try {
+        std::lock_guard lock{dump_mutex};
+        if (dump_path.empty()) {
+            return false;
+        }
+
+        std::string json = chrome_json();
+        auto file = Handle::open_file(dump_path, GENERIC_WRITE, CREATE_ALWAYS);
+        file.write_full_from({(const unsigned char *)json.data(), json.size()});
+        return true;
+    } catch (std::exception &) {
+        // Usually called on the way out of a failure, which matters more
+        return false;
+    }
+}
+
+}  // namespace abel::trace
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Coroutine tracing is compiled in with ABEL_TRACING=1 in the preprocessor definitions. Without it, the hooks
+// expand to nothing. With it, they cost a relaxed load and a branch until tracing is started.
+#ifndef ABEL_TRACING
+#define ABEL_TRACING 0
+#endif
+
+namespace abel {
+
+// What the coroutines on each thread are doing, for when a session stalls: every AIO's creation and destruction,
+// every resumption by an event loop, and every suspension on IO or on an event. Each thread records into a ring
+// buffer of its own, which keeps the most recent events. The rings can be dumped as Chrome trace JSON at any time,
+// to be opened in Perfetto or chrome://tracing.
+namespace trace {
+
+enum class Kind : uint8_t {
+    created,
+    destroyed,
+    // Resumed by an event loop, until control returns to it. `detail` is the coroutine that suspended last.
+    resumed,
+    suspended,
+    // `detail` is the OVERLAPPED, `label` the operation
+    io_wait,
+    io_done,
+    // `detail` is the handle
+    event_wait,
+    event_done,
+    // AIOEnv::update_current found another coroutine current than expected, which is in `detail`
+    nonlinear,
+};
+
+constexpr bool compiled_in = ABEL_TRACING;
+
+inline std::atomic<bool> enabled{false};
+
+// Starts recording. If `dump_path` isn't empty, dump() writes there. Fails if tracing isn't compiled in.
+void start(std::string dump_path = "");
+
+void emit(Kind kind, const void *coro, const void *detail = nullptr, const char *label = nullptr) noexcept;
+
+// Everything in the rings, oldest first within each thread. Events written while this runs may come out garbled.
+std::string chrome_json();
+
+// Writes chrome_json() to the path given to start(), if any. Returns whether it did.
+bool dump() noexcept;
+
+}  // namespace trace
+
+}  // namespace abel
+
+#if ABEL_TRACING
+#define ABEL_TRACE(...) \
+    (::abel::trace::enabled.load(std::memory_order_relaxed) ? ::abel::trace::emit(__VA_ARGS__) : (void)0)
+#else
+#define ABEL_TRACE(...) ((void)0)
+#endif